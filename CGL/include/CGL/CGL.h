@@ -14,12 +14,17 @@ class Vector4D;
 class Matrix3x3;
 class Matrix4x4;
 
+class SIMDVector4D;
+class SIMDMatrix4x4;
+
 class Quaternion;
 class Complex;
 
 class Color;
 class Spectrum;
 
+class PNGEncoder;
+
 class Renderer;
 // class Viewer;
 class Timer;
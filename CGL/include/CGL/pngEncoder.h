@@ -0,0 +1,58 @@
+#ifndef CGL_PNGENCODER_H
+#define CGL_PNGENCODER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace CGL {
+
+/**
+ * PNG encoder that compresses on several threads.
+ *
+ * The filtered scanlines are cut into chunks of whole rows and every chunk
+ * is deflated on its own thread. Chunks still find matches in the 32KB of
+ * data before them, and every chunk but the last ends byte aligned on an
+ * empty stored block, so concatenating them gives one valid zlib stream.
+ * The Adler-32 checksums of the chunks are combined at the end.
+ *
+ * Each row gets the PNG filter with the smallest sum of absolute
+ * differences, computed with SSE2 when available.
+ */
+class PNGEncoder {
+ public:
+
+  enum Level {
+    STORE   = 0, ///< stored blocks, rows are not filtered
+    FAST    = 1, ///< short match search, for frame capture
+    DEFAULT = 6,
+    BEST    = 9
+  };
+
+  /**
+   * Constructor.
+   * Level is 0 - 9 as in zlib. Threads defaults to one per core.
+   */
+  PNGEncoder( int level = FAST, int threads = 0 );
+
+  /**
+   * Encodes 8 bit RGB (channels = 3) or RGBA (channels = 4) pixels, rows
+   * top to bottom without padding. Returns false on invalid arguments.
+   */
+  bool encode( std::vector<unsigned char>& png, const unsigned char* pixels,
+               size_t width, size_t height, int channels ) const;
+
+  /**
+   * Encodes and writes to a file.
+   */
+  bool save( const std::string& filename, const unsigned char* pixels,
+             size_t width, size_t height, int channels ) const;
+
+  int level;
+  int threads;
+
+}; // class PNGEncoder
+
+} // namespace CGL
+
+#endif // CGL_PNGENCODER_H
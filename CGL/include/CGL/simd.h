@@ -0,0 +1,124 @@
+#ifndef CGL_SIMD_H
+#define CGL_SIMD_H
+
+/*
+  Thin wrappers around 4-wide double precision SIMD registers.
+
+  AVX is used when the compiler targets it (-mavx, see BUILD_AVX), SSE2 is
+  used otherwise on x86, and a plain scalar fallback everywhere else. The
+  wrappers only use unaligned loads and stores: malloc only guarantees 16
+  byte alignment, so 32 byte aligned loads on heap data would not be safe.
+*/
+
+#include <cmath>
+
+#if defined(__AVX__)
+  #define CGL_SIMD_AVX 1
+  #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define CGL_SIMD_SSE 1
+  #include <emmintrin.h>
+#endif
+
+namespace CGL {
+namespace SIMD {
+
+#if defined(CGL_SIMD_AVX)
+
+typedef __m256d d4;
+
+inline d4 load( const double* p ) { return _mm256_loadu_pd( p ); }
+inline void store( double* p, d4 a ) { _mm256_storeu_pd( p, a ); }
+inline d4 set( double x, double y, double z, double w ) { return _mm256_set_pd( w, z, y, x ); }
+inline d4 set1( double c ) { return _mm256_set1_pd( c ); }
+inline d4 zero() { return _mm256_setzero_pd(); }
+inline d4 add( d4 a, d4 b ) { return _mm256_add_pd( a, b ); }
+inline d4 sub( d4 a, d4 b ) { return _mm256_sub_pd( a, b ); }
+inline d4 mul( d4 a, d4 b ) { return _mm256_mul_pd( a, b ); }
+inline d4 div( d4 a, d4 b ) { return _mm256_div_pd( a, b ); }
+inline d4 min( d4 a, d4 b ) { return _mm256_min_pd( a, b ); }
+inline d4 max( d4 a, d4 b ) { return _mm256_max_pd( a, b ); }
+inline d4 sqrt( d4 a ) { return _mm256_sqrt_pd( a ); }
+
+// a * b + c
+inline d4 madd( d4 a, d4 b, d4 c ) { return _mm256_add_pd( _mm256_mul_pd( a, b ), c ); }
+
+// sum of all four lanes
+inline double hsum( d4 a ) {
+  __m128d s = _mm_add_pd( _mm256_castpd256_pd128( a ), _mm256_extractf128_pd( a, 1 ) );
+  return _mm_cvtsd_f64( _mm_add_sd( s, _mm_unpackhi_pd( s, s ) ) );
+}
+
+// converts the four lanes to floats and writes them to p
+inline void store_float( float* p, d4 a ) { _mm_storeu_ps( p, _mm256_cvtpd_ps( a ) ); }
+
+#elif defined(CGL_SIMD_SSE)
+
+struct d4 { __m128d lo, hi; };
+
+inline d4 make( __m128d lo, __m128d hi ) { d4 r; r.lo = lo; r.hi = hi; return r; }
+
+inline d4 load( const double* p ) { return make( _mm_loadu_pd( p ), _mm_loadu_pd( p + 2 ) ); }
+inline void store( double* p, d4 a ) { _mm_storeu_pd( p, a.lo ); _mm_storeu_pd( p + 2, a.hi ); }
+inline d4 set( double x, double y, double z, double w ) { return make( _mm_set_pd( y, x ), _mm_set_pd( w, z ) ); }
+inline d4 set1( double c ) { return make( _mm_set1_pd( c ), _mm_set1_pd( c ) ); }
+inline d4 zero() { return make( _mm_setzero_pd(), _mm_setzero_pd() ); }
+inline d4 add( d4 a, d4 b ) { return make( _mm_add_pd( a.lo, b.lo ), _mm_add_pd( a.hi, b.hi ) ); }
+inline d4 sub( d4 a, d4 b ) { return make( _mm_sub_pd( a.lo, b.lo ), _mm_sub_pd( a.hi, b.hi ) ); }
+inline d4 mul( d4 a, d4 b ) { return make( _mm_mul_pd( a.lo, b.lo ), _mm_mul_pd( a.hi, b.hi ) ); }
+inline d4 div( d4 a, d4 b ) { return make( _mm_div_pd( a.lo, b.lo ), _mm_div_pd( a.hi, b.hi ) ); }
+inline d4 min( d4 a, d4 b ) { return make( _mm_min_pd( a.lo, b.lo ), _mm_min_pd( a.hi, b.hi ) ); }
+inline d4 max( d4 a, d4 b ) { return make( _mm_max_pd( a.lo, b.lo ), _mm_max_pd( a.hi, b.hi ) ); }
+inline d4 sqrt( d4 a ) { return make( _mm_sqrt_pd( a.lo ), _mm_sqrt_pd( a.hi ) ); }
+
+// a * b + c
+inline d4 madd( d4 a, d4 b, d4 c ) { return add( mul( a, b ), c ); }
+
+// sum of all four lanes
+inline double hsum( d4 a ) {
+  __m128d s = _mm_add_pd( a.lo, a.hi );
+  return _mm_cvtsd_f64( _mm_add_sd( s, _mm_unpackhi_pd( s, s ) ) );
+}
+
+// converts the four lanes to floats and writes them to p
+inline void store_float( float* p, d4 a ) {
+  _mm_storeu_ps( p, _mm_movelh_ps( _mm_cvtpd_ps( a.lo ), _mm_cvtpd_ps( a.hi ) ) );
+}
+
+#else
+
+struct d4 { double v[4]; };
+
+inline d4 set( double x, double y, double z, double w ) { d4 r = {{ x, y, z, w }}; return r; }
+inline d4 load( const double* p ) { return set( p[0], p[1], p[2], p[3] ); }
+inline void store( double* p, d4 a ) { for( int i = 0; i < 4; i++ ) p[i] = a.v[i]; }
+inline d4 set1( double c ) { return set( c, c, c, c ); }
+inline d4 zero() { return set1( 0.0 ); }
+
+#define CGL_SIMD_LANEWISE( name, expr ) \
+  inline d4 name( d4 a, d4 b ) { d4 r; for( int i = 0; i < 4; i++ ) r.v[i] = ( expr ); return r; }
+CGL_SIMD_LANEWISE( add, a.v[i] + b.v[i] )
+CGL_SIMD_LANEWISE( sub, a.v[i] - b.v[i] )
+CGL_SIMD_LANEWISE( mul, a.v[i] * b.v[i] )
+CGL_SIMD_LANEWISE( div, a.v[i] / b.v[i] )
+CGL_SIMD_LANEWISE( min, a.v[i] < b.v[i] ? a.v[i] : b.v[i] )
+CGL_SIMD_LANEWISE( max, a.v[i] > b.v[i] ? a.v[i] : b.v[i] )
+#undef CGL_SIMD_LANEWISE
+
+inline d4 sqrt( d4 a ) { d4 r; for( int i = 0; i < 4; i++ ) r.v[i] = std::sqrt( a.v[i] ); return r; }
+
+// a * b + c
+inline d4 madd( d4 a, d4 b, d4 c ) { return add( mul( a, b ), c ); }
+
+// sum of all four lanes
+inline double hsum( d4 a ) { return ( a.v[0] + a.v[1] ) + ( a.v[2] + a.v[3] ); }
+
+// converts the four lanes to floats and writes them to p
+inline void store_float( float* p, d4 a ) { for( int i = 0; i < 4; i++ ) p[i] = (float) a.v[i]; }
+
+#endif
+
+} // namespace SIMD
+} // namespace CGL
+
+#endif // CGL_SIMD_H
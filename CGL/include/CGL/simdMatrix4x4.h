@@ -0,0 +1,127 @@
+#ifndef CGL_SIMDMATRIX4X4_H
+#define CGL_SIMDMATRIX4X4_H
+
+#include "CGL.h"
+#include "simd.h"
+#include "simdVector4D.h"
+#include "matrix4x4.h"
+
+#include <cstddef>
+#include <iosfwd>
+
+namespace CGL {
+
+/**
+ * Defines a 4x4 matrix stored as four SIMDVector4D columns.
+ * Matrix-vector products are four broadcast multiply-adds over the columns,
+ * so the hot transforms never touch individual entries. Converts to and
+ * from Matrix4x4 for everything that is not performance critical.
+ */
+class alignas(16) SIMDMatrix4x4 {
+
+  public:
+
+  // The default constructor. Entries are zero.
+  SIMDMatrix4x4( void ) { }
+
+  // Constructor from four columns.
+  SIMDMatrix4x4( const SIMDVector4D& c0, const SIMDVector4D& c1,
+                 const SIMDVector4D& c2, const SIMDVector4D& c3 ) {
+    entries[0] = c0; entries[1] = c1; entries[2] = c2; entries[3] = c3;
+  }
+
+  // Constructor from a Matrix4x4.
+  SIMDMatrix4x4( const Matrix4x4& A );
+
+  /**
+   * Returns a fresh 4x4 identity matrix.
+   */
+  static SIMDMatrix4x4 identity( void );
+
+  /**
+   * Returns a matrix that scales by s and then translates by t.
+   */
+  static SIMDMatrix4x4 scale_translate( double s, const Vector3D& t );
+
+  /**
+   * Returns the same matrix as a Matrix4x4.
+   */
+  Matrix4x4 to_matrix4x4( void ) const;
+
+  /**
+   * Returns the transpose of A.
+   */
+  SIMDMatrix4x4 T( void ) const;
+
+  /**
+   * Returns the inverse of A.
+   */
+  SIMDMatrix4x4 inv( void ) const;
+
+  // accesses element (i,j) of A using 0-based indexing
+  // where (i, j) is (row, column).
+        double& operator()( int i, int j )       { return entries[j][i]; }
+  const double& operator()( int i, int j ) const { return entries[j][i]; }
+
+  // accesses the ith column of A
+        SIMDVector4D& operator[]( int i )       { return entries[i]; }
+  const SIMDVector4D& operator[]( int i ) const { return entries[i]; }
+
+  // returns A*x
+  inline SIMDVector4D operator*( const SIMDVector4D& x ) const {
+    SIMD::d4 r = SIMD::mul( entries[0].simd(), SIMD::set1( x.x ) );
+    r = SIMD::madd( entries[1].simd(), SIMD::set1( x.y ), r );
+    r = SIMD::madd( entries[2].simd(), SIMD::set1( x.z ), r );
+    r = SIMD::madd( entries[3].simd(), SIMD::set1( x.w ), r );
+    return r;
+  }
+
+  // returns A*B
+  inline SIMDMatrix4x4 operator*( const SIMDMatrix4x4& B ) const {
+    const SIMDMatrix4x4& A( *this );
+    return SIMDMatrix4x4( A * B[0], A * B[1], A * B[2], A * B[3] );
+  }
+
+  // returns A*p for the point p (w = 1), divided by the resulting w
+  inline Vector3D transform_point( const Vector3D& p ) const {
+    return ( (*this) * SIMDVector4D( p, 1.0 ) ).projectTo3D();
+  }
+
+  // returns A*v for the direction v (w = 0)
+  inline Vector3D transform_vector( const Vector3D& v ) const {
+    return ( (*this) * SIMDVector4D( v, 0.0 ) ).to3D();
+  }
+
+  protected:
+
+  // 4 by 4 matrices are represented by an array of 4 column vectors.
+  SIMDVector4D entries[4];
+
+}; // class SIMDMatrix4x4
+
+/*
+  Batched transforms. Each one hoists the matrix columns into registers once
+  and streams the input, so prefer these over per-element calls when
+  transforming many points (trails, sphere positions, picking rays...).
+*/
+
+// out[i] = A * (in[i], 1), without the perspective divide
+void transform_points( const SIMDMatrix4x4& A, const Vector3D* in, Vector3D* out, size_t n );
+
+// out[i] = A * (in[i], 0)
+void transform_vectors( const SIMDMatrix4x4& A, const Vector3D* in, Vector3D* out, size_t n );
+
+// Writes A * (in[i], 1) as four floats (x, y, z, w) per point to out, which
+// must hold 4 * n floats. This matches the column layout of a 4 x n
+// Eigen::MatrixXf, so the result can be uploaded as a vertex attribute.
+void transform_points( const SIMDMatrix4x4& A, const Vector3D* in, float* out, size_t n );
+
+// returns c*A
+SIMDMatrix4x4 operator*( double c, const SIMDMatrix4x4& A );
+
+// prints entries
+std::ostream& operator<<( std::ostream& os, const SIMDMatrix4x4& A );
+
+} // namespace CGL
+
+#endif // CGL_SIMDMATRIX4X4_H
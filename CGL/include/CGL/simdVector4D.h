@@ -0,0 +1,205 @@
+#ifndef CGL_SIMDVECTOR4D_H
+#define CGL_SIMDVECTOR4D_H
+
+#include "CGL.h"
+#include "simd.h"
+#include "vector3D.h"
+#include "vector4D.h"
+
+#include <ostream>
+#include <cmath>
+
+namespace CGL {
+
+/**
+ * Defines 4D vectors backed by SIMD registers.
+ * Same layout as Vector4D (four contiguous doubles), but 16 byte aligned and
+ * with every operation done on all four lanes at once. Use w = 1 for points
+ * and w = 0 for directions when going through a SIMDMatrix4x4.
+ */
+class alignas(16) SIMDVector4D {
+ public:
+
+  // components
+  double x, y, z, w;
+
+  /**
+   * Constructor.
+   * Initializes to vector (0,0,0,0).
+   */
+  SIMDVector4D() : x( 0.0 ), y( 0.0 ), z( 0.0 ), w( 0.0 ) { }
+
+  /**
+   * Constructor.
+   * Initializes to vector (x,y,z,w).
+   */
+  SIMDVector4D( double x, double y, double z, double w ) : x( x ), y( y ), z( z ), w( w ) { }
+
+  /**
+   * Constructor.
+   * Initializes to vector (c,c,c,c).
+   */
+  explicit SIMDVector4D( double c ) : x( c ), y( c ), z( c ), w( c ) { }
+
+  /**
+   * Constructor.
+   * Initializes from a Vector3D and a w value.
+   */
+  SIMDVector4D( const Vector3D& v, double w ) : x( v.x ), y( v.y ), z( v.z ), w( w ) { }
+
+  /**
+   * Constructor.
+   * Initializes from an existing Vector4D.
+   */
+  SIMDVector4D( const Vector4D& v ) : x( v.x ), y( v.y ), z( v.z ), w( v.w ) { }
+
+  /**
+   * Constructor.
+   * Initializes from a SIMD register.
+   */
+  SIMDVector4D( SIMD::d4 v ) { SIMD::store( &x, v ); }
+
+  // returns the components as a SIMD register
+  inline SIMD::d4 simd( void ) const { return SIMD::load( &x ); }
+
+  // returns reference to the specified component (0-based indexing: x, y, z, w)
+  inline double& operator[] ( const int& index ) {
+    return ( &x )[ index ];
+  }
+
+  // returns const reference to the specified component (0-based indexing: x, y, z, w)
+  inline const double& operator[] ( const int& index ) const {
+    return ( &x )[ index ];
+  }
+
+  // negation
+  inline SIMDVector4D operator-( void ) const {
+    return SIMD::sub( SIMD::zero(), simd() );
+  }
+
+  // addition
+  inline SIMDVector4D operator+( const SIMDVector4D& v ) const {
+    return SIMD::add( simd(), v.simd() );
+  }
+
+  // subtraction
+  inline SIMDVector4D operator-( const SIMDVector4D& v ) const {
+    return SIMD::sub( simd(), v.simd() );
+  }
+
+  // component-wise multiplication
+  inline SIMDVector4D operator*( const SIMDVector4D& v ) const {
+    return SIMD::mul( simd(), v.simd() );
+  }
+
+  // right scalar multiplication
+  inline SIMDVector4D operator*( const double& c ) const {
+    return SIMD::mul( simd(), SIMD::set1( c ) );
+  }
+
+  // scalar division
+  // NOTE: divides directly; multiply by a hoisted reciprocal when dividing
+  //       many vectors by the same value.
+  inline SIMDVector4D operator/( const double& c ) const {
+    return SIMD::div( simd(), SIMD::set1( c ) );
+  }
+
+  // addition / assignment
+  inline void operator+=( const SIMDVector4D& v ) {
+    SIMD::store( &x, SIMD::add( simd(), v.simd() ) );
+  }
+
+  // subtraction / assignment
+  inline void operator-=( const SIMDVector4D& v ) {
+    SIMD::store( &x, SIMD::sub( simd(), v.simd() ) );
+  }
+
+  // scalar multiplication / assignment
+  inline void operator*=( const double& c ) {
+    SIMD::store( &x, SIMD::mul( simd(), SIMD::set1( c ) ) );
+  }
+
+  // scalar division / assignment
+  inline void operator/=( const double& c ) {
+    SIMD::store( &x, SIMD::div( simd(), SIMD::set1( c ) ) );
+  }
+
+  /**
+   * Returns Euclidean length of all four components.
+   */
+  inline double norm( void ) const {
+    return sqrt( norm2() );
+  }
+
+  /**
+   * Returns Euclidean length squared of all four components.
+   */
+  inline double norm2( void ) const {
+    SIMD::d4 v = simd();
+    return SIMD::hsum( SIMD::mul( v, v ) );
+  }
+
+  /**
+   * Returns unit vector.
+   */
+  inline SIMDVector4D unit( void ) const {
+    return (*this) * ( 1.0 / norm() );
+  }
+
+  /**
+   * Divides by Euclidean length.
+   */
+  inline void normalize( void ) {
+    (*this) *= ( 1.0 / norm() );
+  }
+
+  /**
+   * Returns the xyz components.
+   */
+  inline Vector3D to3D( void ) const {
+    return Vector3D( x, y, z );
+  }
+
+  /**
+   * Returns the xyz components divided by w.
+   */
+  inline Vector3D projectTo3D( void ) const {
+    double rw = 1.0 / w;
+    return Vector3D( x * rw, y * rw, z * rw );
+  }
+
+}; // class SIMDVector4D
+
+// left scalar multiplication
+inline SIMDVector4D operator* ( const double& c, const SIMDVector4D& v ) {
+  return v * c;
+}
+
+// dot product of all four components
+inline double dot( const SIMDVector4D& u, const SIMDVector4D& v ) {
+  return SIMD::hsum( SIMD::mul( u.simd(), v.simd() ) );
+}
+
+// component-wise minimum
+inline SIMDVector4D component_min( const SIMDVector4D& u, const SIMDVector4D& v ) {
+  return SIMD::min( u.simd(), v.simd() );
+}
+
+// component-wise maximum
+inline SIMDVector4D component_max( const SIMDVector4D& u, const SIMDVector4D& v ) {
+  return SIMD::max( u.simd(), v.simd() );
+}
+
+// cross product of the xyz components, w of the result is 0
+inline SIMDVector4D cross3( const SIMDVector4D& u, const SIMDVector4D& v ) {
+  return SIMDVector4D( u.y*v.z - u.z*v.y,
+                       u.z*v.x - u.x*v.z,
+                       u.x*v.y - u.y*v.x, 0.0 );
+}
+
+// prints components
+std::ostream& operator<<( std::ostream& os, const SIMDVector4D& v );
+
+} // namespace CGL
+
+#endif // CGL_SIMDVECTOR4D_H
@@ -0,0 +1,621 @@
+#include "pngEncoder.h"
+#include "lodepng.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define CGL_PNG_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+namespace CGL {
+
+namespace {
+
+//==============================================================================
+// Threads
+//==============================================================================
+
+// Calls fn(i) for every i in [0, count) from up to `threads` threads
+template <typename Fn>
+void run_parallel( size_t count, int threads, Fn fn ) {
+  std::atomic<size_t> next( 0 );
+  auto work = [&]() {
+    for ( size_t i = next++; i < count; i = next++ ) fn( i );
+  };
+  size_t extra = std::min( count, (size_t) std::max( threads, 1 ) ) - 1;
+  std::vector<std::thread> workers;
+  for ( size_t t = 0; t < extra; t++ ) workers.emplace_back( work );
+  work();
+  for ( std::thread& worker : workers ) worker.join();
+}
+
+//==============================================================================
+// Filtering
+//==============================================================================
+
+enum { FILTER_NONE = 0, FILTER_SUB, FILTER_UP, FILTER_AVERAGE, FILTER_PAETH, NUM_FILTERS };
+
+// Zero bytes in front of every padded row, so a[i - bpp] is always readable
+const size_t ROW_PAD = 16;
+
+inline unsigned char paeth( int a, int b, int c ) {
+  int pa = std::abs( b - c ), pb = std::abs( a - c ), pc = std::abs( a + b - 2 * c );
+  if ( pa <= pb && pa <= pc ) return (unsigned char) a;
+  return (unsigned char) ( pb <= pc ? b : c );
+}
+
+inline unsigned char predict( int type, int a, int b, int c ) {
+  switch ( type ) {
+    case FILTER_SUB:     return (unsigned char) a;
+    case FILTER_UP:      return (unsigned char) b;
+    case FILTER_AVERAGE: return (unsigned char) ( ( a + b ) >> 1 );
+    case FILTER_PAETH:   return paeth( a, b, c );
+    default:             return 0;
+  }
+}
+
+// Filters bytes [begin, n) of a row and returns the sum of the absolute
+// values of the filtered bytes taken as signed, the usual PNG heuristic
+uint64_t filter_scalar( int type, unsigned char* out, const unsigned char* cur,
+                        const unsigned char* prior, size_t begin, size_t n, size_t bpp ) {
+  uint64_t score = 0;
+  for ( size_t i = begin; i < n; i++ ) {
+    unsigned char y = cur[i] - predict( type, cur[i - bpp], prior[i], prior[i - bpp] );
+    out[i] = y;
+    score += y < 128 ? y : 256 - y;
+  }
+  return score;
+}
+
+#if defined(CGL_PNG_SSE2)
+
+inline __m128i abs16( __m128i x ) {
+  return _mm_max_epi16( x, _mm_sub_epi16( _mm_setzero_si128(), x ) );
+}
+
+// Paeth predictor on eight 16 bit lanes
+inline __m128i paeth16( __m128i a, __m128i b, __m128i c ) {
+  __m128i bc = _mm_sub_epi16( b, c ), ac = _mm_sub_epi16( a, c );
+  __m128i pa = abs16( bc ), pb = abs16( ac ), pc = abs16( _mm_add_epi16( bc, ac ) );
+  __m128i not_a = _mm_or_si128( _mm_cmpgt_epi16( pa, pb ), _mm_cmpgt_epi16( pa, pc ) );
+  __m128i not_b = _mm_cmpgt_epi16( pb, pc );
+  __m128i b_or_c = _mm_or_si128( _mm_andnot_si128( not_b, b ), _mm_and_si128( not_b, c ) );
+  return _mm_or_si128( _mm_andnot_si128( not_a, a ), _mm_and_si128( not_a, b_or_c ) );
+}
+
+template <int TYPE>
+inline __m128i predict16( __m128i a, __m128i b, __m128i c ) {
+  switch ( TYPE ) {
+    case FILTER_SUB: return a;
+    case FILTER_UP:  return b;
+    case FILTER_AVERAGE:
+      // avg_epu8 rounds up, the PNG average rounds down
+      return _mm_sub_epi8( _mm_avg_epu8( a, b ), _mm_and_si128( _mm_xor_si128( a, b ), _mm_set1_epi8( 1 ) ) );
+    case FILTER_PAETH: {
+      __m128i zero = _mm_setzero_si128();
+      __m128i lo = paeth16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ), _mm_unpacklo_epi8( c, zero ) );
+      __m128i hi = paeth16( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( b, zero ), _mm_unpackhi_epi8( c, zero ) );
+      return _mm_packus_epi16( lo, hi );
+    }
+    default: return _mm_setzero_si128();
+  }
+}
+
+template <int TYPE>
+uint64_t filter_row( unsigned char* out, const unsigned char* cur,
+                     const unsigned char* prior, size_t n, size_t bpp ) {
+  __m128i zero = _mm_setzero_si128(), sum = zero;
+  size_t i = 0;
+  for ( ; i + 16 <= n; i += 16 ) {
+    __m128i x = _mm_loadu_si128( (const __m128i*) ( cur + i ) );
+    __m128i a = _mm_loadu_si128( (const __m128i*) ( cur + i - bpp ) );
+    __m128i b = _mm_loadu_si128( (const __m128i*) ( prior + i ) );
+    __m128i c = _mm_loadu_si128( (const __m128i*) ( prior + i - bpp ) );
+    __m128i y = _mm_sub_epi8( x, predict16<TYPE>( a, b, c ) );
+    _mm_storeu_si128( (__m128i*) ( out + i ), y );
+    // |y| as a signed byte is min(y, -y) as unsigned bytes
+    sum = _mm_add_epi64( sum, _mm_sad_epu8( _mm_min_epu8( y, _mm_sub_epi8( zero, y ) ), zero ) );
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128( (__m128i*) lanes, sum );
+  return lanes[0] + lanes[1] + filter_scalar( TYPE, out, cur, prior, i, n, bpp );
+}
+
+#else
+
+template <int TYPE>
+uint64_t filter_row( unsigned char* out, const unsigned char* cur,
+                     const unsigned char* prior, size_t n, size_t bpp ) {
+  return filter_scalar( TYPE, out, cur, prior, 0, n, bpp );
+}
+
+#endif // CGL_PNG_SSE2
+
+// Filters rows [first, last) into `filtered`, one filter byte plus the row
+void filter_rows( unsigned char* filtered, const unsigned char* pixels, size_t row_bytes,
+                  size_t bpp, size_t first, size_t last, bool choose ) {
+  std::vector<unsigned char> cur( ROW_PAD + row_bytes, 0 ), prior( ROW_PAD + row_bytes, 0 );
+  std::vector<unsigned char> candidates( NUM_FILTERS * row_bytes );
+  unsigned char* c = &cur[ROW_PAD];
+  unsigned char* p = &prior[ROW_PAD];
+
+  if ( first > 0 ) memcpy( p, pixels + ( first - 1 ) * row_bytes, row_bytes );
+  for ( size_t y = first; y < last; y++ ) {
+    unsigned char* out = filtered + y * ( row_bytes + 1 );
+    memcpy( c, pixels + y * row_bytes, row_bytes );
+    if ( !choose ) {
+      out[0] = FILTER_NONE;
+      memcpy( out + 1, c, row_bytes );
+    } else {
+      uint64_t scores[NUM_FILTERS];
+      scores[FILTER_NONE]    = filter_row<FILTER_NONE>   ( &candidates[0 * row_bytes], c, p, row_bytes, bpp );
+      scores[FILTER_SUB]     = filter_row<FILTER_SUB>    ( &candidates[1 * row_bytes], c, p, row_bytes, bpp );
+      scores[FILTER_UP]      = filter_row<FILTER_UP>     ( &candidates[2 * row_bytes], c, p, row_bytes, bpp );
+      scores[FILTER_AVERAGE] = filter_row<FILTER_AVERAGE>( &candidates[3 * row_bytes], c, p, row_bytes, bpp );
+      scores[FILTER_PAETH]   = filter_row<FILTER_PAETH>  ( &candidates[4 * row_bytes], c, p, row_bytes, bpp );
+      int best = (int) ( std::min_element( scores, scores + NUM_FILTERS ) - scores );
+      out[0] = (unsigned char) best;
+      memcpy( out + 1, &candidates[best * row_bytes], row_bytes );
+    }
+    std::swap( c, p );
+  }
+}
+
+//==============================================================================
+// Checksums
+//==============================================================================
+
+const uint32_t ADLER_BASE = 65521;
+
+uint32_t adler32( const unsigned char* data, size_t n ) {
+  uint32_t s1 = 1, s2 = 0;
+  while ( n > 0 ) {
+    // Largest run that cannot overflow s2 before the modulo
+    size_t run = std::min( n, (size_t) 5552 );
+    n -= run;
+    while ( run-- ) {
+      s1 += *data++;
+      s2 += s1;
+    }
+    s1 %= ADLER_BASE;
+    s2 %= ADLER_BASE;
+  }
+  return ( s2 << 16 ) | s1;
+}
+
+// Adler-32 of A followed by B, from the checksums of A and B (as in zlib)
+uint32_t adler32_combine( uint32_t adler1, uint32_t adler2, size_t length2 ) {
+  uint64_t rem = length2 % ADLER_BASE;
+  uint64_t sum1 = adler1 & 0xffff;
+  uint64_t sum2 = ( rem * sum1 ) % ADLER_BASE;
+  sum1 += ( adler2 & 0xffff ) + ADLER_BASE - 1;
+  sum2 += ( ( adler1 >> 16 ) & 0xffff ) + ( ( adler2 >> 16 ) & 0xffff ) + ADLER_BASE - rem;
+  sum1 %= ADLER_BASE;
+  sum2 %= ADLER_BASE;
+  return (uint32_t) ( ( sum2 << 16 ) | sum1 );
+}
+
+//==============================================================================
+// Deflate
+//==============================================================================
+
+const size_t WINDOW_SIZE = 32768;
+const int HASH_BITS = 15;
+const size_t MIN_MATCH = 3;
+const size_t MAX_MATCH = 258;
+const size_t BLOCK_TOKENS = 1 << 15;
+
+const unsigned short LENGTH_BASE[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const unsigned char LENGTH_EXTRA[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const unsigned short DIST_BASE[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const unsigned char DIST_EXTRA[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+const unsigned char CODE_LENGTH_ORDER[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Match candidates followed per position, by level
+const int MAX_CHAIN[10] = { 0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096 };
+
+int length_code( size_t length ) {
+  int code = 0;
+  while ( code < 28 && LENGTH_BASE[code + 1] <= length ) code++;
+  return code;
+}
+
+int dist_code( size_t dist ) {
+  int code = 0;
+  while ( code < 29 && DIST_BASE[code + 1] <= dist ) code++;
+  return code;
+}
+
+// Symbol lookups, built once
+struct CodeTables {
+  unsigned char length[MAX_MATCH + 1];
+  unsigned char dist_small[513];      // distances 1 - 512
+  unsigned char dist_large[256];      // (distance - 1) >> 7 for the rest
+
+  CodeTables() {
+    for ( size_t l = MIN_MATCH; l <= MAX_MATCH; l++ ) length[l] = (unsigned char) length_code( l );
+    for ( size_t d = 1; d <= 512; d++ ) dist_small[d] = (unsigned char) dist_code( d );
+    for ( size_t i = 0; i < 256; i++ ) dist_large[i] = (unsigned char) dist_code( ( i << 7 ) + 1 );
+  }
+
+  int dist( size_t d ) const { return d <= 512 ? dist_small[d] : dist_large[( d - 1 ) >> 7]; }
+};
+
+const CodeTables tables;
+
+// Literal (dist == 0) or back reference
+struct Token {
+  unsigned short length_or_literal;
+  unsigned short dist;
+};
+
+struct BitWriter {
+  std::vector<unsigned char>& out;
+  uint64_t bits = 0;
+  int count = 0;
+
+  explicit BitWriter( std::vector<unsigned char>& out ) : out( out ) { }
+
+  void put( uint32_t value, int n ) {
+    bits |= (uint64_t) value << count;
+    count += n;
+    while ( count >= 8 ) {
+      out.push_back( (unsigned char) bits );
+      bits >>= 8;
+      count -= 8;
+    }
+  }
+
+  void align() {
+    if ( count > 0 ) out.push_back( (unsigned char) bits );
+    bits = 0;
+    count = 0;
+  }
+};
+
+// Canonical Huffman codes, bit reversed since deflate sends them MSB first
+void huffman_codes( const unsigned* lengths, int n, unsigned* codes ) {
+  unsigned count[16] = { 0 }, next[16] = { 0 };
+  for ( int i = 0; i < n; i++ ) count[lengths[i]]++;
+  count[0] = 0;
+  for ( int len = 1; len < 16; len++ ) next[len] = ( next[len - 1] + count[len - 1] ) << 1;
+  for ( int i = 0; i < n; i++ ) {
+    unsigned len = lengths[i];
+    if ( len == 0 ) continue;
+    unsigned code = next[len]++, reversed = 0;
+    for ( unsigned b = 0; b < len; b++ ) reversed |= ( ( code >> b ) & 1 ) << ( len - 1 - b );
+    codes[i] = reversed;
+  }
+}
+
+// One block with dynamic Huffman codes
+void write_block( BitWriter& bw, const std::vector<Token>& tokens, bool final ) {
+  unsigned lit_freq[286] = { 0 }, dist_freq[30] = { 0 };
+  for ( const Token& t : tokens ) {
+    if ( t.dist == 0 ) {
+      lit_freq[t.length_or_literal]++;
+    } else {
+      lit_freq[257 + tables.length[t.length_or_literal]]++;
+      dist_freq[tables.dist( t.dist )]++;
+    }
+  }
+  lit_freq[256] = 1;
+
+  unsigned lit_len[286], dist_len[30], lit_code[286] = { 0 }, dist_code_bits[30] = { 0 };
+  lodepng_huffman_code_lengths( lit_len, lit_freq, 286, 15 );
+  lodepng_huffman_code_lengths( dist_len, dist_freq, 30, 15 );
+  huffman_codes( lit_len, 286, lit_code );
+  huffman_codes( dist_len, 30, dist_code_bits );
+
+  int hlit = 286, hdist = 30;
+  while ( hlit > 257 && lit_len[hlit - 1] == 0 ) hlit--;
+  while ( hdist > 1 && dist_len[hdist - 1] == 0 ) hdist--;
+
+  // Run-length encode both code length tables as one sequence
+  std::vector<unsigned> lengths( lit_len, lit_len + hlit );
+  lengths.insert( lengths.end(), dist_len, dist_len + hdist );
+  std::vector<unsigned> rle_symbols, rle_extra;
+  unsigned cl_freq[19] = { 0 };
+  auto emit = [&]( unsigned symbol, unsigned extra ) {
+    rle_symbols.push_back( symbol );
+    rle_extra.push_back( extra );
+    cl_freq[symbol]++;
+  };
+  for ( size_t i = 0; i < lengths.size(); ) {
+    unsigned value = lengths[i];
+    size_t run = 1;
+    while ( i + run < lengths.size() && lengths[i + run] == value ) run++;
+    i += run;
+    if ( value == 0 ) {
+      while ( run >= 11 ) {
+        size_t r = std::min( run, (size_t) 138 );
+        emit( 18, (unsigned) ( r - 11 ) );
+        run -= r;
+      }
+      if ( run >= 3 ) {
+        emit( 17, (unsigned) ( run - 3 ) );
+        run = 0;
+      }
+    } else {
+      emit( value, 0 );
+      run--;
+      while ( run >= 3 ) {
+        size_t r = std::min( run, (size_t) 6 );
+        emit( 16, (unsigned) ( r - 3 ) );
+        run -= r;
+      }
+    }
+    while ( run-- > 0 ) emit( value, 0 );
+  }
+
+  unsigned cl_len[19], cl_code[19] = { 0 };
+  lodepng_huffman_code_lengths( cl_len, cl_freq, 19, 7 );
+  huffman_codes( cl_len, 19, cl_code );
+  int hclen = 19;
+  while ( hclen > 4 && cl_len[CODE_LENGTH_ORDER[hclen - 1]] == 0 ) hclen--;
+
+  bw.put( final ? 1 : 0, 1 );
+  bw.put( 2, 2 );
+  bw.put( hlit - 257, 5 );
+  bw.put( hdist - 1, 5 );
+  bw.put( hclen - 4, 4 );
+  for ( int i = 0; i < hclen; i++ ) bw.put( cl_len[CODE_LENGTH_ORDER[i]], 3 );
+  for ( size_t i = 0; i < rle_symbols.size(); i++ ) {
+    unsigned s = rle_symbols[i];
+    bw.put( cl_code[s], cl_len[s] );
+    if ( s == 16 ) bw.put( rle_extra[i], 2 );
+    else if ( s == 17 ) bw.put( rle_extra[i], 3 );
+    else if ( s == 18 ) bw.put( rle_extra[i], 7 );
+  }
+
+  for ( const Token& t : tokens ) {
+    if ( t.dist == 0 ) {
+      bw.put( lit_code[t.length_or_literal], lit_len[t.length_or_literal] );
+    } else {
+      int lc = tables.length[t.length_or_literal];
+      bw.put( lit_code[257 + lc], lit_len[257 + lc] );
+      bw.put( t.length_or_literal - LENGTH_BASE[lc], LENGTH_EXTRA[lc] );
+      int dc = tables.dist( t.dist );
+      bw.put( dist_code_bits[dc], dist_len[dc] );
+      bw.put( t.dist - DIST_BASE[dc], DIST_EXTRA[dc] );
+    }
+  }
+  bw.put( lit_code[256], lit_len[256] );
+}
+
+void write_stored( BitWriter& bw, const unsigned char* data, size_t n, bool final ) {
+  bw.put( final ? 1 : 0, 1 );
+  bw.put( 0, 2 );
+  bw.align();
+  bw.out.push_back( (unsigned char) n );
+  bw.out.push_back( (unsigned char) ( n >> 8 ) );
+  bw.out.push_back( (unsigned char) ~n );
+  bw.out.push_back( (unsigned char) ( ~n >> 8 ) );
+  bw.out.insert( bw.out.end(), data, data + n );
+}
+
+inline uint32_t hash3( const unsigned char* p ) {
+  uint32_t v = ( (uint32_t) p[0] << 16 ) | ( (uint32_t) p[1] << 8 ) | p[2];
+  return ( v * 2654435761u ) >> ( 32 - HASH_BITS );
+}
+
+inline size_t match_length( const unsigned char* a, const unsigned char* b, size_t max_length ) {
+  size_t n = 0;
+#if defined(__GNUC__)
+  while ( n + 8 <= max_length ) {
+    uint64_t x, y;
+    memcpy( &x, a + n, 8 );
+    memcpy( &y, b + n, 8 );
+    if ( x != y ) return n + ( __builtin_ctzll( x ^ y ) >> 3 );
+    n += 8;
+  }
+#endif
+  while ( n < max_length && a[n] == b[n] ) n++;
+  return n;
+}
+
+/*
+  Deflates data[start, end) into raw deflate blocks. Matches may reach back
+  to window_start, which lies before start when the data ahead of this chunk
+  is compressed by another thread. Unless `last`, the output ends with an
+  empty stored block so it is byte aligned and the next chunk can follow.
+*/
+void deflate_chunk( std::vector<unsigned char>& out, const unsigned char* data,
+                    size_t window_start, size_t start, size_t end, int level, bool last ) {
+  BitWriter bw( out );
+
+  if ( level <= 0 ) {
+    size_t pos = start;
+    do {
+      size_t n = std::min( end - pos, (size_t) 65535 );
+      write_stored( bw, data + pos, n, last && pos + n == end );
+      pos += n;
+    } while ( pos < end );
+    return;
+  }
+
+  // Positions are stored + 1 so zero means empty
+  std::vector<uint32_t> head( (size_t) 1 << HASH_BITS, 0 );
+  std::vector<uint32_t> prev( WINDOW_SIZE, 0 );
+  auto insert = [&]( size_t p ) {
+    uint32_t h = hash3( data + p );
+    prev[p & ( WINDOW_SIZE - 1 )] = head[h];
+    head[h] = (uint32_t) ( p + 1 );
+  };
+  for ( size_t p = window_start; p < start && p + MIN_MATCH <= end; p++ ) insert( p );
+
+  const int max_chain = MAX_CHAIN[std::min( level, 9 )];
+  const bool insert_all = level >= 4;
+  std::vector<Token> tokens;
+  tokens.reserve( BLOCK_TOKENS );
+
+  size_t pos = start;
+  while ( pos < end ) {
+    size_t best_length = 0, best_dist = 0;
+    if ( end - pos >= MIN_MATCH ) {
+      size_t max_length = std::min( MAX_MATCH, end - pos );
+      size_t limit = std::max( window_start, pos > WINDOW_SIZE ? pos - WINDOW_SIZE : (size_t) 0 );
+      uint32_t candidate = head[hash3( data + pos )];
+      for ( int chain = max_chain; candidate != 0 && chain > 0; chain-- ) {
+        size_t c = candidate - 1;
+        if ( c < limit || c >= pos ) break;
+        if ( data[c + best_length] == data[pos + best_length] ) {
+          size_t length = match_length( data + c, data + pos, max_length );
+          if ( length > best_length ) {
+            best_length = length;
+            best_dist = pos - c;
+            if ( length == max_length ) break;
+          }
+        }
+        uint32_t next = prev[c & ( WINDOW_SIZE - 1 )];
+        if ( next == 0 || next - 1 >= c ) break;
+        candidate = next;
+      }
+      insert( pos );
+    }
+
+    Token t;
+    if ( best_length >= MIN_MATCH ) {
+      t.length_or_literal = (unsigned short) best_length;
+      t.dist = (unsigned short) best_dist;
+      if ( insert_all ) {
+        for ( size_t k = 1; k < best_length && pos + k + MIN_MATCH <= end; k++ ) insert( pos + k );
+      }
+      pos += best_length;
+    } else {
+      t.length_or_literal = data[pos];
+      t.dist = 0;
+      pos++;
+    }
+    tokens.push_back( t );
+
+    if ( tokens.size() == BLOCK_TOKENS ) {
+      write_block( bw, tokens, last && pos == end );
+      tokens.clear();
+    }
+  }
+
+  if ( last ) {
+    if ( !tokens.empty() || start == end ) write_block( bw, tokens, true );
+    bw.align();
+  } else {
+    if ( !tokens.empty() ) write_block( bw, tokens, false );
+    write_stored( bw, nullptr, 0, false );
+  }
+}
+
+void put_u32( std::vector<unsigned char>& out, uint32_t v ) {
+  out.push_back( (unsigned char) ( v >> 24 ) );
+  out.push_back( (unsigned char) ( v >> 16 ) );
+  out.push_back( (unsigned char) ( v >> 8 ) );
+  out.push_back( (unsigned char) v );
+}
+
+void put_chunk( std::vector<unsigned char>& png, const char* type,
+                const unsigned char* data, size_t n ) {
+  put_u32( png, (uint32_t) n );
+  size_t crc_start = png.size();
+  png.insert( png.end(), type, type + 4 );
+  if ( n > 0 ) png.insert( png.end(), data, data + n );
+  put_u32( png, lodepng_crc32( &png[crc_start], n + 4 ) );
+}
+
+} // namespace
+
+PNGEncoder::PNGEncoder( int level, int threads ) : level( level ), threads( threads ) {
+  if ( this->threads <= 0 ) {
+    this->threads = std::max( 1u, std::thread::hardware_concurrency() );
+  }
+}
+
+bool PNGEncoder::encode( std::vector<unsigned char>& png, const unsigned char* pixels,
+                         size_t width, size_t height, int channels ) const {
+  if ( pixels == nullptr || width == 0 || height == 0 || ( channels != 3 && channels != 4 ) ) {
+    return false;
+  }
+  const int lvl = std::max( 0, std::min( level, 9 ) );
+  const size_t row_bytes = width * channels;
+  const size_t stride = row_bytes + 1;
+  std::vector<unsigned char> filtered( stride * height );
+
+  // Rows are cut into chunks of a few hundred KB, with a few chunks per
+  // thread so uneven chunks still balance
+  size_t target = std::max( (size_t) 1 << 18, filtered.size() / ( 4 * (size_t) threads ) + 1 );
+  size_t rows_per_chunk = std::max( (size_t) 1, target / stride );
+  size_t num_chunks = ( height + rows_per_chunk - 1 ) / rows_per_chunk;
+
+  run_parallel( num_chunks, threads, [&]( size_t i ) {
+    size_t first = i * rows_per_chunk, last = std::min( height, first + rows_per_chunk );
+    filter_rows( filtered.data(), pixels, row_bytes, channels, first, last, lvl > 0 );
+  } );
+
+  std::vector<std::vector<unsigned char> > compressed( num_chunks );
+  std::vector<uint32_t> checksums( num_chunks );
+  run_parallel( num_chunks, threads, [&]( size_t i ) {
+    size_t start = i * rows_per_chunk * stride;
+    size_t end = std::min( height, ( i + 1 ) * rows_per_chunk ) * stride;
+    size_t window_start = start > WINDOW_SIZE ? start - WINDOW_SIZE : 0;
+    compressed[i].reserve( ( end - start ) / 2 );
+    deflate_chunk( compressed[i], filtered.data(), window_start, start, end, lvl, i + 1 == num_chunks );
+    checksums[i] = adler32( filtered.data() + start, end - start );
+  } );
+
+  // zlib stream: header, the chunks back to back, Adler-32 of everything
+  std::vector<unsigned char> zlib;
+  size_t total = 2 + 4;
+  for ( const std::vector<unsigned char>& c : compressed ) total += c.size();
+  zlib.reserve( total );
+  zlib.push_back( 0x78 );
+  zlib.push_back( lvl <= 1 ? 0x01 : lvl <= 5 ? 0x5e : lvl == 6 ? 0x9c : 0xda );
+  uint32_t adler = checksums[0];
+  for ( size_t i = 0; i < num_chunks; i++ ) {
+    zlib.insert( zlib.end(), compressed[i].begin(), compressed[i].end() );
+    if ( i > 0 ) {
+      size_t chunk_bytes = ( std::min( height, ( i + 1 ) * rows_per_chunk ) - i * rows_per_chunk ) * stride;
+      adler = adler32_combine( adler, checksums[i], chunk_bytes );
+    }
+  }
+  put_u32( zlib, adler );
+
+  static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  png.assign( signature, signature + 8 );
+  std::vector<unsigned char> header;
+  put_u32( header, (uint32_t) width );
+  put_u32( header, (uint32_t) height );
+  header.push_back( 8 );                       // bit depth
+  header.push_back( channels == 4 ? 6 : 2 );   // RGBA or RGB
+  header.push_back( 0 );                       // deflate
+  header.push_back( 0 );                       // adaptive filtering
+  header.push_back( 0 );                       // not interlaced
+  put_chunk( png, "IHDR", header.data(), header.size() );
+  put_chunk( png, "IDAT", zlib.data(), zlib.size() );
+  put_chunk( png, "IEND", nullptr, 0 );
+  return true;
+}
+
+bool PNGEncoder::save( const std::string& filename, const unsigned char* pixels,
+                       size_t width, size_t height, int channels ) const {
+  std::vector<unsigned char> png;
+  if ( !encode( png, pixels, width, height, channels ) ) return false;
+  std::ofstream file( filename.c_str(), std::ios::binary );
+  file.write( (const char*) png.data(), png.size() );
+  return (bool) file;
+}
+
+} // namespace CGL
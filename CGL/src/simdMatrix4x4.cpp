@@ -0,0 +1,119 @@
+#include "simdMatrix4x4.h"
+
+#include <iostream>
+
+using namespace std;
+
+namespace CGL {
+
+  SIMDMatrix4x4::SIMDMatrix4x4( const Matrix4x4& A ) {
+    for( int j = 0; j < 4; j++ )
+    {
+      entries[j] = SIMDVector4D( A[j] );
+    }
+  }
+
+  SIMDMatrix4x4 SIMDMatrix4x4::identity( void ) {
+    return SIMDMatrix4x4( SIMDVector4D( 1., 0., 0., 0. ),
+                          SIMDVector4D( 0., 1., 0., 0. ),
+                          SIMDVector4D( 0., 0., 1., 0. ),
+                          SIMDVector4D( 0., 0., 0., 1. ) );
+  }
+
+  SIMDMatrix4x4 SIMDMatrix4x4::scale_translate( double s, const Vector3D& t ) {
+    return SIMDMatrix4x4( SIMDVector4D( s, 0., 0., 0. ),
+                          SIMDVector4D( 0., s, 0., 0. ),
+                          SIMDVector4D( 0., 0., s, 0. ),
+                          SIMDVector4D( t, 1. ) );
+  }
+
+  Matrix4x4 SIMDMatrix4x4::to_matrix4x4( void ) const {
+    Matrix4x4 B;
+
+    for( int j = 0; j < 4; j++ )
+    {
+      B[j] = Vector4D( entries[j].x, entries[j].y, entries[j].z, entries[j].w );
+    }
+
+    return B;
+  }
+
+  SIMDMatrix4x4 SIMDMatrix4x4::T( void ) const {
+    const SIMDMatrix4x4& A( *this );
+    SIMDMatrix4x4 B;
+
+    for( int i = 0; i < 4; i++ )
+    for( int j = 0; j < 4; j++ )
+    {
+       B(i,j) = A(j,i);
+    }
+
+    return B;
+  }
+
+  SIMDMatrix4x4 SIMDMatrix4x4::inv( void ) const {
+    // Not on any hot path; reuse the symbolic inverse.
+    return SIMDMatrix4x4( to_matrix4x4().inv() );
+  }
+
+  void transform_points( const SIMDMatrix4x4& A, const Vector3D* in, Vector3D* out, size_t n ) {
+    const SIMD::d4 c0 = A[0].simd(), c1 = A[1].simd(), c2 = A[2].simd(), c3 = A[3].simd();
+    double r[4];
+
+    for( size_t i = 0; i < n; i++ )
+    {
+      SIMD::d4 v = SIMD::madd( c0, SIMD::set1( in[i].x ), c3 );
+      v = SIMD::madd( c1, SIMD::set1( in[i].y ), v );
+      v = SIMD::madd( c2, SIMD::set1( in[i].z ), v );
+      SIMD::store( r, v );
+      out[i] = Vector3D( r[0], r[1], r[2] );
+    }
+  }
+
+  void transform_vectors( const SIMDMatrix4x4& A, const Vector3D* in, Vector3D* out, size_t n ) {
+    const SIMD::d4 c0 = A[0].simd(), c1 = A[1].simd(), c2 = A[2].simd();
+    double r[4];
+
+    for( size_t i = 0; i < n; i++ )
+    {
+      SIMD::d4 v = SIMD::mul( c0, SIMD::set1( in[i].x ) );
+      v = SIMD::madd( c1, SIMD::set1( in[i].y ), v );
+      v = SIMD::madd( c2, SIMD::set1( in[i].z ), v );
+      SIMD::store( r, v );
+      out[i] = Vector3D( r[0], r[1], r[2] );
+    }
+  }
+
+  void transform_points( const SIMDMatrix4x4& A, const Vector3D* in, float* out, size_t n ) {
+    const SIMD::d4 c0 = A[0].simd(), c1 = A[1].simd(), c2 = A[2].simd(), c3 = A[3].simd();
+
+    for( size_t i = 0; i < n; i++ )
+    {
+      SIMD::d4 v = SIMD::madd( c0, SIMD::set1( in[i].x ), c3 );
+      v = SIMD::madd( c1, SIMD::set1( in[i].y ), v );
+      v = SIMD::madd( c2, SIMD::set1( in[i].z ), v );
+      SIMD::store_float( out + 4 * i, v );
+    }
+  }
+
+  SIMDMatrix4x4 operator*( double c, const SIMDMatrix4x4& A ) {
+    return SIMDMatrix4x4( c * A[0], c * A[1], c * A[2], c * A[3] );
+  }
+
+  std::ostream& operator<<( std::ostream& os, const SIMDMatrix4x4& A ) {
+    for( int i = 0; i < 4; i++ )
+    {
+       os << "[ ";
+
+       for( int j = 0; j < 4; j++ )
+       {
+          os << A(i,j) << " ";
+       }
+
+       os << "]" << std::endl;
+    }
+
+    return os;
+  }
+
+} // namespace CGL
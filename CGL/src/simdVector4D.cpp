@@ -0,0 +1,10 @@
+#include "simdVector4D.h"
+
+namespace CGL {
+
+  std::ostream& operator<<( std::ostream& os, const SIMDVector4D& v ) {
+    os << "(" << v.x << "," << v.y << "," << v.z << "," << v.w << ")";
+    return os;
+  }
+
+} // namespace CGL
@@ -1,6 +1,8 @@
 #version 330
 
-uniform mat4 u_view_projection;
+layout(std140) uniform FrameTransforms {
+  mat4 u_view_projection;
+};
 uniform mat4 u_model;
 
 uniform sampler2D u_texture_2;
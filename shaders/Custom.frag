@@ -2,7 +2,6 @@
 
 // (Every uniform is available here.)
 
-uniform mat4 u_view_projection;
 uniform mat4 u_model;
 
 uniform float u_normal_scaling;
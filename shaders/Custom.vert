@@ -3,7 +3,9 @@
 // Uniform variables are constant throughout the entire shader
 // execution. They are also read-only to enable parallelization.
 uniform mat4 u_model;
-uniform mat4 u_view_projection;
+layout(std140) uniform FrameTransforms {
+  mat4 u_view_projection;
+};
 
 // In a vertex shader, the "in" variables are read-only per-vertex 
 // properties. An example of this was shown in the rasterizer project, 
@@ -0,0 +1,296 @@
+#include "bodyBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "misc/parallel.h"
+
+// Bodies per leaf
+#define BVH_LEAF_SIZE 4
+
+static double surface_area(const Vector3D &min, const Vector3D &max) {
+  Vector3D e = max - min;
+  return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+void BodyBVH::refit(const std::vector<Sphere *> &planets, const std::vector<Sphere *> *asteroids) {
+  size_t count = planets.size() + (asteroids != nullptr ? asteroids->size() : 0);
+  if (dirty || count != bodies.size()) {
+    bodies.assign(planets.begin(), planets.end());
+    if (asteroids != nullptr) bodies.insert(bodies.end(), asteroids->begin(), asteroids->end());
+    dirty = true;
+  }
+
+  // Same bounds the renderers draw, see Sphere::renderPosition
+  centers.resize(bodies.size());
+  radii.resize(bodies.size());
+  Parallel::parallel_for(bodies.size(), [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      centers[i] = bodies[i]->renderPosition();
+      radii[i] = std::abs(bodies[i]->renderRadius());
+    }
+  });
+
+  if (dirty) {
+    build();
+  } else if (refit_nodes() > 2 * built_area) {
+    build();
+  }
+}
+
+void BodyBVH::build() {
+  dirty = false;
+  nodes.clear();
+  if (bodies.empty()) {
+    built_area = 0;
+    return;
+  }
+
+  std::vector<int> order(bodies.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = (int) i;
+  build_node(order, 0, (int) order.size());
+
+  // Store the bodies in leaf order so every subtree is a contiguous range
+  std::vector<Sphere *> sorted_bodies(bodies.size());
+  std::vector<Vector3D> sorted_centers(bodies.size());
+  std::vector<double> sorted_radii(bodies.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    sorted_bodies[i] = bodies[order[i]];
+    sorted_centers[i] = centers[order[i]];
+    sorted_radii[i] = radii[order[i]];
+  }
+  bodies.swap(sorted_bodies);
+  centers.swap(sorted_centers);
+  radii.swap(sorted_radii);
+
+  built_area = refit_nodes();
+}
+
+int BodyBVH::build_node(std::vector<int> &order, int first, int count) {
+  int index = (int) nodes.size();
+  nodes.push_back(Node());
+  nodes[index].first = first;
+  nodes[index].count = count;
+  nodes[index].right = -1;
+  if (count <= BVH_LEAF_SIZE) return index;
+
+  // Median split along the widest spread of centers
+  Vector3D lo = centers[order[first]], hi = lo;
+  for (int i = first + 1; i < first + count; i++) {
+    const Vector3D &c = centers[order[i]];
+    lo = Vector3D(std::min(lo.x, c.x), std::min(lo.y, c.y), std::min(lo.z, c.z));
+    hi = Vector3D(std::max(hi.x, c.x), std::max(hi.y, c.y), std::max(hi.z, c.z));
+  }
+  Vector3D extent = hi - lo;
+  int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+  int half = count / 2;
+  std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                   [&](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+
+  build_node(order, first, half);
+  int right = build_node(order, first + half, count - half);
+  nodes[index].right = right;
+  return index;
+}
+
+double BodyBVH::refit_nodes() {
+  // Children always come after their parent, so walking backwards sees
+  // both children of a node before the node itself
+  double area = 0;
+  for (int i = (int) nodes.size() - 1; i >= 0; i--) {
+    Node &node = nodes[i];
+    if (node.right < 0) {
+      Vector3D lo(INFINITY), hi(-INFINITY);
+      for (int b = node.first; b < node.first + node.count; b++) {
+        const Vector3D &c = centers[b];
+        const double r = radii[b];
+        lo = Vector3D(std::min(lo.x, c.x - r), std::min(lo.y, c.y - r), std::min(lo.z, c.z - r));
+        hi = Vector3D(std::max(hi.x, c.x + r), std::max(hi.y, c.y + r), std::max(hi.z, c.z + r));
+      }
+      node.min = lo;
+      node.max = hi;
+    } else {
+      const Node &left = nodes[i + 1], &right = nodes[node.right];
+      node.min = Vector3D(std::min(left.min.x, right.min.x), std::min(left.min.y, right.min.y),
+                          std::min(left.min.z, right.min.z));
+      node.max = Vector3D(std::max(left.max.x, right.max.x), std::max(left.max.y, right.max.y),
+                          std::max(left.max.z, right.max.z));
+    }
+    area += surface_area(node.min, node.max);
+  }
+  return area;
+}
+
+bool BodyBVH::occluded(const Vector3D &eye, const Vector3D &center, double radius,
+                       const std::vector<Occluder> &occluders) const {
+  Vector3D to_center = center - eye;
+  double distance = to_center.norm();
+  if (distance <= radius) return false;
+  double sin_angle = radius / distance, cos_angle = sqrt(1 - sin_angle * sin_angle);
+
+  // Every ray into a sphere that lies inside an occluder's cone enters the
+  // occluder first, as long as the sphere starts beyond the occluder's
+  // center. Inside the cone means the angle between the centers plus the
+  // sphere's angular radius is at most the occluder's, compared as cosines.
+  for (const Occluder &o : occluders) {
+    if (distance - radius < o.distance || sin_angle >= o.sin_angle) continue;
+    double cos_between = dot(to_center, o.center - eye) / (distance * o.distance);
+    if (cos_between >= o.cos_angle * cos_angle + o.sin_angle * sin_angle) return true;
+  }
+  return false;
+}
+
+void BodyBVH::cull(const Camera &camera, std::vector<Sphere *> &visible) {
+  num_frustum_culled = num_occlusion_culled = 0;
+  if (nodes.empty()) return;
+
+  // The camera frame, built like Camera::view_matrix
+  const Vector3D eye = camera.position();
+  const Vector3D z_axis = (eye - camera.view_point()).unit();
+  const Vector3D x_axis = cross(camera.up_dir(), z_axis).unit();
+  const Vector3D y_axis = cross(z_axis, x_axis);
+  const double half_h = tan(camera.v_fov() * PI / 360);
+  const double half_w = half_h * camera.aspect_ratio();
+
+  // Frustum planes as dot(normal, p) + offset >= 0 inside, normals unit
+  // length so spheres can be tested by their radius
+  Vector3D normals[6] = {
+    x_axis - z_axis * half_w, -x_axis - z_axis * half_w,
+    y_axis - z_axis * half_h, -y_axis - z_axis * half_h,
+    -z_axis, z_axis
+  };
+  double offsets[6];
+  for (int p = 0; p < 6; p++) {
+    normals[p].normalize();
+    offsets[p] = -dot(normals[p], eye);
+  }
+  offsets[4] -= camera.near_clip();
+  offsets[5] += camera.far_clip();
+
+  // The bodies that fill the most of the view
+  std::vector<Occluder> occluders;
+  for (size_t b = 0; b < bodies.size(); b++) {
+    double distance = (centers[b] - eye).norm();
+    if (distance <= radii[b]) continue;
+    Occluder o;
+    o.center = centers[b];
+    o.distance = distance;
+    o.sin_angle = radii[b] / distance;
+    o.cos_angle = sqrt(1 - o.sin_angle * o.sin_angle);
+    if (o.sin_angle < sin(min_occluder_angle)) continue;
+    occluders.push_back(o);
+  }
+  if ((int) occluders.size() > max_occluders) {
+    std::partial_sort(occluders.begin(), occluders.begin() + max_occluders, occluders.end(),
+                      [](const Occluder &a, const Occluder &b) { return a.sin_angle > b.sin_angle; });
+    occluders.resize(max_occluders);
+  }
+
+  // Nodes with the planes they still straddle
+  std::vector<std::pair<int, int>> stack;
+  stack.push_back(std::make_pair(0, 0x3f));
+  while (!stack.empty()) {
+    int index = stack.back().first;
+    int planes = stack.back().second;
+    const Node &node = nodes[index];
+    stack.pop_back();
+
+    bool outside = false;
+    for (int p = 0; p < 6 && !outside; p++) {
+      if (!(planes & (1 << p))) continue;
+      const Vector3D &n = normals[p];
+      Vector3D farthest(n.x > 0 ? node.max.x : node.min.x, n.y > 0 ? node.max.y : node.min.y,
+                        n.z > 0 ? node.max.z : node.min.z);
+      Vector3D nearest(n.x > 0 ? node.min.x : node.max.x, n.y > 0 ? node.min.y : node.max.y,
+                       n.z > 0 ? node.min.z : node.max.z);
+      if (dot(n, farthest) + offsets[p] < 0) outside = true;
+      else if (dot(n, nearest) + offsets[p] >= 0) planes &= ~(1 << p);
+    }
+    if (outside) {
+      num_frustum_culled += node.count;
+      continue;
+    }
+    if (!occluders.empty() &&
+        occluded(eye, (node.min + node.max) / 2, (node.max - node.min).norm() / 2, occluders)) {
+      num_occlusion_culled += node.count;
+      continue;
+    }
+
+    if (node.right >= 0) {
+      stack.push_back(std::make_pair(node.right, planes));
+      stack.push_back(std::make_pair(index + 1, planes));
+      continue;
+    }
+    for (int b = node.first; b < node.first + node.count; b++) {
+      bool inside = true;
+      for (int p = 0; p < 6 && inside; p++) {
+        if (planes & (1 << p)) inside = dot(normals[p], centers[b]) + offsets[p] >= -radii[b];
+      }
+      if (!inside) {
+        num_frustum_culled++;
+      } else if (!occluders.empty() && occluded(eye, centers[b], radii[b], occluders)) {
+        num_occlusion_culled++;
+      } else {
+        visible.push_back(bodies[b]);
+      }
+    }
+  }
+}
+
+Sphere *BodyBVH::pick(const Vector3D &origin, const Vector3D &dir, double min_t, double *t) const {
+  Sphere *nearest = nullptr;
+  double best = INFINITY;
+  if (nodes.empty()) return nullptr;
+
+  // Slab test, returning where the ray enters the box or infinity on a miss
+  const Vector3D inv(1 / dir.x, 1 / dir.y, 1 / dir.z);
+  auto enter = [&](const Node &node) {
+    double t0 = min_t, t1 = best;
+    for (int axis = 0; axis < 3; axis++) {
+      double near_t = (node.min[axis] - origin[axis]) * inv[axis];
+      double far_t = (node.max[axis] - origin[axis]) * inv[axis];
+      if (near_t > far_t) std::swap(near_t, far_t);
+      t0 = std::max(t0, near_t);
+      t1 = std::min(t1, far_t);
+    }
+    return t0 <= t1 ? t0 : INFINITY;
+  };
+
+  // Nearer child first, so most boxes behind the first hit are never opened
+  std::vector<std::pair<double, int>> stack;
+  double root_t = enter(nodes[0]);
+  if (root_t < INFINITY) stack.push_back(std::make_pair(root_t, 0));
+  const double a = dot(dir, dir);
+  while (!stack.empty()) {
+    double entry = stack.back().first;
+    int index = stack.back().second;
+    stack.pop_back();
+    if (entry >= best) continue;
+    const Node &node = nodes[index];
+
+    if (node.right >= 0) {
+      double left_t = enter(nodes[index + 1]), right_t = enter(nodes[node.right]);
+      std::pair<double, int> left(left_t, index + 1), right(right_t, node.right);
+      if (left_t > right_t) std::swap(left, right);
+      if (right.first < INFINITY) stack.push_back(right);
+      if (left.first < INFINITY) stack.push_back(left);
+      continue;
+    }
+    for (int b = node.first; b < node.first + node.count; b++) {
+      // Entry point of the ray, or its exit when it starts inside
+      Vector3D oc = origin - centers[b];
+      double half_b = dot(oc, dir);
+      double disc = half_b * half_b - a * (dot(oc, oc) - radii[b] * radii[b]);
+      if (disc < 0) continue;
+      double root = sqrt(disc);
+      double hit = (-half_b - root) / a;
+      if (hit < min_t) hit = (-half_b + root) / a;
+      if (hit >= min_t && hit < best) {
+        best = hit;
+        nearest = bodies[b];
+      }
+    }
+  }
+  if (t != nullptr) *t = best;
+  return nearest;
+}
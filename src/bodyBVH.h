@@ -0,0 +1,86 @@
+#ifndef CLOTHSIM_BODY_BVH_H
+#define CLOTHSIM_BODY_BVH_H
+
+#include <vector>
+
+#include "camera.h"
+#include "collision/sphere.h"
+
+/*
+  Bounding volume hierarchy over the spheres the viewer draws, used to skip
+  bodies that cannot show up in a frame.
+
+  The tree is built once with median splits and then only refit every
+  frame from the bodies' render bounds, which is linear and cheap as long
+  as bodies keep their neighbours. It is rebuilt when the body list changes
+  or when refitting has let the boxes grow to twice their built size.
+
+  cull() walks the tree against the camera frustum, accepting whole
+  subtrees that are inside it, and against the few bodies covering the
+  most of the view: whatever hides entirely behind one of those occluders
+  is dropped too.
+
+  pick() casts a single ray through the same tree for mouse selection.
+*/
+class BodyBVH {
+public:
+  // Forces a rebuild on the next refit
+  void invalidate() { dirty = true; }
+  // Whether the tree may still hold bodies that were removed since
+  bool needs_rebuild() const { return dirty; }
+
+  void refit(const std::vector<Sphere *> &planets, const std::vector<Sphere *> *asteroids);
+
+  // Appends the bodies that may be visible, in tree order
+  void cull(const Camera &camera, std::vector<Sphere *> &visible);
+
+  // Nearest body whose render sphere the ray hits beyond min_t, or null.
+  // Uses the bounds of the last refit, i.e. what was last drawn; t is in
+  // units of dir.
+  Sphere *pick(const Vector3D &origin, const Vector3D &dir, double min_t, double *t = nullptr) const;
+
+  // Results of the last cull, for profiling
+  int culled_by_frustum() const { return num_frustum_culled; }
+  int culled_by_occluders() const { return num_occlusion_culled; }
+
+  // Bodies that may hide others, and how much of the view (angular radius
+  // in radians) they need to cover to be worth testing against
+  int max_occluders = 4;
+  double min_occluder_angle = 0.02;
+
+private:
+  struct Node {
+    Vector3D min, max;
+    // Covers bodies [first, first + count). Inner nodes have their left
+    // child right after them and the right child at `right`, leaves have
+    // right = -1.
+    int first, count, right;
+  };
+
+  struct Occluder {
+    Vector3D center;
+    // Distance from the eye and the angular radius seen from there
+    double distance, sin_angle, cos_angle;
+  };
+
+  void build();
+  int build_node(std::vector<int> &order, int first, int count);
+  double refit_nodes();
+  bool occluded(const Vector3D &eye, const Vector3D &center, double radius,
+                const std::vector<Occluder> &occluders) const;
+
+  // Bodies in leaf order, with their render space bounding spheres
+  std::vector<Sphere *> bodies;
+  std::vector<Vector3D> centers;
+  std::vector<double> radii;
+  std::vector<Node> nodes;
+
+  bool dirty = true;
+  // Summed surface area of the boxes right after the last build
+  double built_area = 0;
+
+  int num_frustum_culled = 0;
+  int num_occlusion_culled = 0;
+};
+
+#endif // CLOTHSIM_BODY_BVH_H
@@ -78,6 +78,11 @@ void Camera::move_by(const double dx, const double dy, const double d) {
   targetPos += displacement;
 }
 
+void Camera::move_target_to(const Vector3D &targetPos) {
+  pos += targetPos - this->targetPos;
+  this->targetPos = targetPos;
+}
+
 void Camera::move_forward(const double dist) {
   double newR = min(max(r - dist, minR), maxR);
   pos = targetPos + ((pos - targetPos) * (newR / r));
@@ -114,6 +119,33 @@ void Camera::compute_position() {
                                // to the world space view direction
 }
 
+SIMDMatrix4x4 Camera::view_matrix() const {
+  const SIMDVector4D eye(pos, 1.0);
+  const SIMDVector4D zAxis = (eye - SIMDVector4D(targetPos, 1.0)).unit();
+  const SIMDVector4D xAxis = cross3(SIMDVector4D(up_dir(), 0.0), zAxis).unit();
+  const SIMDVector4D yAxis = cross3(zAxis, xAxis);
+
+  // Rows of the rotation are the camera axes; the translation is -R * eye.
+  SIMDMatrix4x4 lookAt(SIMDVector4D(xAxis.x, yAxis.x, zAxis.x, 0.0),
+                       SIMDVector4D(xAxis.y, yAxis.y, zAxis.y, 0.0),
+                       SIMDVector4D(xAxis.z, yAxis.z, zAxis.z, 0.0),
+                       SIMDVector4D(0.0, 0.0, 0.0, 1.0));
+  lookAt[3] = -(lookAt * eye);
+  lookAt[3].w = 1.0;
+  return lookAt;
+}
+
+SIMDMatrix4x4 Camera::projection_matrix() const {
+  const double theta = vFov * PI / 360;
+  const double range = fClip - nClip;
+  const double invtan = 1. / tan(theta);
+
+  return SIMDMatrix4x4(SIMDVector4D(invtan / ar, 0.0, 0.0, 0.0),
+                       SIMDVector4D(0.0, invtan, 0.0, 0.0),
+                       SIMDVector4D(0.0, 0.0, -(nClip + fClip) / range, -1.0),
+                       SIMDVector4D(0.0, 0.0, -2 * nClip * fClip / range, 0.0));
+}
+
 void Camera::dump_settings(string filename) {
   ofstream file(filename);
   file << hFov << " " << vFov << " " << ar << " " << nClip << " " << fClip
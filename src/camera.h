@@ -4,6 +4,7 @@
 #include <iostream>
 
 #include "CGL/matrix3x3.h"
+#include "CGL/simdMatrix4x4.h"
 #include "misc/camera_info.h"
 
 #include "math.h"
@@ -51,6 +52,12 @@ public:
   */
   void move_by(const double dx, const double dy, const double d);
 
+  /*
+    Translates the camera together with its target so it looks at
+    targetPos, keeping the orientation and distance.
+  */
+  void move_target_to(const Vector3D &targetPos);
+
   /*
     Move the specified amount along the view axis.
   */
@@ -69,6 +76,13 @@ public:
   double near_clip() const { return nClip; }
   double far_clip() const { return fClip; }
 
+  /*
+    World-to-camera (look-at) matrix and the OpenGL perspective projection
+    matrix for this camera.
+  */
+  SIMDMatrix4x4 view_matrix() const;
+  SIMDMatrix4x4 projection_matrix() const;
+
   virtual void dump_settings(std::string filename);
   virtual void load_settings(std::string filename);
 
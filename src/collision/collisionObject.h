@@ -11,6 +11,8 @@ using namespace nanogui;
 
 class CollisionObject {
 public:
+  virtual ~CollisionObject() {}
+
   virtual void render(GLShader &shader, bool is_paused) = 0;
   virtual void collide(PointMass &pm) = 0;
 
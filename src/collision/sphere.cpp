@@ -3,16 +3,18 @@
 #include "../clothMesh.h"
 #include "../misc/sphere_drawing.h"
 #include "sphere.h"
+#include "../units.h"
+#include "CGL/simdMatrix4x4.h"
 
 #include <glad/glad.h>
 
 using namespace nanogui;
 using namespace CGL;
 
-#define G 6.67408e-11
 double Sphere::sphere_factor = 0;
 double Sphere::gravity_margin = 0;
 double Sphere::radiusFactor = 0;
+double Sphere::render_blend = 1;
 
 void Sphere::collide(PointMass &pm) {
   // TODO (Part 3): Handle collisions with spheres.
@@ -37,7 +39,7 @@ Vector3D Sphere::gravity(Sphere &other_sphere) {
   double r = dir.norm();
   dir.normalize();
   // Divide by r once to normalize dir, then twice more for the gravitation equation
-  return dir * G * mass * other_sphere.mass / (r * r);
+  return dir * Units::G * mass * other_sphere.mass / (r * r);
 }
 
 void Sphere::add_force(Vector3D force) {
@@ -45,7 +47,9 @@ void Sphere::add_force(Vector3D force) {
 }
 
 void Sphere::verlet(double delta_t) {
-  Vector3D new_pos = pm.position + velocity + (pm.forces / mass);
+  pm.last_position = pm.position;
+  velocity += pm.forces / mass * delta_t;
+  Vector3D new_pos = pm.position + velocity * delta_t;
 
 //    std::cout << "forces: " << pm.forces << "\n";
 //    std::cout << "velocity: " << velocity << "\n";
@@ -58,60 +62,64 @@ void Sphere::verlet(double delta_t) {
 //    std::cout << "\n\n\n";
 
   //pm.last_position = pm.position;
-  velocity = new_pos - pm.position;
   pm.position = new_pos;
   pm.forces = Vector3D();
 }
 
+void Sphere::setState(const Vector3D &position, const Vector3D &velocity) {
+  this->velocity = velocity;
+  pm.position = position;
+  pm.last_position = position;
+  pm.forces = Vector3D();
+}
+
+void Sphere::stepTo(const Vector3D &position, const Vector3D &velocity) {
+  pm.last_position = pm.position;
+  this->velocity = velocity;
+  pm.position = position;
+  pm.forces = Vector3D();
+}
+
 void Sphere::render(GLShader &shader, bool is_paused) {
-  // We decrease the radius here so flat triangles don't behave strangely
-  // and intersect with the sphere when rendered
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, *texture);
+  RenderQueue queue;
+  render(queue, shader, is_paused);
+  queue.submit();
+}
 
+void Sphere::render(RenderQueue &queue, GLShader &shader, bool is_paused) {
+  // We decrease the radius here so flat triangles don't behave strangely
+  // and intersect with the sphere when rendered. The draw itself happens
+  // when the queue is submitted.
 //  m_sphere_mesh.draw_sphere(shader, pm.position / sphere_factor, radius / radiusFactor);
-    m_sphere_mesh.draw_sphere(shader, pm.position / sphere_factor, log(radius));
+    queue.push(&shader, *texture, &m_sphere_mesh, renderPosition(), renderRadius());
   if (!is_paused) {
-      if (track.size() > 2 && addTrack) {
-          this->isTrackEnd(track.front(), (track.at(1) - track.at(0)).norm());
-      }
-
-      if (addTrack) {
-          track.push_back(pm.position);
-      }
+      updateTrack();
   }
 }
-void Sphere::trail(GLShader &shader, std::vector<Vector3D> trail) {
-    if (trail.size() >= 2) {
-        int num_lines = track.size() * 2;
-        MatrixXd positions(4, num_lines * 2);
-
-        // Draw springs as lines
-
-        int si = 0;
-//        Vector3D prev;
-
-        for (int i = 0; i < trail.size() - 1; i++) {
-            Vector3D pa = trail[i] / sphere_factor;
-            Vector3D pb = trail[i+1] / sphere_factor;
-//            if (isnan(pa.x) || isnan(pa.y) || isnan(pa.z) ||
-//                isnan(pb.x) || isnan(pb.y) || isnan(pb.z)) {
-//                break;
-//            }
-//            prev = pa;
 
-            positions.col(si) << pa.x, pa.y, pa.z, 1.0;
-            positions.col(si + 1) << pb.x, pb.y, pb.z, 1.0;
+void Sphere::updateTrack() {
+    if (track.size() > 2 && addTrack) {
+        this->isTrackEnd(track.front(), (track.at(1) - track.at(0)).norm());
+    }
 
-            si += 2;
-        }
+    if (addTrack) {
+        track.push_back(pm.position);
+    }
+}
+void Sphere::trail(GLShader &shader, std::vector<Vector3D> trail) {
+    if (trail.size() >= 2) {
+        // Scale the whole trail into render space in one batched pass and
+        // draw it as a line strip
+        MatrixXf positions(4, trail.size());
+        SIMDMatrix4x4 to_render = SIMDMatrix4x4::scale_translate(1.0 / sphere_factor, Vector3D());
+        transform_points(to_render, trail.data(), positions.data(), trail.size());
 
         // shader.setUniform("u_color", nanogui::Color(1.0f, 1.0f, 1.0f, 1.0f), false);
         shader.uploadAttrib("in_position", positions, false);
         // Commented out: the wireframe shader does not have this attribute
         //shader.uploadAttrib("in_normal", normals);
 
-        shader.drawArray(GL_LINES, 0, num_lines);
+        shader.drawArray(GL_LINE_STRIP, 0, trail.size());
 #ifdef LEAK_PATCH_ON
         shader.freeAttrib("in_position");
 #endif
@@ -133,6 +141,22 @@ bool Sphere::getTrackDone() {
     return !addTrack;
 }
 
+Vector3D Sphere::getPosition() {
+    return pm.position;
+}
+
+Vector3D Sphere::getVelocity() {
+    return velocity;
+}
+
+Vector3D Sphere::renderPosition() {
+    return (pm.last_position + (pm.position - pm.last_position) * render_blend) / sphere_factor;
+}
+
+double Sphere::renderRadius() {
+    return log(radius);
+}
+
 Vector3D Sphere::getInitOrigin() {
     return startOrigin;
 }
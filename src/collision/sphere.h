@@ -3,12 +3,15 @@
 
 #include "../clothMesh.h"
 #include "../misc/sphere_drawing.h"
+#include "../renderQueue.h"
 #include "collisionObject.h"
 
-#define seconds 1
-#define hours 3600
-#define days 86400
-#define years 31536000
+// Simulated seconds in each unit, used by the steps/frame presets. These
+// are constants rather than macros so they do not clash with std::chrono.
+const int seconds = 1;
+const int hours = 3600;
+const int days = 86400;
+const int years = 31536000;
 
 
 using namespace CGL;
@@ -31,6 +34,7 @@ struct SphereParameters {
 struct Sphere : public CollisionObject {
 public:
     void render(GLShader &shader, bool is_paused);
+    void render(RenderQueue &queue, GLShader &shader, bool is_paused);
     void trail(GLShader &shader, std::vector<Vector3D> trail);
     void collide(PointMass &pm);
     Sphere(const Vector3D &origin, double radius, double friction, Vector3D &velocity, long double mass=1e-5, string tex_file = "moon.png", int num_lat = 40, int num_lon = 40)
@@ -44,11 +48,26 @@ public:
     void add_force(Vector3D force);
     void verlet(double delta_t);
     void reset();
+    // Moves the sphere to a state found by an outside integrator
+    void setState(const Vector3D &position, const Vector3D &velocity);
+    // Same, as a step along its path: the old position is kept for drawing
+    // in between
+    void stepTo(const Vector3D &position, const Vector3D &velocity);
     void isTrackEnd(Vector3D track_start, double distance);
+    // Appends the current position to the track until the orbit closes
+    void updateTrack();
     std::vector<Vector3D> getTrack();
     Vector3D logPosition();
 
+    // Where the viewer draws the sphere: render_blend of the way from its
+    // position before the last step to its position, scaled into render
+    // space, and a log radius, so small bodies stay visible
+    Vector3D renderPosition();
+    double renderRadius();
+
     // Get Functions
+    Vector3D getPosition();
+    Vector3D getVelocity();
     Vector3D getInitOrigin();
     Vector3D getInitVelocity();
     bool getTrackDone();
@@ -60,6 +79,8 @@ public:
     static double sphere_factor;
     static double gravity_margin;
     static double radiusFactor;
+    // Set by the viewer each frame from StepScheduler::blend
+    static double render_blend;
 
 private:
     PointMass pm;
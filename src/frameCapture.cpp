@@ -0,0 +1,157 @@
+#include "frameCapture.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "CGL/pngEncoder.h"
+#include "misc/exr_file.h"
+
+FrameCapture::FrameCapture(int width, int height, const std::string &directory,
+                           Format format, int ring_size)
+: width(width), height(height), directory(directory), format(format),
+  pixel_size(format == EXR ? 4 * sizeof(unsigned short) : 4), written(0),
+  encoders(format == EXR ? 1 : Parallel::num_threads()) {
+  glGenRenderbuffers(1, &color_buffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, color_buffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, format == EXR ? GL_RGBA16F : GL_RGBA8, width, height);
+  glGenRenderbuffers(1, &depth_buffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    throw std::runtime_error("Could not create the capture framebuffer");
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  ring_size = std::max(ring_size, 1);
+  pixel_buffers.resize(ring_size);
+  fences.assign(ring_size, (GLsync) 0);
+  slot_frame.assign(ring_size, -1);
+  glGenBuffers(ring_size, pixel_buffers.data());
+  for (GLuint pbo : pixel_buffers) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) (width * height * pixel_size), nullptr, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+FrameCapture::~FrameCapture() {
+  finish();
+  glDeleteBuffers((GLsizei) pixel_buffers.size(), pixel_buffers.data());
+  glDeleteFramebuffers(1, &framebuffer);
+  glDeleteRenderbuffers(1, &color_buffer);
+  glDeleteRenderbuffers(1, &depth_buffer);
+}
+
+void FrameCapture::begin_frame() {
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glViewport(0, 0, width, height);
+}
+
+void FrameCapture::end_frame() {
+  int slot = next_frame % (int) pixel_buffers.size();
+  if (slot_frame[slot] >= 0) {
+    retire(slot);
+  }
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[slot]);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  // With a pack buffer bound this only queues the copy
+  glReadPixels(0, 0, width, height, GL_RGBA, format == EXR ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot_frame[slot] = next_frame++;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void FrameCapture::retire(int slot) {
+  glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64) 1000000000);
+  glDeleteSync(fences[slot]);
+  fences[slot] = 0;
+
+  char name[32];
+  snprintf(name, sizeof(name), "/frame_%05d.%s", slot_frame[slot], format == EXR ? "exr" : "png");
+  std::string path = directory + name;
+  slot_frame[slot] = -1;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[slot]);
+  const unsigned char *mapped = (const unsigned char *)
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr) (width * height * pixel_size), GL_MAP_READ_BIT);
+  if (mapped == nullptr) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    std::cout << "Error: could not read back " << path << std::endl;
+    return;
+  }
+
+  // GL rows run bottom to top; flip and drop alpha while copying out
+  std::vector<unsigned char> *pixels = nullptr;
+  std::vector<unsigned short> *planes = nullptr;
+  if (format == EXR) {
+    const size_t plane = (size_t) width * height;
+    planes = new std::vector<unsigned short>(3 * plane);
+    for (int y = 0; y < height; y++) {
+      const unsigned short *src = (const unsigned short *) mapped + (size_t) (height - 1 - y) * width * 4;
+      unsigned short *dst = planes->data() + (size_t) y * width;
+      for (int x = 0; x < width; x++) {
+        dst[x] = src[4 * x + 2];
+        dst[x + plane] = src[4 * x + 1];
+        dst[x + 2 * plane] = src[4 * x + 0];
+      }
+    }
+  } else {
+    pixels = new std::vector<unsigned char>((size_t) width * height * 3);
+    for (int y = 0; y < height; y++) {
+      const unsigned char *src = mapped + (size_t) (height - 1 - y) * width * 4;
+      unsigned char *dst = pixels->data() + (size_t) y * width * 3;
+      for (int x = 0; x < width; x++) {
+        dst[3 * x + 0] = src[4 * x + 0];
+        dst[3 * x + 1] = src[4 * x + 1];
+        dst[3 * x + 2] = src[4 * x + 2];
+      }
+    }
+  }
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  // Keep a couple of frames per encoder queued at most
+  encoders.wait(2 * encoders.size());
+  int w = width, h = height;
+  encoders.submit([this, pixels, planes, path, w, h]() {
+    bool saved;
+    if (planes != nullptr) {
+      saved = ExrFile::save_half(path, planes->data(), w, h);
+      delete planes;
+    } else {
+      // Frames are already spread over the pool, so each encode stays on
+      // its worker thread
+      CGL::PNGEncoder encoder(CGL::PNGEncoder::FAST, 1);
+      saved = encoder.save(path, pixels->data(), w, h, 3);
+      delete pixels;
+    }
+    if (!saved) {
+      std::cout << "Error: could not write " << path << std::endl;
+    } else {
+      written++;
+    }
+  });
+}
+
+void FrameCapture::finish() {
+  // Oldest first so the frames are queued in order
+  for (int i = 0; i < (int) slot_frame.size(); i++) {
+    int slot = (next_frame + i) % (int) slot_frame.size();
+    if (slot_frame[slot] >= 0) retire(slot);
+  }
+  encoders.wait();
+}
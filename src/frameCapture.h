@@ -0,0 +1,69 @@
+#ifndef CLOTHSIM_FRAME_CAPTURE_H
+#define CLOTHSIM_FRAME_CAPTURE_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "misc/thread_pool.h"
+
+/*
+  Renders frames into an offscreen framebuffer and writes them out as a
+  numbered PNG sequence (frame_00000.png, ...), or as half float OpenEXR
+  files for compositing.
+
+  Readback goes through a ring of pixel buffer objects: end_frame() only
+  queues the copy of the current frame, and the frame from ring_size
+  frames ago is mapped once its fence has signalled, so the CPU never
+  waits on the frame it just rendered. Mapped frames are encoded at
+  PNGEncoder's fast level on a pool of worker threads, one frame per
+  thread. When encoding falls behind, end_frame() blocks until the
+  backlog shrinks, which bounds memory.
+
+  EXR frames render to a 16 bit float target, so values above 1 (the sun
+  glow) survive, and are read back as half floats. They are written by a
+  single worker, because tinyexr already ZIP compresses the 16 scanline
+  blocks of a frame in parallel with OpenMP.
+*/
+class FrameCapture {
+public:
+  enum Format { PNG, EXR };
+
+  FrameCapture(int width, int height, const std::string &directory,
+               Format format = PNG, int ring_size = 3);
+  ~FrameCapture();
+
+  // Binds the capture framebuffer; draw the frame after this
+  void begin_frame();
+  void end_frame();
+
+  // Reads back the frames still in flight and waits for every encode
+  void finish();
+
+  int frames_written() { return written; }
+
+private:
+  void retire(int slot);
+
+  int width, height;
+  std::string directory;
+  Format format;
+  size_t pixel_size;
+
+  GLuint framebuffer = 0;
+  GLuint color_buffer = 0;
+  GLuint depth_buffer = 0;
+
+  // Readback ring, with the frame number each slot holds (-1 when free)
+  std::vector<GLuint> pixel_buffers;
+  std::vector<GLsync> fences;
+  std::vector<int> slot_frame;
+  int next_frame = 0;
+
+  std::atomic<int> written;
+  ThreadPool encoders;
+};
+
+#endif // CLOTHSIM_FRAME_CAPTURE_H
@@ -4,6 +4,12 @@
 
 #include "galaxy.h"
 
+#include <algorithm>
+
+#include "misc/morton.h"
+#include "misc/parallel.h"
+#include "units.h"
+
 //TODO: Make dynamically allocated?
 Galaxy::Galaxy(vector<Sphere*> *planets) {
     this->planets = planets;
@@ -47,7 +53,15 @@ void Galaxy::setTextures(map<string, GLuint*> &tex_file_to_texture) {
 }
 
 void Galaxy::simulate(double frames_per_sec, double simulation_steps) {
-    double delta_t = 1 / frames_per_sec / simulation_steps;
+    // Every step advances one simulated second; frames_per_sec and
+    // simulation_steps only decide how many steps are taken per frame.
+    double delta_t = Units::time_from_si(1);
+    integrator_synced = false;
+    time += 1;
+    if (solver != nullptr) {
+        simulate_with_solver(delta_t);
+        return;
+    }
     // std::cout << "DELTA_T:" << delta_t << "\n";
     // std::cout << "Frames per sec:" << frames_per_sec << "\n";
     // std::cout << "Simulation Steps:" << simulation_steps << "\n";
@@ -85,19 +99,170 @@ void Galaxy::simulate(double frames_per_sec, double simulation_steps) {
     }
 }
 
-void Galaxy::render(GLShader &shader, bool is_paused) {
-    for (Sphere *s : *planets) {
-        s->render(shader, is_paused);
-    }
+void Galaxy::gather_bodies() {
+    // Planets and asteroids all go through the backend, so asteroids feel
+    // every body and not just the star
+    bodies.assign(planets->begin(), planets->end());
     if (asteroids != nullptr) {
-        for (Sphere *a : *asteroids) {
-            // Set is_paused to true to ignore adding position for tracking
-            // Set draw_track to false because we are not draw trail for asteroid belt
-            a->render(shader, true);
+        bodies.insert(bodies.end(), asteroids->begin(), asteroids->end());
+    }
+    if (slot_of.size() != bodies.size()) {
+        sort_bodies();
+    }
+    positions.resize(bodies.size());
+    masses.resize(bodies.size());
+    for (size_t i = 0; i < bodies.size(); i++) {
+        positions[slot_of[i]] = bodies[i]->getPosition();
+        masses[slot_of[i]] = bodies[i]->getMass();
+    }
+}
+
+void Galaxy::sort_bodies() {
+    std::vector<int> order(bodies.size());
+    for (size_t i = 0; i < bodies.size(); i++) {
+        order[i] = (int) i;
+    }
+    if (reorder_interval > 0) {
+        std::vector<Vector3D> by_id(bodies.size());
+        for (size_t i = 0; i < bodies.size(); i++) {
+            by_id[i] = bodies[i]->getPosition();
+        }
+        Morton::sort(by_id, order, planets->size());
+    }
+    slot_of.resize(bodies.size());
+    for (size_t slot = 0; slot < order.size(); slot++) {
+        slot_of[order[slot]] = (int) slot;
+    }
+    steps_since_reorder = 0;
+    // The integrator holds its bodies by slot
+    integrator_synced = false;
+}
+
+void Galaxy::simulate_with_solver(double delta_t) {
+    if (reorder_interval > 0 && ++steps_since_reorder >= reorder_interval) {
+        slot_of.clear();
+    }
+    gather_bodies();
+    solver->accelerations(positions, masses, accelerations);
+
+    Parallel::parallel_for(bodies.size(), [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; i++) {
+            const int slot = slot_of[i];
+            bodies[i]->add_force(accelerations[slot] * masses[slot]);
+            bodies[i]->verlet(delta_t);
+        }
+    });
+}
+
+void Galaxy::advance(double seconds) {
+    if (integrator == nullptr) {
+        for (long i = lround(seconds); i > 0; i--) {
+            simulate(1, 1);
         }
+        return;
+    }
+
+    if (reorder_interval > 0 && ++steps_since_reorder >= reorder_interval) {
+        slot_of.clear();
+    }
+    gather_bodies();
+    velocities.resize(bodies.size());
+    for (size_t i = 0; i < bodies.size(); i++) {
+        velocities[slot_of[i]] = bodies[i]->getVelocity();
+    }
+    // Tight bound planet pairs leave the integrator as their center of
+    // mass, so they do not hold its steps down
+    bool pairs_changed = regularization.select(positions, velocities, masses,
+                                               regularize_pairs ? num_planets : 0);
+    if (!integrator_synced || pairs_changed || synced_bodies != bodies.size()) {
+        regularization.reduce(positions, velocities, masses, reduced_positions, reduced_velocities, reduced_masses);
+        integrator->load(reduced_positions, reduced_velocities);
+        integrator_synced = true;
+        synced_bodies = bodies.size();
+    }
+
+    reduced_positions = integrator->positions();
+    reduced_velocities = integrator->velocities();
+    const double delta_t = Units::time_from_si(seconds);
+    GravitySolver *gravity = solver != nullptr ? solver : &direct_sum;
+    integrator->integrate(delta_t, [&](const std::vector<Vector3D> &x, std::vector<Vector3D> &a) {
+        gravity->accelerations(x, reduced_masses, a);
+        regularization.add_quadrupoles(x, reduced_masses, a);
+    });
+    regularization.advance(delta_t, reduced_positions, reduced_velocities, integrator->positions(),
+                           integrator->velocities(), reduced_masses, positions, velocities);
+
+    for (size_t i = 0; i < bodies.size(); i++) {
+        bodies[i]->stepTo(positions[slot_of[i]], velocities[slot_of[i]]);
+    }
+    time += seconds;
+}
+
+void Galaxy::getState(std::vector<Vector3D> &positions, std::vector<Vector3D> &velocities,
+                      std::vector<double> &masses) {
+    gather_bodies();
+    positions.resize(bodies.size());
+    velocities.resize(bodies.size());
+    masses.resize(bodies.size());
+    for (size_t i = 0; i < bodies.size(); i++) {
+        positions[i] = this->positions[slot_of[i]];
+        velocities[i] = bodies[i]->getVelocity();
+        masses[i] = this->masses[slot_of[i]];
     }
 }
 
+void Galaxy::setState(const std::vector<Vector3D> &positions, const std::vector<Vector3D> &velocities) {
+    gather_bodies();
+    for (size_t i = 0; i < bodies.size() && i < positions.size(); i++) {
+        bodies[i]->setState(positions[i], velocities[i]);
+    }
+    integrator_synced = false;
+}
+
+void Galaxy::render(GLShader &shader, bool is_paused, const CGL::Camera &camera) {
+    // Every planet keeps its track, drawn or not
+    if (!is_paused) {
+        updateTracks();
+    }
+    render_queue.clear();
+    for (Sphere *s : visibleBodies(camera)) {
+        s->render(render_queue, shader, true);
+    }
+    render_queue.submit();
+}
+
+void Galaxy::updateTracks() {
+    for (Sphere *s : *planets) {
+        s->updateTrack();
+    }
+}
+
+const std::vector<Sphere*> &Galaxy::visibleBodies(const CGL::Camera &camera) {
+    bvh.refit(*planets, asteroids);
+    visible.clear();
+    bvh.cull(camera, visible);
+    return visible;
+}
+
+Sphere *Galaxy::pick(const CGL::Camera &camera, double x, double y, int width, int height) {
+    // Bodies were added or removed since the last frame
+    if (bvh.needs_rebuild()) {
+        bvh.refit(*planets, asteroids);
+    }
+
+    // Ray through the pixel center, built like Camera::view_matrix and
+    // scaled so t is the view depth
+    const Vector3D z_axis = (camera.position() - camera.view_point()).unit();
+    const Vector3D x_axis = cross(camera.up_dir(), z_axis).unit();
+    const Vector3D y_axis = cross(z_axis, x_axis);
+    const double half_h = tan(camera.v_fov() * PI / 360);
+    const double half_w = half_h * width / height;
+    double sx = half_w * (2 * (x + 0.5) / width - 1);
+    double sy = half_h * (1 - 2 * (y + 0.5) / height);
+    Vector3D dir = x_axis * sx + y_axis * sy - z_axis;
+    return bvh.pick(camera.position(), dir, camera.near_clip());
+}
+
 void Galaxy::add_planet(Sphere *s) {
     add_planet_helper(s);
 }
@@ -127,6 +292,9 @@ void Galaxy::add_planet_helper(Sphere *s) {
     sort(planets->begin(), planets->end(), compareOrigin);
     this->last = planets->back();
     num_planets = planets->size();
+    bvh.invalidate();
+    integrator_synced = false;
+    slot_of.clear();
 }
 
 void Galaxy::remove_planet() {
@@ -134,6 +302,9 @@ void Galaxy::remove_planet() {
     planets->pop_back();
     this->last = planets->back();
     num_planets = planets->size();
+    bvh.invalidate();
+    integrator_synced = false;
+    slot_of.clear();
 
     // Deallocate Sphere object TODO: NVM ACTUALLY BREAKS SIMULATION
 //    delete last;
@@ -144,6 +315,49 @@ void Galaxy::remove_planet(int index) {
     planets->erase(planets->begin()+index);
     this->last = planets->back();
     num_planets = planets->size();
+    bvh.invalidate();
+    integrator_synced = false;
+    slot_of.clear();
+}
+
+bool Galaxy::remove_body(Sphere *s) {
+    auto it = std::find(planets->begin(), planets->end(), s);
+    if (it != planets->end()) {
+        remove_planet(it - planets->begin());
+        return true;
+    }
+    if (asteroids != nullptr) {
+        it = std::find(asteroids->begin(), asteroids->end(), s);
+        if (it != asteroids->end()) {
+            asteroids->erase(it);
+            num_asteroids = asteroids->size();
+            bvh.invalidate();
+            integrator_synced = false;
+            slot_of.clear();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Galaxy::contains(Sphere *s) {
+    if (std::find(planets->begin(), planets->end(), s) != planets->end()) return true;
+    return asteroids != nullptr && std::find(asteroids->begin(), asteroids->end(), s) != asteroids->end();
+}
+
+void Galaxy::setIntegrator(IAS15 *integrator) {
+    this->integrator = integrator;
+    integrator_synced = false;
+    if (integrator != nullptr) {
+        std::cout << "Adaptive integrator: IAS15, tolerance " << integrator->tolerance << "\n";
+    }
+}
+
+void Galaxy::setGravitySolver(GravitySolver *solver) {
+    this->solver = solver;
+    if (solver != nullptr) {
+        std::cout << "Gravity solver: " << solver->name() << "\n";
+    }
 }
 
 int Galaxy::size() {
@@ -158,4 +372,7 @@ void Galaxy::reset() {
     for (Sphere* s : *planets) {
         s->reset();
     }
+    integrator_synced = false;
+    slot_of.clear();
+    time = 0;
 }
\ No newline at end of file
@@ -6,7 +6,14 @@
 #define CLOTHSIM_GALAXY_H
 
 #include <vector>
+#include "bodyBVH.h"
+#include "camera.h"
 #include "collision/sphere.h"
+#include "gravity/directSum.h"
+#include "gravity/gravitySolver.h"
+#include "integrators/ias15.h"
+#include "integrators/ksRegularization.h"
+#include "renderQueue.h"
 
 class Galaxy {
 public:
@@ -18,16 +25,39 @@ public:
 
     // Functions
     void simulate(double frames_per_sec, double simulation_steps);
+    // Advances the bodies by this many simulated seconds: with the adaptive
+    // integrator in as many steps as its tolerance needs, otherwise in
+    // fixed steps of one second each
+    void advance(double seconds);
     void reset();
     void add_planet(Sphere *s);
     void add_planet();
     void add_planet_helper(Sphere *s);
     void remove_planet();
     void remove_planet(int index);
+    // Removes a planet or asteroid by its pointer, false if it is not here
+    bool remove_body(Sphere *s);
+    bool contains(Sphere *s);
     void setTextures(map<string, GLuint*> &tex_file_to_texture);
+    void setGravitySolver(GravitySolver *solver);
+    void setIntegrator(IAS15 *integrator);
+    // State of all planets then all asteroids, in internal units
+    void getState(std::vector<Vector3D> &positions, std::vector<Vector3D> &velocities,
+                  std::vector<double> &masses);
+    // Moves the bodies to a state from getState, with the same bodies
+    void setState(const std::vector<Vector3D> &positions, const std::vector<Vector3D> &velocities);
     int size();
     Sphere* getLastPlanet();
-    void render(GLShader &shader, bool is_paused);
+    // Draws the bodies the camera may see
+    void render(GLShader &shader, bool is_paused, const CGL::Camera &camera);
+    // What render does to the planet tracks, for renderers that skip it
+    void updateTracks();
+    // Refits the culling hierarchy and returns the bodies the camera may
+    // see, valid until the next call
+    const std::vector<Sphere*> &visibleBodies(const CGL::Camera &camera);
+    // The body under window pixel (x, y) of a width x height view, as it
+    // was last drawn, or null
+    Sphere *pick(const CGL::Camera &camera, double x, double y, int width, int height);
 
 
     // Comparators
@@ -52,7 +82,67 @@ public:
     int num_asteroids;
     Sphere *last;
     std::vector<Sphere*> *planets;
-    std::vector<Sphere*> *asteroids;
+    std::vector<Sphere*> *asteroids = nullptr;
+
+    // Gravity backend, the direct sum is used when null
+    GravitySolver *solver = nullptr;
+    // Adaptive integrator used by advance, fixed steps when null
+    IAS15 *integrator = nullptr;
+    // Lets advance regularize tight bound pairs of planets
+    bool regularize_pairs = true;
+    // Pairs advance is carrying in regularized variables
+    size_t regularizedPairs() const { return regularization.size(); }
+    // Simulated seconds since the start, back to zero on reset
+    double time = 0;
+    // Steps between re-sorting the asteroids along a Morton curve for the
+    // gravity backend, 0 to keep them in the order they were loaded in.
+    // Off by default: the solvers gain a few percent, which the permuted
+    // gather and scatter cost back (see -b).
+    int reorder_interval = 0;
+
+private:
+    void simulate_with_solver(double delta_t);
+    // Fills bodies with the planets and asteroids by id, and positions and
+    // masses with theirs by slot
+    void gather_bodies();
+    // Gives every body its slot, the asteroids in Morton order of where
+    // they are now when reordering is on
+    void sort_bodies();
+
+    // The integrator holds the state of the bodies as of its last call;
+    // anything else that moves, adds or removes bodies clears this
+    bool integrator_synced = false;
+    size_t synced_bodies = 0;
+    DirectSum direct_sum;
+
+    // What the integrator carries: every body, with regularized pairs
+    // merged into their centers of mass
+    KSRegularization regularization;
+    std::vector<Vector3D> velocities;
+    std::vector<Vector3D> reduced_positions, reduced_velocities;
+    std::vector<double> reduced_masses;
+
+    // Slot in the gravity backend's arrays of each body, by stable id: the
+    // planets, then the asteroids, as getState lists them. Planets keep
+    // their slots; asteroids may be re-sorted every reorder_interval steps
+    // so that bodies next to each other in the arrays stay close in space.
+    // The spheres themselves are still walked in id order, the order they
+    // were allocated in. Cleared whenever bodies come or go.
+    std::vector<int> slot_of;
+    int steps_since_reorder = 0;
+
+    // Scratch buffers for the gravity backend
+    std::vector<Sphere*> bodies;
+    std::vector<Vector3D> positions;
+    std::vector<double> masses;
+    std::vector<Vector3D> accelerations;
+
+    // Draws of the current frame, sorted before submission
+    RenderQueue render_queue;
+
+    // Frustum and occlusion culling
+    BodyBVH bvh;
+    std::vector<Sphere*> visible;
 };
 
 
@@ -1,4 +1,5 @@
 #include <cmath>
+#include <cstring>
 #include <glad/glad.h>
 
 #include <CGL/vector3D.h>
@@ -12,96 +13,28 @@
 #include "collision/sphere.h"
 #include "misc/camera_info.h"
 #include "misc/file_utils.h"
-// Needed to generate stb_image binaries. Should only define in exactly one source file importing stb_image.h.
-#define STB_IMAGE_IMPLEMENTATION
-#include "misc/stb_image.h"
+#include "units.h"
 
 using namespace nanogui;
 using namespace std;
 
-Vector3D load_texture(int frame_idx, GLuint handle, const char* where) {
-  Vector3D size_retval;
-  
-  if (strlen(where) == 0) return size_retval;
-  
-  glActiveTexture(GL_TEXTURE0 + frame_idx);
-  glBindTexture(GL_TEXTURE_2D, handle);
-  
-  
-  int img_x, img_y, img_n;
-  unsigned char* img_data = stbi_load(where, &img_x, &img_y, &img_n, 3);
-  size_retval.x = img_x;
-  size_retval.y = img_y;
-  size_retval.z = img_n;
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, img_x, img_y, 0, GL_RGB, GL_UNSIGNED_BYTE, img_data);
-  stbi_image_free(img_data);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  
-  return size_retval;
-}
+void GalaxySimulator::load_textures() {
+  textures = new TextureLoader(m_project_root + "/textures/.cache");
 
-void load_cubemap(int frame_idx, GLuint handle, const std::vector<std::string>& file_locs) {
-  glActiveTexture(GL_TEXTURE0 + frame_idx);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, handle);
-  for (int side_idx = 0; side_idx < 6; ++side_idx) {
-    
-    int img_x, img_y, img_n;
-    unsigned char* img_data = stbi_load(file_locs[side_idx].c_str(), &img_x, &img_y, &img_n, 3);
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + side_idx, 0, GL_RGB, img_x, img_y, 0, GL_RGB, GL_UNSIGNED_BYTE, img_data);
-    stbi_image_free(img_data);
-    std::cout << "Side " << side_idx << " has dimensions " << img_x << ", " << img_y << std::endl;
-
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-  }
+  // Scene textures are requested in setSphereTextures once the galaxy is known
+  m_gl_cubemap_tex = textures->load_cubemap(skyboxFaces(m_project_root));
 }
 
-void GalaxySimulator::load_textures() {
-  //TODO: replace with map to texture id
-  vector<string> texture_paths;
-  set<string> files;
-  const string texture_directory = m_project_root + "/textures";
-  bool success = FileUtils::list_files_in_directory(texture_directory, files);
-  if (!success) {
-    std::cout << "Error: could not find the texture folder!" << endl;
-  }
-  std::string file_extension;
-  std::string texture_name;
-  for (auto file : files) {
-    FileUtils::split_filename(file, texture_name, file_extension);
-    if (file_extension == "png") {
-      texture_paths.emplace_back(texture_directory + "/" + file);
-    }
-  }
-  gl_textures = new GLuint[texture_paths.size()];
-  gl_texture_sizes = new Vector3D[texture_paths.size()];
-  //TODO: create map from textures to GLuint*
-  glGenTextures(texture_paths.size(), gl_textures);
-  for (int i = 0; i < texture_paths.size(); i++) {
-    gl_texture_sizes[i] = load_texture(0, gl_textures[i], (texture_paths[i]).c_str());
-    FileUtils::get_filename_from_path(texture_paths[i], texture_name);
-    std::cout << texture_name << endl;
-    tex_file_to_texture[texture_name] = gl_textures+i;
-  }
-  
-  std::vector<std::string> cubemap_fnames = {
-    m_project_root + "/textures/space/posx.jpg",
-    m_project_root + "/textures/space/negx.jpg",
-    m_project_root + "/textures/space/posy.jpg",
-    m_project_root + "/textures/space/negy.jpg",
-    m_project_root + "/textures/space/posz.jpg",
-    m_project_root + "/textures/space/negz.jpg"
+std::vector<std::string> GalaxySimulator::skyboxFaces(const std::string &project_root) {
+  // In GL cubemap face order
+  return {
+    project_root + "/textures/space/posx.png",
+    project_root + "/textures/space/negx.png",
+    project_root + "/textures/space/posy.png",
+    project_root + "/textures/space/negy.png",
+    project_root + "/textures/space/posz.png",
+    project_root + "/textures/space/negz.png"
   };
-  
-  load_cubemap(1, m_gl_cubemap_tex, cubemap_fnames);
-  std::cout << "Loaded cubemap texture" << std::endl;
 }
 
 void GalaxySimulator::load_shaders() {
@@ -136,6 +69,7 @@ void GalaxySimulator::load_shaders() {
     GLShader nanogui_shader;
     nanogui_shader.initFromFiles(shader_name, vert_shader,
                                   m_project_root + "/shaders/" + shader_fname);
+    nanogui_shader.setUniform("FrameTransforms", frame_uniforms, false);
     
     // Special filenames are treated a bit differently
     ShaderTypeHint hint;
@@ -163,16 +97,57 @@ void GalaxySimulator::load_shaders() {
       break;
     }
   }
+
+  // The planets are always drawn with the texture shader
+  for (size_t i = 0; i < shaders_combobox_names.size(); ++i) {
+    if (shaders_combobox_names[i] == "Texture") {
+      texture_shader_idx = i;
+      break;
+    }
+  }
 }
 
 void GalaxySimulator::setSphereTextures() {
+  // Only decode what the scene actually uses
+  set<string> referenced;
+  for (Sphere *s : *galaxy->planets) referenced.insert(s->getTexFile());
+  if (galaxy->asteroids != nullptr) {
+    for (Sphere *a : *galaxy->asteroids) referenced.insert(a->getTexFile());
+  }
+
+  const string texture_directory = m_project_root + "/textures";
+  for (const string &texture_name : referenced) {
+    string path = texture_directory + "/" + texture_name;
+    if (!tex_file_to_texture.count(texture_name) && FileUtils::file_exists(path)) {
+      tex_file_to_texture[texture_name] = textures->load(path);
+    }
+  }
+
+  // Spheres with a missing texture fall back to an arbitrary loaded one
+  if (tex_file_to_texture.empty()) {
+    set<string> files;
+    FileUtils::list_files_in_directory(texture_directory, files);
+    string texture_name, file_extension;
+    for (const string &file : files) {
+      FileUtils::split_filename(file, texture_name, file_extension);
+      if (file_extension == "png") {
+        tex_file_to_texture[file] = textures->load(texture_directory + "/" + file);
+        break;
+      }
+    }
+  }
+
   galaxy->setTextures(tex_file_to_texture);
 }
 
 GalaxySimulator::GalaxySimulator(std::string project_root, Screen *screen)
 : m_project_root(project_root) {
   this->screen = screen;
-  
+
+  // Must exist before the shaders so they can be attached to it
+  frame_uniforms.init();
+  frame_uniforms.bind(0);
+
   this->load_shaders();
   this->load_textures();
 
@@ -185,13 +160,18 @@ GalaxySimulator::~GalaxySimulator() {
   for (auto shader : shaders) {
     shader.nanogui_shader.free();
   }
+  frame_uniforms.free();
   glDeleteTextures(1, &m_gl_texture_1);
   glDeleteTextures(1, &m_gl_texture_2);
   glDeleteTextures(1, &m_gl_texture_3);
   glDeleteTextures(1, &m_gl_texture_4);
   glDeleteTextures(1, &m_gl_texture_5);
   glDeleteTextures(1, &m_gl_texture_6);
-  glDeleteTextures(1, &m_gl_cubemap_tex);
+  delete textures;
+  delete rasterizer;
+  if (galaxy != nullptr && galaxy->integrator == adaptive) galaxy->setIntegrator(nullptr);
+  delete adaptive;
+  delete preview;
 
   if (sp) delete sp;
 }
@@ -202,6 +182,8 @@ void GalaxySimulator::loadSphereParameters(SphereParameters *sp) { this->sp = sp
 void GalaxySimulator::loadGalaxy(Galaxy *galaxy) {
   this->galaxy = galaxy;
   this->setSphereTextures();
+  timeline.clear();
+  timeline.record(*galaxy);
 }
 
 /**
@@ -210,67 +192,157 @@ void GalaxySimulator::loadGalaxy(Galaxy *galaxy) {
  */
 void GalaxySimulator::init() {
 
-  // Initialize GUI
-  screen->setSize(default_window_size);
-  initGUI(screen);
-
-  // Initialize camera
-
-  CGL::Collada::CameraInfo camera_info;
-  camera_info.hFov = 50000;
-  camera_info.vFov = 35000;
-  camera_info.nClip = 0.01;
-  camera_info.fClip = 10000;
-
-  // Try to intelligently figure out the camera target
+  // Mesa's llvmpipe and softpipe, or any other GL running on the CPU, are
+  // far slower at the sphere meshes than the software rasterizer
+  const char *renderer = (const char *) glGetString(GL_RENDERER);
+  software_rendering = renderer != nullptr &&
+                       (strstr(renderer, "llvmpipe") != nullptr || strstr(renderer, "softpipe") != nullptr ||
+                        strstr(renderer, "Software") != nullptr);
+  if (software_rendering) {
+    std::cout << "Software GL (" << renderer << "), drawing with the software rasterizer" << std::endl;
+  }
 
-  Vector3D avg_pm_position(0, 0, 0);
+  // Initialize GUI, there is none when rendering offscreen
+  if (screen != nullptr) {
+    screen->setSize(default_window_size);
+    initGUI(screen);
+  }
 
-//  for (auto &pm : cloth->point_masses) {
-//    avg_pm_position += pm.position / cloth->point_masses.size();
-//  }
+  // Initialize camera
 
-  CGL::Vector3D target(avg_pm_position.x, avg_pm_position.y / 2,
-                       avg_pm_position.z);
-  CGL::Vector3D c_dir(0., 0., 0.);
-//  canonical_view_distance = max(cloth->width, cloth->height) * 0.9;
-//  std::cout << "dist max: " << canonical_view_distance << "\n";
-    // DEBUG: Adjust Camera View Distance Here
   canonical_view_distance = abs(galaxy->getLastPlanet()->getInitOrigin().norm()) / Sphere::sphere_factor;
-//  std::cout << "dist lastPlanet: " << canonical_view_distance << "\n";
   scroll_rate = canonical_view_distance / 100;
 
   view_distance = canonical_view_distance;
   min_view_distance = canonical_view_distance / 100.0;
   max_view_distance = canonical_view_distance * 1000.0;
 
+  screen_w = default_window_size(0);
+  screen_h = default_window_size(1);
+
   // canonicalCamera is a copy used for view resets
+  camera = defaultCamera(galaxy, screen_w, screen_h);
+  canonicalCamera = camera;
+}
 
-  camera.place(target, acos(c_dir.y), atan2(c_dir.x, c_dir.z), view_distance,
-               min_view_distance, max_view_distance);
-  canonicalCamera.place(target, acos(c_dir.y), atan2(c_dir.x, c_dir.z),
-                        view_distance, min_view_distance, max_view_distance);
+CGL::Camera GalaxySimulator::defaultCamera(Galaxy *galaxy, int width, int height) {
+  CGL::Collada::CameraInfo camera_info;
+  camera_info.hFov = 50000;
+  camera_info.vFov = 35000;
+  camera_info.nClip = 0.01;
+  camera_info.fClip = 10000;
 
-  screen_w = default_window_size(0);
-  screen_h = default_window_size(1);
+  // Look at the center from far enough out to frame the last planet
+  CGL::Vector3D target(0, 0, 0);
+  CGL::Vector3D c_dir(0., 0., 0.);
+  double distance = abs(galaxy->getLastPlanet()->getInitOrigin().norm()) / Sphere::sphere_factor;
 
-  camera.configure(camera_info, screen_w, screen_h);
-  canonicalCamera.configure(camera_info, screen_w, screen_h);
+  CGL::Camera camera;
+  camera.place(target, acos(c_dir.y), atan2(c_dir.x, c_dir.z), distance,
+               distance / 100.0, distance * 1000.0);
+  camera.configure(camera_info, width, height);
+  return camera;
 }
 
 bool GalaxySimulator::isAlive() { return is_alive; }
 
+void GalaxySimulator::enableOffscreen() {
+  is_paused = false;
+  offscreen = true;
+  scheduler.set_fixed(true);
+  textures->finish();
+}
+
+bool GalaxySimulator::recordTrajectory(const std::string &path, int every) {
+  return recorder.open(path, *galaxy, every);
+}
+
+bool GalaxySimulator::playTrajectory(const std::string &path) {
+  if (!playback.open(path)) return false;
+  size_t bodies = galaxy->num_planets + (galaxy->asteroids != nullptr ? galaxy->asteroids->size() : 0);
+  if (playback.bodies() != bodies) {
+    std::cout << "Error: " << path << " was recorded with " << playback.bodies() << " bodies, the scene has "
+              << bodies << std::endl;
+    playback.close();
+    return false;
+  }
+  playback_time = playback.start();
+  playback_clock_started = false;
+  playback.apply(*galaxy, playback_time);
+  return true;
+}
+
+void GalaxySimulator::advancePlayback() {
+  typedef std::chrono::steady_clock clock;
+  clock::time_point now = clock::now();
+  double elapsed = playback_clock_started ? std::chrono::duration<double>(now - playback_clock).count() : 0;
+  playback_clock = now;
+  playback_clock_started = true;
+
+  size_t bodies = galaxy->num_planets + (galaxy->asteroids != nullptr ? galaxy->asteroids->size() : 0);
+  if (playback.bodies() != bodies) {
+    std::cout << "Bodies were added or removed, stopping playback" << std::endl;
+    playback.close();
+    return;
+  }
+  if (is_paused) return;
+
+  // Plays at the rate the simulation would run, simulation_steps seconds
+  // per nominal frame; a capture covers exactly one frame each time, and a
+  // stall skips ahead a quarter second at most
+  elapsed = offscreen ? 1.0 / frames_per_sec : std::min(elapsed, 0.25);
+  playback_time += elapsed * frames_per_sec * simulation_steps;
+  if (playback_time > playback.end()) playback_time = playback.start();
+  playback.apply(*galaxy, playback_time);
+}
+
 void GalaxySimulator::drawContents() {
   glEnable(GL_DEPTH_TEST);
 
-  if (!is_paused) {
-    vector<Vector3D> external_accelerations = {gravity};
-
-    for (int i = 0; i < simulation_steps; i++) {
-//      cloth->simulate(frames_per_sec, simulation_steps, sp, external_accelerations, collision_objects);
-        // FIXME:
-        galaxy->simulate(frames_per_sec, simulation_steps);
-    }
+  // Swap in any textures the loader finished since the last frame
+  textures->upload_finished();
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, *m_gl_cubemap_tex);
+
+  if (playback.is_open()) {
+    advancePlayback();
+  } else if (!is_paused && galaxy->integrator != nullptr) {
+    // A single call covers the frame, the integrator splits it as it needs
+    scheduler.run_frame(frames_per_sec, 1, [this]() {
+      galaxy->advance(simulation_steps);
+      timeline.record(*galaxy);
+      recorder.record(*galaxy);
+    });
+  } else if (!is_paused) {
+    scheduler.run_frame(frames_per_sec, simulation_steps, [this]() {
+      galaxy->simulate(frames_per_sec, simulation_steps);
+      timeline.record(*galaxy);
+      recorder.record(*galaxy);
+    });
+  } else {
+    scheduler.idle();
+  }
+  // Playback is already continuous in time
+  Sphere::render_blend = playback.is_open() ? 1 : scheduler.blend();
+  if (follow_selected && selected != nullptr) {
+    camera.move_target_to(selected->renderPosition());
+  }
+  if (show_preview && preview != nullptr) {
+    // The galaxy moved on, so predict again from where it is now
+    if (!is_paused && preview->finished()) updatePreview();
+    preview->path(preview_path);
+  }
+  updateHUD();
+
+  if (software_rendering) {
+    if (rasterizer == nullptr) rasterizer = new SoftwareRasterizer(m_project_root + "/textures");
+    if (!is_paused) galaxy->updateTracks();
+    std::vector<std::vector<Vector3D>> trails;
+    if (draw_track) trails = trailTracks();
+    if (show_preview && preview_path.size() >= 2) trails.push_back(preview_path);
+    rasterizer->render(camera, *galaxy, trails, Vector3D(color.r(), color.g(), color.b()), screen_w, screen_h);
+    rasterizer->blit();
+    return;
   }
 
   // Prepare the camera projection matrix
@@ -283,6 +355,11 @@ void GalaxySimulator::drawContents() {
   Matrix4f viewProjection = projection * view;
   Vector3D cam_pos = camera.position();
 
+  // Every shader reads the camera transform from the same uniform buffer
+  UniformBufferStd140 frame_data;
+  frame_data.push_back(viewProjection);
+  frame_uniforms.update(frame_data);
+
   glActiveTexture(GL_TEXTURE0);
 
   // Draw Trail with Shader2 so it can change colors
@@ -298,16 +375,18 @@ void GalaxySimulator::drawContents() {
     GLShader shader2 = active_shader.nanogui_shader;
   shader2.bind();
   shader2.setUniform("u_model", model);
-  shader2.setUniform("u_view_projection", viewProjection);
   shader2.setUniform("u_color", color, false);
   if (draw_track) { drawTrail(shader2); }
+  if (show_preview && preview_path.size() >= 2) {
+    shader2.setUniform("u_color", preview_color, false);
+    (*galaxy->planets)[0]->trail(shader2, preview_path);
+  }
 
   // Draw Textures with Shader
-    GLShader shader = GLShader();
-    shader.initFromFiles("Texture", m_project_root + "/shaders/Default.vert", m_project_root + "/shaders/Texture.frag");
-    shader.bind();
+  // Taken by reference so its vertex buffers are reused across frames
+  GLShader &shader = shaders[texture_shader_idx].nanogui_shader;
+  shader.bind();
   shader.setUniform("u_model", model);
-  shader.setUniform("u_view_projection", viewProjection);
   shader.setUniform("u_color", color, false);
 
 
@@ -319,18 +398,128 @@ void GalaxySimulator::drawContents() {
   shader.setUniform("u_height_scaling", m_height_scaling, false);
 
   shader.setUniform("u_texture_cubemap", 1, false);
-  galaxy->render(shader, is_paused);
+  galaxy->render(shader, is_paused, camera);
   //drawPhong(shader);
 }
 
+// Formats a span of simulated seconds in the largest unit that fits
+static string formatSimTime(double time) {
+  const char *units[] = {"s", "h", "d", "yr"};
+  const double scale[] = {seconds, hours, days, years};
+  int u = 0;
+  while (u < 3 && time >= scale[u + 1]) u++;
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.3g %s", time / scale[u], units[u]);
+  return buffer;
+}
+
+// Formats a rate in simulated seconds per wall-clock second
+static string formatSimRate(double rate) {
+  return formatSimTime(rate) + "/s";
+}
+
+void GalaxySimulator::updateHUD() {
+  if (rate_label == nullptr) return;
+  // Every fixed step is one simulated second, every adaptive call a frame
+  // of them
+  IAS15 *integrator = galaxy->integrator;
+  double scale = integrator != nullptr ? simulation_steps : 1;
+  string caption = is_paused ? "paused" : formatSimRate(scheduler.achieved_rate() * scale) + " of " + formatSimRate(scheduler.requested_rate() * scale);
+  if (playback.is_open()) {
+    caption = is_paused ? "playback paused" : "playback at " + formatSimRate((double) frames_per_sec * simulation_steps);
+  } else if (integrator != nullptr && integrator->step_size() > 0) {
+    caption += ", step " + formatSimTime(Units::time_to_si(integrator->step_size()));
+    if (galaxy->regularizedPairs() > 0) {
+      caption += ", " + std::to_string(galaxy->regularizedPairs()) + " pairs regularized";
+    }
+  }
+  rate_label->setCaption(caption);
+
+  if (timeline_slider != nullptr && playback.is_open()) {
+    double span = playback.end() - playback.start();
+    if (!is_paused) timeline_slider->setValue(span > 0 ? (playback_time - playback.start()) / span : 1);
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), ", %zu recorded frames", playback.frames());
+    timeline_label->setCaption(formatSimTime(playback_time) + " of " + formatSimTime(playback.end()) + buffer);
+  } else if (timeline_slider != nullptr) {
+    double span = timeline.end() - timeline.start();
+    if (!is_paused) timeline_slider->setValue(span > 0 ? (galaxy->time - timeline.start()) / span : 1);
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), ", %zu keyframes, %zu kB", timeline.size(), timeline.bytes() >> 10);
+    timeline_label->setCaption(formatSimTime(galaxy->time) + " of " + formatSimTime(timeline.end()) + buffer);
+  }
+
+  if (selection_label == nullptr) return;
+  if (selected == nullptr) {
+    selection_label->setCaption("click a body to select it");
+  } else {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), ", %.3g AU out", selected->getPosition().norm());
+    selection_label->setCaption(selected_name + buffer);
+  }
+}
+
+void GalaxySimulator::selectBody(Sphere *s) {
+  selected = s;
+  if (s == nullptr) {
+    follow_selected = false;
+    if (follow_button != nullptr) follow_button->setPushed(false);
+    return;
+  }
+
+  // Planets by their index in the Remove Index box, asteroids are too many
+  // to number
+  auto it = std::find(galaxy->planets->begin(), galaxy->planets->end(), s);
+  if (it != galaxy->planets->end()) {
+    selected_name = "planet " + std::to_string(it - galaxy->planets->begin());
+  } else {
+    selected_name = "asteroid";
+  }
+}
+
+void GalaxySimulator::removeSelected() {
+  if (selected == nullptr) return;
+  galaxy->remove_body(selected);
+  selectBody(nullptr);
+  invalidatePreview();
+}
+
+void GalaxySimulator::updatePreview() {
+  if (!show_preview) return;
+  if (preview == nullptr) preview = new OrbitPreview();
+  // While paused the snapshot stays current and is shared by every
+  // request; a running galaxy needs a fresh one
+  if (preview_snapshot == nullptr || !is_paused) {
+    std::shared_ptr<OrbitPreview::Snapshot> snapshot = std::make_shared<OrbitPreview::Snapshot>();
+    galaxy->getState(snapshot->x, snapshot->v, snapshot->m);
+    preview_snapshot = snapshot;
+  }
+  preview->request(preview_snapshot, sp->newOrigin, sp->newVelocity, sp->newMass);
+}
+
+void GalaxySimulator::invalidatePreview() {
+  preview_snapshot.reset();
+  updatePreview();
+}
+
 void GalaxySimulator::drawTrail(GLShader &shader) {
+    Sphere *center = (*galaxy->planets)[0];
+    for (const std::vector<Vector3D> &track : trailTracks()) {
+        center->trail(shader, track);
+    }
+}
+
+std::vector<std::vector<Vector3D>> GalaxySimulator::trailTracks() {
+    // Every planet but the center one, unless it is orbited by only one
+    std::vector<std::vector<Vector3D>> tracks;
     std::vector<Sphere*> *planets = galaxy->planets;
     Sphere *center = (*planets)[0];
     for (Sphere *s : (*planets)) {
         if (center != s || planets->size() == 2) {
-            center->trail(shader, s->getTrack());
+            tracks.push_back(s->getTrack());
         }
     }
+    return tracks;
 }
 
 //void GalaxySimulator::drawNormals(GLShader &shader) {
@@ -429,53 +618,21 @@ void GalaxySimulator::drawTrail(GLShader &shader) {
 
 void GalaxySimulator::resetCamera() { camera.copy_placement(canonicalCamera); }
 
-Matrix4f GalaxySimulator::getProjectionMatrix() {
-  Matrix4f perspective;
-  perspective.setZero();
-
-  double cam_near = camera.near_clip();
-  double cam_far = camera.far_clip();
-
-  double theta = camera.v_fov() * M_PI / 360;
-  double range = cam_far - cam_near;
-  double invtan = 1. / tanf(theta);
-
-  perspective(0, 0) = invtan / camera.aspect_ratio();
-  perspective(1, 1) = invtan;
-  perspective(2, 2) = -(cam_near + cam_far) / range;
-  perspective(3, 2) = -1;
-  perspective(2, 3) = -2 * cam_near * cam_far / range;
-  perspective(3, 3) = 0;
+// Both CGL and Eigen matrices are column major
+static Matrix4f toEigen(const SIMDMatrix4x4 &M) {
+  Matrix4f result;
+  for (int j = 0; j < 4; j++) {
+    SIMD::store_float(result.col(j).data(), M[j].simd());
+  }
+  return result;
+}
 
-  return perspective;
+Matrix4f GalaxySimulator::getProjectionMatrix() {
+  return toEigen(camera.projection_matrix());
 }
 
 Matrix4f GalaxySimulator::getViewMatrix() {
-  Matrix4f lookAt;
-  Matrix3f R;
-
-  lookAt.setZero();
-
-  // Convert CGL vectors to Eigen vectors
-  // TODO: Find a better way to do this!
-
-  CGL::Vector3D c_pos = camera.position();
-  CGL::Vector3D c_udir = camera.up_dir();
-  CGL::Vector3D c_target = camera.view_point();
-
-  Vector3f eye(c_pos.x, c_pos.y, c_pos.z);
-  Vector3f up(c_udir.x, c_udir.y, c_udir.z);
-  Vector3f target(c_target.x, c_target.y, c_target.z);
-
-  R.col(2) = (eye - target).normalized();
-  R.col(0) = up.cross(R.col(2)).normalized();
-  R.col(1) = R.col(2).cross(R.col(0));
-
-  lookAt.topLeftCorner<3, 3>() = R.transpose();
-  lookAt.topRightCorner<3, 1>() = -R.transpose() * eye;
-  lookAt(3, 3) = 1.0f;
-
-  return lookAt;
+  return toEigen(camera.view_matrix());
 }
 
 // ----------------------------------------------------------------------------
@@ -508,6 +665,8 @@ bool GalaxySimulator::mouseButtonCallbackEvent(int button, int action,
     switch (button) {
     case GLFW_MOUSE_BUTTON_LEFT:
       left_down = true;
+      press_x = mouse_x;
+      press_y = mouse_y;
       break;
     case GLFW_MOUSE_BUTTON_MIDDLE:
       middle_down = true;
@@ -521,6 +680,11 @@ bool GalaxySimulator::mouseButtonCallbackEvent(int button, int action,
   case GLFW_RELEASE:
     switch (button) {
     case GLFW_MOUSE_BUTTON_LEFT:
+      // Releases come here even when the GUI took the press, which then
+      // never set left_down
+      if (left_down && abs(mouse_x - press_x) <= 2 && abs(mouse_y - press_y) <= 2) {
+        selectBody(galaxy->pick(camera, mouse_x, mouse_y, screen_w, screen_h));
+      }
       left_down = false;
       break;
     case GLFW_MOUSE_BUTTON_MIDDLE:
@@ -561,6 +725,7 @@ bool GalaxySimulator::keyCallbackEvent(int key, int scancode, int action,
     case 'r':
     case 'R':
       galaxy->reset();
+      invalidatePreview();
       break;
     case ' ':
       resetCamera();
@@ -575,19 +740,32 @@ bool GalaxySimulator::keyCallbackEvent(int key, int scancode, int action,
         is_paused = false;
         drawContents();
         is_paused = true;
+        invalidatePreview();
       }
       break;
       // TODO: Extra Keys
     case 'a':
     case 'A':
         galaxy->add_planet();
+        invalidatePreview();
         drawContents();
       break;
     case 'd':
     case 'D':
         galaxy->remove_planet();
+        if (!galaxy->contains(selected)) selectBody(nullptr);
+        invalidatePreview();
         drawContents();
         break;
+    case 'f':
+    case 'F':
+        follow_selected = selected != nullptr && !follow_selected;
+        if (follow_button != nullptr) follow_button->setPushed(follow_selected);
+        break;
+    case GLFW_KEY_DELETE:
+    case GLFW_KEY_BACKSPACE:
+        removeSelected();
+        break;
     }
   }
 
@@ -647,9 +825,12 @@ void GalaxySimulator::initGUI(Screen *screen) {
     fb->setValue(sp->newOrigin.norm() * sp->minMultiplier);
     fb->setMinMaxValues(sp->newOrigin.norm() * sp->minMultiplier, sp->newOrigin.norm() * sp->maxMultiplier);
     fb->setValueIncrement(sp->newOrigin.norm() * sp->minMultiplier / 10.f);
-    fb->setUnits("A.U.");
+    fb->setUnits("AU");
     fb->setSpinnable(true);
-    fb->setCallback([this](float value) { sp->newOrigin.x = value; });
+    fb->setCallback([this](float value) {
+      sp->newOrigin.x = value;
+      updatePreview();
+    });
 
     new Label(panel, "Radius :", "sans-bold");
 
@@ -673,10 +854,13 @@ void GalaxySimulator::initGUI(Screen *screen) {
       fb->setValue(sp->newVelocity.norm() * sp->minMultiplier);
       fb->setMinMaxValues(sp->newVelocity.norm() * sp->minMultiplier, sp->newVelocity.norm() * sp->maxMultiplier);
       fb->setValueIncrement(sp->newVelocity.norm() * sp->minMultiplier / 10.f);
-    fb->setUnits("A.U.");
+    fb->setUnits("AU/yr");
     fb->setSpinnable(true);
       fb->setMinValue(0);
-      fb->setCallback([this](float value) { sp->newVelocity.y = value; });
+      fb->setCallback([this](float value) {
+        sp->newVelocity.y = value;
+        updatePreview();
+      });
 
       new Label(panel, "Mass :", "sans-bold");
 
@@ -687,9 +871,12 @@ void GalaxySimulator::initGUI(Screen *screen) {
       fb->setValue(sp->newMass * sp->minMultiplier);
       fb->setMinMaxValues(sp->newMass * sp->minMultiplier, sp->newMass * sp->maxMultiplier);
       fb->setValueIncrement(sp->newMass * sp->minMultiplier / 10.f);
-      fb->setUnits("A.U.");
+      fb->setUnits("Msun");
       fb->setSpinnable(true);
-      fb->setCallback([this](float value) { sp->newMass = value; });
+      fb->setCallback([this](float value) {
+        sp->newMass = value;
+        updatePreview();
+      });
 
       new Label(panel, "Remove Index:", "sans-bold");
 
@@ -721,6 +908,7 @@ void GalaxySimulator::initGUI(Screen *screen) {
                       std::cout << "adding planet using button" << endl;
                       Sphere *newPlanet = new Sphere(sp->newOrigin, sp->newRadius, 1, sp->newVelocity, sp->newMass);
                       galaxy->add_planet(newPlanet);
+                      invalidatePreview();
                       drawContents();
                   }
               });
@@ -737,9 +925,27 @@ void GalaxySimulator::initGUI(Screen *screen) {
                   if (state) {
                       std::cout << "removing planet using button" << endl;
                       galaxy->remove_planet(sp->delIndex);
+                      if (!galaxy->contains(selected)) selectBody(nullptr);
+                      invalidatePreview();
                       drawContents();
                   }
               });
+
+      // Predicted path of the new planet, redrawn as the widgets change
+      b = new Button(window, "Preview Orbit");
+      b->setFlags(Button::ToggleButton);
+      b->setPushed(show_preview);
+      b->setFontSize(14);
+      b->setChangeCallback(
+              [this](bool state) {
+                  show_preview = state;
+                  if (state) {
+                      invalidatePreview();
+                  } else if (preview != nullptr) {
+                      preview->cancel();
+                      preview_path.clear();
+                  }
+              });
   }
 
   // Simulation constants
@@ -775,6 +981,39 @@ void GalaxySimulator::initGUI(Screen *screen) {
     num_steps->setMinValue(0);
     num_steps->setCallback([this](int value) { simulation_steps = value; });
 
+    new Label(panel, "budget :", "sans-bold");
+
+    FloatBox<double> *budget = new FloatBox<double>(panel);
+    budget->setEditable(true);
+    budget->setFixedSize(Vector2i(100, 20));
+    budget->setFontSize(14);
+    budget->setValue(scheduler.get_budget_ms());
+    budget->setUnits("ms");
+    budget->setSpinnable(true);
+    budget->setMinValue(1);
+    budget->setValueIncrement(1);
+    budget->setCallback([this](float value) { scheduler.set_budget_ms(value); });
+
+    // Used when adaptive steps are on
+    new Label(panel, "tolerance :", "sans-bold");
+
+    if (galaxy->integrator != nullptr) {
+      adaptive = galaxy->integrator;
+      adaptive_tolerance = adaptive->tolerance;
+    }
+    FloatBox<double> *tolerance = new FloatBox<double>(panel);
+    tolerance->setEditable(true);
+    tolerance->setFixedSize(Vector2i(100, 20));
+    tolerance->setFontSize(14);
+    tolerance->setValue(adaptive_tolerance);
+    // A tolerance of 0 would shrink every step to nothing, as -i rejects
+    tolerance->setMinValue(1e-16);
+    tolerance->setCallback([this](double value) {
+      if (value <= 0) return;
+      adaptive_tolerance = value;
+      if (adaptive != nullptr) adaptive->tolerance = value;
+    });
+
       // Time Lapse Buttons
       Button *b = new Button(window, "Seconds Per Step");
       b->setFlags(Button::NormalButton);
@@ -828,12 +1067,75 @@ void GalaxySimulator::initGUI(Screen *screen) {
                   }
               });
 
+      // IAS15 with the tolerance above in place of fixed one second steps
+      b = new Button(window, "Adaptive Steps (IAS15)");
+      b->setFlags(Button::ToggleButton);
+      b->setPushed(galaxy->integrator != nullptr);
+      b->setFontSize(14);
+      b->setChangeCallback(
+              [this](bool state) {
+                  if (state && adaptive == nullptr) adaptive = new IAS15(adaptive_tolerance);
+                  galaxy->setIntegrator(state ? adaptive : nullptr);
+              });
+
       b = new Button(window, "Toggle Trail");
       b->setFlags(Button::ToggleButton);
       b->setPushed(draw_track);
       b->setFontSize(14);
       b->setChangeCallback(
               [this](bool state) { draw_track = state; });
+
+      // Dragging pauses and moves the galaxy to that time of the run, or
+      // of the recording being played back
+      new Label(window, "Timeline", "sans-bold");
+      timeline_slider = new Slider(window);
+      timeline_slider->setValue(1);
+      timeline_slider->setFixedWidth(200);
+      timeline_slider->setCallback([this](float value) {
+          is_paused = true;
+          if (playback.is_open()) {
+            playback_time = playback.start() + value * (playback.end() - playback.start());
+            playback.apply(*galaxy, playback_time);
+          } else {
+            timeline.seek(*galaxy, timeline.start() + value * (timeline.end() - timeline.start()));
+          }
+          invalidatePreview();
+      });
+      timeline_label = new Label(window, "", "sans");
+      timeline_label->setFixedWidth(200);
+
+      // Achieved vs requested simulated time per second
+      new Label(window, "Simulation Rate", "sans-bold");
+      rate_label = new Label(window, "paused", "sans");
+      rate_label->setFixedWidth(200);
+
+      // Picked with a left click
+      new Label(window, "Selection", "sans-bold");
+      selection_label = new Label(window, "click a body to select it", "sans");
+      selection_label->setFixedWidth(200);
+
+      follow_button = new Button(window, "Follow Selected");
+      follow_button->setFlags(Button::ToggleButton);
+      follow_button->setPushed(follow_selected);
+      follow_button->setFontSize(14);
+      follow_button->setChangeCallback(
+              [this](bool state) {
+                  follow_selected = state && selected != nullptr;
+                  follow_button->setPushed(follow_selected);
+              });
+
+      b = new Button(window, "Remove Selected");
+      b->setFlags(Button::NormalButton);
+      b->setPushed(sp->button_pushed);
+      b->setFontSize(14);
+      b->setChangeCallback(
+              [this](bool state) {
+                  sp->button_pushed = state;
+                  if (state) {
+                      removeSelected();
+                      drawContents();
+                  }
+              });
   }
   
   window = new Window(screen, "Appearance");
@@ -850,6 +1152,14 @@ void GalaxySimulator::initGUI(Screen *screen) {
     cb->setCallback(
         [this, screen](int idx) { active_shader_idx = idx; });
     cb->setSelectedIndex(active_shader_idx);
+
+    // Ignores the shader choice and always draws textured bodies
+    Button *b = new Button(window, "Software Rasterizer");
+    b->setFlags(Button::ToggleButton);
+    b->setPushed(software_rendering);
+    b->setFontSize(14);
+    b->setChangeCallback(
+            [this](bool state) { software_rendering = state; });
   }
 
   // Shader Parameters
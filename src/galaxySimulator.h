@@ -1,11 +1,19 @@
 #ifndef CGL_CLOTH_SIMULATOR_H
 #define CGL_CLOTH_SIMULATOR_H
 
+#include <chrono>
+
 #include <nanogui/nanogui.h>
 
 #include "camera.h"
 #include "collision/collisionObject.h"
 #include "galaxy.h"
+#include "orbitPreview.h"
+#include "softwareRasterizer.h"
+#include "stepScheduler.h"
+#include "textureLoader.h"
+#include "timeline.h"
+#include "trajectory.h"
 
 using namespace nanogui;
 
@@ -15,7 +23,7 @@ enum ShaderTypeHint { WIREFRAME = 0, NORMALS = 1, PHONG = 2 };
 class GalaxySimulator {
 public:
   GalaxySimulator(std::string project_root, Screen *screen);
-  ~GalaxySimulator();
+  virtual ~GalaxySimulator();
 
   void init();
 
@@ -24,6 +32,25 @@ public:
   virtual bool isAlive();
   virtual void drawContents();
 
+  // For rendering without a window (no Screen): unpauses, runs exactly
+  // steps/frame every frame and waits for the textures to load
+  void enableOffscreen();
+  // Writes the run to a trajectory file every `every` steps
+  bool recordTrajectory(const std::string &path, int every);
+  // Drives the galaxy from a trajectory file instead of the physics; the
+  // galaxy must hold the bodies it was recorded with
+  bool playTrajectory(const std::string &path);
+  Vector2i getFrameSize() { return Vector2i(screen_w, screen_h); }
+
+  // The camera the viewer starts with, framing the outermost planet, and
+  // the skybox faces. Neither needs a GL context, so offline renderers
+  // can match the interactive view.
+  static CGL::Camera defaultCamera(Galaxy *galaxy, int width, int height);
+  static std::vector<std::string> skyboxFaces(const std::string &project_root);
+
+  static const int default_frames_per_sec = 90;
+  static const int default_simulation_steps = 30;
+
   // Screen events
 
   virtual bool cursorPosCallbackEvent(double x, double y);
@@ -36,6 +63,21 @@ public:
 private:
   virtual void initGUI(Screen *screen);
   void drawTrail(GLShader &shader);
+  std::vector<std::vector<Vector3D>> trailTracks();
+  void updateHUD();
+
+  // Selection by clicking a body, which the camera can then follow or the
+  // user remove
+  void selectBody(Sphere *s);
+  void removeSelected();
+
+  // Re-predicts the path of the body the New Planet widgets describe;
+  // invalidate also drops the snapshot, for when the galaxy was edited
+  void updatePreview();
+  void invalidatePreview();
+
+  // Moves playback on by the wall-clock time since the last frame
+  void advancePlayback();
 //  void drawNormals(GLShader &shader);
 //  void drawPhong(GLShader &shader);
   
@@ -55,8 +97,28 @@ private:
 
   // Default simulation values
 
-  int frames_per_sec = 90;
-  int simulation_steps = 30;
+  int frames_per_sec = default_frames_per_sec;
+  int simulation_steps = default_simulation_steps;
+
+  // Runs as many of the requested steps as fit in the frame budget
+  StepScheduler scheduler;
+
+  // Keyframes of the run so far, scrubbed with the timeline slider
+  Timeline timeline;
+
+  // Run written out with -w, and a recording shown in place of the
+  // physics with -v, at the simulated time playback_time
+  TrajectoryRecorder recorder;
+  TrajectoryPlayback playback;
+  double playback_time = 0;
+  std::chrono::steady_clock::time_point playback_clock;
+  bool playback_clock_started = false;
+  bool offscreen = false;
+
+  // With adaptive steps on, steps/frame is the simulated seconds per frame
+  // and IAS15 picks its own steps to hold this error per step
+  IAS15 *adaptive = nullptr;
+  double adaptive_tolerance = 1e-9;
 
   CGL::Vector3D gravity = CGL::Vector3D(0, -9.8, 0);
   nanogui::Color color = nanogui::Color(1.0f, 1.0f, 1.0f, 1.0f);
@@ -64,11 +126,15 @@ private:
 //  Cloth *cloth;
   SphereParameters *sp;
 //  vector<CollisionObject *> *collision_objects;
-  Galaxy *galaxy;
+  Galaxy *galaxy = nullptr;
 
   // OpenGL attributes
 
   int active_shader_idx = 7; //Texture.frag
+  int texture_shader_idx = 7;
+
+  // Per-frame transforms shared by all shaders (FrameTransforms block)
+  GLUniformBuffer frame_uniforms;
 
   vector<UserShader> shaders;
   vector<std::string> shaders_combobox_names;
@@ -88,11 +154,15 @@ private:
   GLuint m_gl_texture_4;
   GLuint m_gl_texture_5;
   GLuint m_gl_texture_6;
-  GLuint m_gl_cubemap_tex;
+  GLuint* m_gl_cubemap_tex;
+
+  // Decodes textures in the background and owns their GL handles
+  TextureLoader *textures = nullptr;
 
-  //TODO: may need to change these
-  GLuint* gl_textures;
-  Vector3D* gl_texture_sizes;
+  // Draws the frame on the CPU instead, on by default when the GL
+  // implementation is a software one itself
+  SoftwareRasterizer *rasterizer = nullptr;
+  bool software_rendering = false;
   
   // OpenGL customizable inputs
   
@@ -114,6 +184,11 @@ private:
   // Screen methods
 
   Screen *screen;
+  Label *rate_label = nullptr;
+  Slider *timeline_slider = nullptr;
+  Label *timeline_label = nullptr;
+  Label *selection_label = nullptr;
+  Button *follow_button = nullptr;
   void mouseLeftDragged(double x, double y);
   void mouseRightDragged(double x, double y);
   void mouseMoved(double x, double y);
@@ -133,11 +208,28 @@ private:
   bool is_paused = true;
   bool draw_track = false;
 
+  // Picked body, still owned by the galaxy, and its label in the HUD
+  Sphere *selected = nullptr;
+  std::string selected_name;
+  bool follow_selected = false;
+
+  // Predicted path of the planet about to be added, from a snapshot that
+  // is shared with the worker until the galaxy changes
+  OrbitPreview *preview = nullptr;
+  std::shared_ptr<const OrbitPreview::Snapshot> preview_snapshot;
+  std::vector<Vector3D> preview_path;
+  bool show_preview = false;
+  nanogui::Color preview_color = nanogui::Color(1.0f, 0.6f, 0.2f, 1.0f);
+
   // Screen attributes
 
   int mouse_x;
   int mouse_y;
 
+  // Where the left button went down, a click picks if it has not moved
+  int press_x;
+  int press_y;
+
   int screen_w;
   int screen_h;
 
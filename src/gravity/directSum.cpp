@@ -0,0 +1,30 @@
+#include "directSum.h"
+
+#include <cmath>
+
+#include "../misc/parallel.h"
+#include "../units.h"
+
+// Below this many bodies starting threads costs more than the sum
+#define DIRECT_SUM_PARALLEL_MIN 64
+
+void DirectSum::accelerations(const std::vector<Vector3D> &positions,
+                              const std::vector<double> &masses,
+                              std::vector<Vector3D> &accelerations) {
+  const size_t n = positions.size();
+  accelerations.assign(n, Vector3D());
+  unsigned use = n < DIRECT_SUM_PARALLEL_MIN ? 1 : threads > 0 ? threads : Parallel::num_threads();
+  Parallel::parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      Vector3D a;
+      for (size_t j = 0; j < n; j++) {
+        Vector3D d = positions[j] - positions[i];
+        double r2 = dot(d, d);
+        // Skips the body itself and anything sitting exactly on it
+        if (r2 == 0) continue;
+        a += d * (masses[j] / (r2 * sqrt(r2)));
+      }
+      accelerations[i] = a * Units::G;
+    }
+  }, use);
+}
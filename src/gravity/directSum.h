@@ -0,0 +1,27 @@
+#ifndef CLOTHSIM_DIRECT_SUM_H
+#define CLOTHSIM_DIRECT_SUM_H
+
+#include <vector>
+
+#include "gravitySolver.h"
+
+/*
+  Exact pairwise gravity, O(N^2): every body sums the pull of every other
+  one, split by target across threads. Unlike Galaxy's own direct sum it
+  lets asteroids feel all bodies, so it is the reference the approximate
+  solvers are measured against.
+*/
+class DirectSum : public GravitySolver {
+public:
+  // threads = 0 uses every core; small scenes always run on one
+  DirectSum(unsigned threads = 0) : threads(threads) {}
+
+  std::string name() { return "Direct sum"; }
+  void accelerations(const std::vector<Vector3D> &positions,
+                     const std::vector<double> &masses,
+                     std::vector<Vector3D> &accelerations);
+
+  unsigned threads;
+};
+
+#endif // CLOTHSIM_DIRECT_SUM_H
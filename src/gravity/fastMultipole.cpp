@@ -0,0 +1,396 @@
+#include "fastMultipole.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../misc/parallel.h"
+#include "../units.h"
+
+// Cells stop splitting this deep even when their bodies sit on one point
+#define FMM_MAX_LEVEL 40
+// Well separated pairs with fewer body pairs than this many times the
+// number of expansion terms are summed directly
+#define FMM_DIRECT_COST 4
+
+static double factorial(int n) {
+  double f = 1;
+  for (int i = 2; i <= n; i++) f *= i;
+  return f;
+}
+
+FastMultipole::FastMultipole(int order, double opening_angle, int leaf_size)
+    : opening_angle(opening_angle), leaf_size(leaf_size) {
+  setOrder(order);
+}
+
+void FastMultipole::setOrder(int order) {
+  this->order = std::min(std::max(order, 1), (int) max_order);
+  build_terms();
+}
+
+void FastMultipole::build_terms() {
+  const int p = order;
+  const int side = p + 2;
+  // Index of every multi-index up to degree p + 1, -1 beyond p
+  std::vector<int> index(side * side * side, -1);
+  auto at = [&](int x, int y, int z) {
+    if (x < 0 || y < 0 || z < 0 || x + y + z > p) return -1;
+    return index[(x * side + y) * side + z];
+  };
+
+  for (int axis = 0; axis < 3; axis++) exponent[axis].clear();
+  degree.clear();
+  for (int d = 0; d <= p; d++) {
+    for (int x = d; x >= 0; x--) {
+      for (int y = d - x; y >= 0; y--) {
+        index[(x * side + y) * side + (d - x - y)] = (int) degree.size();
+        exponent[0].push_back(x);
+        exponent[1].push_back(y);
+        exponent[2].push_back(d - x - y);
+        degree.push_back(d);
+      }
+    }
+  }
+  num_terms = (int) degree.size();
+
+  build_from.assign(num_terms, -1);
+  build_axis.assign(num_terms, -1);
+  for (int axis = 0; axis < 3; axis++) {
+    lower[axis].assign(num_terms, -1);
+    lower2[axis].assign(num_terms, -1);
+    raise[axis].assign(num_terms, -1);
+  }
+  for (int t = 0; t < num_terms; t++) {
+    int n[3] = { exponent[0][t], exponent[1][t], exponent[2][t] };
+    for (int axis = 0; axis < 3; axis++) {
+      int e[3] = { 0, 0, 0 };
+      e[axis] = 1;
+      lower[axis][t] = at(n[0] - e[0], n[1] - e[1], n[2] - e[2]);
+      lower2[axis][t] = at(n[0] - 2 * e[0], n[1] - 2 * e[1], n[2] - 2 * e[2]);
+      raise[axis][t] = at(n[0] + e[0], n[1] + e[1], n[2] + e[2]);
+      if (build_from[t] < 0 && n[axis] > 0) {
+        build_from[t] = lower[axis][t];
+        build_axis[t] = axis;
+      }
+    }
+  }
+
+  // M2M and L2L: every k <= n componentwise
+  shift_terms.clear();
+  for (int n = 0; n < num_terms; n++) {
+    for (int k = 0; k < num_terms; k++) {
+      bool below = true;
+      double coefficient = 1;
+      for (int axis = 0; axis < 3; axis++) {
+        below = below && exponent[axis][k] <= exponent[axis][n];
+        coefficient *= factorial(exponent[axis][n]) / factorial(exponent[axis][k]);
+      }
+      if (!below) continue;
+      Term term;
+      term.a = n;
+      term.b = k;
+      term.c = at(exponent[0][n] - exponent[0][k], exponent[1][n] - exponent[1][k],
+                  exponent[2][n] - exponent[2][k]);
+      term.coefficient = coefficient;
+      shift_terms.push_back(term);
+    }
+  }
+
+  // M2L. With M'_n = (-1)^|n| M_n / n! and D'_q = q! D_q this is
+  // L_k = sum_n M'_n D'_(k+n) / k!
+  factorials.resize(num_terms);
+  multipole_scale.resize(num_terms);
+  for (int t = 0; t < num_terms; t++) {
+    factorials[t] = factorial(exponent[0][t]) * factorial(exponent[1][t]) * factorial(exponent[2][t]);
+    multipole_scale[t] = (degree[t] % 2 ? -1 : 1) / factorials[t];
+  }
+  m2l_pairs.clear();
+  m2l_start.assign(1, 0);
+  for (int k = 0; k < num_terms; k++) {
+    for (int n = 0; n < num_terms; n++) {
+      if (degree[k] + degree[n] > p) continue;
+      Pair pair;
+      pair.n = n;
+      pair.kn = at(exponent[0][k] + exponent[0][n], exponent[1][k] + exponent[1][n],
+                   exponent[2][k] + exponent[2][n]);
+      m2l_pairs.push_back(pair);
+    }
+    m2l_start.push_back((int) m2l_pairs.size());
+  }
+}
+
+void FastMultipole::monomials(const Vector3D &x, double *out, bool divided) const {
+  out[0] = 1;
+  for (int t = 1; t < num_terms; t++) {
+    int axis = build_axis[t];
+    out[t] = out[build_from[t]] * x[axis];
+    if (divided) out[t] /= exponent[axis][t];
+  }
+}
+
+void FastMultipole::kernel(const Vector3D &r, double *out) const {
+  // Recurrence for the Taylor coefficients of 1/|r|:
+  //   |n| r^2 a_n = -(2|n| - 1) sum_i r_i a_(n - e_i) - (|n| - 1) sum_i a_(n - 2 e_i)
+  const double r2 = dot(r, r);
+  out[0] = 1 / sqrt(r2);
+  for (int t = 1; t < num_terms; t++) {
+    double first = 0, second = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      if (lower[axis][t] >= 0) first += r[axis] * out[lower[axis][t]];
+      if (lower2[axis][t] >= 0) second += out[lower2[axis][t]];
+    }
+    int d = degree[t];
+    out[t] = -((2 * d - 1) * first + (d - 1) * second) / (d * r2);
+  }
+}
+
+void FastMultipole::build_cell(int index, int first, int count, const Vector3D &center,
+                               double half_size, int parent, int level) {
+  Cell &cell = cells[index];
+  cell.center = center;
+  cell.radius = 0;
+  cell.first = first;
+  cell.count = count;
+  cell.first_child = -1;
+  cell.num_children = 0;
+  cell.parent = parent;
+  if ((int) levels.size() <= level) levels.resize(level + 1);
+  levels[level].push_back(index);
+  if (count <= leaf_size || level >= FMM_MAX_LEVEL) return;
+
+  // Counting sort of the bodies by octant
+  int octant_count[8] = { 0 };
+  std::vector<unsigned char> octant(count);
+  for (int i = 0; i < count; i++) {
+    const Vector3D &p = sorted_positions[first + i];
+    octant[i] = (p.x >= center.x) | (p.y >= center.y) << 1 | (p.z >= center.z) << 2;
+    octant_count[octant[i]]++;
+  }
+  int start[8], fill[8];
+  start[0] = first;
+  for (int o = 1; o < 8; o++) start[o] = start[o - 1] + octant_count[o - 1];
+  std::copy(start, start + 8, fill);
+  std::vector<int> bodies(count);
+  std::vector<Vector3D> positions(count);
+  for (int i = 0; i < count; i++) {
+    int slot = fill[octant[i]]++ - first;
+    bodies[slot] = order_of[first + i];
+    positions[slot] = sorted_positions[first + i];
+  }
+  std::copy(bodies.begin(), bodies.end(), order_of.begin() + first);
+  std::copy(positions.begin(), positions.end(), sorted_positions.begin() + first);
+
+  // Children go next to each other, then get built one after the other
+  int num_children = 0;
+  for (int o = 0; o < 8; o++) num_children += octant_count[o] > 0;
+  int first_child = (int) cells.size();
+  cells.resize(cells.size() + num_children);
+  cells[index].first_child = first_child;
+  cells[index].num_children = num_children;
+
+  const double h = half_size / 2;
+  int child = first_child;
+  for (int o = 0; o < 8; o++) {
+    if (octant_count[o] == 0) continue;
+    Vector3D offset(o & 1 ? h : -h, o & 2 ? h : -h, o & 4 ? h : -h);
+    build_cell(child++, start[o], octant_count[o], center + offset, h, index, level + 1);
+  }
+}
+
+void FastMultipole::interact(int a, int b) {
+  const Cell &A = cells[a], &B = cells[b];
+  if (a == b) {
+    if (A.num_children == 0) {
+      near_lists[a].push_back(a);
+      return;
+    }
+    for (int i = 0; i < A.num_children; i++)
+      for (int j = i; j < A.num_children; j++) interact(A.first_child + i, A.first_child + j);
+    return;
+  }
+
+  if (A.radius + B.radius < opening_angle * (A.center - B.center).norm()) {
+    // Small pairs are cheaper summed directly than through two expansions
+    if ((double) A.count * B.count < FMM_DIRECT_COST * num_terms) {
+      near_lists[a].push_back(b);
+      near_lists[b].push_back(a);
+    } else {
+      far_lists[a].push_back(b);
+      far_lists[b].push_back(a);
+    }
+  } else if (A.num_children == 0 && B.num_children == 0) {
+    near_lists[a].push_back(b);
+    near_lists[b].push_back(a);
+  } else if (B.num_children == 0 || (A.num_children > 0 && A.radius >= B.radius)) {
+    for (int i = 0; i < A.num_children; i++) interact(A.first_child + i, b);
+  } else {
+    for (int i = 0; i < B.num_children; i++) interact(a, B.first_child + i);
+  }
+}
+
+void FastMultipole::upward_pass() {
+  // Deepest level first, so children are done before their parents
+  for (int level = (int) levels.size() - 1; level >= 0; level--) {
+    const std::vector<int> &cells_here = levels[level];
+    Parallel::parallel_for(cells_here.size(), [&](size_t begin, size_t end, unsigned) {
+      std::vector<double> scratch(num_terms);
+      for (size_t i = begin; i < end; i++) {
+        Cell &cell = cells[cells_here[i]];
+        double *M = &multipoles[(size_t) cells_here[i] * num_terms];
+        std::fill(M, M + num_terms, 0.0);
+
+        // Expanding about the center of mass zeroes the dipole term, and
+        // the radius is exact rather than bounded by the children's
+        double mass = 0;
+        Vector3D weighted;
+        for (int b = cell.first; b < cell.first + cell.count; b++) {
+          mass += sorted_masses[b];
+          weighted += sorted_positions[b] * sorted_masses[b];
+        }
+        if (mass > 0) cell.center = weighted / mass;
+        cell.radius = 0;
+        for (int b = cell.first; b < cell.first + cell.count; b++) {
+          cell.radius = std::max(cell.radius, (sorted_positions[b] - cell.center).norm2());
+        }
+        cell.radius = sqrt(cell.radius);
+
+        if (cell.num_children == 0) {
+          // P2M
+          for (int b = cell.first; b < cell.first + cell.count; b++) {
+            monomials(sorted_positions[b] - cell.center, scratch.data(), false);
+            for (int t = 0; t < num_terms; t++) M[t] += sorted_masses[b] * scratch[t];
+          }
+          continue;
+        }
+        // M2M
+        for (int c = cell.first_child; c < cell.first_child + cell.num_children; c++) {
+          monomials(cells[c].center - cell.center, scratch.data(), true);
+          const double *child = &multipoles[(size_t) c * num_terms];
+          for (const Term &term : shift_terms) M[term.a] += term.coefficient * scratch[term.c] * child[term.b];
+        }
+      }
+    });
+  }
+}
+
+void FastMultipole::multipole_to_local(int target, int source, double *scratch) {
+  double *D = scratch, *M = scratch + num_terms;
+  kernel(cells[target].center - cells[source].center, D);
+  const double *source_M = &multipoles[(size_t) source * num_terms];
+  for (int t = 0; t < num_terms; t++) {
+    D[t] *= factorials[t];
+    M[t] = source_M[t] * multipole_scale[t];
+  }
+  double *L = &locals[(size_t) target * num_terms];
+  for (int k = 0; k < num_terms; k++) {
+    double sum = 0;
+    for (int i = m2l_start[k]; i < m2l_start[k + 1]; i++) sum += M[m2l_pairs[i].n] * D[m2l_pairs[i].kn];
+    L[k] += sum / factorials[k];
+  }
+}
+
+void FastMultipole::downward_pass() {
+  // M2L into every cell, then L2L from the root down
+  Parallel::parallel_for(cells.size(), [&](size_t begin, size_t end, unsigned) {
+    std::vector<double> scratch(2 * num_terms);
+    for (size_t c = begin; c < end; c++) {
+      std::fill(&locals[c * num_terms], &locals[(c + 1) * num_terms], 0.0);
+      for (int source : far_lists[c]) multipole_to_local((int) c, source, scratch.data());
+    }
+  });
+
+  for (size_t level = 1; level < levels.size(); level++) {
+    const std::vector<int> &cells_here = levels[level];
+    Parallel::parallel_for(cells_here.size(), [&](size_t begin, size_t end, unsigned) {
+      std::vector<double> scratch(num_terms);
+      for (size_t i = begin; i < end; i++) {
+        const Cell &cell = cells[cells_here[i]];
+        monomials(cell.center - cells[cell.parent].center, scratch.data(), true);
+        double *L = &locals[(size_t) cells_here[i] * num_terms];
+        const double *parent = &locals[(size_t) cell.parent * num_terms];
+        for (const Term &term : shift_terms) L[term.b] += term.coefficient * scratch[term.c] * parent[term.a];
+      }
+    });
+  }
+}
+
+void FastMultipole::evaluate_leaf(int leaf, double *scratch) {
+  const Cell &cell = cells[leaf];
+  const double *L = &locals[(size_t) leaf * num_terms];
+  for (int b = cell.first; b < cell.first + cell.count; b++) {
+    const Vector3D &x = sorted_positions[b];
+
+    // L2P: the gradient of sum_k L_k a^k
+    monomials(x - cell.center, scratch, false);
+    Vector3D far;
+    for (int t = 0; t < num_terms; t++) {
+      for (int axis = 0; axis < 3; axis++) {
+        int up = raise[axis][t];
+        if (up >= 0) far[axis] += L[up] * (exponent[axis][t] + 1) * scratch[t];
+      }
+    }
+
+    // P2P with the cells paired directly with this leaf or any cell
+    // containing it, including the leaf itself
+    Vector3D near;
+    for (int c = leaf; c >= 0; c = cells[c].parent) {
+      for (int other : near_lists[c]) {
+        const Cell &source = cells[other];
+        for (int j = source.first; j < source.first + source.count; j++) {
+          Vector3D d = sorted_positions[j] - x;
+          double r2 = dot(d, d);
+          if (r2 == 0) continue;
+          near += d * (sorted_masses[j] / (r2 * sqrt(r2)));
+        }
+      }
+    }
+    sorted_accelerations[b] = (far + near) * Units::G;
+  }
+}
+
+void FastMultipole::accelerations(const std::vector<Vector3D> &positions,
+                                  const std::vector<double> &masses,
+                                  std::vector<Vector3D> &accelerations) {
+  const size_t n = positions.size();
+  accelerations.assign(n, Vector3D());
+  if (n == 0) return;
+
+  // Cube around the bodies, a little larger so none sits on its faces
+  Vector3D lo = positions[0], hi = positions[0];
+  for (const Vector3D &p : positions) {
+    lo = Vector3D(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+    hi = Vector3D(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+  }
+  Vector3D extent = hi - lo;
+  double half_size = std::max(extent.x, std::max(extent.y, extent.z)) * 0.5 * (1 + 1e-9);
+  if (half_size <= 0) half_size = 1;
+
+  order_of.resize(n);
+  for (size_t i = 0; i < n; i++) order_of[i] = (int) i;
+  sorted_positions = positions;
+  cells.assign(1, Cell());
+  levels.clear();
+  build_cell(0, 0, (int) n, (lo + hi) / 2, half_size, -1, 0);
+
+  sorted_masses.resize(n);
+  for (size_t i = 0; i < n; i++) sorted_masses[i] = masses[order_of[i]];
+  multipoles.resize(cells.size() * num_terms);
+  locals.resize(cells.size() * num_terms);
+  upward_pass();
+
+  far_lists.assign(cells.size(), std::vector<int>());
+  near_lists.assign(cells.size(), std::vector<int>());
+  interact(0, 0);
+  downward_pass();
+
+  sorted_accelerations.resize(n);
+  std::vector<int> leaves;
+  for (size_t c = 0; c < cells.size(); c++) {
+    if (cells[c].num_children == 0) leaves.push_back((int) c);
+  }
+  Parallel::parallel_for(leaves.size(), [&](size_t begin, size_t end, unsigned) {
+    std::vector<double> scratch(num_terms);
+    for (size_t i = begin; i < end; i++) evaluate_leaf(leaves[i], scratch.data());
+  });
+  for (size_t i = 0; i < n; i++) accelerations[order_of[i]] = sorted_accelerations[i];
+}
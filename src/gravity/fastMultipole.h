@@ -0,0 +1,120 @@
+#ifndef CLOTHSIM_FAST_MULTIPOLE_H
+#define CLOTHSIM_FAST_MULTIPOLE_H
+
+#include <vector>
+
+#include "gravitySolver.h"
+
+/*
+  Fast multipole method gravity, O(N) for a fixed order and opening angle.
+
+  Bodies are sorted into an adaptive octree whose leaves hold at most
+  leaf_size bodies. Every cell carries a Cartesian multipole expansion of
+  its bodies and a Taylor (local) expansion of the field of everything far
+  from it, both about the cell's center of mass and truncated at the given
+  order p: the error of a well separated pair falls roughly like
+  opening_angle^(p + 1).
+
+  One evaluation is
+    - upward pass: P2M in the leaves, then M2M level by level to the root;
+    - a dual tree walk that pairs cells whose radii fit opening_angle times
+      their distance (M2L) and leaves that do not (direct P2P);
+    - M2L per target cell, then L2L level by level down to the leaves;
+    - L2P plus the direct sums of each leaf.
+  The cells of one level, and the targets of M2L and P2P, are split across
+  threads; every thread only writes to its own cells and bodies.
+
+  There is no softening, the same as the direct sum.
+*/
+class FastMultipole : public GravitySolver {
+public:
+  FastMultipole(int order = 4, double opening_angle = 0.5, int leaf_size = 16);
+
+  std::string name() { return "Fast multipole"; }
+  void accelerations(const std::vector<Vector3D> &positions,
+                     const std::vector<double> &masses,
+                     std::vector<Vector3D> &accelerations);
+
+  // Expansion order, between 1 and max_order
+  void setOrder(int order);
+  int getOrder() { return order; }
+
+  static const int max_order = 12;
+
+  double opening_angle;
+  int leaf_size;
+
+private:
+  struct Cell {
+    // Expansion center (the center of mass) and the distance from it to
+    // the farthest body inside
+    Vector3D center;
+    double radius;
+    // Bodies [first, first + count) in tree order and the children
+    // [first_child, first_child + num_children), contiguous
+    int first, count;
+    int first_child, num_children;
+    int parent;
+  };
+
+  // A term of a product of two expansions: out[a] += coefficient * x[b] * y[c]
+  struct Term {
+    int a, b, c;
+    double coefficient;
+  };
+
+  // M2L pairs of local term k and multipole term n, grouped by k, with the
+  // kernel term k + n
+  struct Pair {
+    int n, kn;
+  };
+
+  void build_terms();
+  void build_cell(int index, int first, int count, const Vector3D &center,
+                  double half_size, int parent, int level);
+  void interact(int a, int b);
+
+  void upward_pass();
+  void multipole_to_local(int target, int source, double *scratch);
+  void downward_pass();
+  void evaluate_leaf(int leaf, double *scratch);
+
+  // Monomials x^n of all terms, or x^n / n! when divided
+  void monomials(const Vector3D &x, double *out, bool divided) const;
+  // Taylor coefficients D^n(1/|r|) / n! of all terms at r
+  void kernel(const Vector3D &r, double *out) const;
+
+  int order;
+  int num_terms;
+
+  // Multi-indices of the terms in order of degree, and for each term the
+  // one with a smaller x, y or z exponent that builds it (-1 if none)
+  std::vector<int> exponent[3];
+  std::vector<int> degree;
+  std::vector<int> lower[3], lower2[3];
+  std::vector<int> build_from, build_axis;
+  // For L2P: the term one degree up along each axis, -1 past the order
+  std::vector<int> raise[3];
+
+  // M2M and L2L as out[n] += (n! / k!) * (d^(n-k) / (n-k)!) * in[k]
+  std::vector<Term> shift_terms;
+  // M2L as L_k += sum_n (-1)^|n| (k + n)! / (k! n!) M_n D_(k+n), where D
+  // holds the Taylor coefficients. The factorials are folded into
+  // per-term scales, so the pairs of local term k are
+  // [m2l_start[k], m2l_start[k + 1]) and need no coefficient.
+  std::vector<Pair> m2l_pairs;
+  std::vector<int> m2l_start;
+  std::vector<double> factorials, multipole_scale;
+
+  std::vector<Cell> cells;
+  std::vector<std::vector<int>> levels;
+  // Body indices in tree order, with their positions, masses and results
+  std::vector<int> order_of;
+  std::vector<Vector3D> sorted_positions;
+  std::vector<double> sorted_masses;
+  std::vector<Vector3D> sorted_accelerations;
+  std::vector<double> multipoles, locals;
+  std::vector<std::vector<int>> far_lists, near_lists;
+};
+
+#endif // CLOTHSIM_FAST_MULTIPOLE_H
@@ -0,0 +1,88 @@
+#include "fft.h"
+
+#include <cmath>
+
+#include "../misc/parallel.h"
+
+namespace FFT {
+
+bool is_power_of_two(size_t n) {
+  return n != 0 && (n & (n - 1)) == 0;
+}
+
+size_t next_power_of_two(size_t n) {
+  size_t p = 1;
+  while (p < n) p <<= 1;
+  return p;
+}
+
+// twiddles[k] = exp(-2 pi i k / n) for k < n / 2
+static void make_twiddles(std::vector<complex> &twiddles, size_t n) {
+  twiddles.resize(n / 2);
+  for (size_t k = 0; k < n / 2; k++) {
+    twiddles[k] = std::polar(1.0, -2 * M_PI * k / n);
+  }
+}
+
+static void transform(complex *data, size_t n, bool inverse, const std::vector<complex> &twiddles) {
+  // Bit reversal permutation
+  for (size_t i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) std::swap(data[i], data[j]);
+  }
+
+  // Iterative Cooley-Tukey butterflies
+  for (size_t len = 2; len <= n; len <<= 1) {
+    size_t half = len >> 1;
+    size_t step = n / len;
+    for (size_t i = 0; i < n; i += len) {
+      for (size_t k = 0; k < half; k++) {
+        complex w = inverse ? std::conj(twiddles[k * step]) : twiddles[k * step];
+        complex u = data[i + k];
+        complex v = data[i + k + half] * w;
+        data[i + k] = u + v;
+        data[i + k + half] = u - v;
+      }
+    }
+  }
+}
+
+void transform(complex *data, size_t n, bool inverse) {
+  std::vector<complex> twiddles;
+  make_twiddles(twiddles, n);
+  transform(data, n, inverse, twiddles);
+}
+
+void transform3d(std::vector<complex> &data, size_t n, bool inverse) {
+  std::vector<complex> twiddles;
+  make_twiddles(twiddles, n);
+
+  // Along k: lines are contiguous
+  Parallel::parallel_for(n * n, [&](size_t begin, size_t end, unsigned) {
+    for (size_t line = begin; line < end; line++) {
+      transform(&data[line * n], n, inverse, twiddles);
+    }
+  });
+
+  // Along j and then i: gather each strided line into a scratch buffer
+  const size_t strides[2] = { n, n * n };
+  for (size_t stride : strides) {
+    Parallel::parallel_for(n * n, [&](size_t begin, size_t end, unsigned) {
+      std::vector<complex> line(n);
+      for (size_t l = begin; l < end; l++) {
+        // l enumerates the two other axes
+        size_t a = l / n, b = l % n;
+        size_t base = stride == n ? a * n * n + b : a * n + b;
+        for (size_t t = 0; t < n; t++) line[t] = data[base + t * stride];
+        transform(line.data(), n, inverse, twiddles);
+        for (size_t t = 0; t < n; t++) data[base + t * stride] = line[t];
+      }
+    });
+  }
+}
+
+} // namespace FFT
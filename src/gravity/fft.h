@@ -0,0 +1,27 @@
+#ifndef CLOTHSIM_FFT_H
+#define CLOTHSIM_FFT_H
+
+#include <complex>
+#include <vector>
+
+/*
+  Self-contained radix-2 complex FFT. Sizes must be powers of two and the
+  inverse transforms are not normalized (divide by the number of samples).
+*/
+namespace FFT {
+
+typedef std::complex<double> complex;
+
+bool is_power_of_two(size_t n);
+size_t next_power_of_two(size_t n);
+
+// In-place transform of n contiguous values.
+void transform(complex *data, size_t n, bool inverse);
+
+// In-place transform of an n^3 cube stored as data[(i * n + j) * n + k].
+// Lines along each axis are split across worker threads.
+void transform3d(std::vector<complex> &data, size_t n, bool inverse);
+
+} // namespace FFT
+
+#endif // CLOTHSIM_FFT_H
@@ -0,0 +1,26 @@
+#ifndef CLOTHSIM_GRAVITY_SOLVER_H
+#define CLOTHSIM_GRAVITY_SOLVER_H
+
+#include <string>
+#include <vector>
+
+#include "CGL/vector3D.h"
+
+using namespace CGL;
+
+/*
+  Gravity backend used by Galaxy::simulate in place of the direct O(N^2)
+  sum. Positions and masses are in internal units (see units.h) and the
+  solver writes one acceleration per body.
+*/
+class GravitySolver {
+public:
+  virtual ~GravitySolver() {}
+
+  virtual std::string name() = 0;
+  virtual void accelerations(const std::vector<Vector3D> &positions,
+                             const std::vector<double> &masses,
+                             std::vector<Vector3D> &accelerations) = 0;
+};
+
+#endif // CLOTHSIM_GRAVITY_SOLVER_H
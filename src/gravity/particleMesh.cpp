@@ -0,0 +1,177 @@
+#include "particleMesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "fft.h"
+#include "../misc/parallel.h"
+#include "../units.h"
+
+// Mesh cells kept free around the bodies so the CIC stencil and the
+// central differences never leave the mesh
+#define PM_BORDER 3
+
+ParticleMesh::ParticleMesh(int grid_size) {
+  setGridSize(grid_size);
+}
+
+void ParticleMesh::setGridSize(int grid_size) {
+  // The FFT needs powers of two and the border needs some room
+  this->grid_size = (int) FFT::next_power_of_two((size_t) std::max(grid_size, 4 * PM_BORDER));
+  this->padded_size = 2 * this->grid_size;
+  build_green_function();
+}
+
+void ParticleMesh::build_green_function() {
+  // Potential of a unit mass at unit cell size, softened by half a cell so
+  // the self term stays finite. The padded mesh wraps around, so distances
+  // are measured to the nearest image of the origin.
+  const int M = padded_size;
+  green.assign((size_t) M * M * M, complex(0, 0));
+  for (int i = 0; i < M; i++) {
+    double di = std::min(i, M - i);
+    for (int j = 0; j < M; j++) {
+      double dj = std::min(j, M - j);
+      for (int k = 0; k < M; k++) {
+        double dk = std::min(k, M - k);
+        green[padded_cell(i, j, k)] = -1.0 / sqrt(di * di + dj * dj + dk * dk + 0.25);
+      }
+    }
+  }
+  FFT::transform3d(green, M, false);
+}
+
+void ParticleMesh::accelerations(const std::vector<Vector3D> &positions,
+                                 const std::vector<double> &masses,
+                                 std::vector<Vector3D> &accelerations) {
+  const size_t n = positions.size();
+  accelerations.assign(n, Vector3D());
+  if (n == 0) return;
+
+  // Fit a cube around the bodies
+  Vector3D lo = positions[0], hi = positions[0];
+  for (const Vector3D &p : positions) {
+    lo = Vector3D(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+    hi = Vector3D(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+  }
+  Vector3D extent = hi - lo;
+  double size = std::max(extent.x, std::max(extent.y, extent.z));
+  if (size <= 0) return;
+
+  const double h = size / (grid_size - 2 * PM_BORDER);
+  const Vector3D origin = (lo + hi) / 2 - Vector3D(h * grid_size / 2);
+
+  // Mesh coordinates of every body
+  body_cell.resize(3 * n);
+  body_frac.resize(n);
+  Parallel::parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+    for (size_t b = begin; b < end; b++) {
+      Vector3D u = (positions[b] - origin) / h;
+      for (int axis = 0; axis < 3; axis++) {
+        int c = std::min(std::max((int) floor(u[axis]), 1), grid_size - 3);
+        body_cell[3 * b + axis] = c;
+        body_frac[b][axis] = std::min(std::max(u[axis] - c, 0.0), 1.0);
+      }
+    }
+  });
+
+  deposit(masses);
+  solve_potential(h);
+  mesh_accelerations(h);
+  interpolate(accelerations);
+}
+
+void ParticleMesh::deposit(const std::vector<double> &masses) {
+  const size_t n = masses.size();
+  density.assign((size_t) grid_size * grid_size * grid_size, 0);
+
+  // Counting sort of the bodies by the x plane of their cell
+  std::vector<size_t> plane_start(grid_size + 1, 0);
+  for (size_t b = 0; b < n; b++) plane_start[body_cell[3 * b] + 1]++;
+  for (int i = 0; i < grid_size; i++) plane_start[i + 1] += plane_start[i];
+  by_plane.resize(n);
+  std::vector<size_t> fill(plane_start.begin(), plane_start.end() - 1);
+  for (size_t b = 0; b < n; b++) by_plane[fill[body_cell[3 * b]]++] = b;
+
+  // A body in plane i writes planes i and i + 1. Splitting the planes into
+  // slabs and depositing the even slabs, then the odd ones, lets the threads
+  // write to the shared mesh without ever touching the same plane.
+  const int slabs = std::min<int>(2 * Parallel::num_threads(), grid_size);
+  auto deposit_slab = [&](int slab) {
+    int first = slab * grid_size / slabs;
+    int last = (slab + 1) * grid_size / slabs;
+    for (size_t s = plane_start[first]; s < plane_start[last]; s++) {
+      size_t b = by_plane[s];
+      const int *c = &body_cell[3 * b];
+      const Vector3D &f = body_frac[b];
+      double wx[2] = { 1 - f.x, f.x }, wy[2] = { 1 - f.y, f.y }, wz[2] = { 1 - f.z, f.z };
+      for (int di = 0; di < 2; di++)
+        for (int dj = 0; dj < 2; dj++)
+          for (int dk = 0; dk < 2; dk++)
+            density[cell(c[0] + di, c[1] + dj, c[2] + dk)] += masses[b] * wx[di] * wy[dj] * wz[dk];
+    }
+  };
+  for (int parity = 0; parity < 2; parity++) {
+    int count = (slabs - parity + 1) / 2;
+    Parallel::parallel_for(count, [&](size_t begin, size_t end, unsigned) {
+      for (size_t s = begin; s < end; s++) deposit_slab(2 * s + parity);
+    });
+  }
+}
+
+void ParticleMesh::solve_potential(double cell_size) {
+  const int N = grid_size, M = padded_size;
+  work.assign((size_t) M * M * M, complex(0, 0));
+  Parallel::parallel_for(N, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++)
+      for (int j = 0; j < N; j++)
+        for (int k = 0; k < N; k++)
+          work[padded_cell(i, j, k)] = density[cell(i, j, k)];
+  });
+
+  FFT::transform3d(work, M, false);
+  Parallel::parallel_for(work.size(), [&](size_t begin, size_t end, unsigned) {
+    for (size_t c = begin; c < end; c++) work[c] *= green[c];
+  });
+  FFT::transform3d(work, M, true);
+
+  // The Green's function was built for unit cells: phi scales with 1 / h
+  const double scale = Units::G / cell_size / ((double) M * M * M);
+  potential.resize((size_t) N * N * N);
+  Parallel::parallel_for(N, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++)
+      for (int j = 0; j < N; j++)
+        for (int k = 0; k < N; k++)
+          potential[cell(i, j, k)] = work[padded_cell(i, j, k)].real() * scale;
+  });
+}
+
+void ParticleMesh::mesh_accelerations(double cell_size) {
+  const int N = grid_size;
+  const double inv = -1.0 / (2 * cell_size);
+  field.assign((size_t) N * N * N, Vector3D());
+  Parallel::parallel_for(N - 2, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin + 1; i < end + 1; i++)
+      for (int j = 1; j < N - 1; j++)
+        for (int k = 1; k < N - 1; k++)
+          field[cell(i, j, k)] = Vector3D(potential[cell(i + 1, j, k)] - potential[cell(i - 1, j, k)],
+                                          potential[cell(i, j + 1, k)] - potential[cell(i, j - 1, k)],
+                                          potential[cell(i, j, k + 1)] - potential[cell(i, j, k - 1)]) * inv;
+  });
+}
+
+void ParticleMesh::interpolate(std::vector<Vector3D> &accelerations) {
+  Parallel::parallel_for(accelerations.size(), [&](size_t begin, size_t end, unsigned) {
+    for (size_t b = begin; b < end; b++) {
+      const int *c = &body_cell[3 * b];
+      const Vector3D &f = body_frac[b];
+      double wx[2] = { 1 - f.x, f.x }, wy[2] = { 1 - f.y, f.y }, wz[2] = { 1 - f.z, f.z };
+      Vector3D a;
+      for (int di = 0; di < 2; di++)
+        for (int dj = 0; dj < 2; dj++)
+          for (int dk = 0; dk < 2; dk++)
+            a += field[cell(c[0] + di, c[1] + dj, c[2] + dk)] * (wx[di] * wy[dj] * wz[dk]);
+      accelerations[b] = a;
+    }
+  });
+}
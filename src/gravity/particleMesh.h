@@ -0,0 +1,60 @@
+#ifndef CLOTHSIM_PARTICLE_MESH_H
+#define CLOTHSIM_PARTICLE_MESH_H
+
+#include <complex>
+#include <vector>
+
+#include "gravitySolver.h"
+
+/*
+  Particle-mesh gravity for large collisionless runs.
+
+  Each call deposits the masses onto a grid_size^3 mesh spanning the bodies
+  with cloud-in-cell weights, solves Poisson's equation with an FFT
+  convolution against the free-space Green's function (the mesh is zero
+  padded to twice its size, so there are no periodic images), differentiates
+  the potential on the mesh and interpolates the accelerations back with the
+  same CIC weights. Cost is O(N + M^3 log M) for N bodies and M = grid_size;
+  forces are softened below about one cell, so larger grids trade speed for
+  resolution.
+*/
+class ParticleMesh : public GravitySolver {
+public:
+  ParticleMesh(int grid_size = 64);
+
+  std::string name() { return "Particle-mesh"; }
+  void accelerations(const std::vector<Vector3D> &positions,
+                     const std::vector<double> &masses,
+                     std::vector<Vector3D> &accelerations);
+
+  void setGridSize(int grid_size);
+  int getGridSize() { return grid_size; }
+
+private:
+  typedef std::complex<double> complex;
+
+  void build_green_function();
+  void deposit(const std::vector<double> &masses);
+  void solve_potential(double cell_size);
+  void mesh_accelerations(double cell_size);
+  void interpolate(std::vector<Vector3D> &accelerations);
+
+  size_t cell(int i, int j, int k) const { return ((size_t) i * grid_size + j) * grid_size + k; }
+  size_t padded_cell(int i, int j, int k) const { return ((size_t) i * padded_size + j) * padded_size + k; }
+
+  int grid_size;
+  int padded_size;
+
+  // Per-body cell index and CIC fractions from the last deposit
+  std::vector<int> body_cell;
+  std::vector<Vector3D> body_frac;
+  std::vector<size_t> by_plane;
+
+  std::vector<double> density;
+  std::vector<double> potential;
+  std::vector<Vector3D> field;
+  std::vector<complex> work;
+  std::vector<complex> green;
+};
+
+#endif // CLOTHSIM_PARTICLE_MESH_H
@@ -0,0 +1,104 @@
+#include "headless.h"
+
+#include <iostream>
+
+#include <glad/glad.h>
+
+#ifdef CLOTHSIM_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif // CLOTHSIM_HAVE_EGL
+
+namespace Headless {
+
+#ifdef CLOTHSIM_HAVE_EGL
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+
+static EGLDisplay open_display() {
+  // Prefer the surfaceless platform, it needs neither X nor a GPU
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (get_platform_display != nullptr) {
+    EGLDisplay surfaceless = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (surfaceless != EGL_NO_DISPLAY) return surfaceless;
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool create_context() {
+  display = open_display();
+  EGLint major, minor;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    std::cout << "Error: could not initialize EGL" << std::endl;
+    return false;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    std::cout << "Error: EGL does not support desktop OpenGL" << std::endl;
+    return false;
+  }
+
+  const EGLint config_attribs[] = {
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8,
+    EGL_GREEN_SIZE, 8,
+    EGL_BLUE_SIZE, 8,
+    EGL_ALPHA_SIZE, 8,
+    EGL_DEPTH_SIZE, 24,
+    EGL_NONE
+  };
+  EGLConfig config;
+  EGLint num_configs = 0;
+  eglChooseConfig(display, config_attribs, &config, 1, &num_configs);
+
+  // Same version and profile as the windowed context in main.cpp
+  const EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  // Surfaceless displays may expose no configs at all; contexts can then
+  // still be created with EGL_KHR_no_config_context
+  context = eglCreateContext(display, num_configs > 0 ? config : (EGLConfig) 0, EGL_NO_CONTEXT, context_attribs);
+  if (context == EGL_NO_CONTEXT) {
+    std::cout << "Error: could not create an OpenGL 3.3 core context through EGL" << std::endl;
+    return false;
+  }
+  if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    std::cout << "Error: EGL does not support surfaceless contexts" << std::endl;
+    return false;
+  }
+
+  if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress)) {
+    std::cout << "Error: could not initialize GLAD" << std::endl;
+    return false;
+  }
+  glGetError(); // pull and ignore unhandled errors like GL_INVALID_ENUM
+
+  std::cout << "Headless renderer: " << glGetString(GL_RENDERER) << std::endl;
+  return true;
+}
+
+void destroy_context() {
+  if (display == EGL_NO_DISPLAY) return;
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+  eglTerminate(display);
+  display = EGL_NO_DISPLAY;
+  context = EGL_NO_CONTEXT;
+}
+
+#else
+
+bool create_context() {
+  std::cout << "Error: built without EGL, headless rendering is unavailable" << std::endl;
+  return false;
+}
+
+void destroy_context() {}
+
+#endif // CLOTHSIM_HAVE_EGL
+
+} // namespace Headless
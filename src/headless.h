@@ -0,0 +1,20 @@
+#ifndef CLOTHSIM_HEADLESS_H
+#define CLOTHSIM_HEADLESS_H
+
+/*
+  OpenGL 3.3 core context without a window, for rendering on machines with
+  no display. Uses EGL with Mesa's surfaceless platform when the build
+  found EGL (CLOTHSIM_HAVE_EGL), so it also runs on the llvmpipe software
+  rasterizer. There is no default framebuffer: render into an FBO such as
+  the one FrameCapture provides.
+*/
+namespace Headless {
+
+// Creates the context, makes it current and loads the GL entry points
+bool create_context();
+
+void destroy_context();
+
+} // namespace Headless
+
+#endif // CLOTHSIM_HEADLESS_H
@@ -0,0 +1,234 @@
+#include "ensemble.h"
+
+#include <algorithm>
+
+#include "CGL/simd.h"
+#include "../misc/parallel.h"
+#include "../units.h"
+
+bool Ensemble::add(const std::vector<Vector3D> &x, const std::vector<Vector3D> &v,
+                   const std::vector<double> &m) {
+  if (x.size() != m.size() || v.size() != m.size()) return false;
+  if (!systems.empty() && m.size() != bodies()) return false;
+  System system;
+  system.x = x;
+  system.v = v;
+  system.m = m;
+  systems.push_back(system);
+  return true;
+}
+
+void Ensemble::state(size_t k, std::vector<Vector3D> &x, std::vector<Vector3D> &v) const {
+  x = systems[k].x;
+  v = systems[k].v;
+}
+
+double Ensemble::shortest_period(const std::vector<Vector3D> &x, const std::vector<double> &m) {
+  double shortest = INFINITY;
+  for (size_t i = 0; i < x.size(); i++) {
+    for (size_t j = i + 1; j < x.size(); j++) {
+      double r = (x[j] - x[i]).norm();
+      double mass = m[i] + m[j];
+      if (r > 0 && mass > 0) shortest = std::min(shortest, 2 * PI * sqrt(r * r * r / (Units::G * mass)));
+    }
+  }
+  return shortest;
+}
+
+void Ensemble::pack(size_t block, Block &out) const {
+  const size_t n = bodies();
+  out.x.assign(3 * n * LANES, 0);
+  out.v.assign(3 * n * LANES, 0);
+  out.a.assign(3 * n * LANES, 0);
+  out.m.assign(n * LANES, 0);
+  for (size_t l = 0; l < LANES; l++) {
+    // The last block is topped up with copies of its last system, which
+    // keeps the padding lanes as well behaved as a real one
+    const System &system = systems[std::min(block * LANES + l, systems.size() - 1)];
+    for (size_t i = 0; i < n; i++) {
+      for (int c = 0; c < 3; c++) {
+        out.x[(3 * i + c) * LANES + l] = system.x[i][c];
+        out.v[(3 * i + c) * LANES + l] = system.v[i][c];
+      }
+      out.m[i * LANES + l] = system.m[i];
+    }
+    out.closest2[l] = INFINITY;
+  }
+}
+
+void Ensemble::accelerations(Block &block) const {
+  const size_t n = bodies();
+  const double *x = block.x.data();
+  const double *m = block.m.data();
+  double *a = block.a.data();
+  std::fill(block.a.begin(), block.a.end(), 0.0);
+  // Keeps two bodies on the same spot from dividing by zero: r^3 of the
+  // floor is still a normal double, so 1 / r^3 stays finite and the pair,
+  // with d = 0, adds nothing
+  const SIMD::d4 tiny = SIMD::set1(1e-200);
+  const SIMD::d4 one = SIMD::set1(1.0);
+
+  for (size_t l = 0; l < LANES; l += 4) {
+    SIMD::d4 nearest = SIMD::load(block.closest2 + l);
+    for (size_t i = 0; i < n; i++) {
+      const double *xi = x + 3 * i * LANES + l;
+      SIMD::d4 xi0 = SIMD::load(xi), xi1 = SIMD::load(xi + LANES), xi2 = SIMD::load(xi + 2 * LANES);
+      SIMD::d4 mi = SIMD::load(m + i * LANES + l);
+      SIMD::d4 ai0 = SIMD::zero(), ai1 = SIMD::zero(), ai2 = SIMD::zero();
+      // Each pair once, pushing both bodies
+      for (size_t j = i + 1; j < n; j++) {
+        const double *xj = x + 3 * j * LANES + l;
+        SIMD::d4 d0 = SIMD::sub(SIMD::load(xj), xi0);
+        SIMD::d4 d1 = SIMD::sub(SIMD::load(xj + LANES), xi1);
+        SIMD::d4 d2 = SIMD::sub(SIMD::load(xj + 2 * LANES), xi2);
+        SIMD::d4 r2 = SIMD::madd(d0, d0, SIMD::madd(d1, d1, SIMD::mul(d2, d2)));
+        nearest = SIMD::min(nearest, r2);
+        r2 = SIMD::max(r2, tiny);
+        SIMD::d4 inv_r3 = SIMD::div(one, SIMD::mul(r2, SIMD::sqrt(r2)));
+        SIMD::d4 si = SIMD::mul(SIMD::load(m + j * LANES + l), inv_r3);
+        SIMD::d4 sj = SIMD::mul(mi, inv_r3);
+        ai0 = SIMD::madd(d0, si, ai0);
+        ai1 = SIMD::madd(d1, si, ai1);
+        ai2 = SIMD::madd(d2, si, ai2);
+        double *aj = a + 3 * j * LANES + l;
+        SIMD::store(aj, SIMD::sub(SIMD::load(aj), SIMD::mul(d0, sj)));
+        SIMD::store(aj + LANES, SIMD::sub(SIMD::load(aj + LANES), SIMD::mul(d1, sj)));
+        SIMD::store(aj + 2 * LANES, SIMD::sub(SIMD::load(aj + 2 * LANES), SIMD::mul(d2, sj)));
+      }
+      double *ai = a + 3 * i * LANES + l;
+      SIMD::store(ai, SIMD::add(SIMD::load(ai), ai0));
+      SIMD::store(ai + LANES, SIMD::add(SIMD::load(ai + LANES), ai1));
+      SIMD::store(ai + 2 * LANES, SIMD::add(SIMD::load(ai + 2 * LANES), ai2));
+    }
+    SIMD::store(block.closest2 + l, nearest);
+  }
+  for (double &value : block.a) {
+    value *= Units::G;
+  }
+}
+
+double Ensemble::energy(const Block &block, size_t lane) const {
+  const size_t n = bodies();
+  auto position = [&](size_t i) {
+    const double *p = block.x.data() + 3 * i * LANES + lane;
+    return Vector3D(p[0], p[LANES], p[2 * LANES]);
+  };
+  double kinetic = 0, potential = 0;
+  for (size_t i = 0; i < n; i++) {
+    const double *p = block.v.data() + 3 * i * LANES + lane;
+    double mi = block.m[i * LANES + lane];
+    kinetic += 0.5 * mi * (p[0] * p[0] + p[LANES] * p[LANES] + p[2 * LANES] * p[2 * LANES]);
+    Vector3D xi = position(i);
+    for (size_t j = i + 1; j < n; j++) {
+      double r = (position(j) - xi).norm();
+      if (r > 0) potential -= Units::G * mi * block.m[j * LANES + lane] / r;
+    }
+  }
+  return kinetic + potential;
+}
+
+void Ensemble::check(const Block &block, size_t first, double time, std::vector<bool> &gone,
+                     const std::vector<double> &escape_radius) {
+  const size_t n = bodies();
+  for (size_t l = 0; l < LANES && first + l < systems.size(); l++) {
+    double total = 0;
+    Vector3D center, drift;
+    for (size_t i = 0; i < n; i++) {
+      double mi = block.m[i * LANES + l];
+      const double *p = block.x.data() + 3 * i * LANES + l;
+      const double *q = block.v.data() + 3 * i * LANES + l;
+      total += mi;
+      center += Vector3D(p[0], p[LANES], p[2 * LANES]) * mi;
+      drift += Vector3D(q[0], q[LANES], q[2 * LANES]) * mi;
+    }
+    center /= total;
+    drift /= total;
+
+    Stats &stats = statistics[first + l];
+    for (size_t i = 0; i < n; i++) {
+      if (gone[i * LANES + l]) continue;
+      const double *p = block.x.data() + 3 * i * LANES + l;
+      const double *q = block.v.data() + 3 * i * LANES + l;
+      double r = (Vector3D(p[0], p[LANES], p[2 * LANES]) - center).norm();
+      double speed2 = (Vector3D(q[0], q[LANES], q[2 * LANES]) - drift).norm2();
+      if (r > escape_radius[l] && 0.5 * speed2 > Units::G * total / r) {
+        gone[i * LANES + l] = true;
+        if (stats.ejected++ == 0) stats.first_ejection = time;
+      }
+    }
+  }
+}
+
+long Ensemble::run(double duration, unsigned threads) {
+  statistics.assign(systems.size(), Stats());
+  if (systems.empty() || duration <= 0) return 0;
+
+  double shortest = INFINITY;
+  for (const System &system : systems) {
+    shortest = std::min(shortest, shortest_period(system.x, system.m));
+  }
+  double step = std::isfinite(shortest) ? shortest / steps_per_orbit : duration;
+  const long steps = std::max(1L, (long) ceil(duration / step));
+  step = duration / steps;
+
+  const size_t n = bodies();
+  const size_t blocks = (systems.size() + LANES - 1) / LANES;
+  Parallel::parallel_for(blocks, [&](size_t begin, size_t end, unsigned) {
+    Block block;
+    std::vector<bool> gone;
+    std::vector<double> start_energy(LANES), escape_radius(LANES);
+    for (size_t b = begin; b < end; b++) {
+      const size_t first = b * LANES;
+      pack(b, block);
+      gone.assign(n * LANES, false);
+      for (size_t l = 0; l < LANES; l++) {
+        start_energy[l] = energy(block, l);
+        double farthest = 0;
+        const System &system = systems[std::min(first + l, systems.size() - 1)];
+        Vector3D center;
+        double total = 0;
+        for (size_t i = 0; i < n; i++) {
+          center += system.x[i] * system.m[i];
+          total += system.m[i];
+        }
+        center /= total;
+        for (size_t i = 0; i < n; i++) {
+          farthest = std::max(farthest, (system.x[i] - center).norm());
+        }
+        escape_radius[l] = escape_factor * farthest;
+      }
+
+      // Kick-drift-kick leapfrog
+      const size_t count = block.x.size();
+      const double half = step / 2;
+      accelerations(block);
+      for (long s = 0; s < steps; s++) {
+        for (size_t k = 0; k < count; k++) block.v[k] += block.a[k] * half;
+        for (size_t k = 0; k < count; k++) block.x[k] += block.v[k] * step;
+        accelerations(block);
+        for (size_t k = 0; k < count; k++) block.v[k] += block.a[k] * half;
+        if ((s + 1) % check_interval == 0 || s + 1 == steps) {
+          check(block, first, (s + 1) * step, gone, escape_radius);
+        }
+      }
+
+      for (size_t l = 0; l < LANES && first + l < systems.size(); l++) {
+        Stats &stats = statistics[first + l];
+        double end_energy = energy(block, l);
+        stats.energy_error = start_energy[l] != 0 ? std::abs((end_energy - start_energy[l]) / start_energy[l])
+                                                  : std::abs(end_energy);
+        stats.closest = sqrt(block.closest2[l]);
+        stats.stable = stats.ejected == 0 && stats.energy_error < energy_tolerance;
+
+        System &system = systems[first + l];
+        for (size_t i = 0; i < n; i++) {
+          for (int c = 0; c < 3; c++) {
+            system.x[i][c] = block.x[(3 * i + c) * LANES + l];
+            system.v[i][c] = block.v[(3 * i + c) * LANES + l];
+          }
+        }
+      }
+    }
+  }, threads > 0 ? threads : Parallel::num_threads());
+  return steps;
+}
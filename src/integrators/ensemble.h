@@ -0,0 +1,91 @@
+#ifndef CLOTHSIM_ENSEMBLE_H
+#define CLOTHSIM_ENSEMBLE_H
+
+#include <cmath>
+#include <vector>
+
+#include "CGL/vector3D.h"
+
+using namespace CGL;
+
+/*
+  Many independent systems with the same number of bodies, integrated side
+  by side.
+
+  The systems are packed in blocks of LANES, with the lane (the system) as
+  the innermost index of every coordinate, so one SIMD register holds the
+  same coordinate of the same body in four systems. The force kernel and
+  the leapfrog updates then run one instruction for four systems, and the
+  blocks are spread over the cores with nothing shared between them. All
+  systems take the same fixed step, sized for the tightest orbit among
+  them, since lanes cannot branch apart.
+
+  Along the way every system tracks its energy error, the closest approach
+  of any two of its bodies, and the bodies it loses: a body is ejected once
+  it is unbound from its system's barycenter and escape_factor times
+  farther out than the farthest body started.
+*/
+class Ensemble {
+public:
+  // Systems in a block: two 4-wide registers per coordinate
+  static const size_t LANES = 8;
+
+  struct Stats {
+    // Relative energy change over the run
+    double energy_error = 0;
+    // Closest approach of any two bodies
+    double closest = INFINITY;
+    int ejected = 0;
+    // Time of the first ejection, negative if there was none
+    double first_ejection = -1;
+    // Kept its bodies and its energy to energy_tolerance
+    bool stable = false;
+  };
+
+  // Adds a system (internal units). Returns false, leaving the ensemble as
+  // it was, if its body count differs from the systems already added.
+  bool add(const std::vector<Vector3D> &x, const std::vector<Vector3D> &v, const std::vector<double> &m);
+  size_t size() const { return systems.size(); }
+  size_t bodies() const { return systems.empty() ? 0 : systems[0].m.size(); }
+
+  // Advances every system by duration (internal units), threads = 0 uses
+  // every core. Returns the number of steps taken.
+  long run(double duration, unsigned threads = 0);
+
+  // Statistics and final state of system k after run
+  const Stats &stats(size_t k) const { return statistics[k]; }
+  void state(size_t k, std::vector<Vector3D> &x, std::vector<Vector3D> &v) const;
+
+  // Shortest orbital period of any pair of bodies in a system
+  static double shortest_period(const std::vector<Vector3D> &x, const std::vector<double> &m);
+
+  int steps_per_orbit = 64;
+  double escape_factor = 10;
+  double energy_tolerance = 1e-4;
+  // Steps between ejection checks
+  int check_interval = 64;
+
+private:
+  struct System {
+    std::vector<Vector3D> x, v;
+    std::vector<double> m;
+  };
+  // One block of LANES systems, coordinate c of body i in lane l at
+  // (3 i + c) LANES + l and its mass at i LANES + l
+  struct Block {
+    std::vector<double> x, v, a, m;
+    // Squared closest approach per lane
+    double closest2[LANES];
+  };
+
+  void pack(size_t block, Block &out) const;
+  void accelerations(Block &block) const;
+  void check(const Block &block, size_t first, double time, std::vector<bool> &gone,
+             const std::vector<double> &escape_radius);
+  double energy(const Block &block, size_t lane) const;
+
+  std::vector<System> systems;
+  std::vector<Stats> statistics;
+};
+
+#endif // CLOTHSIM_ENSEMBLE_H
@@ -0,0 +1,312 @@
+#include "ias15.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../misc/parallel.h"
+
+// Below this many bodies the per-body loops stay on the calling thread
+#define IAS15_PARALLEL_MIN 256
+
+// A step may shrink the next one to no less than this fraction before it
+// is redone, and grows it by at most the inverse
+#define IAS15_SAFETY 0.25
+// Predictor-corrector passes per step, and the change that counts as
+// converged
+#define IAS15_MAX_ITERATIONS 12
+#define IAS15_CONVERGED 1e-16
+
+namespace {
+
+// Gauss-Radau nodes on [0, 1], the first one fixed at the step start
+const double nodes[8] = {
+  0.0,
+  0.0562625605369221464656521910318,
+  0.180240691736892364987579942780,
+  0.352624717113169637373907769648,
+  0.547153626330555383001448554766,
+  0.734210177215410531523210605558,
+  0.885320946839095768090359771030,
+  0.977520613561287501891174488626
+};
+
+/*
+  Conversions between the two forms of the acceleration polynomial: the
+  power basis b, a0 + sum_k b_k s^(k + 1), and the Newton form g,
+  a0 + sum_j g_j s (s - h_1) ... (s - h_j), whose coefficients are divided
+  differences of the substep accelerations. b_k = sum_j c[j][k] g_j and
+  g_j = sum_k d[j][k] b_k, both triangular.
+*/
+struct Coefficients {
+  double c[7][7], d[7][7];
+  // 1 / (h_n - h_(j + 1)) for the divided differences, 1 / h_n in [n][n - 1]
+  double inverse[8][7];
+  // Binomials (k + 1 choose m + 1) to shift the polynomial to the next step
+  double binomial[7][7];
+
+  Coefficients() {
+    long double poly[8] = { 0, 1 };  // s
+    long double C[7][7] = {};
+    for (int j = 0; j < 7; j++) {
+      if (j > 0) {
+        // Multiply by (s - h_j)
+        for (int p = j + 1; p >= 1; p--) poly[p] = poly[p - 1] - nodes[j] * poly[p];
+        poly[0] = 0;
+      }
+      for (int k = 0; k <= j; k++) C[k][j] = poly[k + 1];
+    }
+    // D = C^-1, unit upper triangular like C
+    long double D[7][7] = {};
+    for (int col = 0; col < 7; col++) {
+      for (int row = col; row >= 0; row--) {
+        long double v = row == col ? 1 : 0;
+        for (int k = row + 1; k <= col; k++) v -= C[row][k] * D[k][col];
+        D[row][col] = v;
+      }
+    }
+    for (int j = 0; j < 7; j++) {
+      for (int k = 0; k < 7; k++) {
+        c[j][k] = (double) C[k][j];
+        d[j][k] = (double) D[j][k];
+      }
+    }
+
+    for (int n = 1; n < 8; n++) {
+      for (int j = 0; j + 1 < n; j++) inverse[n][j] = 1.0 / (nodes[n] - nodes[j + 1]);
+      inverse[n][n - 1] = 1.0 / nodes[n];
+    }
+
+    for (int k = 0; k < 7; k++) {
+      for (int m = 0; m < 7; m++) {
+        double v = 0;
+        if (m <= k) {
+          v = 1;
+          for (int i = 0; i < m + 1; i++) v = v * (k + 1 - i) / (i + 1);
+        }
+        binomial[k][m] = v;
+      }
+    }
+  }
+};
+
+const Coefficients coefficients;
+
+// Kahan summation: value - residual stays the exact running sum
+inline void add_compensated(Vector3D &value, Vector3D &residual, const Vector3D &add) {
+  Vector3D y = add - residual;
+  Vector3D t = value + y;
+  residual = (t - value) - y;
+  value = t;
+}
+
+inline double max_component(const Vector3D &v) {
+  return std::max(std::abs(v.x), std::max(std::abs(v.y), std::abs(v.z)));
+}
+
+} // namespace
+
+IAS15::IAS15(double tolerance) : tolerance(tolerance) {}
+
+unsigned IAS15::thread_count() const {
+  if (x.size() < IAS15_PARALLEL_MIN) return 1;
+  return threads > 0 ? threads : Parallel::num_threads();
+}
+
+void IAS15::load(const std::vector<Vector3D> &positions, const std::vector<Vector3D> &velocities) {
+  const size_t n = positions.size();
+  x = out_x = positions;
+  v = out_v = velocities;
+  cs_x.assign(n, Vector3D());
+  cs_v.assign(n, Vector3D());
+  x0.resize(n);
+  v0.resize(n);
+  a0.resize(n);
+  x_sub.resize(n);
+  a_sub.resize(n);
+  for (int k = 0; k < 7; k++) {
+    b[k].assign(n, Vector3D());
+    g[k].assign(n, Vector3D());
+    e[k].assign(n, Vector3D());
+  }
+  time = out_time = 0;
+  dt = last_dt = 0;
+  has_prediction = false;
+  rejected = 0;
+}
+
+// Divisors of b_k in x(s) and v(s), which integrate the polynomial once and twice
+static const double position_divisor[7] = { 6, 12, 20, 30, 42, 56, 72 };
+static const double velocity_divisor[7] = { 2, 3, 4, 5, 6, 7, 8 };
+
+void IAS15::positions_at(double s) {
+  // x(s) = x0 + s dt v0 + (s dt)^2 (a0 / 2 + s b0 / 6 + s^2 b1 / 12 + ...)
+  const double sdt = s * dt;
+  Parallel::parallel_for(x.size(), [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      Vector3D p = b[6][i] / position_divisor[6];
+      for (int m = 5; m >= 0; m--) p = b[m][i] / position_divisor[m] + p * s;
+      p = a0[i] / 2 + p * s;
+      x_sub[i] = x0[i] - cs_x[i] + (v0[i] * sdt + p * (sdt * sdt));
+    }
+  }, thread_count());
+}
+
+bool IAS15::step(const Accelerations &accelerations) {
+  const size_t n = x.size();
+  const Coefficients &k = coefficients;
+  x0 = x;
+  v0 = v;
+  accelerations(x0, a0);
+
+  // Newton form of the predicted polynomial
+  Parallel::parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      for (int j = 0; j < 7; j++) {
+        Vector3D sum;
+        for (int m = j; m < 7; m++) sum += b[m][i] * k.d[j][m];
+        g[j][i] = sum;
+      }
+    }
+  }, thread_count());
+
+  // Predictor-corrector: refit the polynomial to the accelerations at the
+  // substeps until the last coefficient settles
+  double last_change = INFINITY;
+  double max_a = 0;
+  for (int iteration = 0; iteration < IAS15_MAX_ITERATIONS; iteration++) {
+    double max_change = 0;
+    for (int sub = 1; sub < 8; sub++) {
+      positions_at(nodes[sub]);
+      accelerations(x_sub, a_sub);
+
+      const int j = sub - 1;
+      std::vector<double> thread_change(thread_count(), 0.0);
+      Parallel::parallel_for(n, [&](size_t begin, size_t end, unsigned thread) {
+        for (size_t i = begin; i < end; i++) {
+          Vector3D G = (a_sub[i] - a0[i]) * k.inverse[sub][j];
+          for (int m = 0; m < j; m++) G = (G - g[m][i]) * k.inverse[sub][m];
+          Vector3D change = G - g[j][i];
+          g[j][i] = G;
+          for (int m = 0; m <= j; m++) b[m][i] += change * k.c[j][m];
+          thread_change[thread] = std::max(thread_change[thread], max_component(change));
+        }
+      }, thread_count());
+      if (sub == 7) max_change = *std::max_element(thread_change.begin(), thread_change.end());
+    }
+
+    max_a = 0;
+    for (size_t i = 0; i < n; i++) max_a = std::max(max_a, max_component(a_sub[i]));
+    double change = max_a > 0 ? max_change / max_a : 0;
+    // Converged, or rounding noise has stopped it from improving
+    if (change < IAS15_CONVERGED || (iteration > 1 && change >= last_change)) break;
+    last_change = change;
+  }
+
+  // Next step from the last coefficient, which bounds the truncation error
+  double max_b6 = 0;
+  for (size_t i = 0; i < n; i++) max_b6 = std::max(max_b6, max_component(b[6][i]));
+  double error = max_a > 0 ? max_b6 / max_a : 0;
+  double dt_new;
+  if (!std::isfinite(error)) {
+    dt_new = dt * IAS15_SAFETY * IAS15_SAFETY;
+  } else if (error > 0) {
+    dt_new = dt * pow(tolerance / error, 1.0 / 7);
+  } else {
+    dt_new = dt / IAS15_SAFETY;
+  }
+  dt_new = std::max(dt_new, min_step);
+
+  if (dt_new < IAS15_SAFETY * dt && dt > min_step) {
+    // Too long: redo it shorter, with the polynomial rescaled to the new
+    // step as the prediction
+    const double q = dt_new / dt;
+    for (int m = 0; m < 7; m++) {
+      double scale = pow(q, m + 1);
+      for (size_t i = 0; i < n; i++) b[m][i] *= scale;
+    }
+    x = x0;
+    v = v0;
+    dt = dt_new;
+    rejected++;
+    return false;
+  }
+  dt_new = std::min(dt_new, dt / IAS15_SAFETY);
+
+  // Keep the accepted step for dense output
+  last_x0 = x0;
+  last_v0 = v0;
+  last_a0 = a0;
+  for (int m = 0; m < 7; m++) last_b[m] = b[m];
+  last_dt = dt;
+
+  Parallel::parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      Vector3D dx = a0[i] / 2, dv = a0[i];
+      for (int m = 0; m < 7; m++) {
+        dx += b[m][i] / position_divisor[m];
+        dv += b[m][i] / velocity_divisor[m];
+      }
+      add_compensated(x[i], cs_x[i], v0[i] * dt + dx * (dt * dt));
+      add_compensated(v[i], cs_v[i], dv * dt);
+    }
+  }, thread_count());
+  time += dt;
+
+  // Predict the next polynomial by continuing this one past the step end,
+  // corrected by how far this step's prediction was off
+  const double q = dt_new / dt;
+  Parallel::parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      for (int m = 0; m < 7; m++) {
+        Vector3D predicted;
+        for (int j = m; j < 7; j++) predicted += b[j][i] * k.binomial[j][m];
+        predicted *= pow(q, m + 1);
+        Vector3D correction = has_prediction ? b[m][i] - e[m][i] : Vector3D();
+        e[m][i] = predicted;
+        b[m][i] = predicted + correction;
+      }
+    }
+  }, thread_count());
+  has_prediction = true;
+  dt = dt_new;
+  return true;
+}
+
+void IAS15::dense_output(double s) {
+  const double sdt = s * last_dt;
+  Parallel::parallel_for(x.size(), [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      Vector3D p = last_b[6][i] / position_divisor[6], q = last_b[6][i] / velocity_divisor[6];
+      for (int m = 5; m >= 0; m--) {
+        p = last_b[m][i] / position_divisor[m] + p * s;
+        q = last_b[m][i] / velocity_divisor[m] + q * s;
+      }
+      p = last_a0[i] / 2 + p * s;
+      q = last_a0[i] + q * s;
+      out_x[i] = last_x0[i] + last_v0[i] * sdt + p * (sdt * sdt);
+      out_v[i] = last_v0[i] + q * sdt;
+    }
+  }, thread_count());
+}
+
+int IAS15::integrate(double duration, const Accelerations &accelerations) {
+  if (x.empty() || duration <= 0) return 0;
+  const double target = out_time + duration;
+  if (dt <= 0) dt = duration;
+
+  int steps = 0;
+  while (time < target) {
+    if (step(accelerations)) steps++;
+  }
+
+  // The state at the target, from the step that covers it
+  double s = (target - (time - last_dt)) / last_dt;
+  if (s >= 1) {
+    out_x = x;
+    out_v = v;
+  } else {
+    dense_output(std::max(s, 0.0));
+  }
+  out_time = target;
+  return steps;
+}
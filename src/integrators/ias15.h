@@ -0,0 +1,88 @@
+#ifndef CLOTHSIM_IAS15_H
+#define CLOTHSIM_IAS15_H
+
+#include <functional>
+#include <vector>
+
+#include "CGL/vector3D.h"
+
+using namespace CGL;
+
+/*
+  Adaptive 15th order Gauss-Radau integrator (IAS15, Rein & Spiegel 2015).
+
+  Every step fits the acceleration over the step with a 7th degree
+  polynomial through the Gauss-Radau nodes, iterating the predictor-
+  corrector until the fit stops changing. The size of the highest order
+  coefficient relative to the accelerations then sets the next step, so
+  that its error stays below `tolerance`: quiet stretches take long steps
+  and close encounters take as many short ones as they need. At the
+  default tolerance the error per step sits at the level of double
+  rounding, which compensated summation keeps from piling up.
+
+  The integrator owns the state between calls. integrate() steps past the
+  requested time and reports the state there from the polynomial of the
+  step covering it, so asking for small intervals does not cut the steps
+  short.
+*/
+class IAS15 {
+public:
+  // Fills accelerations for the given positions (forces may not depend on
+  // velocity)
+  typedef std::function<void(const std::vector<Vector3D> &positions,
+                             std::vector<Vector3D> &accelerations)> Accelerations;
+
+  IAS15(double tolerance = 1e-9);
+
+  // Starts over from this state with no step size history
+  void load(const std::vector<Vector3D> &positions, const std::vector<Vector3D> &velocities);
+  size_t size() const { return x.size(); }
+
+  // Advances the reported state by duration (internal time units) and
+  // returns the number of steps that took
+  int integrate(double duration, const Accelerations &accelerations);
+
+  // State at the time reached by integrate
+  const std::vector<Vector3D> &positions() const { return out_x; }
+  const std::vector<Vector3D> &velocities() const { return out_v; }
+
+  // Size of the next step
+  double step_size() const { return dt; }
+  int steps_rejected() const { return rejected; }
+
+  double tolerance;
+  // Steps never get shorter than this, so a collision cannot stall it
+  double min_step = 1e-14;
+  // Threads for the per-body loops, 0 for every core; small systems always
+  // use one
+  unsigned threads = 0;
+
+private:
+  bool step(const Accelerations &accelerations);
+  void dense_output(double s);
+  // Fills x_sub with the positions at fraction s of the step
+  void positions_at(double s);
+  unsigned thread_count() const;
+
+  // Step start state and the fitted polynomial of the acceleration,
+  // a(s) = a0 + sum_k b[k] s^(k + 1) for s in [0, 1] across the step
+  std::vector<Vector3D> x0, v0, a0;
+  std::vector<Vector3D> b[7], g[7], e[7];
+  // Current state, with the compensated summation residuals
+  std::vector<Vector3D> x, v, cs_x, cs_v;
+  // Scratch for the substeps
+  std::vector<Vector3D> x_sub, a_sub;
+
+  // Reported state, and a copy of the last step for dense output
+  std::vector<Vector3D> out_x, out_v;
+  std::vector<Vector3D> last_x0, last_v0, last_a0, last_b[7];
+  double last_dt = 0;
+
+  // Time of x and v, time of the reported state, both since load
+  double time = 0, out_time = 0;
+  double dt = 0;
+  bool has_prediction = false;
+  int rejected = 0;
+};
+
+#endif // CLOTHSIM_IAS15_H
@@ -0,0 +1,374 @@
+#include "ksRegularization.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "stumpff.h"
+#include "../units.h"
+
+// Tidal perturbations below this fraction of gamma_on are not followed
+#define KS_PERTURBER_CUTOFF 1e-6
+// Iterations allowed to hit the end time of an interval exactly
+#define KS_MAX_ITERATIONS 60
+
+namespace {
+
+// x = L(u) u, the first three components
+Vector3D ks_position(const double *u) {
+  return Vector3D(u[0] * u[0] - u[1] * u[1] - u[2] * u[2] + u[3] * u[3],
+                  2 * (u[0] * u[1] - u[2] * u[3]),
+                  2 * (u[0] * u[2] + u[1] * u[3]));
+}
+
+// dx/dt = 2 L(u) u' / r
+Vector3D ks_velocity(const double *u, const double *du) {
+  double r = u[0] * u[0] + u[1] * u[1] + u[2] * u[2] + u[3] * u[3];
+  Vector3D l(u[0] * du[0] - u[1] * du[1] - u[2] * du[2] + u[3] * du[3],
+             u[1] * du[0] + u[0] * du[1] - u[3] * du[2] - u[2] * du[3],
+             u[2] * du[0] + u[3] * du[1] + u[0] * du[2] + u[1] * du[3]);
+  return l * (2 / r);
+}
+
+// L(u)^T applied to (a, 0)
+void ks_transpose(const double *u, const Vector3D &a, double *out) {
+  out[0] = u[0] * a.x + u[1] * a.y + u[2] * a.z;
+  out[1] = -u[1] * a.x + u[0] * a.y + u[3] * a.z;
+  out[2] = -u[2] * a.x - u[3] * a.y + u[0] * a.z;
+  out[3] = u[3] * a.x - u[2] * a.y + u[1] * a.z;
+}
+
+// u and u' for relative position x and velocity v, taking the branch
+// that avoids dividing by a small number
+void to_ks(const Vector3D &x, const Vector3D &v, double *u, double *du) {
+  double r = x.norm();
+  if (x.x >= 0) {
+    u[0] = sqrt((r + x.x) / 2);
+    u[1] = x.y / (2 * u[0]);
+    u[2] = x.z / (2 * u[0]);
+    u[3] = 0;
+  } else {
+    u[1] = sqrt((r - x.x) / 2);
+    u[0] = x.y / (2 * u[1]);
+    u[2] = 0;
+    u[3] = x.z / (2 * u[1]);
+  }
+  ks_transpose(u, v, du);
+  for (int k = 0; k < 4; k++) du[k] /= 2;
+}
+
+double dot4(const double *a, const double *b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+}
+
+/*
+  The unperturbed oscillator u'' = (h / 2) u over dtau, with c0 and c1
+  giving cos and sin (or cosh and sinh) for either sign of h. Returns the
+  physical time it took, t = integral of |u|^2 dtau.
+*/
+double oscillate(const double *u, const double *du, double h, double dtau,
+                 double *u_out, double *du_out) {
+  const double omega2 = -h / 2;
+  double c0, c1, c2, c3;
+  stumpff(omega2 * dtau * dtau, c0, c1, c2, c3);
+  const double C = c0, S = dtau * c1;
+  if (u_out != nullptr) {
+    for (int k = 0; k < 4; k++) {
+      u_out[k] = u[k] * C + du[k] * S;
+      du_out[k] = -omega2 * u[k] * S + du[k] * C;
+    }
+  }
+  // integral C^2 = (tau + C S) / 2, integral C S = S^2 / 2 and
+  // integral S^2 = 2 tau^3 c3(4 z)
+  double d0, d1, d2, d3;
+  stumpff(4 * omega2 * dtau * dtau, d0, d1, d2, d3);
+  return dot4(u, u) * (dtau + C * S) / 2 + dot4(u, du) * S * S + dot4(du, du) * 2 * dtau * dtau * dtau * d3;
+}
+
+// The fictitious time the oscillator takes to cover physical time t,
+// bracketed Newton on the increasing t(tau)
+double solve_time(const double *u, const double *du, double h, double t) {
+  double u_tau[4], du_tau[4];
+  double lo = 0, hi = t / dot4(u, u);
+  while (oscillate(u, du, h, hi, nullptr, nullptr) < t) {
+    lo = hi;
+    hi *= 2;
+  }
+  double tau = (lo + hi) / 2;
+  for (int iteration = 0; iteration < KS_MAX_ITERATIONS; iteration++) {
+    double f = oscillate(u, du, h, tau, u_tau, du_tau) - t;
+    if (f > 0) hi = tau; else lo = tau;
+    double next = tau - f / dot4(u_tau, u_tau);
+    // Bisect whenever Newton leaves the bracket
+    if (!(next > lo && next < hi)) next = (lo + hi) / 2;
+    if (std::abs(next - tau) <= 1e-15 * tau) return next;
+    tau = next;
+  }
+  return tau;
+}
+
+// Cubic Hermite interpolation between the two ends of an interval
+Vector3D hermite(const Vector3D &x0, const Vector3D &v0, const Vector3D &x1, const Vector3D &v1,
+                 double dt, double s) {
+  double s2 = s * s, s3 = s2 * s;
+  return x0 * (2 * s3 - 3 * s2 + 1) + v0 * (dt * (s3 - 2 * s2 + s)) + x1 * (3 * s2 - 2 * s3) +
+         v1 * (dt * (s3 - s2));
+}
+
+} // namespace
+
+double KSRegularization::perturbation(size_t i, size_t j, const std::vector<Vector3D> &x,
+                                      const std::vector<Vector3D> &v, const std::vector<double> &m,
+                                      size_t candidates, bool &bound) const {
+  const double mass = m[i] + m[j];
+  const double mu = Units::G * mass;
+  Vector3D dx = x[i] - x[j], dv = v[i] - v[j];
+  double r = dx.norm();
+  double h = dv.norm2() / 2 - mu / r;
+  bound = h < 0 && r > 0;
+  if (!bound) return INFINITY;
+
+  // Tides of the other candidates across the largest separation the orbit
+  // can reach, 2a, relative to the pair's own pull there
+  double apocenter = -mu / h;
+  Vector3D center = (x[i] * m[i] + x[j] * m[j]) / mass;
+  double gamma = 0;
+  for (size_t k = 0; k < candidates; k++) {
+    if (k == i || k == j) continue;
+    double d = (x[k] - center).norm();
+    gamma += 2 * m[k] / mass * pow(apocenter / d, 3);
+  }
+  return gamma;
+}
+
+bool KSRegularization::select(const std::vector<Vector3D> &x, const std::vector<Vector3D> &v,
+                              const std::vector<double> &m, size_t candidates) {
+  bool changed = false;
+  candidates = std::min(candidates, x.size());
+  if (x.size() != full_size) {
+    // Bodies came or went, the indices mean nothing now
+    changed = !pairs.empty();
+    pairs.clear();
+  }
+
+  std::vector<bool> paired(candidates, false);
+  std::vector<Pair> kept;
+  for (const Pair &pair : pairs) {
+    bool bound;
+    double gamma = perturbation(pair.i, pair.j, x, v, m, candidates, bound);
+    if (bound && gamma < gamma_off) {
+      kept.push_back(pair);
+      paired[pair.i] = paired[pair.j] = true;
+    } else {
+      changed = true;
+    }
+  }
+
+  // New pairs from mutual nearest neighbours
+  std::vector<size_t> nearest(candidates, candidates);
+  for (size_t i = 0; i < candidates; i++) {
+    if (paired[i]) continue;
+    double best = INFINITY;
+    for (size_t j = 0; j < candidates; j++) {
+      if (j == i || paired[j]) continue;
+      double d2 = (x[j] - x[i]).norm2();
+      if (d2 < best) {
+        best = d2;
+        nearest[i] = j;
+      }
+    }
+  }
+  for (size_t i = 0; i < candidates; i++) {
+    size_t j = nearest[i];
+    if (j == candidates || j < i || nearest[j] != i || m[i] + m[j] <= 0) continue;
+    bool bound;
+    if (perturbation(i, j, x, v, m, candidates, bound) < gamma_on && bound) {
+      Pair pair;
+      pair.i = i;
+      pair.j = j;
+      kept.push_back(pair);
+      changed = true;
+    }
+  }
+
+  pairs = kept;
+  full_size = x.size();
+  return changed;
+}
+
+void KSRegularization::reduce(const std::vector<Vector3D> &x, const std::vector<Vector3D> &v,
+                              const std::vector<double> &m, std::vector<Vector3D> &reduced_x,
+                              std::vector<Vector3D> &reduced_v, std::vector<double> &reduced_m) {
+  const size_t n = x.size();
+  full_size = n;
+  std::vector<bool> second(n, false);
+  for (const Pair &pair : pairs) second[pair.j] = true;
+
+  reduced_x.clear();
+  reduced_v.clear();
+  reduced_m.clear();
+  reduced_of.assign(n, 0);
+  for (size_t b = 0; b < n; b++) {
+    if (second[b]) continue;
+    reduced_of[b] = reduced_x.size();
+    reduced_x.push_back(x[b]);
+    reduced_v.push_back(v[b]);
+    reduced_m.push_back(m[b]);
+  }
+
+  for (Pair &pair : pairs) {
+    size_t r = reduced_of[pair.i];
+    reduced_of[pair.j] = r;
+    pair.m_i = m[pair.i];
+    pair.m_j = m[pair.j];
+    double mass = pair.m_i + pair.m_j;
+    reduced_x[r] = (x[pair.i] * pair.m_i + x[pair.j] * pair.m_j) / mass;
+    reduced_v[r] = (v[pair.i] * pair.m_i + v[pair.j] * pair.m_j) / mass;
+    reduced_m[r] = mass;
+
+    Vector3D dx = x[pair.i] - x[pair.j];
+    to_ks(dx, v[pair.i] - v[pair.j], pair.u, pair.du);
+    pair.h = (2 * dot4(pair.du, pair.du) - Units::G * mass) / dx.norm();
+    update_quadrupole(pair);
+  }
+}
+
+void KSRegularization::update_quadrupole(Pair &pair) const {
+  const double mass = pair.m_i + pair.m_j;
+  const double reduced_mass = pair.m_i * pair.m_j / mass;
+  Vector3D x = ks_position(pair.u), v = ks_velocity(pair.u, pair.du);
+  Matrix3x3 moment;
+  if (pair.h < 0) {
+    // <x x^T> over a Kepler orbit: a^2 (1 + 4 e^2) / 2 along the
+    // eccentricity vector and a^2 (1 - e^2) / 2 across it in the plane
+    const double mu = Units::G * mass;
+    const double a = -mu / (2 * pair.h);
+    Vector3D normal = cross(x, v);
+    Vector3D eccentricity = cross(v, normal) / mu - x / x.norm();
+    double e = eccentricity.norm();
+    Vector3D along = e > 1e-12 ? eccentricity / e : x.unit();
+    Vector3D across = cross(normal.unit(), along);
+    moment = outer(along, along) * (a * a * (1 + 4 * e * e) / 2);
+    moment += outer(across, across) * (a * a * (1 - e * e) / 2);
+  } else {
+    moment = outer(x, x);
+  }
+  moment = moment * reduced_mass;
+  double trace = moment(0, 0) + moment(1, 1) + moment(2, 2);
+  pair.quadrupole = moment * 3 - Matrix3x3::identity() * trace;
+}
+
+void KSRegularization::add_quadrupoles(const std::vector<Vector3D> &reduced_x,
+                                       const std::vector<double> &reduced_m,
+                                       std::vector<Vector3D> &a) const {
+  for (const Pair &pair : pairs) {
+    const size_t self = reduced_of[pair.i];
+    // a = G (Q R / R^5 - 5 (R . Q R) R / (2 R^7)) from the potential
+    // -G R^T Q R / (2 R^5)
+    Vector3D reaction;
+    for (size_t k = 0; k < reduced_x.size(); k++) {
+      if (k == self) continue;
+      Vector3D R = reduced_x[k] - reduced_x[self];
+      double R2 = R.norm2();
+      double R5 = R2 * R2 * sqrt(R2);
+      Vector3D QR = pair.quadrupole * R;
+      Vector3D ak = (QR - R * (2.5 * dot(R, QR) / R2)) * (Units::G / R5);
+      a[k] += ak;
+      reaction -= ak * reduced_m[k];
+    }
+    a[self] += reaction / reduced_m[self];
+  }
+}
+
+void KSRegularization::step(Pair &pair, double dtau, double &t, double dt,
+                            const std::vector<Vector3D> &start_x, const std::vector<Vector3D> &start_v,
+                            const std::vector<Vector3D> &end_x, const std::vector<Vector3D> &end_v,
+                            const std::vector<double> &reduced_m) {
+  const size_t self = reduced_of[pair.i];
+  const double mass = pair.m_i + pair.m_j;
+
+  // Tidal kick on u' and h, u' += (r / 2) L^T P tau and h' = 2 u' . L^T P
+  auto kick = [&](double tau) {
+    double s = dt > 0 ? std::min(t / dt, 1.0) : 0;
+    Vector3D center = hermite(start_x[self], start_v[self], end_x[self], end_v[self], dt, s);
+    Vector3D rel = ks_position(pair.u);
+    Vector3D x_i = center + rel * (pair.m_j / mass), x_j = center - rel * (pair.m_i / mass);
+    Vector3D p;
+    for (size_t k : pair.perturbers) {
+      Vector3D xk = hermite(start_x[k], start_v[k], end_x[k], end_v[k], dt, s);
+      Vector3D di = xk - x_i, dj = xk - x_j;
+      double ri = di.norm(), rj = dj.norm();
+      p += (di / (ri * ri * ri) - dj / (rj * rj * rj)) * (Units::G * reduced_m[k]);
+    }
+    double q[4];
+    ks_transpose(pair.u, p, q);
+    double r = dot4(pair.u, pair.u);
+    double before[4] = { pair.du[0], pair.du[1], pair.du[2], pair.du[3] };
+    for (int k = 0; k < 4; k++) pair.du[k] += r / 2 * q[k] * tau;
+    double mid[4];
+    for (int k = 0; k < 4; k++) mid[k] = before[k] + pair.du[k];
+    pair.h += dot4(q, mid) * tau;
+  };
+
+  // Shorten the last step to land on dt
+  const double remaining = dt - t;
+  if (oscillate(pair.u, pair.du, pair.h, dtau, nullptr, nullptr) >= remaining) {
+    dtau = solve_time(pair.u, pair.du, pair.h, remaining);
+  }
+  kick(dtau / 2);
+  double u[4], du[4];
+  double taken = oscillate(pair.u, pair.du, pair.h, dtau, u, du);
+  if (t + taken > dt) {
+    // The kick moved the end past dt, hit it exactly
+    dtau = solve_time(pair.u, pair.du, pair.h, remaining);
+    taken = oscillate(pair.u, pair.du, pair.h, dtau, u, du);
+    t = dt;
+  } else {
+    t += taken;
+  }
+  std::copy(u, u + 4, pair.u);
+  std::copy(du, du + 4, pair.du);
+  kick(dtau / 2);
+}
+
+void KSRegularization::advance(double dt, const std::vector<Vector3D> &start_x,
+                               const std::vector<Vector3D> &start_v, const std::vector<Vector3D> &end_x,
+                               const std::vector<Vector3D> &end_v, const std::vector<double> &reduced_m,
+                               std::vector<Vector3D> &x, std::vector<Vector3D> &v) {
+  x.resize(full_size);
+  v.resize(full_size);
+  for (size_t b = 0; b < full_size; b++) {
+    x[b] = end_x[reduced_of[b]];
+    v[b] = end_v[reduced_of[b]];
+  }
+
+  for (Pair &pair : pairs) {
+    const size_t self = reduced_of[pair.i];
+    const double mass = pair.m_i + pair.m_j;
+    const double mu = Units::G * mass;
+
+    // Only bodies whose tides can matter over this interval
+    double apocenter = pair.h < 0 ? -mu / pair.h : ks_position(pair.u).norm();
+    pair.perturbers.clear();
+    for (size_t k = 0; k < start_x.size(); k++) {
+      if (k == self) continue;
+      double d = (start_x[k] - start_x[self]).norm();
+      if (2 * reduced_m[k] / mass * pow(apocenter / d, 3) > KS_PERTURBER_CUTOFF * gamma_on) {
+        pair.perturbers.push_back(k);
+      }
+    }
+
+    // A fixed number of oscillator steps per orbit, half an oscillation
+    // of u being one orbit; unbound pairs step by their current radius
+    double dtau = pair.h < 0 ? PI / (sqrt(-pair.h / 2) * steps_per_orbit)
+                             : dt / dot4(pair.u, pair.u) / steps_per_orbit;
+    double t = 0;
+    while (dt - t > 1e-15 * dt) step(pair, dtau, t, dt, start_x, start_v, end_x, end_v, reduced_m);
+
+    Vector3D rel = ks_position(pair.u), rel_v = ks_velocity(pair.u, pair.du);
+    x[pair.i] = end_x[self] + rel * (pair.m_j / mass);
+    x[pair.j] = end_x[self] - rel * (pair.m_i / mass);
+    v[pair.i] = end_v[self] + rel_v * (pair.m_j / mass);
+    v[pair.j] = end_v[self] - rel_v * (pair.m_i / mass);
+    update_quadrupole(pair);
+  }
+}
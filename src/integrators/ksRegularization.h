@@ -0,0 +1,103 @@
+#ifndef CLOTHSIM_KS_REGULARIZATION_H
+#define CLOTHSIM_KS_REGULARIZATION_H
+
+#include <vector>
+
+#include "CGL/matrix3x3.h"
+#include "CGL/vector3D.h"
+
+using namespace CGL;
+
+/*
+  Kustaanheimo-Stiefel regularization of tight bound pairs.
+
+  A pair whose orbit is small next to its distance from everything else is
+  taken out of the global integration: the integrator only sees its center
+  of mass with the summed mass, and can keep the long steps the rest of the
+  system allows. The relative orbit is carried in KS variables, a 4-vector
+  u with x = L(u) u and the fictitious time dtau = dt / r. There the
+  unperturbed Kepler motion is a harmonic oscillator, u'' = (h / 2) u, for
+  the binding energy h, with no singularity at r = 0 and the same cost for
+  every eccentricity. Each step moves the oscillator exactly and kicks u'
+  and h with the tidal pull of the other bodies, taken along their paths
+  across the interval (cubic Hermite between its two ends).
+
+  Seen from outside, a pair is its center of mass plus the quadrupole of
+  its orbit averaged over a revolution, which add_quadrupoles puts into
+  the reduced system's accelerations; without it distant bodies would
+  precess as if the pair were a point.
+
+  Pairs are mutual nearest neighbours among the candidate bodies. They are
+  regularized while bound with a relative tidal perturbation below
+  gamma_on and released once it passes gamma_off or they come unbound.
+*/
+class KSRegularization {
+public:
+  // Re-picks the pairs for a full state (positions, velocities and masses
+  // of every body, the first `candidates` of them allowed to pair). Pairs
+  // that still qualify are kept. Returns true if the set of pairs changed.
+  bool select(const std::vector<Vector3D> &x, const std::vector<Vector3D> &v,
+              const std::vector<double> &m, size_t candidates);
+
+  // Starts the pairs from a full state and fills the reduced system the
+  // integrator should carry, with every pair as one body at its center of
+  // mass
+  void reduce(const std::vector<Vector3D> &x, const std::vector<Vector3D> &v,
+              const std::vector<double> &m, std::vector<Vector3D> &reduced_x,
+              std::vector<Vector3D> &reduced_v, std::vector<double> &reduced_m);
+
+  // Advances the pairs by dt (internal units) while the reduced system went
+  // from start to end, then writes the full state at the end
+  void advance(double dt, const std::vector<Vector3D> &start_x, const std::vector<Vector3D> &start_v,
+               const std::vector<Vector3D> &end_x, const std::vector<Vector3D> &end_v,
+               const std::vector<double> &reduced_m, std::vector<Vector3D> &x,
+               std::vector<Vector3D> &v);
+
+  // Adds the pairs' orbit-averaged quadrupoles to the accelerations of
+  // the reduced system, with the reaction on each pair
+  void add_quadrupoles(const std::vector<Vector3D> &reduced_x, const std::vector<double> &reduced_m,
+                       std::vector<Vector3D> &a) const;
+
+  size_t size() const { return pairs.size(); }
+
+  // Perturbation, relative to the pair's own pull, below which a pair is
+  // regularized and above which it is released
+  double gamma_on = 1e-4;
+  double gamma_off = 1e-3;
+  // Oscillator steps per orbit of a pair
+  int steps_per_orbit = 32;
+
+private:
+  struct Pair {
+    // Bodies i (the reduced body) and j, with x = x_i - x_j
+    size_t i, j;
+    double m_i, m_j;
+    // KS coordinates, their fictitious time derivative and the binding
+    // energy per unit reduced mass
+    double u[4], du[4];
+    double h;
+    // Traceless quadrupole 3 I - tr(I) of the orbit-averaged second
+    // moment I about the center of mass
+    Matrix3x3 quadrupole;
+    // Bodies whose tides are worth following this interval
+    std::vector<size_t> perturbers;
+  };
+
+  // Relative orbit of i about j: whether it is bound and the tidal
+  // perturbation of the other candidates on it
+  double perturbation(size_t i, size_t j, const std::vector<Vector3D> &x,
+                      const std::vector<Vector3D> &v, const std::vector<double> &m,
+                      size_t candidates, bool &bound) const;
+  void update_quadrupole(Pair &pair) const;
+  void step(Pair &pair, double dtau, double &t, double dt, const std::vector<Vector3D> &start_x,
+            const std::vector<Vector3D> &start_v, const std::vector<Vector3D> &end_x,
+            const std::vector<Vector3D> &end_v, const std::vector<double> &reduced_m);
+
+  std::vector<Pair> pairs;
+  // Reduced index of every body, and the reduced index of each pair
+  std::vector<size_t> reduced_of;
+  // Full size of the last reduced state
+  size_t full_size = 0;
+};
+
+#endif // CLOTHSIM_KS_REGULARIZATION_H
@@ -0,0 +1,254 @@
+#include "parareal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "ias15.h"
+#include "stumpff.h"
+#include "../misc/parallel.h"
+#include "../units.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+Parareal::Parareal(int slices, double tolerance)
+    : slices(slices > 0 ? slices : (int) Parallel::num_threads()), tolerance(tolerance) {}
+
+double Parareal::shortest_period(const State &state) const {
+  double shortest = INFINITY;
+  for (size_t i = 0; i < state.x.size(); i++) {
+    for (size_t j = i + 1; j < state.x.size(); j++) {
+      double r = (state.x[j] - state.x[i]).norm();
+      double m = masses[i] + masses[j];
+      if (r > 0 && m > 0) shortest = std::min(shortest, 2 * PI * sqrt(r * r * r / (Units::G * m)));
+    }
+  }
+  return shortest;
+}
+
+namespace {
+
+// Moves a body along its two-body orbit around mu = G M for dt, in
+// universal variables so any eccentricity works
+void kepler_drift(Vector3D &x, Vector3D &v, double mu, double dt) {
+  const double r0 = x.norm();
+  if (r0 == 0 || mu <= 0) {
+    x += v * dt;
+    return;
+  }
+  const double sqrt_mu = sqrt(mu);
+  const double sigma = dot(x, v) / sqrt_mu;
+  const double alpha = 2 / r0 - v.norm2() / mu;
+
+  // Laguerre-Conway iteration on the universal anomaly chi
+  double chi = alpha > 0 ? sqrt_mu * dt * alpha : sqrt_mu * dt / r0;
+  double c0, c1, c2, c3, r = r0;
+  for (int iteration = 0; iteration < 50; iteration++) {
+    double z = alpha * chi * chi;
+    stumpff(z, c0, c1, c2, c3);
+    double chi2 = chi * chi;
+    double f = r0 * chi + sigma * chi2 * c2 + (1 - alpha * r0) * chi2 * chi * c3 - sqrt_mu * dt;
+    r = r0 + sigma * chi * (1 - z * c3) + (1 - alpha * r0) * chi2 * c2;
+    double f2 = sigma * (1 - z * c2) + (1 - alpha * r0) * chi * (1 - z * c3);
+    const double n = 5;
+    double root = sqrt(std::abs((n - 1) * (n - 1) * r * r - n * (n - 1) * f * f2));
+    double delta = n * f / (r + (r >= 0 ? root : -root));
+    chi -= delta;
+    if (std::abs(delta) <= 1e-14 * std::max(std::abs(chi), 1e-300)) break;
+  }
+  double z = alpha * chi * chi;
+  stumpff(z, c0, c1, c2, c3);
+  double chi2 = chi * chi;
+  r = r0 + sigma * chi * (1 - z * c3) + (1 - alpha * r0) * chi2 * c2;
+
+  // Lagrange coefficients
+  double f = 1 - chi2 / r0 * c2;
+  double g = dt - chi2 * chi / sqrt_mu * c3;
+  double f_dot = sqrt_mu / (r * r0) * chi * (z * c3 - 1);
+  double g_dot = 1 - chi2 / r * c2;
+  Vector3D x0 = x;
+  x = x0 * f + v * g;
+  v = x0 * f_dot + v * g_dot;
+}
+
+} // namespace
+
+void Parareal::coarse(const State &in, double duration, State &out) {
+  /*
+    Wisdom-Holman map in democratic heliocentric coordinates (Duncan,
+    Levison & Lee 1998): positions relative to the heaviest body and
+    barycentric velocities. Every body then moves exactly on its Kepler
+    orbit around that body, and only the much smaller pulls between the
+    others and the motion of the center are stepped, so steps of a good
+    fraction of an orbit keep the phases right where a plain leapfrog
+    would drift.
+  */
+  const size_t n = in.x.size();
+  const int steps = std::max(1, (int) ceil(duration / coarse_step));
+  const double dt = duration / steps;
+
+  const size_t c = center;
+  double total = 0;
+  Vector3D x_cm, v_cm;
+  for (size_t i = 0; i < n; i++) {
+    total += masses[i];
+    x_cm += in.x[i] * masses[i];
+    v_cm += in.v[i] * masses[i];
+  }
+  x_cm /= total;
+  v_cm /= total;
+
+  // Everything but the center, in the split coordinates
+  coarse_x.clear();
+  coarse_v.clear();
+  for (size_t i = 0; i < n; i++) {
+    if (i == c) continue;
+    coarse_x.push_back(in.x[i] - in.x[c]);
+    coarse_v.push_back(in.v[i] - v_cm);
+  }
+  const size_t m = coarse_x.size();
+  const double mu = Units::G * masses[c];
+
+  auto kick = [&](double h) {
+    coarse_gravity.accelerations(coarse_x, others, coarse_a);
+    for (size_t i = 0; i < m; i++) coarse_v[i] += coarse_a[i] * h;
+  };
+  auto center_drift = [&](double h) {
+    Vector3D momentum;
+    for (size_t i = 0; i < m; i++) momentum += coarse_v[i] * others[i];
+    Vector3D shift = momentum * (h / masses[c]);
+    for (size_t i = 0; i < m; i++) coarse_x[i] += shift;
+  };
+  for (int s = 0; s < steps; s++) {
+    kick(dt / 2);
+    center_drift(dt / 2);
+    for (size_t i = 0; i < m; i++) kepler_drift(coarse_x[i], coarse_v[i], mu, dt);
+    center_drift(dt / 2);
+    kick(dt / 2);
+  }
+
+  // Back to barycentric positions and velocities, the barycenter drifting
+  x_cm += v_cm * duration;
+  Vector3D offset, momentum;
+  for (size_t i = 0; i < m; i++) {
+    offset += coarse_x[i] * others[i];
+    momentum += coarse_v[i] * others[i];
+  }
+  out.x.resize(n);
+  out.v.resize(n);
+  out.x[c] = x_cm - offset / total;
+  out.v[c] = v_cm - momentum / masses[c];
+  for (size_t i = 0, j = 0; i < n; i++) {
+    if (i == c) continue;
+    out.x[i] = out.x[c] + coarse_x[j];
+    out.v[i] = v_cm + coarse_v[j];
+    j++;
+  }
+}
+
+void Parareal::fine(const State &in, double duration, State &out) const {
+  // Runs alongside the other slices, so everything here is its own
+  IAS15 integrator(fine_tolerance);
+  integrator.threads = 1;
+  DirectSum gravity(1);
+  integrator.load(in.x, in.v);
+  integrator.integrate(duration, [&](const std::vector<Vector3D> &x, std::vector<Vector3D> &a) {
+    gravity.accelerations(x, masses, a);
+  });
+  out.x = integrator.positions();
+  out.v = integrator.velocities();
+}
+
+double Parareal::relative_change(const State &a, const State &b) const {
+  double x_scale = 0, v_scale = 0, dx = 0, dv = 0;
+  for (size_t i = 0; i < a.x.size(); i++) {
+    x_scale = std::max(x_scale, a.x[i].norm());
+    v_scale = std::max(v_scale, a.v[i].norm());
+    dx = std::max(dx, (a.x[i] - b.x[i]).norm());
+    dv = std::max(dv, (a.v[i] - b.v[i]).norm());
+  }
+  return std::max(x_scale > 0 ? dx / x_scale : dx, v_scale > 0 ? dv / v_scale : dv);
+}
+
+Parareal::Report Parareal::run(Galaxy &galaxy, double seconds) {
+  Report report;
+  Clock::time_point start = Clock::now();
+  const int num_slices = std::max(slices, 1);
+  const double slice = Units::time_from_si(seconds) / num_slices;
+  const int iterations = max_iterations > 0 ? std::min(max_iterations, num_slices) : num_slices;
+
+  // Boundary states, and the coarse and fine ends of every slice as of the
+  // last iteration
+  std::vector<State> boundary(num_slices + 1), coarse_end(num_slices), fine_end(num_slices);
+  galaxy.getState(boundary[0].x, boundary[0].v, masses);
+  if (boundary[0].x.empty() || slice <= 0) return report;
+  coarse_step = shortest_period(boundary[0]) / coarse_steps_per_orbit;
+  center = std::max_element(masses.begin(), masses.end()) - masses.begin();
+  others.clear();
+  for (size_t i = 0; i < masses.size(); i++) {
+    if (i != center) others.push_back(masses[i]);
+  }
+
+  Clock::time_point phase = Clock::now();
+  for (int n = 0; n < num_slices; n++) {
+    coarse(boundary[n], slice, coarse_end[n]);
+    boundary[n + 1] = coarse_end[n];
+  }
+  report.coarse_seconds += seconds_since(phase);
+
+  State corrected, predicted;
+  std::vector<double> slice_seconds(num_slices);
+  // Slices before first start from boundaries that have settled, so their
+  // fine runs are final
+  int first = 0;
+  for (int k = 0; k < iterations && first < num_slices; k++) {
+    phase = Clock::now();
+    Parallel::parallel_for(num_slices - first, [&](size_t begin, size_t end, unsigned) {
+      for (size_t n = first + begin; n < first + end; n++) {
+        Clock::time_point slice_start = Clock::now();
+        fine(boundary[n], slice, fine_end[n]);
+        slice_seconds[n] = seconds_since(slice_start);
+      }
+    });
+    report.fine_seconds += seconds_since(phase);
+    report.critical_seconds += *std::max_element(slice_seconds.begin() + first, slice_seconds.end());
+
+    phase = Clock::now();
+    double change = 0;
+    int next = num_slices;
+    for (int n = first; n < num_slices; n++) {
+      // The first start did not move, so the coarse end is still current
+      // and its slice comes out exact
+      if (n > first) {
+        coarse(boundary[n], slice, predicted);
+      } else {
+        predicted = coarse_end[n];
+      }
+      corrected = predicted;
+      for (size_t i = 0; i < corrected.x.size(); i++) {
+        corrected.x[i] += fine_end[n].x[i] - coarse_end[n].x[i];
+        corrected.v[i] += fine_end[n].v[i] - coarse_end[n].v[i];
+      }
+      double moved = relative_change(corrected, boundary[n + 1]);
+      if (moved >= tolerance && next == num_slices) next = n + 1;
+      change = std::max(change, moved);
+      coarse_end[n] = predicted;
+      boundary[n + 1] = corrected;
+    }
+    report.coarse_seconds += seconds_since(phase);
+
+    report.iterations = k + 1;
+    report.change = change;
+    first = next;
+  }
+  report.converged = first == num_slices;
+
+  galaxy.setState(boundary[num_slices].x, boundary[num_slices].v);
+  report.seconds = seconds_since(start);
+  report.critical_seconds += report.coarse_seconds;
+  return report;
+}
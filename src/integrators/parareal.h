@@ -0,0 +1,86 @@
+#ifndef CLOTHSIM_PARAREAL_H
+#define CLOTHSIM_PARAREAL_H
+
+#include <vector>
+
+#include "CGL/vector3D.h"
+#include "../galaxy.h"
+#include "../gravity/directSum.h"
+
+using namespace CGL;
+
+/*
+  Parallel-in-time integration (Parareal, Lions, Maday & Turinici 2001).
+
+  The run is cut into `slices` equal time slices. A cheap coarse propagator
+  (a fixed step Wisdom-Holman map in democratic heliocentric coordinates,
+  Kepler drifts about the heaviest body with kicks from the others) sweeps
+  across them serially to guess the state at every slice boundary; then
+  every iteration
+    - runs the accurate fine propagator (IAS15) over all slices at once,
+      one slice per core, each from its current boundary guess;
+    - sweeps the coarse propagator again, correcting each boundary by how
+      far fine and coarse disagreed on the slice before it:
+        U[n + 1] = G(U[n]) + F(U_old[n]) - G(U_old[n]).
+  After k iterations the first k slices match the serial fine run exactly,
+  so it always converges, but it only pays off when the boundaries settle
+  in a few iterations: the speedup is at most slices / iterations.
+
+  Gravity is the direct sum on one thread per slice, which suits the small
+  scenes where parallelizing over bodies has nothing left to give.
+*/
+class Parareal {
+public:
+  struct Report {
+    int iterations = 0;
+    bool converged = false;
+    // Largest relative boundary update of the last iteration
+    double change = 0;
+    // Wall-clock seconds in total and in each propagator
+    double seconds = 0;
+    double fine_seconds = 0;
+    double coarse_seconds = 0;
+    // What it would take with a core for every slice: the coarse sweeps
+    // plus the slowest slice of every iteration
+    double critical_seconds = 0;
+  };
+
+  // slices = 0 uses one per core
+  Parareal(int slices = 0, double tolerance = 1e-10);
+
+  // Advances the galaxy by this many simulated seconds
+  Report run(Galaxy &galaxy, double seconds);
+
+  int slices;
+  // Converged once no boundary moves by more than this, relative to the
+  // size of the positions and velocities
+  double tolerance;
+  // Tolerance of the fine IAS15 propagator
+  double fine_tolerance = 1e-9;
+  // Wisdom-Holman steps per shortest orbital period for the coarse propagator
+  int coarse_steps_per_orbit = 32;
+  // 0 allows as many as there are slices, which is always exact
+  int max_iterations = 0;
+
+private:
+  struct State {
+    std::vector<Vector3D> x, v;
+  };
+
+  void coarse(const State &in, double duration, State &out);
+  void fine(const State &in, double duration, State &out) const;
+  // Period of the tightest pair, to size the coarse steps
+  double shortest_period(const State &state) const;
+  double relative_change(const State &a, const State &b) const;
+
+  std::vector<double> masses;
+  double coarse_step = 0;
+  // The coarse propagator's central body, the masses of the others and
+  // their state relative to it
+  size_t center = 0;
+  std::vector<double> others;
+  std::vector<Vector3D> coarse_x, coarse_v, coarse_a;
+  DirectSum coarse_gravity = DirectSum(1);
+};
+
+#endif // CLOTHSIM_PARAREAL_H
@@ -0,0 +1,33 @@
+#ifndef CLOTHSIM_STUMPFF_H
+#define CLOTHSIM_STUMPFF_H
+
+#include <cmath>
+
+/*
+  Stumpff functions c_k(z) = sum_j (-z)^j / (2j + k)!, which write the
+  two-body motion of any eccentricity in one form: c0 = cos(sqrt z) and
+  c1 = sin(sqrt z) / sqrt z for z > 0, their hyperbolic versions for z < 0.
+  Near z = 0 the closed forms cancel badly, so the series takes over.
+*/
+inline void stumpff(double z, double &c0, double &c1, double &c2, double &c3) {
+  if (std::abs(z) < 1e-3) {
+    c0 = 1 - z / 2 * (1 - z / 12 * (1 - z / 30));
+    c1 = 1 - z / 6 * (1 - z / 20 * (1 - z / 42));
+    c2 = 0.5 * (1 - z / 12 * (1 - z / 30 * (1 - z / 56)));
+    c3 = (1 - z / 20 * (1 - z / 42 * (1 - z / 72))) / 6;
+  } else if (z > 0) {
+    double s = sqrt(z);
+    c0 = cos(s);
+    c1 = sin(s) / s;
+    c2 = (1 - c0) / z;
+    c3 = (1 - c1) / z;
+  } else {
+    double s = sqrt(-z);
+    c0 = cosh(s);
+    c1 = sinh(s) / s;
+    c2 = (1 - c0) / z;
+    c3 = (1 - c1) / z;
+  }
+}
+
+#endif // CLOTHSIM_STUMPFF_H
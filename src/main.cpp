@@ -12,14 +12,29 @@
 #include <unordered_set>
 #include <stdlib.h> // atoi for getopt inputs
 #include <random>
+#include <stdexcept>
+#include <chrono>
 
 #include "CGL/CGL.h"
 #include "collision/plane.h"
 #include "collision/sphere.h"
+#include "frameCapture.h"
 #include "galaxySimulator.h"
+#include "headless.h"
+#include "rayTracer.h"
 #include "json.hpp"
 #include "misc/file_utils.h"
+#include "misc/morton.h"
+#include "misc/parallel.h"
+#include "misc/perf_counters.h"
 #include "galaxy.h"
+#include "gravity/directSum.h"
+#include "gravity/fastMultipole.h"
+#include "gravity/particleMesh.h"
+#include "integrators/ensemble.h"
+#include "integrators/ias15.h"
+#include "integrators/parareal.h"
+#include "units.h"
 
 typedef uint32_t gid_t;
 
@@ -98,6 +113,219 @@ void createGLContexts() {
   glfwSwapBuffers(window);
 }
 
+bool captureFrames(const string &directory, int num_frames, FrameCapture::Format format) {
+  if (!FileUtils::make_directory(directory)) {
+    std::cout << "Error: could not create capture directory " << directory << std::endl;
+    return false;
+  }
+  app->enableOffscreen();
+
+  Vector2i size = app->getFrameSize();
+  try {
+    FrameCapture capture(size.x(), size.y(), directory, format);
+    for (int i = 0; i < num_frames; i++) {
+      capture.begin_frame();
+      glClearColor(0.25f, 0.25f, 0.25f, 1.0f);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      app->drawContents();
+      capture.end_frame();
+    }
+    capture.finish();
+    std::cout << "Wrote " << capture.frames_written() << " frames to " << directory << std::endl;
+  } catch (const std::runtime_error &error) {
+    std::cout << "Error: " << error.what() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void rayTraceFrames(const string &project_root, const string &directory, Galaxy &galaxy,
+                    int width, int height, int num_frames, FrameCapture::Format format) {
+  if (!FileUtils::make_directory(directory)) {
+    std::cout << "Error: could not create capture directory " << directory << std::endl;
+    return;
+  }
+
+  // Same view and pacing the viewer starts with
+  CGL::Camera camera = GalaxySimulator::defaultCamera(&galaxy, width, height);
+  RayTracer tracer(project_root + "/textures");
+  tracer.set_skybox(GalaxySimulator::skyboxFaces(project_root));
+
+  std::vector<float> pixels;
+  int written = 0;
+  for (int i = 0; i < num_frames; i++) {
+    if (i > 0) {
+      galaxy.advance(GalaxySimulator::default_simulation_steps);
+    }
+    tracer.render(camera, galaxy, width, height, pixels);
+
+    char name[32];
+    snprintf(name, sizeof(name), "/frame_%05d.%s", i, format == FrameCapture::EXR ? "exr" : "png");
+    bool saved = format == FrameCapture::EXR ? RayTracer::save_exr(directory + name, pixels, width, height)
+                                             : RayTracer::save_png(directory + name, pixels, width, height);
+    if (!saved) {
+      std::cout << "Error: could not write " << directory + name << std::endl;
+      break;
+    }
+    written++;
+  }
+  std::cout << "Wrote " << written << " frames to " << directory << std::endl;
+}
+
+// Runs every approximate gravity solver once on the scene's bodies and
+// prints its time and error against the exact direct sum
+void sweepGravitySolvers(Galaxy &galaxy) {
+  std::vector<Vector3D> positions;
+  std::vector<double> masses;
+  for (Sphere *s : *galaxy.planets) {
+    positions.push_back(s->getPosition());
+    masses.push_back(s->getMass());
+  }
+  if (galaxy.asteroids != nullptr) {
+    for (Sphere *s : *galaxy.asteroids) {
+      positions.push_back(s->getPosition());
+      masses.push_back(s->getMass());
+    }
+  }
+  const size_t n = positions.size();
+
+  auto time_ms = [&](GravitySolver &solver, std::vector<Vector3D> &accelerations) {
+    auto start = std::chrono::steady_clock::now();
+    solver.accelerations(positions, masses, accelerations);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  DirectSum direct;
+  std::vector<Vector3D> reference, result;
+  double direct_ms = time_ms(direct, reference);
+  double reference_norm2 = 0;
+  for (const Vector3D &a : reference) reference_norm2 += a.norm2();
+  printf("%zu bodies, direct sum %.1f ms\n", n, direct_ms);
+  printf("%-16s %-14s %10s %8s %10s %10s\n", "solver", "setting", "time (ms)", "speedup", "rms error", "99% error");
+
+  // The rms error is relative to the rms acceleration; the percentile is
+  // of every body's own relative error, which is large wherever the pulls
+  // on a body nearly cancel
+  auto report = [&](GravitySolver &solver, const std::string &setting) {
+    double ms = time_ms(solver, result);
+    double error2 = 0;
+    std::vector<double> relative(n);
+    for (size_t i = 0; i < n; i++) {
+      double error = (result[i] - reference[i]).norm();
+      error2 += error * error;
+      relative[i] = error / std::max(reference[i].norm(), 1e-300);
+    }
+    size_t percentile = std::min(n - 1, (size_t) (0.99 * n));
+    std::nth_element(relative.begin(), relative.begin() + percentile, relative.end());
+    printf("%-16s %-14s %10.1f %8.2f %10.3e %10.3e\n", solver.name().c_str(), setting.c_str(), ms,
+           direct_ms / ms, sqrt(error2 / reference_norm2), relative[percentile]);
+  };
+
+  char setting[32];
+  for (double opening_angle : {0.3, 0.5, 0.7}) {
+    for (int order = 1; order <= 8; order++) {
+      FastMultipole fmm(order, opening_angle);
+      snprintf(setting, sizeof(setting), "p=%d theta=%.1f", order, opening_angle);
+      report(fmm, setting);
+    }
+  }
+  for (int grid_size : {32, 64, 128}) {
+    ParticleMesh pm(grid_size);
+    snprintf(setting, sizeof(setting), "grid=%d", grid_size);
+    report(pm, setting);
+  }
+
+  // The same solvers fed the bodies in the order they were loaded and in
+  // the Morton order Galaxy keeps them in with -z, best of three runs each
+  std::vector<int> order(n);
+  for (size_t i = 0; i < n; i++) order[i] = (int) i;
+  Morton::sort(positions, order, galaxy.planets->size());
+  std::vector<Vector3D> loaded_positions = positions, sorted_positions(n);
+  std::vector<double> loaded_masses = masses, sorted_masses(n);
+  for (size_t i = 0; i < n; i++) {
+    sorted_positions[i] = loaded_positions[order[i]];
+    sorted_masses[i] = loaded_masses[order[i]];
+  }
+
+  PerfCounters counters;
+  printf("\n%-16s %-14s %-8s %10s %14s %14s\n", "solver", "setting", "order", "time (ms)", "cache misses",
+         "L1d misses");
+  auto compare = [&](GravitySolver &solver, const std::string &setting) {
+    for (int sorted = 0; sorted < 2; sorted++) {
+      positions = sorted ? sorted_positions : loaded_positions;
+      masses = sorted ? sorted_masses : loaded_masses;
+      double best = INFINITY;
+      uint64_t misses = 0, l1d = 0;
+      for (int run = 0; run < 3; run++) {
+        counters.start();
+        double ms = time_ms(solver, result);
+        counters.stop();
+        if (ms < best) {
+          best = ms;
+          misses = counters.cache_misses;
+          l1d = counters.l1d_misses;
+        }
+      }
+      if (counters.available()) {
+        printf("%-16s %-14s %-8s %10.2f %14llu %14llu\n", solver.name().c_str(), setting.c_str(),
+               sorted ? "morton" : "loaded", best, (unsigned long long) misses, (unsigned long long) l1d);
+      } else {
+        printf("%-16s %-14s %-8s %10.2f %14s %14s\n", solver.name().c_str(), setting.c_str(),
+               sorted ? "morton" : "loaded", best, "n/a", "n/a");
+      }
+    }
+  };
+  FastMultipole fmm(4, 0.5);
+  compare(fmm, "p=4 theta=0.5");
+  for (int grid_size : {64, 128}) {
+    ParticleMesh pm(grid_size);
+    snprintf(setting, sizeof(setting), "grid=%d", grid_size);
+    compare(pm, setting);
+  }
+}
+
+// Runs the scene for the given span with Parareal and, from the same
+// start, with the serial fine integrator it parallelizes, and prints the
+// speedup and how far apart the two end up
+void compareParareal(Galaxy &galaxy, double years, int slices) {
+  std::vector<Vector3D> start_x, start_v;
+  std::vector<double> masses;
+  galaxy.getState(start_x, start_v, masses);
+  const double seconds = Units::time_to_si(years);
+
+  Parareal parareal(slices);
+  printf("%zu bodies, %g years in %d slices on %u threads\n", start_x.size(), years, parareal.slices,
+         Parallel::num_threads());
+
+  auto start = std::chrono::steady_clock::now();
+  IAS15 serial(parareal.fine_tolerance);
+  DirectSum gravity(1);
+  serial.load(start_x, start_v);
+  int steps = serial.integrate(Units::time_from_si(seconds), [&](const std::vector<Vector3D> &x, std::vector<Vector3D> &a) {
+    gravity.accelerations(x, masses, a);
+  });
+  double serial_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("serial IAS15: %.3f s, %d steps\n", serial_seconds, steps);
+
+  Parareal::Report report = parareal.run(galaxy, seconds);
+  std::vector<Vector3D> end_x, end_v;
+  galaxy.getState(end_x, end_v, masses);
+  galaxy.setState(start_x, start_v);
+
+  double error = 0, scale = 0;
+  for (size_t i = 0; i < end_x.size(); i++) {
+    error = std::max(error, (end_x[i] - serial.positions()[i]).norm());
+    scale = std::max(scale, serial.positions()[i].norm());
+  }
+  printf("parareal: %d iterations (%s, last change %.2e)\n", report.iterations,
+         report.converged ? "converged" : "not converged", report.change);
+  printf("  %.3f s (fine %.3f s, coarse %.3f s), speedup %.2f\n", report.seconds, report.fine_seconds,
+         report.coarse_seconds, serial_seconds / report.seconds);
+  printf("  with a core per slice %.3f s, speedup %.2f\n", report.critical_seconds,
+         serial_seconds / report.critical_seconds);
+  printf("  largest position difference %.3e AU (%.3e relative)\n", error, error / scale);
+}
+
 void setGLFWCallbacks() {
   glfwSetCursorPosCallback(window, [](GLFWwindow *, double x, double y) {
     if (!screen->cursorPosCallbackEvent(x, y)) {
@@ -153,6 +381,34 @@ void usageError(const char *binaryName) {
   printf("                     Automatically searched for by default.\n");
   printf("  -a     <INT>       Sphere vertices latitude direction.\n");
   printf("  -o     <INT>       Sphere vertices longitude direction.\n");
+  printf("  -g     <STRING>    Gravity solver: \"direct\" (default), \"pm\" or \"fmm\".\n");
+  printf("  -m     <INT>       Particle-mesh grid size, rounded up to a power of two.\n");
+  printf("  -p     <INT>       Fast multipole expansion order (default 4).\n");
+  printf("  -i     <FLOAT>     Integrate with adaptive IAS15 steps held to this\n");
+  printf("                     relative error per step (e.g. 1e-9).\n");
+  printf("  -l     <FLOAT>     Integrate the scene for this many years with Parareal\n");
+  printf("                     and serially, print the speedup and error and exit.\n");
+  printf("  -k     <INT>       Parareal time slices (default one per core).\n");
+  printf("  -x     <INT>       Generate this many variants of the scene, one per seed,\n");
+  printf("                     integrate them together in SIMD lanes, print their\n");
+  printf("                     stability and exit.\n");
+  printf("  -y     <FLOAT>     Years to integrate the -x ensemble (default 100).\n");
+  printf("  -d     <INT>       Seed of the scene generator; -x variant k uses seed + k.\n");
+  printf("  -b                 Time the gravity solvers against the direct sum on\n");
+  printf("                     the scene, print their errors and exit.\n");
+  printf("  -c     <STRING>    Render offscreen without a window and write a PNG\n");
+  printf("                     sequence to this directory.\n");
+  printf("  -n     <INT>       Number of frames to capture with -c (default 300).\n");
+  printf("  -e                 Write the -c sequence as linear half float OpenEXR.\n");
+  printf("  -t     <STRING>    Ray trace on the CPU instead, no GPU needed, and write\n");
+  printf("                     the sequence to this directory. Takes -n and -e.\n");
+  printf("  -s     <W>x<H>     Frame size for -t (default 1920x1080).\n");
+  printf("  -w     <STRING>    Record the run to this trajectory file.\n");
+  printf("  -u     <INT>       Steps between frames recorded with -w (default 16).\n");
+  printf("  -v     <STRING>    Play back a trajectory file instead of simulating;\n");
+  printf("                     load the scene it was recorded from with -f.\n");
+  printf("  -z     <INT>       Re-sort the asteroids along a Morton curve for the\n");
+  printf("                     gravity solver every this many steps (default off).\n");
   printf("\n");
   exit(-1);
 }
@@ -162,21 +418,20 @@ void incompleteObjectError(const char *object, const char *attribute) {
   exit(-1);
 }
 
+// Shared by the scene generator; seeded with -d or from the device
+mt19937 generator(random_device{}());
+
 long double randomVal(long double min, long double max) {
     // Return random value between min and max
-    random_device rd;
-    mt19937 gen(rd());
     uniform_real_distribution<long double> dist(min, max);
-    long double val = dist(gen);
+    long double val = dist(generator);
     return val;
 }
 
  double randomAngle() {
     // Return random angle between 0 and 2PI
-    random_device rd;
-    mt19937 gen(rd());
     uniform_real_distribution<double> dist(0, 2*PI);
-    long double val = dist(gen);
+    long double val = dist(generator);
     return val;
 }
 
@@ -214,7 +469,7 @@ void generateObjectsFromFile(vector<Sphere *>* planets, vector<Sphere *>* astero
                 origin = Vector3D(0,0,0);
                 velocity = Vector3D(0,0,0);
                 radius = randomVal(7, 12);
-                mass = randomVal(1E30, 5E30);
+                mass = Units::mass_from_si(randomVal(1E30, 5E30));
 
                 Sphere *new_sphere = new Sphere(origin, radius, friction, velocity, mass, star_texture);
                 planets->push_back(new_sphere);
@@ -225,11 +480,11 @@ void generateObjectsFromFile(vector<Sphere *>* planets, vector<Sphere *>* astero
                 radiusVals->push_back(radius);
             } else {
                 // Generate rest of the planets
-                Vector3D origSeed(5.79E10,0,0);
-                Vector3D vecSeed(0,4740,0);
+                Vector3D origSeed = Units::length_from_si(Vector3D(5.79E10,0,0));
+                Vector3D vecSeed = Units::velocity_from_si(Vector3D(0,4740,0));
                 velocity = randomVec(5 * vecSeed, 10 * vecSeed); // Make velocity large
 //                velocity = 10 * vecSeed;
-                mass = randomVal(1E23, 6E24);
+                mass = Units::mass_from_si(randomVal(1E23, 6E24));
                 radius = randomVal(1, 5);
 
                 if (planets->size() == 1) {
@@ -292,14 +547,14 @@ void generateObjectsFromFile(vector<Sphere *>* planets, vector<Sphere *>* astero
     }
     if (num_asteroids) {
         double angle = randomAngle();
-        Vector3D astVelMin(cos(angle)*17900, sin(angle)*17900, 0);
-        Vector3D astVelMax(cos(angle)*30000, sin(angle)*30000, 0);
+        Vector3D astVelMin = Units::velocity_from_si(Vector3D(cos(angle)*17900, sin(angle)*17900, 0));
+        Vector3D astVelMax = Units::velocity_from_si(Vector3D(cos(angle)*30000, sin(angle)*30000, 0));
         double astDist, astRadiusMin=1, astRadiusMax=1.22;
-        long double astMassMin=2.8E21, astMassMax=3.2E21;
+        long double astMassMin=Units::mass_from_si(2.8E21), astMassMax=Units::mass_from_si(3.2E21);
 
 //        Sphere* last = *std::max_element(planets->begin()+1, planets->end(), Galaxy::compareOrigin);
 //        double lastDist = 1.f * last->getInitOrigin().norm();
-        double lastDist = 1.f * 3.5E11;
+        double lastDist = 1.f * Units::length_from_si(3.5E11);
 
         for (int j = 0; j < num_asteroids; j++) {
             astDist = randomVal(lastDist, 1.1f * lastDist);
@@ -315,6 +570,91 @@ void generateObjectsFromFile(vector<Sphere *>* planets, vector<Sphere *>* astero
     }
 }
 
+void runEnsemble(const vector<Sphere *> &scene, int systems, long seed, double years, int num_spheres,
+                 int num_asteroids, const string &planet_texture, const string &asteroid_texture) {
+  // Every variant starts from the scene's own bodies and generates the
+  // rest from its seed; nothing is drawn, so no textures or shaders load
+  Ensemble ensemble;
+  vector<double> coordVals, massVals, radiusVals;
+  std::vector<Vector3D> first_x, first_v;
+  std::vector<double> first_m;
+  for (int k = 0; k < systems; k++) {
+    vector<Sphere *> planets, asteroids;
+    for (Sphere *sphere : scene) {
+      planets.push_back(new Sphere(*sphere));
+    }
+    generator.seed(seed + k);
+    if (num_spheres != 0 || num_asteroids != 0) {
+      generateObjectsFromFile(&planets, &asteroids, &coordVals, &massVals, &radiusVals, num_spheres, num_asteroids,
+                              planet_texture, asteroid_texture);
+    }
+    vector<Sphere *> owned(planets);
+    owned.insert(owned.end(), asteroids.begin(), asteroids.end());
+
+    std::vector<Vector3D> x, v;
+    std::vector<double> m;
+    {
+      Galaxy galaxy(&planets, &asteroids);
+      galaxy.getState(x, v, m);
+    }
+    for (Sphere *sphere : owned) {
+      delete sphere;
+    }
+    if (k == 0) {
+      first_x = x;
+      first_v = v;
+      first_m = m;
+    }
+    if (!ensemble.add(x, v, m)) {
+      printf("seed %ld has %zu bodies instead of %zu, skipped\n", seed + k, m.size(), ensemble.bodies());
+    }
+  }
+  if (ensemble.size() == 0) return;
+
+  printf("%zu systems of %zu bodies, %g years on %u threads, %zu systems per block\n", ensemble.size(),
+         ensemble.bodies(), years, Parallel::num_threads(), Ensemble::LANES);
+  auto start = std::chrono::steady_clock::now();
+  long steps = ensemble.run(years);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  int stable = 0, ejected = 0;
+  double worst = 0;
+  for (size_t k = 0; k < ensemble.size(); k++) {
+    const Ensemble::Stats &stats = ensemble.stats(k);
+    printf("  seed %ld: ", seed + (long) k);
+    if (stats.ejected > 0) {
+      printf("%d ejected (first after %.2f years)", stats.ejected, stats.first_ejection);
+    } else {
+      printf(stats.stable ? "stable" : "unstable");
+    }
+    printf(", dE/E %.2e, closest approach %.3e AU\n", stats.energy_error, stats.closest);
+    stable += stats.stable;
+    ejected += stats.ejected;
+    worst = std::max(worst, stats.energy_error);
+  }
+  printf("%d of %zu stable, %d bodies ejected, largest dE/E %.2e\n", stable, ensemble.size(), ejected, worst);
+  printf("%ld steps in %.3f s, %.1f system-years per second\n", steps, seconds,
+         ensemble.size() * years / seconds);
+
+  // The same leapfrog for one system at a time through the direct sum,
+  // timed over a few steps, for comparison
+  const long reference_steps = std::min(steps, 200L);
+  const double step = years / steps;
+  DirectSum gravity(1);
+  std::vector<Vector3D> a;
+  start = std::chrono::steady_clock::now();
+  gravity.accelerations(first_x, first_m, a);
+  for (long s = 0; s < reference_steps; s++) {
+    for (size_t i = 0; i < first_x.size(); i++) first_v[i] += a[i] * (step / 2);
+    for (size_t i = 0; i < first_x.size(); i++) first_x[i] += first_v[i] * step;
+    gravity.accelerations(first_x, first_m, a);
+    for (size_t i = 0; i < first_x.size(); i++) first_v[i] += a[i] * (step / 2);
+  }
+  double serial = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() *
+                  steps / reference_steps * ensemble.size();
+  printf("one at a time on one thread: ~%.3f s, speedup %.1f\n", serial, serial / seconds);
+}
+
 bool loadObjectsFromFile(string filename, vector<Sphere *>* planets, vector<double> *coordVals, vector<double> *massVals, vector<double> *radiusVals,
         int* num_spheres, int* num_asteroids, string* planet_texture, string* asteroid_texture, int sphere_num_lat, int sphere_num_lon) {
   // Read JSON from file
@@ -350,10 +690,10 @@ bool loadObjectsFromFile(string filename, vector<Sphere *>* planets, vector<doub
         auto it_origin = sphere_element.find("origin");
         if (it_origin != sphere_element.end()) {
           vector<double> vec_origin = *it_origin;
-          origin = Vector3D(vec_origin[0], vec_origin[1], vec_origin[2]);
-          coordVals->push_back(vec_origin[0]);
-          coordVals->push_back(vec_origin[1]);
-          coordVals->push_back(vec_origin[2]);
+          origin = Units::length_from_si(Vector3D(vec_origin[0], vec_origin[1], vec_origin[2]));
+          coordVals->push_back(origin[0]);
+          coordVals->push_back(origin[1]);
+          coordVals->push_back(origin[2]);
         } else {
           incompleteObjectError("sphere", "origin");
         }
@@ -376,16 +716,16 @@ bool loadObjectsFromFile(string filename, vector<Sphere *>* planets, vector<doub
         auto it_velocity = sphere_element.find("velocity");
         if (it_velocity != sphere_element.end()) {
           vector<double> vec_velocity = *it_velocity;
-          velocity = Vector3D(vec_velocity[0], vec_velocity[1], vec_velocity[2]);
+          velocity = Units::velocity_from_si(Vector3D(vec_velocity[0], vec_velocity[1], vec_velocity[2]));
         } else {
           incompleteObjectError("sphere", "velocity");
         }
 
-        std::cout << "velocity: " << velocity << "\n";
+        std::cout << "velocity: " << Units::velocity_to_si(velocity) << "\n";
 
         auto it_mass = sphere_element.find("mass");
         if (it_mass != sphere_element.end()) {
-          mass = *it_mass;
+          mass = Units::mass_from_si(*it_mass);
           massVals->push_back(mass);
         } else {
           incompleteObjectError("sphere", "mass");
@@ -484,11 +824,32 @@ int main(int argc, char **argv) {
   
   int sphere_num_lat = 40;
   int sphere_num_lon = 40;
+
+  std::string gravity_solver = "direct";
+  int pm_grid_size = 64;
+  int fmm_order = 4;
+  bool sweep_solvers = false;
+  double ias15_tolerance = 0;
+  double parareal_years = 0;
+  int parareal_slices = 0;
+  int ensemble_systems = 0;
+  double ensemble_years = 100;
+  long seed = -1;
+
+  std::string capture_directory;
+  int capture_frames = 300;
+  FrameCapture::Format capture_format = FrameCapture::PNG;
+  std::string trace_directory;
+  int trace_width = 1920, trace_height = 1080;
+  std::string record_path;
+  int record_every = 16;
+  std::string playback_path;
+  int reorder_interval = 0;
   
   std::string file_to_load_from;
   bool file_specified = false;
   
-  while ((c = getopt (argc, argv, "f:r:a:o:")) != -1) {
+  while ((c = getopt (argc, argv, "f:r:a:o:g:m:p:i:l:k:x:y:d:bc:n:et:s:w:u:v:z:")) != -1) {
     switch (c) {
       case 'f': {
         file_to_load_from = optarg;
@@ -519,6 +880,93 @@ int main(int argc, char **argv) {
         sphere_num_lon = arg_int;
         break;
       }
+      case 'g': {
+        gravity_solver = optarg;
+        if (gravity_solver != "direct" && gravity_solver != "pm" && gravity_solver != "fmm") {
+          usageError(argv[0]);
+        }
+        break;
+      }
+      case 'm': {
+        pm_grid_size = atoi(optarg);
+        break;
+      }
+      case 'p': {
+        fmm_order = atoi(optarg);
+        break;
+      }
+      case 'i': {
+        ias15_tolerance = atof(optarg);
+        if (ias15_tolerance <= 0) {
+          usageError(argv[0]);
+        }
+        break;
+      }
+      case 'l': {
+        parareal_years = atof(optarg);
+        break;
+      }
+      case 'k': {
+        parareal_slices = std::max(atoi(optarg), 1);
+        break;
+      }
+      case 'x': {
+        ensemble_systems = std::max(atoi(optarg), 1);
+        break;
+      }
+      case 'y': {
+        ensemble_years = atof(optarg);
+        if (ensemble_years <= 0) {
+          usageError(argv[0]);
+        }
+        break;
+      }
+      case 'd': {
+        seed = atol(optarg);
+        break;
+      }
+      case 'b': {
+        sweep_solvers = true;
+        break;
+      }
+      case 'c': {
+        capture_directory = optarg;
+        break;
+      }
+      case 'n': {
+        capture_frames = std::max(atoi(optarg), 1);
+        break;
+      }
+      case 'e': {
+        capture_format = FrameCapture::EXR;
+        break;
+      }
+      case 't': {
+        trace_directory = optarg;
+        break;
+      }
+      case 's': {
+        if (sscanf(optarg, "%dx%d", &trace_width, &trace_height) != 2 || trace_width < 1 || trace_height < 1) {
+          usageError(argv[0]);
+        }
+        break;
+      }
+      case 'w': {
+        record_path = optarg;
+        break;
+      }
+      case 'u': {
+        record_every = std::max(atoi(optarg), 1);
+        break;
+      }
+      case 'v': {
+        playback_path = optarg;
+        break;
+      }
+      case 'z': {
+        reorder_interval = std::max(atoi(optarg), 0);
+        break;
+      }
       default: {
         usageError(argv[0]);
         break;
@@ -545,9 +993,27 @@ int main(int argc, char **argv) {
     std::cout << "Warn: Unable to load from file: " << file_to_load_from << std::endl;
   }
 
-  glfwSetErrorCallback(error_callback);
+  // The ray tracer and the benchmarks need no GL context at all
+  bool ray_traced = !trace_directory.empty();
+  bool benchmark = sweep_solvers || parareal_years > 0 || ensemble_systems > 0;
+  bool headless = !ray_traced && !benchmark && !capture_directory.empty();
+  if (headless) {
+    if (!Headless::create_context()) {
+      return -1;
+    }
+  } else if (!ray_traced && !benchmark) {
+    glfwSetErrorCallback(error_callback);
+    createGLContexts();
+  }
 
-  createGLContexts();
+  if (ensemble_systems > 0) {
+    runEnsemble(planets, ensemble_systems, seed < 0 ? 1 : seed, ensemble_years, num_spheres, num_asteroids,
+                planet_texture, asteroid_texture);
+    return 0;
+  }
+  if (seed >= 0) {
+    generator.seed(seed);
+  }
 
     // Initialize the GalaxySimulator object
     if (num_spheres != 0 || num_asteroids != 0) {
@@ -557,30 +1023,61 @@ int main(int argc, char **argv) {
   // Ryan's factoring code
     if (!coordVals.empty()) {
         coordVals.erase(std::remove(coordVals.begin(), coordVals.end(), 0), coordVals.end());
+        for (double &coord : coordVals) {
+            coord = std::abs(coord);
+        }
         sort(coordVals.begin(), coordVals.end());
         sort(massVals.begin(), massVals.end());
         sort(radiusVals.begin(), radiusVals.end());
-        double val = coordVals.front();
-        int count = 0;
-        while (val >= 10) {
-            val /= 10;
-            count++;
-        }
-        Sphere::sphere_factor = pow(10, count);
+        Sphere::sphere_factor = Units::render_scale(coordVals.front());
         Sphere::gravity_margin = (massVals.back() - massVals.front()) / 2;
         Sphere::radiusFactor = 1; //TODO NEED TO FIX
         std::cout << "Planet size = " << planets.size() << endl;
-        std::cout << "Gravity margin = " << Sphere::gravity_margin << endl;
-        std::cout << "Sphere factor = " << Sphere::sphere_factor << endl;
+        std::cout << "Gravity margin = " << Units::mass_to_si(Sphere::gravity_margin) << " kg" << endl;
+        std::cout << "Sphere factor = " << Units::length_to_si(Sphere::sphere_factor) << " m" << endl;
         std::cout << "Radius factor = " << Sphere::radiusFactor << endl;
     }
 
 
   Galaxy galaxy(&planets, &asteroids);
+  galaxy.reorder_interval = reorder_interval;
+  if (gravity_solver == "pm") {
+    galaxy.setGravitySolver(new ParticleMesh(pm_grid_size));
+  } else if (gravity_solver == "fmm") {
+    galaxy.setGravitySolver(new FastMultipole(fmm_order));
+  }
+  if (ias15_tolerance > 0) {
+    galaxy.setIntegrator(new IAS15(ias15_tolerance));
+  }
+  if (sweep_solvers) {
+    sweepGravitySolvers(galaxy);
+    return 0;
+  }
+  if (parareal_years > 0) {
+    compareParareal(galaxy, parareal_years, parareal_slices);
+    return 0;
+  }
+  if (ray_traced) {
+    rayTraceFrames(project_root, trace_directory, galaxy, trace_width, trace_height, capture_frames, capture_format);
+    return 0;
+  }
   app = new GalaxySimulator(project_root, screen);
   app->loadSphereParameters(&sp);
   app->loadGalaxy(&galaxy);
   app->init();
+  if (!playback_path.empty() && !app->playTrajectory(playback_path)) {
+    return -1;
+  }
+  if (!record_path.empty() && playback_path.empty()) {
+    app->recordTrajectory(record_path, record_every);
+  }
+
+  if (headless) {
+    bool captured = captureFrames(capture_directory, capture_frames, capture_format);
+    delete app;
+    Headless::destroy_context();
+    return captured ? 0 : -1;
+  }
 
   // Call this after all the widgets have been defined
 
@@ -0,0 +1,57 @@
+#include "exr_file.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+// Needed to generate tinyexr binaries. Should only define in exactly one source file importing tinyexr.h.
+#define TINYEXR_IMPLEMENTATION
+#include "CGL/tinyexr.h"
+
+namespace ExrFile {
+
+static bool save(const std::string& path, const unsigned char* planes, size_t value_size,
+                 int pixel_type, int width, int height) {
+  const size_t plane = (size_t) width * height * value_size;
+  // EXR readers expect the channels sorted by name
+  const char* names[3] = {"B", "G", "R"};
+  unsigned char* images[3];
+  int types[3], requested[3];
+  for (int c = 0; c < 3; c++) {
+    images[c] = const_cast<unsigned char*>(planes + c * plane);
+    types[c] = pixel_type;
+    requested[c] = TINYEXR_PIXELTYPE_HALF;
+  }
+
+  EXRImage image;
+  InitEXRImage(&image);
+  image.num_channels = 3;
+  image.channel_names = names;
+  image.images = images;
+  image.pixel_types = types;
+  image.requested_pixel_types = requested;
+  image.width = width;
+  image.height = height;
+
+  unsigned char* memory = nullptr;
+  const char* err = nullptr;
+  size_t size = SaveMultiChannelEXRToMemory(&image, &memory, &err);
+  if (memory == nullptr || size == 0 || size == (size_t) -1) return false;
+
+  FILE* file = fopen(path.c_str(), "wb");
+  bool ok = file != nullptr && fwrite(memory, 1, size, file) == size;
+  if (file != nullptr) ok = fclose(file) == 0 && ok;
+  free(memory);
+  return ok;
+}
+
+bool save_half(const std::string& path, const unsigned short* planes, int width, int height) {
+  return save(path, reinterpret_cast<const unsigned char*>(planes), sizeof(unsigned short),
+              TINYEXR_PIXELTYPE_HALF, width, height);
+}
+
+bool save_float(const std::string& path, const float* planes, int width, int height) {
+  return save(path, reinterpret_cast<const unsigned char*>(planes), sizeof(float),
+              TINYEXR_PIXELTYPE_FLOAT, width, height);
+}
+
+}
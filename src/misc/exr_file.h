@@ -0,0 +1,18 @@
+#ifndef CS184_EXR_FILE_H
+#define CS184_EXR_FILE_H
+
+#include <string>
+
+/*
+  OpenEXR output through the bundled tinyexr. Images are passed as planar
+  B, G and R channels of width * height values each, rows top to bottom,
+  and stored as half floats with ZIP compression.
+*/
+namespace ExrFile {
+
+bool save_half(const std::string& path, const unsigned short* planes, int width, int height);
+bool save_float(const std::string& path, const float* planes, int width, int height);
+
+}
+
+#endif // CS184_EXR_FILE_H
@@ -1,9 +1,13 @@
 #ifdef _WIN32
 #include "dirent.h"
+#include <direct.h>
 #else
 #include <dirent.h>
 #endif // WIN32
 
+#include <sys/stat.h>
+#include <sys/types.h>
+
 #include <fstream>
 
 #include "file_utils.h"
@@ -67,4 +71,25 @@ bool file_exists(const std::string& test_filename) {
   return true;
 }
 
+bool file_info(const std::string& filename, long long& size, long long& modified_time) {
+  struct stat info;
+  if (stat(filename.c_str(), &info) != 0) {
+    return false;
+  }
+  size = (long long) info.st_size;
+  modified_time = (long long) info.st_mtime;
+  return true;
+}
+
+bool make_directory(const std::string& dir_path) {
+#ifdef _WIN32
+  int result = _mkdir(dir_path.c_str());
+#else
+  int result = mkdir(dir_path.c_str(), 0755);
+#endif // WIN32
+  // An existing directory is fine too
+  struct stat info;
+  return result == 0 || (stat(dir_path.c_str(), &info) == 0 && (info.st_mode & S_IFDIR));
+}
+
 }
@@ -10,6 +10,8 @@ bool list_files_in_directory(const std::string& dir_path, std::set<std::string>&
 bool split_filename(const std::string& filename, std::string& before_extension, std::string& extension);
 void get_filename_from_path(const std::string& path, std::string& filename, char delimiter = '/');
 bool file_exists(const std::string& filename);
+bool file_info(const std::string& filename, long long& size, long long& modified_time);
+bool make_directory(const std::string& dir_path);
 
 }
 
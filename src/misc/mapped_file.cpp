@@ -0,0 +1,56 @@
+#include "mapped_file.h"
+
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+bool MappedFile::open(const std::string &path) {
+  close();
+
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void *addr = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file
+  ::close(fd);
+  if (addr == MAP_FAILED) return false;
+  bytes = (const unsigned char *) addr;
+  length = (size_t) info.st_size;
+  mapped = true;
+  return true;
+#else
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) return false;
+  std::streamoff end = file.tellg();
+  if (end <= 0) return false;
+  fallback.resize((size_t) end);
+  file.seekg(0);
+  if (!file.read((char *) fallback.data(), end)) {
+    fallback.clear();
+    return false;
+  }
+  bytes = fallback.data();
+  length = fallback.size();
+  return true;
+#endif // _WIN32
+}
+
+void MappedFile::close() {
+#ifndef _WIN32
+  if (mapped) munmap((void *) bytes, length);
+#endif // _WIN32
+  fallback.clear();
+  bytes = nullptr;
+  length = 0;
+  mapped = false;
+}
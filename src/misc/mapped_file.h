@@ -0,0 +1,35 @@
+#ifndef CS184_MAPPED_FILE_H
+#define CS184_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+  Read-only view of a whole file. Uses mmap where available so the pages
+  are only read from disk when touched; elsewhere the file is read into
+  memory. data() stays valid until close() or destruction.
+*/
+class MappedFile {
+public:
+  MappedFile() {}
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const std::string &path);
+  void close();
+
+  bool is_open() const { return bytes != nullptr; }
+  const unsigned char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  const unsigned char *bytes = nullptr;
+  size_t length = 0;
+  bool mapped = false;
+  std::vector<unsigned char> fallback;
+};
+
+#endif // CS184_MAPPED_FILE_H
@@ -0,0 +1,57 @@
+#ifndef CS184_MORTON_H
+#define CS184_MORTON_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "CGL/vector3D.h"
+
+namespace Morton {
+
+// Spreads the low 21 bits of v so two zero bits follow each one
+inline uint64_t spread(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffULL;
+  v = (v | v << 16) & 0x1f0000ff0000ffULL;
+  v = (v | v << 8) & 0x100f00f00f00f00fULL;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+  v = (v | v << 2) & 0x1249249249249249ULL;
+  return v;
+}
+
+// Position along the Z-order curve of a point on a 2^21 grid per axis
+inline uint64_t key(uint32_t x, uint32_t y, uint32_t z) {
+  return spread(x) | spread(y) << 1 | spread(z) << 2;
+}
+
+/*
+  Sorts order[first, end) by the Morton key of positions[order[i]] within
+  the bounding box of those positions, so indices next to each other in
+  order are mostly next to each other in space.
+*/
+inline void sort(const std::vector<CGL::Vector3D> &positions, std::vector<int> &order, size_t first = 0) {
+  if (order.size() <= first + 1) return;
+  CGL::Vector3D lo = positions[order[first]], hi = lo;
+  for (size_t i = first; i < order.size(); i++) {
+    const CGL::Vector3D &p = positions[order[i]];
+    lo = CGL::Vector3D(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+    hi = CGL::Vector3D(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+  }
+  CGL::Vector3D extent = hi - lo;
+  double size = std::max(extent.x, std::max(extent.y, extent.z));
+  const double scale = size > 0 ? 2097151 / size : 0;
+
+  std::vector<std::pair<uint64_t, int>> keyed(order.size() - first);
+  for (size_t i = first; i < order.size(); i++) {
+    CGL::Vector3D u = (positions[order[i]] - lo) * scale;
+    keyed[i - first] = std::make_pair(key((uint32_t) u.x, (uint32_t) u.y, (uint32_t) u.z), order[i]);
+  }
+  std::sort(keyed.begin(), keyed.end());
+  for (size_t i = first; i < order.size(); i++) order[i] = keyed[i - first].second;
+}
+
+} // namespace Morton
+
+#endif // CS184_MORTON_H
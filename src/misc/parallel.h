@@ -0,0 +1,47 @@
+#ifndef CS184_PARALLEL_H
+#define CS184_PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+
+inline unsigned num_threads() {
+  unsigned n = std::thread::hardware_concurrency();
+  return n == 0 ? 1 : n;
+}
+
+/*
+  Splits [0, n) into one contiguous chunk per thread and calls
+  fn(begin, end, thread_index) for each chunk. The calling thread runs the
+  first chunk itself and returns once every chunk is done.
+*/
+template <typename Fn>
+void parallel_for(size_t n, Fn fn, unsigned threads = num_threads()) {
+  if (n == 0) return;
+  threads = (unsigned) std::max<size_t>(1, std::min<size_t>(threads, n));
+  if (threads == 1) {
+    fn((size_t) 0, n, 0u);
+    return;
+  }
+
+  size_t chunk = (n + threads - 1) / threads;
+  std::vector<std::thread> workers;
+  workers.reserve(threads - 1);
+  for (unsigned t = 1; t < threads; t++) {
+    size_t begin = t * chunk;
+    size_t end = std::min(n, begin + chunk);
+    if (begin >= end) break;
+    workers.emplace_back([=]() { fn(begin, end, t); });
+  }
+  fn((size_t) 0, std::min(n, chunk), 0u);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+} // namespace Parallel
+
+#endif // CS184_PARALLEL_H
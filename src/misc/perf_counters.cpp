@@ -0,0 +1,67 @@
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int open_counter(uint32_t type, uint64_t config, int group) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = group < 0;
+  // Also counts the worker threads started while counting
+  attr.inherit = 1;
+  // User space only, which needs no privileges
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static uint64_t read_counter(int fd) {
+  uint64_t value = 0;
+  if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) return 0;
+  return value;
+}
+
+PerfCounters::PerfCounters() {
+  // One group, so the three count over exactly the same instructions
+  misses_fd = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1);
+  if (misses_fd < 0) return;
+  references_fd = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, misses_fd);
+  l1d_fd = open_counter(PERF_TYPE_HW_CACHE,
+                        PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                        PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+                        misses_fd);
+}
+
+PerfCounters::~PerfCounters() {
+  if (l1d_fd >= 0) close(l1d_fd);
+  if (references_fd >= 0) close(references_fd);
+  if (misses_fd >= 0) close(misses_fd);
+}
+
+void PerfCounters::start() {
+  cache_misses = cache_references = l1d_misses = 0;
+  if (misses_fd < 0) return;
+  ioctl(misses_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(misses_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void PerfCounters::stop() {
+  if (misses_fd < 0) return;
+  ioctl(misses_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  cache_misses = read_counter(misses_fd);
+  cache_references = read_counter(references_fd);
+  l1d_misses = read_counter(l1d_fd);
+}
+#else
+PerfCounters::PerfCounters() {}
+PerfCounters::~PerfCounters() {}
+void PerfCounters::start() {}
+void PerfCounters::stop() {}
+#endif // __linux__
@@ -0,0 +1,37 @@
+#ifndef CS184_PERF_COUNTERS_H
+#define CS184_PERF_COUNTERS_H
+
+#include <cstdint>
+
+/*
+  Hardware cache counters for the calling thread and the threads it starts,
+  through perf_event_open on Linux. available() is false elsewhere, and where the kernel or a
+  virtual machine does not expose the counters; the counts then stay 0.
+*/
+class PerfCounters {
+public:
+  PerfCounters();
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  bool available() const { return misses_fd >= 0; }
+
+  // Zeroes the counts and starts counting
+  void start();
+  // Stops counting and reads the counts
+  void stop();
+
+  // Last level cache misses and references, and L1 data cache read misses
+  uint64_t cache_misses = 0;
+  uint64_t cache_references = 0;
+  uint64_t l1d_misses = 0;
+
+private:
+  int misses_fd = -1;
+  int references_fd = -1;
+  int l1d_fd = -1;
+};
+
+#endif // CS184_PERF_COUNTERS_H
@@ -1,4 +1,7 @@
 #include <cmath>
+#include <cstring>
+#include <map>
+#include <mutex>
 #include <nanogui/nanogui.h>
 
 #include "sphere_drawing.h"
@@ -8,39 +11,66 @@
 #include "CGL/color.h"
 #include "CGL/vector3D.h"
 
-#define TCOORD_OFFSET 0
-#define NORMAL_OFFSET 2
-#define VERTEX_OFFSET 5
-#define TANGEN_OFFSET 8
-#define VERTEX_SIZE 11
-
 using namespace nanogui;
 
 namespace CGL {
 namespace Misc {
 
+// Half float bits of a value in [-1, 1], rounded to nearest; values too
+// small for a normal half become zero
+static uint16_t to_half(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint16_t sign = (bits >> 16) & 0x8000;
+  int exponent = (int) ((bits >> 23) & 0xff) - 127 + 15;
+  if (exponent <= 0) return sign;
+  uint32_t mantissa = (bits & 0x7fffff) + 0x1000;
+  if (mantissa & 0x800000) {
+    mantissa = 0;
+    exponent++;
+  }
+  return sign | (uint16_t) (exponent << 10) | (uint16_t) (mantissa >> 13);
+}
+
 SphereMesh::SphereMesh(int num_lat, int num_lon)
 : sphere_num_lat(num_lat)
 , sphere_num_lon(num_lon)
 , sphere_num_vertices((sphere_num_lat + 1) * (sphere_num_lon + 1))
-, sphere_num_indices(6 * sphere_num_lat * sphere_num_lon) {
-  
-  Indices.resize(sphere_num_indices);
-  Vertices.resize(VERTEX_SIZE * sphere_num_vertices);
-  
-  
-  for (int i = 0; i <= sphere_num_lat; i++) {
-    for (int j = 0; j <= sphere_num_lon; j++) {
-      double lat = ((double)i) / sphere_num_lat;
-      double lon = ((double)j) / sphere_num_lon;
-      double *vptr = &Vertices[VERTEX_SIZE * s_index(i, j)];
-
-      double uv_u = lon;
-      double uv_v = lat;
-
-      vptr[TCOORD_OFFSET + 0] = uv_u;
-      vptr[TCOORD_OFFSET + 1] = uv_v;
-      
+, sphere_num_indices(6 * sphere_num_lat * sphere_num_lon)
+, data(shared_data(num_lat, num_lon)) {
+}
+
+std::shared_ptr<const SphereMesh::Data> SphereMesh::shared_data(int num_lat, int num_lon) {
+  // Every sphere owns a mesh, but the data only depends on the detail
+  static std::mutex mutex;
+  static std::map<std::pair<int, int>, std::weak_ptr<const Data>> cache;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::weak_ptr<const Data> &entry = cache[std::make_pair(num_lat, num_lon)];
+  std::shared_ptr<const Data> data = entry.lock();
+  if (!data) {
+    data = build_data(num_lat, num_lon);
+    entry = data;
+  }
+  return data;
+}
+
+std::shared_ptr<const SphereMesh::Data> SphereMesh::build_data(int num_lat, int num_lon) {
+  std::shared_ptr<Data> data = std::make_shared<Data>();
+  const int num_vertices = (num_lat + 1) * (num_lon + 1);
+  data->positions.resize(4, num_vertices);
+  data->normals.resize(4, num_vertices);
+  data->tangents.resize(4, num_vertices);
+  data->uvs.resize(2, num_vertices);
+
+  const uint16_t zero = to_half(0);
+  for (int i = 0; i <= num_lat; i++) {
+    for (int j = 0; j <= num_lon; j++) {
+      double lat = ((double)i) / num_lat;
+      double lon = ((double)j) / num_lon;
+      int v = i * (num_lon + 1) + j;
+
+      data->uvs.col(v) << (uint16_t) lround(lon * 65535), (uint16_t) lround(lat * 65535);
+
       // Simple patch to rotate the sphere so by default
       // the seam is facing away from the camera
       lon += 0.5;
@@ -52,25 +82,25 @@ SphereMesh::SphereMesh(int num_lat, int num_lon)
       lon *= 2 * M_PI;
 
       // Vertex and normals are actually the same here
-      vptr[NORMAL_OFFSET + 0] = vptr[VERTEX_OFFSET + 0] = sin(lat) * sin(lon);
-      vptr[NORMAL_OFFSET + 1] = vptr[VERTEX_OFFSET + 1] = cos(lat);
-      vptr[NORMAL_OFFSET + 2] = vptr[VERTEX_OFFSET + 2] = sin(lat) * cos(lon);
-      
+      double p[3] = { sin(lat) * sin(lon), cos(lat), sin(lat) * cos(lon) };
+      data->positions.col(v) << (int16_t) lround(p[0] * 32767), (int16_t) lround(p[1] * 32767),
+                                (int16_t) lround(p[2] * 32767), 32767;
+      data->normals.col(v) << to_half(p[0]), to_half(p[1]), to_half(p[2]), zero;
+
       // Compute tangents (take partial derivative with respect to longitude, normalize)
-      vptr[TANGEN_OFFSET + 0] = cos(lon);
-      vptr[TANGEN_OFFSET + 1] = 0;
-      vptr[TANGEN_OFFSET + 2] = -sin(lon);
+      data->tangents.col(v) << to_half(cos(lon)), zero, to_half(-sin(lon)), zero;
     }
   }
 
-  for (int i = 0; i < sphere_num_lat; i++) {
-    for (int j = 0; j < sphere_num_lon; j++) {
-      unsigned int *iptr = &Indices[6 * (sphere_num_lon * i + j)];
+  std::vector<uint32_t> indices(6 * num_lat * num_lon);
+  for (int i = 0; i < num_lat; i++) {
+    for (int j = 0; j < num_lon; j++) {
+      uint32_t *iptr = &indices[6 * (num_lon * i + j)];
 
-      unsigned int i00 = s_index(i, j);
-      unsigned int i10 = s_index(i + 1, j);
-      unsigned int i11 = s_index(i + 1, j + 1);
-      unsigned int i01 = s_index(i, j + 1);
+      uint32_t i00 = i * (num_lon + 1) + j;
+      uint32_t i10 = (i + 1) * (num_lon + 1) + j;
+      uint32_t i11 = i10 + 1;
+      uint32_t i01 = i00 + 1;
 
       iptr[0] = i00;
       iptr[1] = i10;
@@ -80,91 +110,57 @@ SphereMesh::SphereMesh(int num_lat, int num_lon)
       iptr[5] = i00;
     }
   }
-  
-  build_data();
-}
-
-int SphereMesh::s_index(int x, int y) {
-  return ((x) * (sphere_num_lon + 1) + (y));
-}
-
-void SphereMesh::build_data() {
-  
-  positions = MatrixXf(4, sphere_num_indices * 3);
-  normals = MatrixXf(4, sphere_num_indices * 3);
-  uvs = MatrixXf(2, sphere_num_indices * 3);
-  tangents = MatrixXf(4, sphere_num_indices * 3);
-
-  for (int i = 0; i < sphere_num_indices; i += 3) {
-    double *vPtr1 = &Vertices[VERTEX_SIZE * Indices[i]];
-    double *vPtr2 = &Vertices[VERTEX_SIZE * Indices[i + 1]];
-    double *vPtr3 = &Vertices[VERTEX_SIZE * Indices[i + 2]];
-
-    Vector3D p1(vPtr1[VERTEX_OFFSET], vPtr1[VERTEX_OFFSET + 1],
-                vPtr1[VERTEX_OFFSET + 2]);
-    Vector3D p2(vPtr2[VERTEX_OFFSET], vPtr2[VERTEX_OFFSET + 1],
-                vPtr2[VERTEX_OFFSET + 2]);
-    Vector3D p3(vPtr3[VERTEX_OFFSET], vPtr3[VERTEX_OFFSET + 1],
-                vPtr3[VERTEX_OFFSET + 2]);
-
-    Vector3D n1(vPtr1[NORMAL_OFFSET], vPtr1[NORMAL_OFFSET + 1],
-                vPtr1[NORMAL_OFFSET + 2]);
-    Vector3D n2(vPtr2[NORMAL_OFFSET], vPtr2[NORMAL_OFFSET + 1],
-                vPtr2[NORMAL_OFFSET + 2]);
-    Vector3D n3(vPtr3[NORMAL_OFFSET], vPtr3[NORMAL_OFFSET + 1],
-                vPtr3[NORMAL_OFFSET + 2]);
-        
-    Vector3D uv1(vPtr1[TCOORD_OFFSET], vPtr1[TCOORD_OFFSET + 1], 0);
-    Vector3D uv2(vPtr2[TCOORD_OFFSET], vPtr2[TCOORD_OFFSET + 1], 0);
-    Vector3D uv3(vPtr3[TCOORD_OFFSET], vPtr3[TCOORD_OFFSET + 1], 0);
-    
-    Vector3D t1(vPtr1[TANGEN_OFFSET], vPtr1[TANGEN_OFFSET + 1],
-                vPtr1[TANGEN_OFFSET + 2]);
-    Vector3D t2(vPtr2[TANGEN_OFFSET], vPtr2[TANGEN_OFFSET + 1],
-                vPtr2[TANGEN_OFFSET + 2]);
-    Vector3D t3(vPtr3[TANGEN_OFFSET], vPtr3[TANGEN_OFFSET + 1],
-                vPtr3[TANGEN_OFFSET + 2]);
-
-    positions.col(i    ) << p1.x, p1.y, p1.z, 1.0;
-    positions.col(i + 1) << p2.x, p2.y, p2.z, 1.0;
-    positions.col(i + 2) << p3.x, p3.y, p3.z, 1.0;
-
-    normals.col(i    ) << n1.x, n1.y, n1.z, 0.0;
-    normals.col(i + 1) << n2.x, n2.y, n2.z, 0.0;
-    normals.col(i + 2) << n3.x, n3.y, n3.z, 0.0;
-    
-    uvs.col(i    ) << uv1.x, uv1.y;
-    uvs.col(i + 1) << uv2.x, uv2.y;
-    uvs.col(i + 2) << uv3.x, uv3.y;
-    
-    tangents.col(i    ) << t1.x, t1.y, t1.z, 0.0;
-    tangents.col(i + 1) << t2.x, t2.y, t2.z, 0.0;
-    tangents.col(i + 2) << t3.x, t3.y, t3.z, 0.0;
+  if (num_vertices <= 65536) {
+    data->short_indices.resize(1, indices.size());
+    for (size_t k = 0; k < indices.size(); k++) data->short_indices(k) = (uint16_t) indices[k];
+  } else {
+    data->indices = Eigen::Map<Eigen::Matrix<uint32_t, 1, Eigen::Dynamic>>(indices.data(), 1, indices.size());
   }
+  return data;
 }
 
 void SphereMesh::draw_sphere(GLShader &shader, const Vector3D &p, double r) {
+  bind(shader);
+  draw(shader, p, r);
+  unbind(shader);
+}
 
-  Matrix4f model;
-  model << r, 0, 0, p.x, 0, r, 0, p.y, 0, 0, r, p.z, 0, 0, 0, 1;
-
-  shader.setUniform("u_model", model);
-
-
-  shader.uploadAttrib("in_position", positions);
+void SphereMesh::bind(GLShader &shader) {
+  // Integer attributes are uploaded normalized, so the shaders still read
+  // the same floats
+  shader.uploadAttrib("in_position", data->positions);
   if (shader.attrib("in_normal", false) != -1) {
-    shader.uploadAttrib("in_normal", normals);
+    shader.uploadAttrib("in_normal", data->normals.size(), 4, sizeof(uint16_t),
+                        GL_HALF_FLOAT, false, data->normals.data());
   }
   if (shader.attrib("in_uv", false) != -1) {
-    shader.uploadAttrib("in_uv", uvs);
+    shader.uploadAttrib("in_uv", data->uvs);
   }
   if (shader.attrib("in_tangent", false) != -1) {
-    shader.uploadAttrib("in_tangent", tangents, false);
+    shader.uploadAttrib("in_tangent", data->tangents.size(), 4, sizeof(uint16_t),
+                        GL_HALF_FLOAT, false, data->tangents.data());
   }
+  if (data->short_indices.size() > 0) {
+    shader.uploadIndices(data->short_indices);
+  } else {
+    shader.uploadIndices(data->indices);
+  }
+}
+
+void SphereMesh::draw(GLShader &shader, const Vector3D &p, double r) {
+  Matrix4f model;
+  model << r, 0, 0, p.x, 0, r, 0, p.y, 0, 0, r, p.z, 0, 0, 0, 1;
+
+  shader.setUniform("u_model", model);
+  // GLShader::drawIndexed only knows 32 bit indices
+  glDrawElements(GL_TRIANGLES, sphere_num_indices,
+                 data->short_indices.size() > 0 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, 0);
+}
 
-  shader.drawArray(GL_TRIANGLES, 0, sphere_num_indices);
+void SphereMesh::unbind(GLShader &shader) {
 #ifdef LEAK_PATCH_ON
   shader.freeAttrib("in_position");
+  shader.freeAttrib("indices");
   if (shader.attrib("in_normal", false) != -1) {
     shader.freeAttrib("in_normal");
   }
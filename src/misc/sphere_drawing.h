@@ -1,6 +1,8 @@
 #ifndef CGL_UTIL_SPHEREDRAWING_H
 #define CGL_UTIL_SPHEREDRAWING_H
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 #include <nanogui/nanogui.h>
@@ -23,24 +25,45 @@ public:
    * current modelview/projection matrices and color/material settings.
    */
   void draw_sphere(GLShader &shader, const Vector3D &p, double r);
+
+  /**
+   * Split version of draw_sphere for batched drawing: bind uploads the
+   * vertex data once, then draw can be called for every sphere sharing
+   * this mesh's level of detail before unbind.
+   */
+  void bind(GLShader &shader);
+  void draw(GLShader &shader, const Vector3D &p, double r);
+  void unbind(GLShader &shader);
+
+  // Meshes with the same level of detail have identical vertex data
+  int lod() const { return sphere_num_lat * 65536 + sphere_num_lon; }
 private:
-  std::vector<unsigned int> Indices;
-  std::vector<double> Vertices;
-  
-  int s_index(int x, int y);
-  
-  void build_data();
-  
+  /**
+   * The indexed mesh in a packed vertex format, 28 bytes per vertex:
+   * positions as normalized shorts, normals and tangents as half floats
+   * (their w has to stay exactly 0) and uvs as normalized unsigned shorts.
+   * Indices are shorts whenever the vertex count allows.
+   */
+  struct Data {
+    Eigen::Matrix<int16_t, 4, Eigen::Dynamic> positions;
+    Eigen::Matrix<uint16_t, 4, Eigen::Dynamic> normals;
+    Eigen::Matrix<uint16_t, 4, Eigen::Dynamic> tangents;
+    Eigen::Matrix<uint16_t, 2, Eigen::Dynamic> uvs;
+    Eigen::Matrix<uint16_t, 1, Eigen::Dynamic> short_indices;
+    Eigen::Matrix<uint32_t, 1, Eigen::Dynamic> indices;
+  };
+
+  // Shared by all meshes of the same level of detail
+  static std::shared_ptr<const Data> shared_data(int num_lat, int num_lon);
+  static std::shared_ptr<const Data> build_data(int num_lat, int num_lon);
+
   int sphere_num_lat;
   int sphere_num_lon;
   
   int sphere_num_vertices;
   int sphere_num_indices;
-  
-  MatrixXf positions;
-  MatrixXf normals;
-  MatrixXf uvs;
-  MatrixXf tangents;
+
+  std::shared_ptr<const Data> data;
 };
 
 
@@ -0,0 +1,94 @@
+#ifndef CS184_THREAD_POOL_H
+#define CS184_THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+
+/*
+  Fixed set of worker threads running queued tasks in submission order.
+  Unlike Parallel::parallel_for the caller does not wait: submit returns
+  immediately and wait() blocks until the queue has drained, or shrunk to
+  a given backlog so producers can be throttled. The destructor
+  finishes the queued tasks before joining the workers.
+*/
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned threads = Parallel::num_threads()) {
+    for (unsigned t = 0; t < std::max(threads, 1u); t++) {
+      workers.emplace_back([this]() { work(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    task_ready.notify_all();
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+      pending++;
+    }
+    task_ready.notify_one();
+  }
+
+  // Blocks until at most max_pending submitted tasks are unfinished
+  void wait(size_t max_pending = 0) {
+    std::unique_lock<std::mutex> lock(mutex);
+    task_done.wait(lock, [this, max_pending]() { return pending <= max_pending; });
+  }
+
+  // Tasks queued or running
+  size_t busy() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending;
+  }
+
+  size_t size() const { return workers.size(); }
+
+private:
+  void work() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        task_ready.wait(lock, [this]() { return stopping || !tasks.empty(); });
+        if (tasks.empty()) return;
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending--;
+      }
+      task_done.notify_all();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable task_ready;
+  std::condition_variable task_done;
+  size_t pending = 0;
+  bool stopping = false;
+};
+
+#endif // CS184_THREAD_POOL_H
@@ -0,0 +1,134 @@
+#include "orbitPreview.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "gravity/directSum.h"
+#include "integrators/ias15.h"
+#include "units.h"
+
+OrbitPreview::OrbitPreview() : worker([this]() { work(); }) {}
+
+OrbitPreview::~OrbitPreview() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    generation++;
+  }
+  wake.notify_all();
+  worker.join();
+}
+
+void OrbitPreview::request(std::shared_ptr<const Snapshot> snapshot, const Vector3D &x, const Vector3D &v,
+                           double m) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->snapshot = snapshot;
+    candidate_x = x;
+    candidate_v = v;
+    candidate_m = m;
+    requested = true;
+    generation++;
+    points.clear();
+    points_changed = true;
+    done = false;
+  }
+  wake.notify_all();
+}
+
+void OrbitPreview::cancel() {
+  std::lock_guard<std::mutex> lock(mutex);
+  requested = false;
+  generation++;
+  snapshot.reset();
+  points.clear();
+  points_changed = true;
+  done = false;
+}
+
+bool OrbitPreview::path(std::vector<Vector3D> &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!points_changed) return false;
+  path = points;
+  points_changed = false;
+  return true;
+}
+
+bool OrbitPreview::finished() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return done;
+}
+
+double OrbitPreview::orbit_period(const Snapshot &snapshot, const Vector3D &x, const Vector3D &v,
+                                  double m) const {
+  if (snapshot.m.empty()) return 1;
+  size_t center = std::max_element(snapshot.m.begin(), snapshot.m.end()) - snapshot.m.begin();
+  double mu = Units::G * (snapshot.m[center] + m);
+  Vector3D r = x - snapshot.x[center];
+  double distance = std::max(r.norm(), 1e-12);
+  double speed2 = (v - snapshot.v[center]).norm2();
+  // Vis-viva: 1 / a = 2 / r - v^2 / mu
+  double inverse_a = 2 / distance - speed2 / mu;
+  if (inverse_a > 0) {
+    double a = 1 / inverse_a;
+    return 2 * PI * sqrt(a * a * a / mu);
+  }
+  return 2 * PI * sqrt(distance * distance * distance / mu);
+}
+
+void OrbitPreview::work() {
+  while (true) {
+    std::shared_ptr<const Snapshot> state;
+    Vector3D x, v;
+    double m;
+    unsigned mine;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this]() { return stopping || requested; });
+      if (stopping) return;
+      requested = false;
+      state = snapshot;
+      x = candidate_x;
+      v = candidate_v;
+      m = candidate_m;
+      mine = generation;
+    }
+    if (state == nullptr) continue;
+
+    // The candidate goes last, so its position is the last one out
+    std::vector<Vector3D> start_x = state->x, start_v = state->v;
+    std::vector<double> masses = state->m;
+    start_x.push_back(x);
+    start_v.push_back(v);
+    masses.push_back(m);
+
+    IAS15 integrator(tolerance);
+    integrator.threads = 1;
+    DirectSum gravity(1);
+    integrator.load(start_x, start_v);
+    auto accelerations = [&](const std::vector<Vector3D> &positions, std::vector<Vector3D> &a) {
+      gravity.accelerations(positions, masses, a);
+    };
+
+    const int samples = std::max(orbits * samples_per_orbit, 1);
+    const double interval = orbit_period(*state, x, v, m) * orbits / samples;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (generation != mine) continue;
+      points.push_back(x);
+      points_changed = true;
+    }
+    bool cancelled = false;
+    for (int s = 0; s < samples && !cancelled; s++) {
+      integrator.integrate(interval, accelerations);
+      std::lock_guard<std::mutex> lock(mutex);
+      cancelled = generation != mine;
+      if (!cancelled) {
+        points.push_back(integrator.positions().back());
+        points_changed = true;
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!cancelled && generation == mine) done = true;
+  }
+}
@@ -0,0 +1,82 @@
+#ifndef CLOTHSIM_ORBIT_PREVIEW_H
+#define CLOTHSIM_ORBIT_PREVIEW_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "CGL/vector3D.h"
+
+using namespace CGL;
+
+/*
+  Predicts, on a worker thread, the path a body would take if it were added
+  to the galaxy now.
+
+  A request hands over a snapshot of the galaxy and the candidate body. The
+  snapshot is never written once made, so the viewer shares it with the
+  worker and only copies the galaxy again when it has moved on. The worker
+  integrates the snapshot plus the candidate with IAS15 for `orbits` of the
+  candidate's orbit and appends its position to the path as it goes, so
+  the viewer can draw the first part while the rest is computed. A new
+  request cancels the one in flight at its next sample.
+*/
+class OrbitPreview {
+public:
+  struct Snapshot {
+    std::vector<Vector3D> x, v;
+    std::vector<double> m;
+  };
+
+  OrbitPreview();
+  ~OrbitPreview();
+
+  OrbitPreview(const OrbitPreview &) = delete;
+  OrbitPreview &operator=(const OrbitPreview &) = delete;
+
+  // Starts predicting the candidate (internal units) in the snapshot,
+  // dropping the current path
+  void request(std::shared_ptr<const Snapshot> snapshot, const Vector3D &x, const Vector3D &v, double m);
+  // Stops the prediction in flight and clears the path
+  void cancel();
+
+  // Copies the path predicted so far. Returns false, leaving path alone,
+  // if it has not grown since the last call.
+  bool path(std::vector<Vector3D> &path);
+  // The latest request ran to the end
+  bool finished();
+
+  // Orbits of the candidate to predict, and points per orbit
+  int orbits = 3;
+  int samples_per_orbit = 128;
+  double tolerance = 1e-9;
+
+private:
+  void work();
+  // Time covered by one orbit of the candidate about the heaviest body, or
+  // the time to fall or fly past it if unbound
+  double orbit_period(const Snapshot &snapshot, const Vector3D &x, const Vector3D &v, double m) const;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  // Latest request, and a count of requests so stale work can tell
+  std::shared_ptr<const Snapshot> snapshot;
+  Vector3D candidate_x, candidate_v;
+  double candidate_m = 0;
+  bool requested = false;
+  std::atomic<unsigned> generation{0};
+
+  std::vector<Vector3D> points;
+  bool points_changed = false;
+  bool done = false;
+
+  // Declared last so it starts once the members above exist
+  std::thread worker;
+};
+
+#endif // CLOTHSIM_ORBIT_PREVIEW_H
@@ -1,8 +1,19 @@
 #include "png.h"
+#include "CGL/pngEncoder.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define CGL_PNG_SSE2 1
+  #include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -29,7 +40,9 @@ namespace CGL {
  *    misrepresented as being the original software.
  * 3. This notice may not be removed or altered from any source distribution.
  */
-int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
+// Full decoder, kept for the formats PNGReader does not handle (interlaced,
+// 16 bit and below 8 bit images). Always outputs RGBA.
+static int load_picopng(const unsigned char *buffer, size_t size, PNG& png) {
 
   static const unsigned long LENBASE[29] =  {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
   static const unsigned long LENEXTRA[29] = {0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0};
@@ -519,6 +532,723 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
   png.width = decoder.info.width;
   png.height = decoder.info.height;
 
+  return decoder.error;
+}
+
+// Row decoder //
+
+namespace {
+
+const unsigned char PNG_SIGNATURE[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+inline uint32_t read_u32( const unsigned char* p ) {
+  return ( (uint32_t) p[0] << 24 ) | ( (uint32_t) p[1] << 16 ) | ( (uint32_t) p[2] << 8 ) | p[3];
+}
+
+// Back references reach at most 32KB behind, and one match writes at most
+// 258 bytes past the point where the inflater is told to stop
+const size_t HISTORY = 32768;
+const size_t MAX_MATCH = 258;
+
+// Filtered bytes inflated per refill of the row window
+const size_t WINDOW_BATCH = 256 * 1024;
+
+const int FAST_BITS = 9;
+
+inline int bit_reverse( int value, int bits ) {
+  int reversed = 0;
+  for ( int i = 0; i < bits; i++ ) {
+    reversed = ( reversed << 1 ) | ( value & 1 );
+    value >>= 1;
+  }
+  return reversed;
+}
+
+// Canonical Huffman code. Codes up to FAST_BITS long are resolved with a
+// single table lookup, longer ones by comparing against the first code of
+// every length.
+struct Huffman {
+  uint16_t fast[1 << FAST_BITS]; // ( length << 9 ) | symbol, 0 for long codes
+  uint16_t first_code[16];
+  uint16_t first_symbol[16];
+  int max_code[17];              // first code past each length, left aligned to 16 bits
+  unsigned char size[288];
+  uint16_t value[288];
+
+  bool build( const unsigned char* lengths, int count ) {
+    int sizes[17] = { 0 }, next_code[16];
+    memset( fast, 0, sizeof( fast ) );
+    memset( size, 0, sizeof( size ) );
+    for ( int i = 0; i < count; i++ ) sizes[lengths[i]]++;
+    sizes[0] = 0;
+
+    int code = 0, symbol = 0;
+    for ( int len = 1; len < 16; len++ ) {
+      if ( sizes[len] > ( 1 << len ) ) return false;
+      next_code[len] = code;
+      first_code[len] = (uint16_t) code;
+      first_symbol[len] = (uint16_t) symbol;
+      code += sizes[len];
+      if ( sizes[len] && code - 1 >= ( 1 << len ) ) return false;
+      max_code[len] = code << ( 16 - len );
+      code <<= 1;
+      symbol += sizes[len];
+    }
+    max_code[16] = 0x10000;
+
+    for ( int i = 0; i < count; i++ ) {
+      int len = lengths[i];
+      if ( !len ) continue;
+      int c = next_code[len] - first_code[len] + first_symbol[len];
+      size[c] = (unsigned char) len;
+      value[c] = (uint16_t) i;
+      if ( len <= FAST_BITS ) {
+        // Deflate sends codes least significant bit first
+        for ( int j = bit_reverse( next_code[len], len ); j < ( 1 << FAST_BITS ); j += 1 << len ) {
+          fast[j] = (uint16_t) ( ( len << 9 ) | i );
+        }
+      }
+      next_code[len]++;
+    }
+    return true;
+  }
+};
+
+const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                   35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const unsigned char LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                         3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const unsigned char DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+                                       8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/**
+ * Zlib stream inflater that can stop between symbols.
+ * Output goes to a caller buffer that keeps at least the last 32KB written
+ * in front of the write position, so the caller can consume the output and
+ * slide the buffer down between calls.
+ */
+class Inflater {
+ public:
+
+  bool begin( const unsigned char* data, size_t size ) {
+    in = data;
+    end = data + size;
+    bits = 0;
+    count = 0;
+    padding = 0;
+    block = BLOCK_NONE;
+    last_block = false;
+    finished = false;
+    if ( size < 2 ) return false;
+    unsigned cmf = data[0], flg = data[1];
+    if ( ( cmf & 15 ) != 8 || ( cmf >> 4 ) > 7 || ( cmf * 256 + flg ) % 31 || ( flg & 32 ) ) return false;
+    in += 2;
+    return true;
+  }
+
+  /**
+   * Inflates into out from pos until pos reaches limit or the stream ends.
+   * out needs room for limit + MAX_MATCH bytes. Returns false on corrupt
+   * or truncated data.
+   */
+  bool run( unsigned char* out, size_t& pos, size_t limit ) {
+    while ( pos < limit && !finished ) {
+      if ( block == BLOCK_NONE ) {
+        if ( !read_block_header() ) return false;
+      } else if ( block == BLOCK_STORED ) {
+        size_t n = std::min( stored_left, std::min( limit - pos, (size_t) ( end - in ) ) );
+        if ( n == 0 ) return false;
+        memcpy( out + pos, in, n );
+        in += n;
+        pos += n;
+        stored_left -= n;
+        if ( !stored_left ) end_block();
+      } else if ( !inflate_block( out, pos, limit ) ) {
+        return false;
+      }
+    }
+    return !overrun();
+  }
+
+  bool done() const { return finished; }
+
+ private:
+
+  enum { BLOCK_NONE, BLOCK_STORED, BLOCK_HUFFMAN };
+
+  // Keeps at least 57 bits buffered; past the end of the input it shifts in
+  // zeros and counts them, so reading too far is caught by overrun()
+  void refill() {
+    while ( count <= 56 ) {
+      uint64_t byte = 0;
+      if ( in < end ) byte = *in++;
+      else padding++;
+      bits |= byte << count;
+      count += 8;
+    }
+  }
+
+  bool overrun() const { return padding * 8 > (size_t) count; }
+
+  unsigned get( int n ) {
+    if ( count < n ) refill();
+    unsigned v = (unsigned) ( bits & ( ( (uint64_t) 1 << n ) - 1 ) );
+    bits >>= n;
+    count -= n;
+    return v;
+  }
+
+  int decode( const Huffman& h ) {
+    if ( count < 16 ) refill();
+    int entry = h.fast[bits & ( ( 1 << FAST_BITS ) - 1 )];
+    if ( entry ) {
+      int len = entry >> 9;
+      bits >>= len;
+      count -= len;
+      return entry & 511;
+    }
+    int k = bit_reverse( (int) ( bits & 0xffff ), 16 ), len;
+    for ( len = FAST_BITS + 1; len < 16; len++ ) {
+      if ( k < h.max_code[len] ) break;
+    }
+    if ( len >= 16 ) return -1;
+    int c = ( k >> ( 16 - len ) ) - h.first_code[len] + h.first_symbol[len];
+    if ( c < 0 || c >= 288 || h.size[c] != len ) return -1;
+    bits >>= len;
+    count -= len;
+    return h.value[c];
+  }
+
+  void end_block() {
+    block = BLOCK_NONE;
+    finished = last_block;
+  }
+
+  bool read_block_header() {
+    if ( overrun() ) return false;
+    last_block = get( 1 ) != 0;
+    switch ( get( 2 ) ) {
+      case 0: {
+        get( count & 7 );
+        unsigned len = get( 16 ), nlen = get( 16 );
+        if ( ( len ^ 0xffff ) != nlen ) return false;
+        // Stored bytes are copied straight from the input, so hand the
+        // whole bytes still in the bit buffer back to it
+        size_t buffered = count / 8;
+        if ( buffered < padding ) return false;
+        in -= buffered - padding;
+        bits = 0;
+        count = 0;
+        padding = 0;
+        stored_left = len;
+        block = BLOCK_STORED;
+        if ( !len ) end_block();
+        return true;
+      }
+      case 1:
+        if ( !fixed_built ) build_fixed_tables();
+        lit = &fixed_lit;
+        dist = &fixed_dist;
+        block = BLOCK_HUFFMAN;
+        return true;
+      case 2:
+        if ( !read_dynamic_tables() ) return false;
+        lit = &dynamic_lit;
+        dist = &dynamic_dist;
+        block = BLOCK_HUFFMAN;
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  void build_fixed_tables() {
+    unsigned char lengths[288];
+    memset( lengths, 8, 144 );
+    memset( lengths + 144, 9, 112 );
+    memset( lengths + 256, 7, 24 );
+    memset( lengths + 280, 8, 8 );
+    fixed_lit.build( lengths, 288 );
+    memset( lengths, 5, 30 );
+    fixed_dist.build( lengths, 30 );
+    fixed_built = true;
+  }
+
+  bool read_dynamic_tables() {
+    static const unsigned char ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    int hlit = get( 5 ) + 257, hdist = get( 5 ) + 1, hclen = get( 4 ) + 4;
+    if ( hlit > 286 || hdist > 30 ) return false;
+
+    unsigned char code_lengths[19] = { 0 };
+    for ( int i = 0; i < hclen; i++ ) code_lengths[ORDER[i]] = (unsigned char) get( 3 );
+    Huffman length_code;
+    if ( !length_code.build( code_lengths, 19 ) ) return false;
+
+    unsigned char lengths[286 + 30];
+    int n = 0;
+    while ( n < hlit + hdist ) {
+      int sym = decode( length_code );
+      if ( sym < 0 ) return false;
+      if ( sym < 16 ) {
+        lengths[n++] = (unsigned char) sym;
+        continue;
+      }
+      unsigned char value = 0;
+      int repeat;
+      if ( sym == 16 ) {
+        if ( n == 0 ) return false;
+        value = lengths[n - 1];
+        repeat = 3 + get( 2 );
+      } else if ( sym == 17 ) {
+        repeat = 3 + get( 3 );
+      } else {
+        repeat = 11 + get( 7 );
+      }
+      if ( n + repeat > hlit + hdist ) return false;
+      memset( lengths + n, value, repeat );
+      n += repeat;
+    }
+    if ( lengths[256] == 0 ) return false;
+    return dynamic_lit.build( lengths, hlit ) && dynamic_dist.build( lengths + hlit, hdist );
+  }
+
+  bool inflate_block( unsigned char* out, size_t& pos, size_t limit ) {
+    while ( pos < limit ) {
+      // Enough for the longest length and distance codes with their extra bits
+      if ( count < 48 ) refill();
+      int sym = decode( *lit );
+      if ( sym < 256 ) {
+        if ( sym < 0 ) return false;
+        out[pos++] = (unsigned char) sym;
+        continue;
+      }
+      if ( sym == 256 ) {
+        end_block();
+        return true;
+      }
+      sym -= 257;
+      if ( sym >= 29 ) return false;
+      size_t length = LENGTH_BASE[sym] + get( LENGTH_EXTRA[sym] );
+      int d = decode( *dist );
+      if ( d < 0 || d >= 30 ) return false;
+      size_t distance = DIST_BASE[d] + get( DIST_EXTRA[d] );
+      if ( distance > pos ) return false;
+
+      unsigned char* dst = out + pos;
+      const unsigned char* src = dst - distance;
+      if ( distance >= length ) {
+        memcpy( dst, src, length );
+      } else if ( distance == 1 ) {
+        memset( dst, *src, length );
+      } else {
+        for ( size_t i = 0; i < length; i++ ) dst[i] = src[i];
+      }
+      pos += length;
+    }
+    return true;
+  }
+
+  const unsigned char* in;
+  const unsigned char* end;
+  uint64_t bits;
+  int count;
+  size_t padding;
+
+  int block;
+  bool last_block;
+  bool finished;
+  size_t stored_left;
+
+  bool fixed_built = false;
+  Huffman fixed_lit, fixed_dist;
+  Huffman dynamic_lit, dynamic_dist;
+  const Huffman* lit;
+  const Huffman* dist;
+};
+
+//------------------------------------------------------------------------------
+// Unfiltering
+//------------------------------------------------------------------------------
+
+enum { FILTER_NONE = 0, FILTER_SUB, FILTER_UP, FILTER_AVERAGE, FILTER_PAETH };
+
+inline unsigned char paeth( int a, int b, int c ) {
+  int pa = std::abs( b - c ), pb = std::abs( a - c ), pc = std::abs( a + b - 2 * c );
+  if ( pa <= pb && pa <= pc ) return (unsigned char) a;
+  return (unsigned char) ( pb <= pc ? b : c );
+}
+
+// Reconstructs bytes [begin, n) of dst from the filtered bytes in src
+void unfilter_scalar( int type, unsigned char* dst, const unsigned char* src,
+                      const unsigned char* prior, size_t begin, size_t n, size_t bpp ) {
+  for ( size_t i = begin; i < n; i++ ) {
+    int a = i >= bpp ? dst[i - bpp] : 0;
+    int c = i >= bpp ? prior[i - bpp] : 0;
+    int b = prior[i];
+    switch ( type ) {
+      case FILTER_SUB:     dst[i] = src[i] + a; break;
+      case FILTER_UP:      dst[i] = src[i] + b; break;
+      case FILTER_AVERAGE: dst[i] = src[i] + ( ( a + b ) >> 1 ); break;
+      case FILTER_PAETH:   dst[i] = src[i] + paeth( a, b, c ); break;
+      default:             dst[i] = src[i]; break;
+    }
+  }
+}
+
+#if defined(CGL_PNG_SSE2)
+
+inline __m128i abs16( __m128i x ) {
+  return _mm_max_epi16( x, _mm_sub_epi16( _mm_setzero_si128(), x ) );
+}
+
+// Paeth predictor on eight 16 bit lanes
+inline __m128i paeth16( __m128i a, __m128i b, __m128i c ) {
+  __m128i bc = _mm_sub_epi16( b, c ), ac = _mm_sub_epi16( a, c );
+  __m128i pa = abs16( bc ), pb = abs16( ac ), pc = abs16( _mm_add_epi16( bc, ac ) );
+  __m128i not_a = _mm_or_si128( _mm_cmpgt_epi16( pa, pb ), _mm_cmpgt_epi16( pa, pc ) );
+  __m128i not_b = _mm_cmpgt_epi16( pb, pc );
+  __m128i b_or_c = _mm_or_si128( _mm_andnot_si128( not_b, b ), _mm_and_si128( not_b, c ) );
+  return _mm_or_si128( _mm_andnot_si128( not_a, a ), _mm_and_si128( not_a, b_or_c ) );
+}
+
+inline __m128i load_pixel( const unsigned char* p, size_t bpp ) {
+  int v = 0;
+  memcpy( &v, p, bpp );
+  return _mm_cvtsi32_si128( v );
+}
+
+inline void store_pixel( unsigned char* p, __m128i v, size_t bpp ) {
+  int x = _mm_cvtsi128_si32( v );
+  memcpy( p, &x, bpp );
+}
+
+// Sub, average and Paeth depend on the pixel just reconstructed, so they
+// run one pixel per step with the channels in parallel. Up has no such
+// dependency and runs 16 bytes per step for any pixel size.
+bool unfilter_row( int type, unsigned char* dst, const unsigned char* src,
+                   const unsigned char* prior, size_t n, size_t bpp ) {
+  const __m128i zero = _mm_setzero_si128();
+  switch ( type ) {
+    case FILTER_NONE:
+      memcpy( dst, src, n );
+      return true;
+    case FILTER_UP: {
+      size_t i = 0;
+      for ( ; i + 16 <= n; i += 16 ) {
+        __m128i x = _mm_loadu_si128( (const __m128i*) ( src + i ) );
+        __m128i b = _mm_loadu_si128( (const __m128i*) ( prior + i ) );
+        _mm_storeu_si128( (__m128i*) ( dst + i ), _mm_add_epi8( x, b ) );
+      }
+      unfilter_scalar( type, dst, src, prior, i, n, bpp );
+      return true;
+    }
+    case FILTER_SUB:
+    case FILTER_AVERAGE:
+    case FILTER_PAETH:
+      break;
+    default:
+      return false;
+  }
+
+  if ( bpp < 3 ) {
+    unfilter_scalar( type, dst, src, prior, 0, n, bpp );
+    return true;
+  }
+
+  __m128i a = zero;
+  if ( type == FILTER_SUB ) {
+    for ( size_t i = 0; i < n; i += bpp ) {
+      a = _mm_add_epi8( a, load_pixel( src + i, bpp ) );
+      store_pixel( dst + i, a, bpp );
+    }
+  } else if ( type == FILTER_AVERAGE ) {
+    // avg_epu8 rounds up, the PNG average rounds down
+    const __m128i one = _mm_set1_epi8( 1 );
+    for ( size_t i = 0; i < n; i += bpp ) {
+      __m128i b = load_pixel( prior + i, bpp );
+      __m128i avg = _mm_sub_epi8( _mm_avg_epu8( a, b ), _mm_and_si128( _mm_xor_si128( a, b ), one ) );
+      a = _mm_add_epi8( load_pixel( src + i, bpp ), avg );
+      store_pixel( dst + i, a, bpp );
+    }
+  } else {
+    // a, b and c stay widened to 16 bits between pixels
+    __m128i c = zero;
+    for ( size_t i = 0; i < n; i += bpp ) {
+      __m128i b = _mm_unpacklo_epi8( load_pixel( prior + i, bpp ), zero );
+      __m128i p = paeth16( a, b, c );
+      __m128i x = _mm_add_epi8( load_pixel( src + i, bpp ), _mm_packus_epi16( p, p ) );
+      store_pixel( dst + i, x, bpp );
+      a = _mm_unpacklo_epi8( x, zero );
+      c = b;
+    }
+  }
+  return true;
+}
+
+#else
+
+bool unfilter_row( int type, unsigned char* dst, const unsigned char* src,
+                   const unsigned char* prior, size_t n, size_t bpp ) {
+  if ( type > FILTER_PAETH ) return false;
+  unfilter_scalar( type, dst, src, prior, 0, n, bpp );
+  return true;
+}
+
+#endif // CGL_PNG_SSE2
+
+} // namespace
+
+struct PNGReader::State {
+  PNGInfo info;
+  bool supported = false;
+  size_t bpp = 0;
+  size_t row_bytes = 0;
+
+  // RGBA palette and transparent color key from PLTE and tRNS
+  unsigned char palette[256 * 4];
+  bool has_key = false;
+  int key[3];
+
+  // Image data, joined only when it is split over several IDAT chunks
+  const unsigned char* data = nullptr;
+  size_t data_size = 0;
+  std::vector<unsigned char> joined;
+
+  // Filtered rows waiting to be unfiltered, behind 32KB of history
+  Inflater inflater;
+  bool started = false;
+  bool failed = false;
+  std::vector<unsigned char> window;
+  size_t window_used = 0;
+  size_t row_start = 0;
+  size_t batch = 0;
+
+  // Two unfiltered rows, for formats that have to be converted
+  std::vector<unsigned char> scratch;
+  int rows = 0;
+
+  // Writes one unfiltered row in the file's layout as RGB or RGBA
+  void convert_row( const unsigned char* row, unsigned char* out, int channels ) const {
+    const bool alpha = channels == 4;
+    for ( int x = 0; x < info.width; x++, out += channels ) {
+      unsigned char a = 255;
+      switch ( info.color_type ) {
+        case 0: {
+          const unsigned char* p = row + x;
+          out[0] = out[1] = out[2] = p[0];
+          if ( has_key && p[0] == key[0] ) a = 0;
+          break;
+        }
+        case 2: {
+          const unsigned char* p = row + 3 * x;
+          out[0] = p[0]; out[1] = p[1]; out[2] = p[2];
+          if ( has_key && p[0] == key[0] && p[1] == key[1] && p[2] == key[2] ) a = 0;
+          break;
+        }
+        case 3: {
+          const unsigned char* p = palette + 4 * row[x];
+          out[0] = p[0]; out[1] = p[1]; out[2] = p[2];
+          a = p[3];
+          break;
+        }
+        case 4: {
+          const unsigned char* p = row + 2 * x;
+          out[0] = out[1] = out[2] = p[0];
+          a = p[1];
+          break;
+        }
+        case 6: {
+          const unsigned char* p = row + 4 * x;
+          out[0] = p[0]; out[1] = p[1]; out[2] = p[2];
+          a = p[3];
+          break;
+        }
+      }
+      if ( alpha ) out[3] = a;
+    }
+  }
+};
+
+PNGReader::PNGReader() : state( new State() ) { }
+
+PNGReader::~PNGReader() {
+  delete state;
+}
+
+int PNGReader::open( const unsigned char* buffer, size_t size ) {
+  delete state;
+  state = new State();
+  State& s = *state;
+
+  if ( size < 8 + 25 ) return 27;
+  if ( memcmp( buffer, PNG_SIGNATURE, 8 ) ) return 28;
+
+  std::vector<std::pair<const unsigned char*, size_t> > idat;
+  bool header = false;
+  for ( size_t pos = 8; pos + 12 <= size; ) {
+    size_t len = read_u32( buffer + pos );
+    const unsigned char* type = buffer + pos + 4;
+    const unsigned char* payload = buffer + pos + 8;
+    if ( len > size - pos - 12 ) return 63;
+
+    if ( !memcmp( type, "IHDR", 4 ) ) {
+      if ( len < 13 ) return 27;
+      s.info.width = (int) read_u32( payload );
+      s.info.height = (int) read_u32( payload + 4 );
+      s.info.bit_depth = payload[8];
+      s.info.color_type = payload[9];
+      s.info.interlaced = payload[12] != 0;
+      if ( s.info.width <= 0 || s.info.height <= 0 ) return 29;
+      if ( payload[10] != 0 ) return 32;
+      if ( payload[11] != 0 ) return 33;
+      header = true;
+    } else if ( !header ) {
+      return 29;
+    } else if ( !memcmp( type, "PLTE", 4 ) ) {
+      size_t entries = std::min<size_t>( len / 3, 256 );
+      for ( size_t i = 0; i < entries; i++ ) {
+        memcpy( s.palette + 4 * i, payload + 3 * i, 3 );
+        s.palette[4 * i + 3] = 255;
+      }
+    } else if ( !memcmp( type, "tRNS", 4 ) ) {
+      if ( s.info.color_type == 3 ) {
+        for ( size_t i = 0; i < len && i < 256; i++ ) s.palette[4 * i + 3] = payload[i];
+      } else if ( s.info.color_type == 0 && len >= 2 ) {
+        s.has_key = true;
+        s.key[0] = 256 * payload[0] + payload[1];
+      } else if ( s.info.color_type == 2 && len >= 6 ) {
+        s.has_key = true;
+        for ( int c = 0; c < 3; c++ ) s.key[c] = 256 * payload[2 * c] + payload[2 * c + 1];
+      }
+    } else if ( !memcmp( type, "IDAT", 4 ) ) {
+      idat.push_back( std::make_pair( payload, len ) );
+    } else if ( !memcmp( type, "IEND", 4 ) ) {
+      break;
+    }
+    pos += 12 + len;
+  }
+  if ( !header ) return 29;
+  if ( idat.empty() ) return 48;
+
+  if ( idat.size() == 1 ) {
+    s.data = idat[0].first;
+    s.data_size = idat[0].second;
+  } else {
+    for ( size_t i = 0; i < idat.size(); i++ ) {
+      s.joined.insert( s.joined.end(), idat[i].first, idat[i].first + idat[i].second );
+    }
+    s.data = s.joined.data();
+    s.data_size = s.joined.size();
+  }
+
+  static const int CHANNELS[7] = { 1, 0, 3, 1, 2, 0, 4 };
+  int type = s.info.color_type;
+  s.supported = s.info.bit_depth == 8 && !s.info.interlaced
+                && type >= 0 && type <= 6 && CHANNELS[type] > 0;
+  if ( s.supported ) {
+    s.bpp = CHANNELS[type];
+    s.row_bytes = s.bpp * s.info.width;
+  }
+  return 0;
+}
+
+const PNGInfo& PNGReader::info() const {
+  return state->info;
+}
+
+bool PNGReader::supported() const {
+  return state->supported;
+}
+
+int PNGReader::rows_decoded() const {
+  return state->rows;
+}
+
+int PNGReader::decode_rows( unsigned char* out, size_t stride, int channels, int max_rows ) {
+  State& s = *state;
+  if ( !s.supported || s.failed || ( channels != 3 && channels != 4 ) ) return -1;
+
+  const size_t line = s.row_bytes + 1;
+  if ( !s.started ) {
+    if ( !s.inflater.begin( s.data, s.data_size ) ) {
+      s.failed = true;
+      return -1;
+    }
+    s.batch = std::max<size_t>( WINDOW_BATCH / line, 1 ) * line;
+    s.window.resize( HISTORY + line + s.batch + MAX_MATCH );
+    s.scratch.assign( 2 * s.row_bytes, 0 );
+    s.started = true;
+  }
+
+  // Rows already in the output layout are unfiltered in place, using the
+  // row above in the output as the prior row
+  const bool direct = ( s.info.color_type == 2 && channels == 3 )
+                      || ( s.info.color_type == 6 && channels == 4 );
+
+  int decoded = 0;
+  while ( decoded < max_rows && s.rows < s.info.height ) {
+    if ( s.window_used - s.row_start < line ) {
+      if ( s.inflater.done() ) {
+        s.failed = true;
+        return -1;
+      }
+      // Drop the consumed rows, keeping the history back references need
+      size_t keep_from = std::min( s.row_start, s.window_used > HISTORY ? s.window_used - HISTORY : 0 );
+      if ( keep_from ) {
+        memmove( &s.window[0], &s.window[keep_from], s.window_used - keep_from );
+        s.window_used -= keep_from;
+        s.row_start -= keep_from;
+      }
+      if ( !s.inflater.run( &s.window[0], s.window_used, s.window_used + s.batch ) ) {
+        s.failed = true;
+        return -1;
+      }
+      continue;
+    }
+
+    const unsigned char* src = &s.window[s.row_start];
+    unsigned char* dst = out + (size_t) s.rows * stride;
+    bool ok;
+    if ( direct ) {
+      const unsigned char* prior = s.rows ? dst - stride : &s.scratch[0];
+      ok = unfilter_row( src[0], dst, src + 1, prior, s.row_bytes, s.bpp );
+    } else {
+      unsigned char* cur = &s.scratch[( s.rows & 1 ) * s.row_bytes];
+      const unsigned char* prior = &s.scratch[( ~s.rows & 1 ) * s.row_bytes];
+      ok = unfilter_row( src[0], cur, src + 1, prior, s.row_bytes, s.bpp );
+      s.convert_row( cur, dst, channels );
+    }
+    if ( !ok ) {
+      s.failed = true;
+      return -1;
+    }
+    s.row_start += line;
+    s.rows++;
+    decoded++;
+  }
+  return decoded;
+}
+
+// PNGParser //
+
+int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
+
+  // Common formats go through the row decoder, the rest through picoPNG
+  PNGReader reader;
+  int error = reader.open(buffer, size);
+  if (!error && reader.supported()) {
+    png.width = reader.info().width;
+    png.height = reader.info().height;
+    png.pixels.resize((size_t) png.width * png.height * 4);
+    if (reader.decode_rows(&png.pixels[0], (size_t) png.width * 4, 4, png.height) != png.height) {
+      error = -1;
+    }
+  } else {
+    error = load_picopng(buffer, size, png);
+  }
+
   // premultiply by alpha
   for (size_t i = 0; i < png.pixels.size(); i+= 4) {
     if( ! png.pixels[i + 3] ) {
@@ -528,7 +1258,32 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
     }
   }
 
-  return decoder.error;
+  return error;
+}
+
+int PNGParser::decode(const unsigned char *buffer, size_t size,
+                      unsigned char *out, size_t stride, int channels) {
+  if (channels != 3 && channels != 4) return -1;
+
+  PNGReader reader;
+  int error = reader.open(buffer, size);
+  if (error) return error;
+  if (reader.supported()) {
+    int height = reader.info().height;
+    return reader.decode_rows(out, stride, channels, height) == height ? 0 : -1;
+  }
+
+  PNG png;
+  error = load_picopng(buffer, size, png);
+  if (error) return error;
+  for (int y = 0; y < png.height; y++) {
+    const unsigned char *src = &png.pixels[(size_t) y * png.width * 4];
+    unsigned char *dst = out + (size_t) y * stride;
+    for (int x = 0; x < png.width; x++) {
+      for (int c = 0; c < channels; c++) dst[channels * x + c] = src[4 * x + c];
+    }
+  }
+  return 0;
 }
 
 int PNGParser::load(const char* filename, PNG& png) {
@@ -555,7 +1310,8 @@ int PNGParser::load(const char* filename, PNG& png) {
 }
 
 int PNGParser::save(const char *filename, const PNG& png) {
-  return 0;
+  PNGEncoder encoder(PNGEncoder::DEFAULT);
+  return encoder.save(filename, &png.pixels[0], png.width, png.height, 4) ? 0 : -1;
 }
 
 
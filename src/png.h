@@ -1,6 +1,7 @@
 #ifndef CGL_PNG_H
 #define CGL_PNG_H
 
+#include <cstddef>
 #include <map>
 #include <vector>
 
@@ -12,11 +13,69 @@ namespace CGL {
     std::vector<unsigned char> pixels;
   }; // class PNG
 
+  struct PNGInfo {
+    int width;
+    int height;
+    int bit_depth;
+    int color_type;
+    bool interlaced;
+  }; // struct PNGInfo
+
+  /**
+   * Row by row PNG decoder.
+   * The image data is inflated only as far as the rows asked for, and every
+   * row is unfiltered straight into the caller's buffer, so the top of an
+   * image can be used (uploaded to GL, say) while the rest is still
+   * compressed. Handles non interlaced 8 bit gray, gray alpha, RGB, RGBA and
+   * palette images; PNGParser falls back to its full decoder for the rest.
+   */
+  class PNGReader {
+  public:
+    PNGReader();
+    ~PNGReader();
+
+    /**
+     * Reads the chunk layout. The buffer must outlive the reader.
+     * Returns 0 or an error code.
+     */
+    int open( const unsigned char* buffer, size_t size );
+
+    const PNGInfo& info() const;
+
+    // True when decode_rows can decode the opened image
+    bool supported() const;
+
+    /**
+     * Decodes up to max_rows more rows as 8 bit RGB (channels = 3) or RGBA
+     * (channels = 4). Row y goes to out + y * stride, and the previous row
+     * must still be there when the next call is made. Returns the number of
+     * rows decoded, 0 once every row is done and -1 on corrupt data.
+     */
+    int decode_rows( unsigned char* out, size_t stride, int channels, int max_rows );
+
+    int rows_decoded() const;
+
+  private:
+    PNGReader( const PNGReader& ) = delete;
+    PNGReader& operator=( const PNGReader& ) = delete;
+
+    struct State;
+    State* state;
+  }; // class PNGReader
+
   class PNGParser {
   public:
     static int load( const unsigned char* buffer, size_t size, PNG& png );
     static int load( const char* filename, PNG& png );
     static int save( const char* filename, const PNG& png );
+
+    /**
+     * Decodes into caller memory: height rows of RGB (channels = 3) or RGBA
+     * (channels = 4) pixels, stride bytes apart. Use PNGReader::open to read
+     * the size first.
+     */
+    static int decode( const unsigned char* buffer, size_t size,
+                       unsigned char* out, size_t stride, int channels );
   }; // class PNGParser
 
 } // namespace CGL
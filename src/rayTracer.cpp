@@ -0,0 +1,326 @@
+#include "rayTracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+
+#include "CGL/pngEncoder.h"
+#include "misc/exr_file.h"
+#include "misc/parallel.h"
+#include "misc/stb_image.h"
+
+// Ray tracer hits closer than this, relative to the body radius, are
+// taken as the surface the ray starts on
+#define RT_EPSILON 1e-9
+
+// Bodies per BVH leaf
+#define RT_LEAF_SIZE 4
+
+static const double INF = std::numeric_limits<double>::infinity();
+
+// What the viewer clears to, as a linear color
+static const Vector3D BACKGROUND(0.0508, 0.0508, 0.0508);
+
+static double srgb_to_linear(double c) {
+  return c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+}
+
+static double linear_to_srgb(double c) {
+  c = std::min(std::max(c, 0.0), 1.0);
+  return c <= 0.0031308 ? c * 12.92 : 1.055 * pow(c, 1 / 2.4) - 0.055;
+}
+
+static const float *srgb_table() {
+  static const std::vector<float> table = []() {
+    std::vector<float> t(256);
+    for (int i = 0; i < 256; i++) t[i] = (float) srgb_to_linear(i / 255.0);
+    return t;
+  }();
+  return table.data();
+}
+
+// Uniform value in [0, 1) from an integer, for the pixel jitter
+static double hash01(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352dU;
+  x ^= x >> 15;
+  x *= 0x846ca68bU;
+  x ^= x >> 16;
+  return x / 4294967296.0;
+}
+
+bool RayTracer::Image::load(const std::string &path) {
+  int n;
+  unsigned char *data = stbi_load(path.c_str(), &width, &height, &n, 3);
+  if (data == nullptr) return false;
+  texels.assign(data, data + (size_t) width * height * 3);
+  stbi_image_free(data);
+  return true;
+}
+
+Vector3D RayTracer::Image::sample(double u, double v, bool wrap_u) const {
+  const float *linear = srgb_table();
+  double x = u * width - 0.5, y = v * height - 0.5;
+  int x0 = (int) floor(x), y0 = (int) floor(y);
+  double fx = x - x0, fy = y - y0;
+
+  Vector3D corners[4];
+  for (int i = 0; i < 4; i++) {
+    int tx = x0 + (i & 1), ty = y0 + (i >> 1);
+    tx = wrap_u ? ((tx % width) + width) % width : std::min(std::max(tx, 0), width - 1);
+    ty = std::min(std::max(ty, 0), height - 1);
+    const unsigned char *p = &texels[((size_t) ty * width + tx) * 3];
+    corners[i] = Vector3D(linear[p[0]], linear[p[1]], linear[p[2]]);
+  }
+  return (corners[0] * (1 - fx) + corners[1] * fx) * (1 - fy)
+         + (corners[2] * (1 - fx) + corners[3] * fx) * fy;
+}
+
+RayTracer::RayTracer(const std::string &texture_directory)
+: texture_directory(texture_directory) {}
+
+void RayTracer::set_skybox(const std::vector<std::string> &face_paths) {
+  has_skybox = face_paths.size() == 6;
+  for (size_t face = 0; face < face_paths.size() && face < 6; face++) {
+    if (!skybox[face].load(face_paths[face])) {
+      std::cout << "Error: could not decode skybox face " << face_paths[face] << std::endl;
+      has_skybox = false;
+    }
+  }
+}
+
+const RayTracer::Image *RayTracer::texture(const std::string &tex_file) {
+  auto found = images.find(tex_file);
+  if (found == images.end()) {
+    Image image;
+    if (!image.load(texture_directory + "/" + tex_file)) {
+      std::cout << "Error: could not decode texture " << tex_file << std::endl;
+    }
+    found = images.insert(std::make_pair(tex_file, std::move(image))).first;
+  }
+  if (found->second.width > 0) return &found->second;
+
+  // Like Galaxy::setTextures, a missing texture falls back to any other
+  for (const auto &entry : images) {
+    if (entry.second.width > 0) return &entry.second;
+  }
+  return nullptr;
+}
+
+void RayTracer::gather_bodies(Galaxy &galaxy) {
+  bodies.clear();
+  auto add = [this](Sphere *s) {
+    Body body;
+    body.center = s->renderPosition();
+    body.scale = s->renderRadius();
+    body.radius = std::abs(body.scale);
+    body.image = texture(s->getTexFile());
+    if (body.radius > 0) bodies.push_back(body);
+  };
+  for (Sphere *s : *galaxy.planets) add(s);
+  if (galaxy.asteroids != nullptr) {
+    for (Sphere *a : *galaxy.asteroids) add(a);
+  }
+}
+
+int RayTracer::build_node(int first, int count) {
+  int index = (int) nodes.size();
+  nodes.push_back(Node());
+
+  Vector3D lo(INF), hi(-INF), center_lo(INF), center_hi(-INF);
+  for (int i = first; i < first + count; i++) {
+    const Body &b = bodies[i];
+    for (int axis = 0; axis < 3; axis++) {
+      lo[axis] = std::min(lo[axis], b.center[axis] - b.radius);
+      hi[axis] = std::max(hi[axis], b.center[axis] + b.radius);
+      center_lo[axis] = std::min(center_lo[axis], b.center[axis]);
+      center_hi[axis] = std::max(center_hi[axis], b.center[axis]);
+    }
+  }
+  nodes[index].min = lo;
+  nodes[index].max = hi;
+
+  if (count <= RT_LEAF_SIZE) {
+    nodes[index].first = first;
+    nodes[index].count = count;
+    nodes[index].right = -1;
+    return index;
+  }
+
+  // Median split along the widest spread of centers
+  Vector3D extent = center_hi - center_lo;
+  int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+  int half = count / 2;
+  std::nth_element(bodies.begin() + first, bodies.begin() + first + half, bodies.begin() + first + count,
+                   [axis](const Body &a, const Body &b) { return a.center[axis] < b.center[axis]; });
+
+  build_node(first, half);
+  int right = build_node(first + half, count - half);
+  nodes[index].first = first;
+  nodes[index].count = 0;
+  nodes[index].right = right;
+  return index;
+}
+
+bool RayTracer::intersect(const Vector3D &origin, const Vector3D &dir, int &body, double &t) const {
+  body = -1;
+  t = INF;
+  if (nodes.empty()) return false;
+
+  const Vector3D inv(1 / dir.x, 1 / dir.y, 1 / dir.z);
+  int stack[64];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    int index = stack[--top];
+    const Node &node = nodes[index];
+
+    // Slab test against the box, skipped when it starts past the best hit
+    double t0 = 0, t1 = t;
+    for (int axis = 0; axis < 3; axis++) {
+      double near_t = (node.min[axis] - origin[axis]) * inv[axis];
+      double far_t = (node.max[axis] - origin[axis]) * inv[axis];
+      if (near_t > far_t) std::swap(near_t, far_t);
+      t0 = std::max(t0, near_t);
+      t1 = std::min(t1, far_t);
+    }
+    if (t0 > t1) continue;
+
+    if (node.count == 0) {
+      stack[top++] = node.right;
+      stack[top++] = index + 1;
+      continue;
+    }
+    for (int i = node.first; i < node.first + node.count; i++) {
+      const Body &b = bodies[i];
+      Vector3D oc = origin - b.center;
+      double half_b = dot(oc, dir);
+      double c = dot(oc, oc) - b.radius * b.radius;
+      double disc = half_b * half_b - c;
+      if (disc < 0) continue;
+      double root = sqrt(disc);
+      double eps = RT_EPSILON * b.radius;
+      double hit = -half_b - root;
+      if (hit <= eps) hit = -half_b + root;
+      if (hit > eps && hit < t) {
+        t = hit;
+        body = i;
+      }
+    }
+  }
+  return body >= 0;
+}
+
+Vector3D RayTracer::sky(const Vector3D &dir) const {
+  if (!has_skybox) return BACKGROUND;
+
+  // Face selection and face coordinates as GL does for cubemaps
+  double ax = std::abs(dir.x), ay = std::abs(dir.y), az = std::abs(dir.z);
+  int face;
+  double sc, tc, ma;
+  if (ax >= ay && ax >= az) {
+    face = dir.x > 0 ? 0 : 1;
+    sc = dir.x > 0 ? -dir.z : dir.z;
+    tc = -dir.y;
+    ma = ax;
+  } else if (ay >= az) {
+    face = dir.y > 0 ? 2 : 3;
+    sc = dir.x;
+    tc = dir.y > 0 ? dir.z : -dir.z;
+    ma = ay;
+  } else {
+    face = dir.z > 0 ? 4 : 5;
+    sc = dir.z > 0 ? dir.x : -dir.x;
+    tc = -dir.y;
+    ma = az;
+  }
+  return skybox[face].sample((sc / ma + 1) / 2, (tc / ma + 1) / 2, false);
+}
+
+Vector3D RayTracer::shade(const Vector3D &origin, const Vector3D &dir) const {
+  int index;
+  double t;
+  if (!intersect(origin, dir, index, t)) return sky(dir);
+
+  const Body &b = bodies[index];
+  if (b.image == nullptr) return Vector3D(0.5);
+
+  // Point on the unit sphere mesh, then SphereMesh's parameterization
+  // inverted: v runs down from the +y pole, u around from the seam, which
+  // the mesh turns half a revolution away from +z
+  Vector3D n = (origin + dir * t - b.center) / b.scale;
+  double v = acos(std::min(std::max(n.y, -1.0), 1.0)) / PI;
+  double u = atan2(n.x, n.z) / (2 * PI) - 0.5;
+  u -= floor(u);
+  return b.image->sample(u, v, true);
+}
+
+void RayTracer::render(const Camera &camera, Galaxy &galaxy, int width, int height,
+                       std::vector<float> &pixels) {
+  gather_bodies(galaxy);
+  nodes.clear();
+  if (!bodies.empty()) build_node(0, (int) bodies.size());
+
+  // The camera frame, built like Camera::view_matrix
+  const Vector3D eye = camera.position();
+  const Vector3D z_axis = (eye - camera.view_point()).unit();
+  const Vector3D x_axis = cross(camera.up_dir(), z_axis).unit();
+  const Vector3D y_axis = cross(z_axis, x_axis);
+  const double tan_half = tan(camera.v_fov() * PI / 360);
+  const double aspect = (double) width / height;
+
+  pixels.assign((size_t) width * height * 3, 0);
+  const int n = std::max(samples_per_axis, 1);
+  const int tiles_x = (width + tile_size - 1) / tile_size;
+  const int tiles = tiles_x * ((height + tile_size - 1) / tile_size);
+
+  // Threads take tiles from a shared counter, so a tile full of bodies
+  // does not hold up a whole band of the image
+  std::atomic<int> next_tile(0);
+  Parallel::parallel_for(Parallel::num_threads(), [&](size_t, size_t, unsigned) {
+    for (int tile = next_tile++; tile < tiles; tile = next_tile++) {
+      int x0 = (tile % tiles_x) * tile_size, y0 = (tile / tiles_x) * tile_size;
+      int x1 = std::min(x0 + tile_size, width), y1 = std::min(y0 + tile_size, height);
+      for (int py = y0; py < y1; py++) {
+        for (int px = x0; px < x1; px++) {
+          uint32_t seed = (uint32_t) (((size_t) py * width + px) * n * n);
+          Vector3D color;
+          for (int s = 0; s < n * n; s++) {
+            double sx = px + (s % n + hash01(2 * (seed + s))) / n;
+            double sy = py + (s / n + hash01(2 * (seed + s) + 1)) / n;
+            double ndc_x = 2 * sx / width - 1, ndc_y = 1 - 2 * sy / height;
+            Vector3D dir = (x_axis * (ndc_x * tan_half * aspect) + y_axis * (ndc_y * tan_half) - z_axis).unit();
+            color += shade(eye, dir);
+          }
+          color /= n * n;
+          float *out = &pixels[((size_t) py * width + px) * 3];
+          out[0] = (float) color.x;
+          out[1] = (float) color.y;
+          out[2] = (float) color.z;
+        }
+      }
+    }
+  });
+}
+
+bool RayTracer::save_png(const std::string &path, const std::vector<float> &pixels, int width, int height) {
+  std::vector<unsigned char> bytes(pixels.size());
+  for (size_t i = 0; i < pixels.size(); i++) {
+    bytes[i] = (unsigned char) (linear_to_srgb(pixels[i]) * 255 + 0.5);
+  }
+  return CGL::PNGEncoder(CGL::PNGEncoder::DEFAULT).save(path, bytes.data(), width, height, 3);
+}
+
+bool RayTracer::save_exr(const std::string &path, const std::vector<float> &pixels, int width, int height) {
+  const size_t plane = (size_t) width * height;
+  std::vector<float> planes(3 * plane);
+  for (size_t i = 0; i < plane; i++) {
+    planes[i] = pixels[3 * i + 2];
+    planes[i + plane] = pixels[3 * i + 1];
+    planes[i + 2 * plane] = pixels[3 * i];
+  }
+  return ExrFile::save_float(path, planes.data(), width, height);
+}
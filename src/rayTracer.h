@@ -0,0 +1,84 @@
+#ifndef CLOTHSIM_RAY_TRACER_H
+#define CLOTHSIM_RAY_TRACER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "galaxy.h"
+
+/*
+  CPU renderer for stills and videos on machines without a GPU.
+
+  Every body is intersected analytically as the sphere the viewer draws
+  (see Sphere::renderPosition), through a BVH rebuilt each frame, and
+  textured with the same spherical mapping as SphereMesh. Rays that miss
+  sample the skybox cubemap. The image is cut into tiles that the threads
+  take from a shared counter, and every pixel averages a jittered grid of
+  samples.
+
+  Textures are decoded once and filtered in linear color, so render()
+  produces linear RGB; save_png encodes it back to sRGB to match what the
+  viewer shows, save_exr keeps it linear.
+*/
+class RayTracer {
+public:
+  RayTracer(const std::string &texture_directory);
+
+  // Faces in GL cubemap order, see GalaxySimulator::skyboxFaces
+  void set_skybox(const std::vector<std::string> &face_paths);
+
+  // Renders width x height linear RGB pixels, rows top to bottom
+  void render(const Camera &camera, Galaxy &galaxy, int width, int height,
+              std::vector<float> &pixels);
+
+  static bool save_png(const std::string &path, const std::vector<float> &pixels, int width, int height);
+  static bool save_exr(const std::string &path, const std::vector<float> &pixels, int width, int height);
+
+  // Samples per pixel along each axis
+  int samples_per_axis = 3;
+  int tile_size = 16;
+
+private:
+  struct Image {
+    int width = 0, height = 0;
+    std::vector<unsigned char> texels;
+
+    bool load(const std::string &path);
+    // Bilinear lookup in linear color; u wraps around when wrap_u is set
+    Vector3D sample(double u, double v, bool wrap_u) const;
+  };
+
+  struct Body {
+    Vector3D center;
+    double radius;
+    // Signed scale of the unit sphere mesh, mirrored when negative
+    double scale;
+    const Image *image;
+  };
+
+  struct Node {
+    Vector3D min, max;
+    // Leaves hold bodies [first, first + count); inner nodes have their
+    // left child right after them and the right child at `right`
+    int first, count, right;
+  };
+
+  const Image *texture(const std::string &tex_file);
+  void gather_bodies(Galaxy &galaxy);
+  int build_node(int first, int count);
+  bool intersect(const Vector3D &origin, const Vector3D &dir, int &body, double &t) const;
+  Vector3D shade(const Vector3D &origin, const Vector3D &dir) const;
+  Vector3D sky(const Vector3D &dir) const;
+
+  std::string texture_directory;
+  std::map<std::string, Image> images;
+  Image skybox[6];
+  bool has_skybox = false;
+
+  std::vector<Body> bodies;
+  std::vector<Node> nodes;
+};
+
+#endif // CLOTHSIM_RAY_TRACER_H
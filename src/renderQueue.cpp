@@ -0,0 +1,59 @@
+#include "renderQueue.h"
+
+#include <algorithm>
+
+void RenderQueue::push(GLShader *shader, GLuint texture, Misc::SphereMesh *mesh,
+                       const Vector3D &position, double radius) {
+  DrawItem item;
+  item.shader = shader;
+  item.texture = texture;
+  item.mesh = mesh;
+  item.position = position;
+  item.radius = radius;
+  items.push_back(item);
+}
+
+bool RenderQueue::compare(const DrawItem &a, const DrawItem &b) {
+  // Most expensive state first
+  if (a.shader != b.shader) return a.shader < b.shader;
+  if (a.texture != b.texture) return a.texture < b.texture;
+  return a.mesh->lod() < b.mesh->lod();
+}
+
+void RenderQueue::submit() {
+  num_shader_binds = num_texture_binds = num_mesh_uploads = 0;
+  if (items.empty()) return;
+
+  // Stable so equal items keep their submission order from frame to frame
+  std::stable_sort(items.begin(), items.end(), compare);
+
+  glActiveTexture(GL_TEXTURE0);
+
+  GLShader *shader = nullptr;
+  GLuint texture = 0;
+  Misc::SphereMesh *mesh = nullptr;
+  for (const DrawItem &item : items) {
+    if (item.shader != shader) {
+      if (mesh != nullptr) mesh->unbind(*shader);
+      shader = item.shader;
+      shader->bind();
+      mesh = nullptr;
+      num_shader_binds++;
+    }
+    if (item.texture != texture) {
+      texture = item.texture;
+      glBindTexture(GL_TEXTURE_2D, texture);
+      num_texture_binds++;
+    }
+    // Meshes of the same detail share their vertex data, so the buffers
+    // uploaded for the previous item can be reused
+    if (mesh == nullptr || mesh->lod() != item.mesh->lod()) {
+      if (mesh != nullptr) mesh->unbind(*shader);
+      mesh = item.mesh;
+      mesh->bind(*shader);
+      num_mesh_uploads++;
+    }
+    mesh->draw(*shader, item.position, item.radius);
+  }
+  mesh->unbind(*shader);
+}
@@ -0,0 +1,56 @@
+#ifndef CLOTHSIM_RENDER_QUEUE_H
+#define CLOTHSIM_RENDER_QUEUE_H
+
+#include <vector>
+
+#include <nanogui/nanogui.h>
+
+#include "CGL/vector3D.h"
+#include "misc/sphere_drawing.h"
+
+using namespace CGL;
+using namespace nanogui;
+
+/*
+  Collects the sphere draws of a frame and submits them sorted by shader,
+  texture and mesh level of detail, so each shader is bound once, each
+  texture is bound once per shader and the vertex data is uploaded once
+  per run of same-detail meshes instead of once per sphere.
+
+  Only u_model changes between consecutive draws; the per-frame camera
+  transform is expected in the FrameTransforms uniform block.
+*/
+class RenderQueue {
+public:
+  void clear() { items.clear(); }
+
+  void push(GLShader *shader, GLuint texture, Misc::SphereMesh *mesh,
+            const Vector3D &position, double radius);
+
+  void submit();
+
+  // State changes made by the last submit, for profiling
+  int shader_binds() { return num_shader_binds; }
+  int texture_binds() { return num_texture_binds; }
+  int mesh_uploads() { return num_mesh_uploads; }
+  int draws() { return (int) items.size(); }
+
+private:
+  struct DrawItem {
+    GLShader *shader;
+    GLuint texture;
+    Misc::SphereMesh *mesh;
+    Vector3D position;
+    double radius;
+  };
+
+  static bool compare(const DrawItem &a, const DrawItem &b);
+
+  std::vector<DrawItem> items;
+
+  int num_shader_binds = 0;
+  int num_texture_binds = 0;
+  int num_mesh_uploads = 0;
+};
+
+#endif // CLOTHSIM_RENDER_QUEUE_H
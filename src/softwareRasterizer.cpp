@@ -0,0 +1,378 @@
+#include "softwareRasterizer.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include "misc/parallel.h"
+#include "misc/stb_image.h"
+
+// What the viewer clears to, 0.25 grey
+#define SR_BACKGROUND 0xff404040u
+
+static inline uint32_t lerp_rgba(uint32_t a, uint32_t b, int f) {
+  // Both channel pairs of a 32 bit pixel at once, f in [0, 256]
+  uint32_t rb = ((a & 0x00ff00ffu) * (256 - f) + (b & 0x00ff00ffu) * f) >> 8;
+  uint32_t ga = (((a >> 8) & 0x00ff00ffu) * (256 - f) + ((b >> 8) & 0x00ff00ffu) * f) >> 8;
+  return (rb & 0x00ff00ffu) | ((ga & 0x00ff00ffu) << 8);
+}
+
+bool SoftwareRasterizer::Texture::load(const std::string &path) {
+  int w, h, n;
+  unsigned char *data = stbi_load(path.c_str(), &w, &h, &n, 4);
+  if (data == nullptr) return false;
+  widths.assign(1, w);
+  heights.assign(1, h);
+  levels.assign(1, std::vector<uint32_t>((uint32_t *) data, (uint32_t *) data + (size_t) w * h));
+  stbi_image_free(data);
+
+  // Box filtered mip chain down to a single texel
+  while (w > 1 || h > 1) {
+    const std::vector<uint32_t> &src = levels.back();
+    int nw = std::max(w / 2, 1), nh = std::max(h / 2, 1);
+    std::vector<uint32_t> dst((size_t) nw * nh);
+    for (int y = 0; y < nh; y++) {
+      const uint32_t *row0 = &src[(size_t) std::min(2 * y, h - 1) * w];
+      const uint32_t *row1 = &src[(size_t) std::min(2 * y + 1, h - 1) * w];
+      for (int x = 0; x < nw; x++) {
+        int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+        dst[(size_t) y * nw + x] = lerp_rgba(lerp_rgba(row0[x0], row0[x1], 128),
+                                             lerp_rgba(row1[x0], row1[x1], 128), 128);
+      }
+    }
+    levels.push_back(std::move(dst));
+    widths.push_back(w = nw);
+    heights.push_back(h = nh);
+  }
+  return true;
+}
+
+uint32_t SoftwareRasterizer::Texture::sample(int level, double u, double v) const {
+  const int w = widths[level], h = heights[level];
+  const uint32_t *texels = levels[level].data();
+
+  // Bilinear, wrapping around in u and clamped in v like the GL textures
+  double x = u * w - 0.5, y = v * h - 0.5;
+  int x0 = (int) floor(x), y0 = (int) floor(y);
+  int fx = (int) ((x - x0) * 256), fy = (int) ((y - y0) * 256);
+  int x1 = x0 + 1;
+  x0 = ((x0 % w) + w) % w;
+  x1 = x1 % w;
+  int y1 = std::min(std::max(y0 + 1, 0), h - 1);
+  y0 = std::min(std::max(y0, 0), h - 1);
+  const uint32_t *row0 = texels + (size_t) y0 * w, *row1 = texels + (size_t) y1 * w;
+  return lerp_rgba(lerp_rgba(row0[x0], row0[x1], fx), lerp_rgba(row1[x0], row1[x1], fx), fy);
+}
+
+SoftwareRasterizer::SoftwareRasterizer(const std::string &texture_directory)
+: texture_directory(texture_directory) {}
+
+SoftwareRasterizer::~SoftwareRasterizer() {
+  if (gl_texture != 0) glDeleteTextures(1, &gl_texture);
+  if (gl_framebuffer != 0) glDeleteFramebuffers(1, &gl_framebuffer);
+}
+
+const SoftwareRasterizer::Texture *SoftwareRasterizer::texture(const std::string &tex_file) {
+  auto found = textures.find(tex_file);
+  if (found == textures.end()) {
+    Texture texture;
+    if (!texture.load(texture_directory + "/" + tex_file)) {
+      std::cout << "Error: could not decode texture " << tex_file << std::endl;
+    }
+    found = textures.insert(std::make_pair(tex_file, std::move(texture))).first;
+  }
+  if (!found->second.levels.empty()) return &found->second;
+
+  // Like Galaxy::setTextures, a missing texture falls back to any other
+  for (const auto &entry : textures) {
+    if (!entry.second.levels.empty()) return &entry.second;
+  }
+  return nullptr;
+}
+
+void SoftwareRasterizer::bin(int index, double x0, double y0, double x1, double y1, unsigned thread) {
+  // Ends close to the near plane can project far off screen
+  int tx0 = (int) std::max(x0, 0.0) / tile_size;
+  int ty0 = (int) std::max(y0, 0.0) / tile_size;
+  int tx1 = (int) std::min(x1, width - 1.0) / tile_size;
+  int ty1 = (int) std::min(y1, height - 1.0) / tile_size;
+  for (int ty = ty0; ty <= ty1; ty++) {
+    for (int tx = tx0; tx <= tx1; tx++) {
+      bins[thread][ty * tiles_x + tx].push_back(index);
+    }
+  }
+}
+
+void SoftwareRasterizer::setup_disc(Sphere *s, const Texture *texture, unsigned thread) {
+  Disc disc;
+  Vector3D d = s->renderPosition() - eye;
+  disc.center = Vector3D(dot(d, x_axis), dot(d, y_axis), dot(d, z_axis));
+  disc.scale = s->renderRadius();
+  disc.radius = std::abs(disc.scale);
+  disc.texture = texture;
+  const double depth = -disc.center.z, r = disc.radius;
+  if (r <= 0 || depth + r <= near_clip) return;
+
+  // Screen bounds: x / depth over the box around the sphere is extreme at
+  // its corners. A sphere crossing the near plane may cover anything.
+  double x0 = 0, y0 = 0, x1 = width, y1 = height;
+  if (depth - r > near_clip) {
+    const double xs[2] = { disc.center.x - r, disc.center.x + r };
+    const double ys[2] = { disc.center.y - r, disc.center.y + r };
+    const double zs[2] = { depth - r, depth + r };
+    double sx0 = INFINITY, sx1 = -INFINITY, sy0 = INFINITY, sy1 = -INFINITY;
+    for (int i = 0; i < 2; i++) {
+      for (int j = 0; j < 2; j++) {
+        sx0 = std::min(sx0, xs[i] / zs[j]);
+        sx1 = std::max(sx1, xs[i] / zs[j]);
+        sy0 = std::min(sy0, ys[i] / zs[j]);
+        sy1 = std::max(sy1, ys[i] / zs[j]);
+      }
+    }
+    x0 = (sx0 / half_w + 1) * width / 2;
+    x1 = (sx1 / half_w + 1) * width / 2;
+    y0 = (1 - sy1 / half_h) * height / 2;
+    y1 = (1 - sy0 / half_h) * height / 2;
+    if (x1 < 0 || y1 < 0 || x0 >= width || y0 >= height) return;
+  }
+
+  // Texels per pixel around the middle of the disc, which shows a
+  // 1 / (2 pi) of the circumference for every radius in pixels
+  disc.level = 0;
+  if (texture != nullptr) {
+    double pixels = r / std::max(depth, near_clip) / (2 * half_h) * height;
+    double texels = texture->widths[0] / (2 * PI * std::max(pixels, 1e-6));
+    disc.level = std::min(std::max((int) floor(log2(std::max(texels, 1.0))), 0),
+                          (int) texture->levels.size() - 1);
+  }
+
+  int index = (int) discs[thread].size();
+  discs[thread].push_back(disc);
+  bin(index, x0, y0, x1, y1, thread);
+}
+
+void SoftwareRasterizer::setup_segment(Vector3D a, Vector3D b, unsigned thread) {
+  // To view space, with z as the depth
+  Vector3D ends[2];
+  for (int i = 0; i < 2; i++) {
+    Vector3D d = (i == 0 ? a : b) - eye;
+    ends[i] = Vector3D(dot(d, x_axis), dot(d, y_axis), -dot(d, z_axis));
+  }
+  if (ends[0].z < near_clip && ends[1].z < near_clip) return;
+  for (int i = 0; i < 2; i++) {
+    if (ends[i].z < near_clip) {
+      const Vector3D &other = ends[1 - i];
+      ends[i] = other + (ends[i] - other) * ((other.z - near_clip) / (other.z - ends[i].z));
+    }
+  }
+
+  Segment segment;
+  for (int i = 0; i < 2; i++) {
+    segment.x[i] = (ends[i].x / ends[i].z / half_w + 1) * width / 2;
+    segment.y[i] = (1 - ends[i].y / ends[i].z / half_h) * height / 2;
+    segment.inv_depth[i] = 1 / ends[i].z;
+  }
+  double x0 = std::min(segment.x[0], segment.x[1]), x1 = std::max(segment.x[0], segment.x[1]);
+  double y0 = std::min(segment.y[0], segment.y[1]), y1 = std::max(segment.y[0], segment.y[1]);
+  if (x1 < 0 || y1 < 0 || x0 >= width || y0 >= height) return;
+
+  int index = (int) segments[thread].size();
+  segments[thread].push_back(segment);
+  bin(~index, x0, y0, x1, y1, thread);
+}
+
+void SoftwareRasterizer::render(const Camera &camera, Galaxy &galaxy,
+                                const std::vector<std::vector<Vector3D>> &trails,
+                                const Vector3D &trail_color, int width, int height) {
+  this->width = width;
+  this->height = height;
+  tiles_x = (width + tile_size - 1) / tile_size;
+  tiles_y = (height + tile_size - 1) / tile_size;
+  framebuffer.resize((size_t) width * height);
+
+  // The camera frame, built like Camera::view_matrix
+  eye = camera.position();
+  z_axis = (eye - camera.view_point()).unit();
+  x_axis = cross(camera.up_dir(), z_axis).unit();
+  y_axis = cross(z_axis, x_axis);
+  near_clip = camera.near_clip();
+  half_h = tan(camera.v_fov() * PI / 360);
+  half_w = half_h * width / height;
+
+  const unsigned threads = Parallel::num_threads();
+  discs.resize(threads);
+  segments.resize(threads);
+  bins.resize(threads);
+  for (unsigned t = 0; t < threads; t++) {
+    discs[t].clear();
+    segments[t].clear();
+    bins[t].resize(tiles_x * tiles_y);
+    for (std::vector<int> &tile_bin : bins[t]) tile_bin.clear();
+  }
+
+  // Only what survives the galaxy's culling. Textures are looked up
+  // before the threads start, the cache is not thread safe.
+  const std::vector<Sphere *> &bodies = galaxy.visibleBodies(camera);
+  std::vector<const Texture *> body_textures(bodies.size());
+  for (size_t i = 0; i < bodies.size(); i++) {
+    body_textures[i] = texture(bodies[i]->getTexFile());
+  }
+
+  Parallel::parallel_for(bodies.size(), [&](size_t begin, size_t end, unsigned thread) {
+    for (size_t i = begin; i < end; i++) setup_disc(bodies[i], body_textures[i], thread);
+  }, threads);
+
+  // Trail segments are numbered through all the strips
+  std::vector<size_t> first_segment(1, 0);
+  for (const std::vector<Vector3D> &trail : trails) {
+    first_segment.push_back(first_segment.back() + (trail.size() < 2 ? 0 : trail.size() - 1));
+  }
+  Parallel::parallel_for(first_segment.back(), [&](size_t begin, size_t end, unsigned thread) {
+    size_t strip = std::upper_bound(first_segment.begin(), first_segment.end(), begin) - first_segment.begin() - 1;
+    for (size_t i = begin; i < end; i++) {
+      while (i >= first_segment[strip + 1]) strip++;
+      const std::vector<Vector3D> &trail = trails[strip];
+      size_t point = i - first_segment[strip];
+      setup_segment(trail[point] / Sphere::sphere_factor, trail[point + 1] / Sphere::sphere_factor, thread);
+    }
+  }, threads);
+
+  uint32_t trail_rgba = 0xff000000u;
+  for (int c = 0; c < 3; c++) {
+    trail_rgba |= (uint32_t) (std::min(std::max(trail_color[c], 0.0), 1.0) * 255 + 0.5) << (8 * c);
+  }
+
+  // Threads take tiles from a shared counter, so a crowded tile does not
+  // hold up a whole band of the screen
+  const int tiles = tiles_x * tiles_y;
+  std::atomic<int> next_tile(0);
+  Parallel::parallel_for(threads, [&](size_t, size_t, unsigned) {
+    for (int tile = next_tile++; tile < tiles; tile = next_tile++) draw_tile(tile, trail_rgba);
+  }, threads);
+}
+
+void SoftwareRasterizer::draw_tile(int tile, uint32_t trail_rgba) {
+  const int x0 = (tile % tiles_x) * tile_size, y0 = (tile / tiles_x) * tile_size;
+  const int x1 = std::min(x0 + tile_size, width), y1 = std::min(y0 + tile_size, height);
+
+  // Drawn in a local buffer that stays in cache
+  std::vector<uint32_t> color((size_t) tile_size * tile_size, SR_BACKGROUND);
+  std::vector<float> depth((size_t) tile_size * tile_size, std::numeric_limits<float>::infinity());
+
+  for (size_t t = 0; t < bins.size(); t++) {
+    for (int index : bins[t][tile]) {
+      if (index >= 0) {
+        draw_disc(discs[t][index], x0, y0, x1, y1, color.data(), depth.data());
+      } else {
+        draw_segment(segments[t][~index], x0, y0, x1, y1, trail_rgba, color.data(), depth.data());
+      }
+    }
+  }
+
+  for (int y = y0; y < y1; y++) {
+    std::copy(&color[(size_t) (y - y0) * tile_size], &color[(size_t) (y - y0) * tile_size] + (x1 - x0),
+              &framebuffer[(size_t) y * width + x0]);
+  }
+}
+
+void SoftwareRasterizer::draw_disc(const Disc &disc, int x0, int y0, int x1, int y1,
+                                   uint32_t *color, float *depth) const {
+  // Rays leave the eye through (sx, sy, -1) in view space, so the ray
+  // parameter of a hit is its view depth
+  const Vector3D &c = disc.center;
+  const double cc = dot(c, c) - disc.radius * disc.radius;
+  for (int y = y0; y < y1; y++) {
+    const double sy = half_h * (1 - 2 * (y + 0.5) / height);
+    for (int x = x0; x < x1; x++) {
+      const double sx = half_w * (2 * (x + 0.5) / width - 1);
+      const double a = sx * sx + sy * sy + 1;
+      const double half_b = sx * c.x + sy * c.y - c.z;
+      const double disc_sq = half_b * half_b - a * cc;
+      if (disc_sq < 0) continue;
+
+      const double root = sqrt(disc_sq);
+      double t = (half_b - root) / a;
+      if (t < near_clip) t = (half_b + root) / a;
+      float *z = &depth[(y - y0) * tile_size + (x - x0)];
+      if (t < near_clip || t >= *z) continue;
+      *z = (float) t;
+
+      uint32_t rgba = 0xff808080u;
+      if (disc.texture != nullptr) {
+        // Normal of the unit sphere mesh back in world space, then the
+        // spherical UV SphereMesh assigns to it
+        Vector3D p = Vector3D(sx * t, sy * t, -t) - c;
+        Vector3D n = (x_axis * p.x + y_axis * p.y + z_axis * p.z) / disc.scale;
+        double v = acos(std::min(std::max(n.y, -1.0), 1.0)) / PI;
+        double u = atan2(n.x, n.z) / (2 * PI) - 0.5;
+        u -= floor(u);
+        rgba = disc.texture->sample(disc.level, u, v) | 0xff000000u;
+      }
+      color[(y - y0) * tile_size + (x - x0)] = rgba;
+    }
+  }
+}
+
+void SoftwareRasterizer::draw_segment(const Segment &s, int x0, int y0, int x1, int y1,
+                                      uint32_t rgba, uint32_t *color, float *depth) const {
+  // Steps one pixel at a time along the longer axis, only over the part of
+  // the line inside this tile
+  const double dx = s.x[1] - s.x[0], dy = s.y[1] - s.y[0];
+  const bool along_x = std::abs(dx) >= std::abs(dy);
+  const double major = along_x ? dx : dy;
+  const double from = along_x ? s.x[0] : s.y[0];
+  const int first = (int) std::max<double>(along_x ? x0 : y0, ceil(std::min(from, from + major) - 0.5));
+  const int last = (int) std::min<double>(along_x ? x1 - 1 : y1 - 1, floor(std::max(from, from + major) - 0.5));
+
+  for (int i = first; i <= last; i++) {
+    double f = major == 0 ? 0 : (i + 0.5 - from) / major;
+    double minor = along_x ? s.y[0] + f * dy : s.x[0] + f * dx;
+    if (minor < (along_x ? y0 : x0) || minor >= (along_x ? y1 : x1)) continue;
+    int j = (int) minor;
+    int x = along_x ? i : j, y = along_x ? j : i;
+
+    // 1 / depth is what varies linearly across the screen
+    float z = (float) (1 / (s.inv_depth[0] + f * (s.inv_depth[1] - s.inv_depth[0])));
+    float *d = &depth[(y - y0) * tile_size + (x - x0)];
+    if (z >= *d) continue;
+    *d = z;
+    color[(y - y0) * tile_size + (x - x0)] = rgba;
+  }
+}
+
+void SoftwareRasterizer::blit() {
+  if (framebuffer.empty()) return;
+
+  GLint bound_texture, read_framebuffer, viewport[4];
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound_texture);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  if (gl_texture == 0) {
+    glGenTextures(1, &gl_texture);
+    glGenFramebuffers(1, &gl_framebuffer);
+  }
+  glBindTexture(GL_TEXTURE_2D, gl_texture);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, gl_framebuffer);
+  if (gl_width != width || gl_height != height) {
+    gl_width = width;
+    gl_height = height;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl_texture, 0);
+  }
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, framebuffer.data());
+
+  // Rows are stored top down, GL counts them bottom up
+  glBlitFramebuffer(0, 0, width, height,
+                    viewport[0], viewport[1] + viewport[3], viewport[0] + viewport[2], viewport[1],
+                    GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+  glBindTexture(GL_TEXTURE_2D, bound_texture);
+}
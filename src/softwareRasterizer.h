@@ -0,0 +1,104 @@
+#ifndef CLOTHSIM_SOFTWARE_RASTERIZER_H
+#define CLOTHSIM_SOFTWARE_RASTERIZER_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "galaxy.h"
+
+/*
+  Viewer fallback for machines where GL itself runs on the CPU.
+
+  Spheres are drawn as analytic discs: every pixel under a body's screen
+  bounds intersects its eye ray with the sphere, which gives an exact depth
+  and the spherical UV SphereMesh would have interpolated. Trails are one
+  pixel lines. The frame is cut into tiles, the bodies and trail segments
+  are binned into the tiles they cover on all threads, and every thread
+  then takes whole tiles from a shared counter, so no two threads ever touch
+  the same pixels.
+
+  Shading matches the Texture shader (unlit, no gamma), sampling a mip
+  level picked from each body's size on screen. The result is an RGBA8
+  image that blit() copies into the bound GL framebuffer.
+*/
+class SoftwareRasterizer {
+public:
+  SoftwareRasterizer(const std::string &texture_directory);
+  ~SoftwareRasterizer();
+
+  // Trails are line strips of simulation positions, as Sphere::getTrack
+  // returns them, drawn in trail_color
+  void render(const Camera &camera, Galaxy &galaxy,
+              const std::vector<std::vector<Vector3D>> &trails,
+              const Vector3D &trail_color, int width, int height);
+
+  // Stretches the last frame over the current viewport of the draw
+  // framebuffer; needs the GL context
+  void blit();
+
+  // RGBA8, rows top to bottom
+  const std::vector<uint32_t> &pixels() const { return framebuffer; }
+
+  int tile_size = 32;
+
+private:
+  struct Texture {
+    // Level 0 is the image, every other level halves the one before
+    std::vector<int> widths, heights;
+    std::vector<std::vector<uint32_t>> levels;
+
+    bool load(const std::string &path);
+    uint32_t sample(int level, double u, double v) const;
+  };
+
+  struct Disc {
+    // View space center, looking down -z
+    Vector3D center;
+    double radius;
+    // Signed scale of the unit sphere mesh, mirrored when negative
+    double scale;
+    const Texture *texture;
+    int level;
+  };
+
+  struct Segment {
+    // Pixel coordinates and inverse view depth of both ends
+    double x[2], y[2], inv_depth[2];
+  };
+
+  const Texture *texture(const std::string &tex_file);
+  void setup_disc(Sphere *s, const Texture *texture, unsigned thread);
+  void setup_segment(Vector3D a, Vector3D b, unsigned thread);
+  void bin(int index, double x0, double y0, double x1, double y1, unsigned thread);
+  void draw_tile(int tile, uint32_t trail_rgba);
+  void draw_disc(const Disc &disc, int x0, int y0, int x1, int y1,
+                 uint32_t *color, float *depth) const;
+  void draw_segment(const Segment &segment, int x0, int y0, int x1, int y1,
+                    uint32_t rgba, uint32_t *color, float *depth) const;
+
+  std::string texture_directory;
+  std::map<std::string, Texture> textures;
+
+  // Frame state: the camera frame as in Camera::view_matrix, and the half
+  // extents of the view at unit depth
+  Vector3D eye, x_axis, y_axis, z_axis;
+  double near_clip, half_w, half_h;
+  int width = 0, height = 0, tiles_x = 0, tiles_y = 0;
+
+  // Primitives and tile bins of every thread, bins indexed [thread][tile].
+  // A bin holds indices into the same thread's discs, and segment indices
+  // as their complement.
+  std::vector<std::vector<Disc>> discs;
+  std::vector<std::vector<Segment>> segments;
+  std::vector<std::vector<std::vector<int>>> bins;
+
+  std::vector<uint32_t> framebuffer;
+
+  unsigned int gl_texture = 0, gl_framebuffer = 0;
+  int gl_width = 0, gl_height = 0;
+};
+
+#endif // CLOTHSIM_SOFTWARE_RASTERIZER_H
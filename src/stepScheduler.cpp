@@ -0,0 +1,63 @@
+#include "stepScheduler.h"
+
+#include <algorithm>
+
+// Longest gap between frames that still counts as simulation time, so
+// dragging the window or a breakpoint does not create a huge debt
+#define MAX_FRAME_GAP 0.25
+// Weight of the newest sample in the running averages
+#define SMOOTHING 0.1
+
+static double elapsed_ms(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+int StepScheduler::run_frame(double frames_per_sec, int steps_per_frame, const std::function<void()> &step) {
+  if (fixed) {
+    for (int i = 0; i < steps_per_frame; i++) {
+      step();
+    }
+    requested = achieved = frames_per_sec * steps_per_frame;
+    return steps_per_frame;
+  }
+
+  clock::time_point frame_start = clock::now();
+  double frame_gap = started ? std::chrono::duration<double>(frame_start - last_frame).count() : 1.0 / frames_per_sec;
+  frame_gap = std::min(frame_gap, MAX_FRAME_GAP);
+  last_frame = frame_start;
+  started = true;
+
+  requested = frames_per_sec * steps_per_frame;
+  debt = std::min(debt + requested * frame_gap, std::max(requested, 1.0));
+
+  int steps = 0;
+  while (debt >= 1) {
+    // Always make progress, then only start steps expected to fit
+    if (steps > 0 && elapsed_ms(frame_start) + step_cost > budget_ms) {
+      break;
+    }
+    clock::time_point step_start = clock::now();
+    step();
+    double cost = elapsed_ms(step_start);
+    step_cost = step_cost == 0 ? cost : (1 - SMOOTHING) * step_cost + SMOOTHING * cost;
+    debt -= 1;
+    steps++;
+  }
+
+  if (frame_gap > 0) {
+    achieved = (1 - SMOOTHING) * achieved + SMOOTHING * (steps / frame_gap);
+  }
+  return steps;
+}
+
+double StepScheduler::blend() {
+  // Fixed frames always end on a whole step; a scene that fell behind
+  // shows its newest state
+  if (fixed) return 1;
+  return std::min(std::max(debt, 0.0), 1.0);
+}
+
+void StepScheduler::idle() {
+  started = false;
+  achieved = 0;
+}
@@ -0,0 +1,68 @@
+#ifndef CLOTHSIM_STEP_SCHEDULER_H
+#define CLOTHSIM_STEP_SCHEDULER_H
+
+#include <chrono>
+#include <functional>
+
+/*
+  Decides how many physics steps to run in a frame.
+
+  The user asks for a simulated-time rate (steps per frame at the nominal
+  frames/s). Every frame that rate is turned into a debt of steps for the
+  wall-clock time that actually passed, and steps are run while the debt
+  lasts and the measured per-step cost still fits in the frame budget.
+  Whatever does not fit is carried to the next frame, bounded to one second
+  of requested simulation so a slow scene cannot fall behind forever.
+
+  The fraction of a step left owed after a frame is how far the clock has
+  got into the next step. Drawing every body that far from its previous
+  state towards its current one (Sphere::render_blend) makes what is shown
+  move at an even rate, however the steps fall between frames, so the
+  display refresh rate and the step rate can each be whatever they are.
+*/
+class StepScheduler {
+public:
+  StepScheduler(double budget_ms = 12.0) : budget_ms(budget_ms) {}
+
+  // Runs the steps owed for this frame. Returns the number of steps taken.
+  int run_frame(double frames_per_sec, int steps_per_frame, const std::function<void()> &step);
+
+  // Call on frames where the simulation is paused so the debt does not grow
+  void idle();
+
+  // Fixed mode ignores the clock and runs exactly steps_per_frame every
+  // frame, for offscreen captures where every frame must cover the same
+  // simulated time
+  void set_fixed(bool fixed) { this->fixed = fixed; }
+
+  void set_budget_ms(double budget_ms) { this->budget_ms = budget_ms; }
+  double get_budget_ms() { return budget_ms; }
+
+  // Rates in simulated steps per wall-clock second
+  double requested_rate() { return requested; }
+  double achieved_rate() { return achieved; }
+
+  // Steps owed but not run yet
+  double step_debt() { return debt; }
+
+  // How far, from 0 to 1, to draw the bodies from the state before the
+  // last step towards the state after it
+  double blend();
+
+  // Average wall-clock cost of one step in milliseconds
+  double step_cost_ms() { return step_cost; }
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  double budget_ms;
+  double debt = 0;
+  double step_cost = 0;
+  double requested = 0;
+  double achieved = 0;
+  bool started = false;
+  bool fixed = false;
+  clock::time_point last_frame;
+};
+
+#endif // CLOTHSIM_STEP_SCHEDULER_H
@@ -0,0 +1,378 @@
+#include "textureLoader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+#include "misc/file_utils.h"
+#include "png.h"
+// Needed to generate stb_image binaries. Should only define in exactly one source file importing stb_image.h.
+#define STB_IMAGE_IMPLEMENTATION
+#include "misc/stb_image.h"
+
+// Layout of a cache file: the header, then every mip level from largest
+// to smallest as tightly packed RGB rows
+struct TextureCacheHeader {
+  char magic[4];
+  uint32_t width;
+  uint32_t height;
+  uint32_t levels;
+  int64_t source_size;
+  int64_t source_mtime;
+};
+
+static const char CACHE_MAGIC[4] = {'T', 'X', 'C', '1'};
+
+static const unsigned char PNG_SIGNATURE[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+
+// Rows decoded between updates of a streamed image
+static const int STREAM_ROWS = 64;
+
+static int mip_levels(int width, int height) {
+  int levels = 1;
+  while (width > 1 || height > 1) {
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+    levels++;
+  }
+  return levels;
+}
+
+static size_t mip_chain_bytes(int width, int height, int levels) {
+  size_t bytes = 0;
+  for (int l = 0; l < levels; l++) {
+    bytes += (size_t) width * height * 3;
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+  }
+  return bytes;
+}
+
+// Appends the next level to texels with a 2x2 box filter; odd edges reuse
+// their last row or column
+static void build_mip(std::vector<unsigned char> &texels, size_t offset, int width, int height) {
+  int w = std::max(width / 2, 1), h = std::max(height / 2, 1);
+  size_t out = texels.size();
+  texels.resize(out + (size_t) w * h * 3);
+  const unsigned char *src = &texels[offset];
+  unsigned char *dst = &texels[out];
+  for (int y = 0; y < h; y++) {
+    int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+    for (int x = 0; x < w; x++) {
+      int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+      for (int c = 0; c < 3; c++) {
+        int sum = src[((size_t) y0 * width + x0) * 3 + c] + src[((size_t) y0 * width + x1) * 3 + c]
+                + src[((size_t) y1 * width + x0) * 3 + c] + src[((size_t) y1 * width + x1) * 3 + c];
+        dst[((size_t) y * w + x) * 3 + c] = (unsigned char) ((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+TextureLoader::TextureLoader(const std::string &cache_directory)
+: cache_directory(cache_directory) {
+  cache_enabled = FileUtils::make_directory(cache_directory);
+  if (!cache_enabled) {
+    std::cout << "Warning: could not create texture cache " << cache_directory << std::endl;
+  }
+}
+
+TextureLoader::~TextureLoader() {
+  workers.wait();
+  if (!handles.empty()) {
+    std::vector<GLuint> ids(handles.begin(), handles.end());
+    glDeleteTextures((GLsizei) ids.size(), ids.data());
+  }
+}
+
+GLuint *TextureLoader::create_texture(GLenum type) {
+  handles.push_back(0);
+  GLuint *handle = &handles.back();
+  glGenTextures(1, handle);
+
+  // Grey placeholder until the real image is uploaded
+  const unsigned char grey[3] = {128, 128, 128};
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(type, *handle);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  if (type == GL_TEXTURE_CUBE_MAP) {
+    for (int face = 0; face < 6; face++) {
+      glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+    }
+  } else {
+    glTexImage2D(type, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+  }
+  glTexParameteri(type, GL_TEXTURE_MAX_LEVEL, 0);
+  glTexParameteri(type, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(type, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  if (type == GL_TEXTURE_CUBE_MAP) {
+    glTexParameteri(type, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(type, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(type, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  } else {
+    glTexParameteri(type, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(type, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  }
+  return handle;
+}
+
+GLuint *TextureLoader::load(const std::string &path) {
+  GLuint *handle = create_texture(GL_TEXTURE_2D);
+  queue(path, *handle, GL_TEXTURE_2D, false);
+  return handle;
+}
+
+GLuint *TextureLoader::load_cubemap(const std::vector<std::string> &face_paths) {
+  GLuint *handle = create_texture(GL_TEXTURE_CUBE_MAP);
+  for (size_t face = 0; face < face_paths.size() && face < 6; face++) {
+    queue(face_paths[face], *handle, GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum) face, true);
+  }
+  return handle;
+}
+
+void TextureLoader::queue(const std::string &path, GLuint handle, GLenum target, bool cubemap_face) {
+  // Owned by the worker until it lands in the finished list
+  Job *job = new Job();
+  job->path = path;
+  job->handle = handle;
+  job->target = target;
+  job->cubemap_face = cubemap_face;
+  {
+    std::lock_guard<std::mutex> lock(finished_mutex);
+    outstanding++;
+  }
+  workers.submit([this, job]() {
+    decode(*job);
+    std::lock_guard<std::mutex> lock(finished_mutex);
+    finished.push_back(std::unique_ptr<Job>(job));
+  });
+}
+
+std::string TextureLoader::cache_path(const std::string &path) {
+  std::string name;
+  FileUtils::get_filename_from_path(path, name);
+  char key[32];
+  snprintf(key, sizeof(key), "%016llx", (unsigned long long) std::hash<std::string>()(path));
+  return cache_directory + "/" + name + "." + key + ".tex";
+}
+
+void TextureLoader::decode(Job &job) {
+  long long size = 0, mtime = 0;
+  if (!FileUtils::file_info(job.path, size, mtime)) {
+    std::cout << "Error: could not find texture " << job.path << std::endl;
+    return;
+  }
+
+  std::string cached = cache_path(job.path);
+  if (cache_enabled && read_cache(job, cached, size, mtime)) {
+    return;
+  }
+
+  MappedFile source;
+  if (!source.open(job.path)) {
+    std::cout << "Error: could not read texture " << job.path << std::endl;
+    return;
+  }
+
+  // Several of the .png textures are really JPEGs, so go by the signature
+  bool is_png = source.size() >= 8 && memcmp(source.data(), PNG_SIGNATURE, 8) == 0;
+  if (!is_png || !decode_png(job, source)) {
+    int img_x, img_y, img_n;
+    unsigned char *img_data = stbi_load_from_memory(source.data(), (int) source.size(), &img_x, &img_y, &img_n, 3);
+    if (img_data == nullptr) {
+      std::cout << "Error: could not decode texture " << job.path << std::endl;
+      return;
+    }
+    job.width = img_x;
+    job.height = img_y;
+    job.levels = mip_levels(img_x, img_y);
+    job.texels.reserve(mip_chain_bytes(img_x, img_y, job.levels));
+    job.texels.assign(img_data, img_data + (size_t) img_x * img_y * 3);
+    stbi_image_free(img_data);
+  }
+  source.close();
+
+  size_t offset = 0;
+  int w = job.width, h = job.height;
+  for (int l = 1; l < job.levels; l++) {
+    build_mip(job.texels, offset, w, h);
+    offset += (size_t) w * h * 3;
+    w = std::max(w / 2, 1);
+    h = std::max(h / 2, 1);
+  }
+  job.level_data = job.texels.data();
+  job.ok = true;
+
+  if (cache_enabled) {
+    write_cache(job, cached, size, mtime);
+  }
+}
+
+bool TextureLoader::decode_png(Job &job, const MappedFile &source) {
+  CGL::PNGReader reader;
+  if (reader.open(source.data(), source.size()) != 0 || !reader.supported()) return false;
+
+  job.width = reader.info().width;
+  job.height = reader.info().height;
+  job.levels = mip_levels(job.width, job.height);
+  // Reserved up front so building the mipmaps never moves level 0 while
+  // the GL thread is copying rows out of it
+  job.texels.reserve(mip_chain_bytes(job.width, job.height, job.levels));
+  job.texels.resize((size_t) job.width * job.height * 3);
+  unsigned char *pixels = job.texels.data();
+
+  // Cube faces wait for the whole image: a face of a different size from
+  // the others would leave the cubemap incomplete
+  bool stream = !job.cubemap_face;
+  if (stream) {
+    job.stream_pixels = pixels;
+    std::lock_guard<std::mutex> lock(finished_mutex);
+    streaming.push_back(&job);
+  }
+
+  int rows = 0, decoded;
+  while ((decoded = reader.decode_rows(pixels, (size_t) job.width * 3, 3, STREAM_ROWS)) > 0) {
+    rows += decoded;
+    job.rows_ready.store(rows, std::memory_order_release);
+  }
+
+  if (stream) {
+    std::lock_guard<std::mutex> lock(finished_mutex);
+    streaming.erase(std::find(streaming.begin(), streaming.end(), &job));
+  }
+  if (rows != job.height) {
+    job.stream_pixels = nullptr;
+    job.texels.clear();
+    return false;
+  }
+  return true;
+}
+
+bool TextureLoader::read_cache(Job &job, const std::string &cache_path, long long size, long long mtime) {
+  if (!job.cache.open(cache_path)) return false;
+
+  TextureCacheHeader header;
+  bool valid = job.cache.size() >= sizeof(header);
+  if (valid) {
+    memcpy(&header, job.cache.data(), sizeof(header));
+    valid = memcmp(header.magic, CACHE_MAGIC, 4) == 0
+            && header.source_size == size && header.source_mtime == mtime
+            && header.width > 0 && header.height > 0
+            && (int) header.levels == mip_levels(header.width, header.height)
+            && job.cache.size() == sizeof(header) + mip_chain_bytes(header.width, header.height, header.levels);
+  }
+  if (!valid) {
+    job.cache.close();
+    return false;
+  }
+
+  job.width = header.width;
+  job.height = header.height;
+  job.levels = header.levels;
+  job.level_data = job.cache.data() + sizeof(header);
+  job.from_cache = true;
+  job.ok = true;
+  return true;
+}
+
+void TextureLoader::write_cache(const Job &job, const std::string &cache_path, long long size, long long mtime) {
+  TextureCacheHeader header;
+  memcpy(header.magic, CACHE_MAGIC, 4);
+  header.width = job.width;
+  header.height = job.height;
+  header.levels = job.levels;
+  header.source_size = size;
+  header.source_mtime = mtime;
+
+  // Written under a temporary name and renamed, so a crash never leaves a
+  // truncated entry behind for the next launch to map
+  std::string temp_path = cache_path + ".tmp";
+  FILE *file = fopen(temp_path.c_str(), "wb");
+  if (file == nullptr) return;
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(job.texels.data(), 1, job.texels.size(), file) == job.texels.size();
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+    remove(temp_path.c_str());
+  }
+}
+
+void TextureLoader::upload(const Job &job) {
+  GLenum type = job.cubemap_face ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+  glBindTexture(type, job.handle);
+
+  // A streamed image already has all of level 0
+  bool has_level0 = job.rows_uploaded == job.height;
+  const unsigned char *data = job.level_data;
+  int w = job.width, h = job.height;
+  for (int l = 0; l < job.levels; l++) {
+    if (l > 0 || !has_level0) {
+      glTexImage2D(job.target, l, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+    }
+    data += (size_t) w * h * 3;
+    w = std::max(w / 2, 1);
+    h = std::max(h / 2, 1);
+  }
+  glTexParameteri(type, GL_TEXTURE_MAX_LEVEL, job.levels - 1);
+  glTexParameteri(type, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+}
+
+void TextureLoader::upload_rows(Job &job) {
+  int rows = job.rows_ready.load(std::memory_order_acquire);
+  if (rows <= job.rows_uploaded) return;
+
+  glBindTexture(GL_TEXTURE_2D, job.handle);
+  if (job.rows_uploaded == 0) {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, job.width, job.height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+  }
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, job.rows_uploaded, job.width, rows - job.rows_uploaded,
+                  GL_RGB, GL_UNSIGNED_BYTE, job.stream_pixels + (size_t) job.rows_uploaded * job.width * 3);
+  job.rows_uploaded = rows;
+}
+
+int TextureLoader::upload_finished() {
+  std::vector<std::unique_ptr<Job>> ready;
+  std::vector<Job *> partial;
+  {
+    std::lock_guard<std::mutex> lock(finished_mutex);
+    ready.swap(finished);
+    partial = streaming;
+    outstanding -= ready.size();
+  }
+  // Jobs are only freed here, so the streaming ones stay alive past the lock
+  if (ready.empty() && partial.empty()) return 0;
+
+  GLint active_unit;
+  glGetIntegerv(GL_ACTIVE_TEXTURE, &active_unit);
+  glActiveTexture(GL_TEXTURE0);
+  // Rows of RGB texels are not padded to four bytes
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  for (Job *job : partial) {
+    upload_rows(*job);
+  }
+
+  int uploaded = 0;
+  for (const std::unique_ptr<Job> &job : ready) {
+    if (!job->ok) continue;
+    if (job->stream_pixels != nullptr) upload_rows(*job);
+    upload(*job);
+    std::cout << "Loaded texture " << job->path << (job->from_cache ? " (cached)" : "") << std::endl;
+    uploaded++;
+  }
+  glActiveTexture(active_unit);
+  return uploaded;
+}
+
+void TextureLoader::finish() {
+  workers.wait();
+  upload_finished();
+}
+
+bool TextureLoader::done() {
+  std::lock_guard<std::mutex> lock(finished_mutex);
+  return outstanding == 0;
+}
@@ -0,0 +1,96 @@
+#ifndef CLOTHSIM_TEXTURE_LOADER_H
+#define CLOTHSIM_TEXTURE_LOADER_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "misc/mapped_file.h"
+#include "misc/thread_pool.h"
+
+/*
+  Loads textures in the background.
+
+  load() hands back a GL texture right away, holding a 1x1 grey placeholder,
+  and queues the file on a worker thread. Workers decode the image, build
+  its mipmaps and write them to an on-disk cache next to the textures;
+  later launches map the cached texels directly and skip the decode. The
+  finished images are uploaded on the GL thread by upload_finished(), which
+  should be called once per frame.
+
+  PNG files are decoded a few rows at a time with CGL::PNGReader, and
+  upload_finished() copies the rows decoded so far into the texture, so a
+  large image shows up top first instead of all at once when it is done.
+
+  Cache entries are keyed by source path and remember the size and
+  modification time of the source, so editing a texture invalidates it.
+*/
+class TextureLoader {
+public:
+  TextureLoader(const std::string &cache_directory);
+  ~TextureLoader();
+
+  // Returned handles stay valid for the lifetime of the loader
+  GLuint *load(const std::string &path);
+  GLuint *load_cubemap(const std::vector<std::string> &face_paths);
+
+  // Uploads every image decoded so far. Returns the number uploaded.
+  int upload_finished();
+
+  // Blocks until every queued texture is uploaded
+  void finish();
+
+  bool done();
+
+private:
+  struct Job {
+    std::string path;
+    GLuint handle;
+    GLenum target;
+    bool cubemap_face;
+
+    // Results, filled in by the worker
+    bool ok = false;
+    bool from_cache = false;
+    int width = 0, height = 0, levels = 0;
+    std::vector<unsigned char> texels;
+    MappedFile cache;
+    const unsigned char *level_data = nullptr;
+
+    // Level 0 rows decoded so far, when the image is streamed in
+    const unsigned char *stream_pixels = nullptr;
+    std::atomic<int> rows_ready{0};
+    int rows_uploaded = 0;
+  };
+
+  GLuint *create_texture(GLenum type);
+  void queue(const std::string &path, GLuint handle, GLenum target, bool cubemap_face);
+  void decode(Job &job);
+  bool decode_png(Job &job, const MappedFile &source);
+  bool read_cache(Job &job, const std::string &cache_path, long long size, long long mtime);
+  void write_cache(const Job &job, const std::string &cache_path, long long size, long long mtime);
+  std::string cache_path(const std::string &path);
+  void upload(const Job &job);
+  void upload_rows(Job &job);
+
+  std::string cache_directory;
+  bool cache_enabled;
+
+  // Deque so handles handed out never move
+  std::deque<GLuint> handles;
+
+  std::mutex finished_mutex;
+  std::vector<std::unique_ptr<Job>> finished;
+  std::vector<Job *> streaming;
+  size_t outstanding = 0;
+
+  // Declared last so workers stop before the members they use go away
+  ThreadPool workers;
+};
+
+#endif // CLOTHSIM_TEXTURE_LOADER_H
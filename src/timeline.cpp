@@ -0,0 +1,186 @@
+#include "timeline.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "units.h"
+
+void Timeline::record(Galaxy &galaxy) {
+  size_t bodies = galaxy.num_planets + (galaxy.asteroids != nullptr ? galaxy.asteroids->size() : 0);
+  if (!keyframes.empty() && 6 * bodies != values) clear();
+
+  // Stepping on from before the end, after a seek back or a reset: what
+  // was recorded past here is no longer where the run is going
+  if (!keyframes.empty() && galaxy.time < latest) {
+    while (!keyframes.empty() && keyframes.back().time > galaxy.time) {
+      stored -= keyframes.back().data.size();
+      keyframes.pop_back();
+    }
+    if (keyframes.empty()) {
+      clear();
+    } else {
+      decode(keyframes.size() - 1, previous, &earlier);
+    }
+    steps = 0;
+  }
+
+  latest = galaxy.time;
+  if (!keyframes.empty() && ++steps < interval) return;
+  steps = 0;
+
+  galaxy.getState(x, v, m);
+  values = 6 * x.size();
+  state.resize(values);
+  for (size_t i = 0; i < x.size(); i++) {
+    for (int c = 0; c < 3; c++) {
+      state[3 * i + c] = x[i][c];
+      state[3 * (x.size() + i) + c] = v[i][c];
+    }
+  }
+  append(state, galaxy.time);
+}
+
+double Timeline::seek(Galaxy &galaxy, double time) {
+  if (keyframes.empty()) return galaxy.time;
+  time = std::min(std::max(time, start()), end());
+
+  // Last keyframe at or before the time
+  size_t index = std::upper_bound(keyframes.begin(), keyframes.end(), time,
+                                  [](double t, const Keyframe &keyframe) { return t < keyframe.time; }) -
+                 keyframes.begin() - 1;
+  decode(index, state);
+  const size_t n = values / 6;
+  x.resize(n);
+  v.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    x[i] = Vector3D(state[3 * i], state[3 * i + 1], state[3 * i + 2]);
+    v[i] = Vector3D(state[3 * (n + i)], state[3 * (n + i) + 1], state[3 * (n + i) + 2]);
+  }
+  galaxy.setState(x, v);
+  galaxy.time = keyframes[index].time;
+  if (time > galaxy.time) {
+    galaxy.advance(time - galaxy.time);
+    // advance leaves the keyframe as where each body was before the step,
+    // so settle them where they are or they are drawn partway back there
+    galaxy.getState(x, v, m);
+    galaxy.setState(x, v);
+  }
+  return galaxy.time;
+}
+
+void Timeline::clear() {
+  keyframes.clear();
+  previous.clear();
+  earlier.clear();
+  stored = 0;
+  steps = 0;
+  latest = 0;
+  interval = base_interval;
+}
+
+void Timeline::predict(const std::vector<double> &previous, const std::vector<double> &earlier, double dt,
+                       double dt_earlier, std::vector<double> &prediction) const {
+  const size_t half = values / 2;
+  const double h = Units::time_from_si(dt);
+  const double h_earlier = Units::time_from_si(dt_earlier);
+  const bool second_order = !earlier.empty() && h_earlier > 0;
+  prediction.resize(values);
+  for (size_t k = 0; k < half; k++) {
+    double velocity = previous[half + k];
+    double acceleration = second_order ? (velocity - earlier[half + k]) / h_earlier : 0;
+    prediction[k] = previous[k] + (velocity + acceleration * h / 2) * h;
+    prediction[half + k] = velocity + acceleration * h;
+  }
+}
+
+void Timeline::encode(const std::vector<double> &state, double time, Keyframe &out) const {
+  out.time = time;
+  out.anchor = previous.empty() || keyframes.size() % ANCHOR_SPACING == 0;
+  out.data.clear();
+  if (out.anchor) {
+    out.data.resize(values * sizeof(double));
+    memcpy(out.data.data(), state.data(), out.data.size());
+    return;
+  }
+
+  // A nibble per value with its count of significant bytes, then the
+  // bytes, least significant first
+  std::vector<double> prediction;
+  const size_t last = keyframes.size() - 1;
+  predict(previous, earlier, time - keyframes[last].time, last > 0 ? keyframes[last].time - keyframes[last - 1].time : 0,
+          prediction);
+  out.data.assign((values + 1) / 2, 0);
+  for (size_t k = 0; k < values; k++) {
+    uint64_t actual, predicted;
+    memcpy(&actual, &state[k], sizeof(double));
+    memcpy(&predicted, &prediction[k], sizeof(double));
+    uint64_t diff = actual ^ predicted;
+    int bytes = 0;
+    while (bytes < 8 && (diff >> (8 * bytes)) != 0) bytes++;
+    out.data[k / 2] |= (uint8_t) (bytes << (4 * (k % 2)));
+    for (int b = 0; b < bytes; b++) {
+      out.data.push_back((uint8_t) (diff >> (8 * b)));
+    }
+  }
+}
+
+void Timeline::decode(size_t index, std::vector<double> &state, std::vector<double> *before) const {
+  size_t anchor = index;
+  while (!keyframes[anchor].anchor) anchor--;
+  state.resize(values);
+  memcpy(state.data(), keyframes[anchor].data.data(), values * sizeof(double));
+
+  std::vector<double> prediction, older;
+  for (size_t i = anchor + 1; i <= index; i++) {
+    const Keyframe &keyframe = keyframes[i];
+    predict(state, older, keyframe.time - keyframes[i - 1].time,
+            i > anchor + 1 ? keyframes[i - 1].time - keyframes[i - 2].time : 0, prediction);
+    older = state;
+    const uint8_t *bytes = keyframe.data.data() + (values + 1) / 2;
+    for (size_t k = 0; k < values; k++) {
+      int count = (keyframe.data[k / 2] >> (4 * (k % 2))) & 0xF;
+      uint64_t diff = 0;
+      for (int b = 0; b < count; b++) {
+        diff |= (uint64_t) *bytes++ << (8 * b);
+      }
+      uint64_t predicted;
+      memcpy(&predicted, &prediction[k], sizeof(double));
+      predicted ^= diff;
+      memcpy(&state[k], &predicted, sizeof(double));
+    }
+  }
+  if (before != nullptr) *before = older;
+}
+
+void Timeline::append(const std::vector<double> &state, double time) {
+  // Encoded before it joins the list, so it sees its predecessor as last
+  Keyframe keyframe;
+  encode(state, time, keyframe);
+  stored += keyframe.data.size();
+  keyframes.push_back(std::move(keyframe));
+  earlier = keyframes.back().anchor ? std::vector<double>() : previous;
+  previous = state;
+
+  if (stored + keyframes.size() * sizeof(Keyframe) > budget && keyframes.size() > 2) thin();
+}
+
+void Timeline::thin() {
+  // Decode everything once, keep every other keyframe and compress the
+  // survivors against their new predecessors
+  std::vector<std::vector<double>> states;
+  std::vector<double> times;
+  std::vector<double> current;
+  for (size_t i = 0; i < keyframes.size(); i += 2) {
+    decode(i, current);
+    states.push_back(current);
+    times.push_back(keyframes[i].time);
+  }
+  keyframes.clear();
+  previous.clear();
+  earlier.clear();
+  stored = 0;
+  for (size_t i = 0; i < states.size(); i++) {
+    append(states[i], times[i]);
+  }
+  interval *= 2;
+}
@@ -0,0 +1,97 @@
+#ifndef CLOTHSIM_TIMELINE_H
+#define CLOTHSIM_TIMELINE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "CGL/vector3D.h"
+#include "galaxy.h"
+
+using namespace CGL;
+
+/*
+  History of a galaxy for scrubbing back and forth in time.
+
+  record() is called after every step and keeps a keyframe of the state of
+  every body once every `interval` steps. seek() goes to any time between
+  the first keyframe and the last step recorded by loading the keyframe at
+  or before it and stepping the galaxy forward from there, so a seek costs
+  at most `interval` steps.
+
+  Keyframes are compressed against the ones before: each coordinate is
+  predicted by stepping the previous keyframe on with its velocity and the
+  acceleration seen since the one before that, XORed with the prediction
+  and stored without its leading zero bytes.
+  Every ANCHOR_SPACING-th keyframe is stored whole, which bounds how many
+  keyframes a seek decodes. When the history outgrows `budget` bytes every
+  other keyframe is dropped and the interval doubles, so a long run keeps
+  reaching back to its start at a coarser spacing.
+
+  Recording after seeking back drops the keyframes past that point: the
+  run continues from there as a new future. Adding or removing bodies
+  starts the history over.
+*/
+class Timeline {
+public:
+  Timeline(size_t budget = 64 << 20, int interval = 256)
+      : budget(budget), interval(interval), base_interval(interval) {}
+
+  // Call after every simulate or advance
+  void record(Galaxy &galaxy);
+  // Puts the galaxy at the given simulated time, clamped to the history,
+  // and returns the time it got to
+  double seek(Galaxy &galaxy, double time);
+  // Drops the history and goes back to the interval it was made with
+  void clear();
+
+  // Simulated time covered
+  double start() const { return keyframes.empty() ? 0 : keyframes.front().time; }
+  double end() const { return keyframes.empty() ? 0 : latest; }
+  size_t size() const { return keyframes.size(); }
+  size_t bytes() const { return stored; }
+  // Size of the keyframes uncompressed
+  size_t raw_bytes() const { return keyframes.size() * values * sizeof(double); }
+
+  size_t budget;
+  // Steps between keyframes
+  int interval;
+
+  static const int ANCHOR_SPACING = 16;
+
+private:
+  struct Keyframe {
+    double time;
+    bool anchor;
+    std::vector<uint8_t> data;
+  };
+
+  // State as flat values, positions then velocities of every body
+  void encode(const std::vector<double> &state, double time, Keyframe &out) const;
+  // Also fills before with the keyframe ahead of it when that was needed
+  // for the prediction, and empties it otherwise
+  void decode(size_t index, std::vector<double> &state, std::vector<double> *before = nullptr) const;
+  // Fills prediction with the state dt after previous; earlier, dt_earlier
+  // before previous, gives the acceleration and may be empty
+  void predict(const std::vector<double> &previous, const std::vector<double> &earlier, double dt,
+               double dt_earlier, std::vector<double> &prediction) const;
+  void append(const std::vector<double> &state, double time);
+  void thin();
+
+  // Interval a new history starts at, before any thinning
+  int base_interval;
+
+  std::vector<Keyframe> keyframes;
+  // The last two keyframes, which the next one is compressed against;
+  // earlier is empty when the last one is an anchor
+  std::vector<double> previous, earlier;
+  size_t values = 0;
+  size_t stored = 0;
+  int steps = 0;
+  double latest = 0;
+
+  // Scratch
+  std::vector<Vector3D> x, v;
+  std::vector<double> m, state;
+};
+
+#endif // CLOTHSIM_TIMELINE_H
@@ -0,0 +1,186 @@
+#include "trajectory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "units.h"
+
+bool TrajectoryRecorder::open(const std::string &path, Galaxy &galaxy, int every) {
+  close();
+  file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    std::cout << "Error: could not write " << path << std::endl;
+    return false;
+  }
+  this->path = path;
+  this->every = std::max(every, 1);
+  steps = 0;
+  written = 0;
+
+  galaxy.getState(x, v, m);
+  bodies = m.size();
+  uint32_t version = Trajectory::VERSION, count = (uint32_t) bodies;
+  fwrite(Trajectory::MAGIC, 1, sizeof(Trajectory::MAGIC), file);
+  fwrite(&version, sizeof(version), 1, file);
+  fwrite(&count, sizeof(count), 1, file);
+  fwrite(m.data(), sizeof(double), m.size(), file);
+  write_frame(galaxy);
+  std::cout << "Recording every " << this->every << " steps to " << path << std::endl;
+  return true;
+}
+
+void TrajectoryRecorder::close() {
+  if (file == nullptr) return;
+  fclose(file);
+  file = nullptr;
+  std::cout << "Recorded " << written << " frames to " << path << std::endl;
+}
+
+void TrajectoryRecorder::record(Galaxy &galaxy) {
+  if (file == nullptr || ++steps < every) return;
+  steps = 0;
+  size_t now = galaxy.num_planets + (galaxy.asteroids != nullptr ? galaxy.asteroids->size() : 0);
+  if (now != bodies) {
+    std::cout << "Bodies were added or removed, stopping the recording" << std::endl;
+    close();
+    return;
+  }
+  // A reset or a seek would put frames out of order
+  if (galaxy.time <= last_time) {
+    std::cout << "Time went back, stopping the recording" << std::endl;
+    close();
+    return;
+  }
+  write_frame(galaxy);
+}
+
+void TrajectoryRecorder::write_frame(Galaxy &galaxy) {
+  galaxy.getState(x, v, m);
+  frame.resize(1 + 6 * bodies);
+  frame[0] = galaxy.time;
+  for (size_t i = 0; i < bodies; i++) {
+    for (int c = 0; c < 3; c++) {
+      frame[1 + 3 * i + c] = x[i][c];
+      frame[1 + 3 * (bodies + i) + c] = v[i][c];
+    }
+  }
+  if (fwrite(frame.data(), sizeof(double), frame.size(), file) != frame.size()) {
+    std::cout << "Error: could not write " << path << ", stopping the recording" << std::endl;
+    close();
+    return;
+  }
+  last_time = galaxy.time;
+  written++;
+}
+
+bool TrajectoryPlayback::open(const std::string &path) {
+  close();
+  if (!file.open(path)) {
+    std::cout << "Error: could not read " << path << std::endl;
+    return false;
+  }
+  const size_t fixed = sizeof(Trajectory::MAGIC) + 2 * sizeof(uint32_t);
+  uint32_t version = 0, bodies = 0;
+  if (file.size() >= fixed) {
+    memcpy(&version, file.data() + sizeof(Trajectory::MAGIC), sizeof(version));
+    memcpy(&bodies, file.data() + sizeof(Trajectory::MAGIC) + sizeof(version), sizeof(bodies));
+  }
+  if (file.size() < fixed || memcmp(file.data(), Trajectory::MAGIC, sizeof(Trajectory::MAGIC)) != 0 ||
+      version != Trajectory::VERSION || bodies == 0) {
+    std::cout << "Error: " << path << " is not a trajectory file" << std::endl;
+    close();
+    return false;
+  }
+
+  header_bytes = fixed + bodies * sizeof(double);
+  frame_bytes = (1 + 6 * (size_t) bodies) * sizeof(double);
+  count = file.size() > header_bytes ? (file.size() - header_bytes) / frame_bytes : 0;
+  if (count == 0) {
+    std::cout << "Error: " << path << " holds no frames" << std::endl;
+    close();
+    return false;
+  }
+  masses.resize(bodies);
+  memcpy(masses.data(), file.data() + fixed, bodies * sizeof(double));
+  std::cout << "Playing back " << count << " frames of " << bodies << " bodies from " << path << std::endl;
+  return true;
+}
+
+void TrajectoryPlayback::close() {
+  file.close();
+  masses.clear();
+  count = 0;
+}
+
+double TrajectoryPlayback::time(size_t frame) const {
+  double t;
+  memcpy(&t, file.data() + header_bytes + frame * frame_bytes, sizeof(double));
+  return t;
+}
+
+const unsigned char *TrajectoryPlayback::values(size_t frame) const {
+  return file.data() + header_bytes + frame * frame_bytes + sizeof(double);
+}
+
+void TrajectoryPlayback::sample(double t, std::vector<Vector3D> &positions, std::vector<Vector3D> &velocities) const {
+  const size_t n = bodies();
+  positions.resize(n);
+  velocities.resize(n);
+  if (count == 0) return;
+
+  // Frames are in time order, so the pair around t is a binary search
+  // that only touches a few pages
+  size_t lo = 0, hi = count - 1;
+  t = std::min(std::max(t, start()), end());
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (time(mid) <= t) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  const double t0 = time(lo), t1 = time(hi);
+  const unsigned char *a = values(lo), *b = values(hi);
+  auto read = [](const unsigned char *frame, size_t k) {
+    double value;
+    memcpy(&value, frame + k * sizeof(double), sizeof(double));
+    return value;
+  };
+
+  if (hi == lo || t1 <= t0) {
+    for (size_t i = 0; i < n; i++) {
+      for (int c = 0; c < 3; c++) {
+        positions[i][c] = read(a, 3 * i + c);
+        velocities[i][c] = read(a, 3 * (n + i) + c);
+      }
+    }
+    return;
+  }
+
+  // Cubic Hermite basis on s in [0, 1]; velocities are per internal time
+  // unit, so the slopes are scaled by the interval in those units
+  const double h = Units::time_from_si(t1 - t0);
+  const double s = (t - t0) / (t1 - t0);
+  const double s2 = s * s, s3 = s2 * s;
+  const double h00 = 2 * s3 - 3 * s2 + 1, h10 = s3 - 2 * s2 + s;
+  const double h01 = -2 * s3 + 3 * s2, h11 = s3 - s2;
+  // Their derivatives with respect to s
+  const double d00 = 6 * s2 - 6 * s, d10 = 3 * s2 - 4 * s + 1;
+  const double d01 = -6 * s2 + 6 * s, d11 = 3 * s2 - 2 * s;
+  for (size_t i = 0; i < n; i++) {
+    for (int c = 0; c < 3; c++) {
+      double x0 = read(a, 3 * i + c), x1 = read(b, 3 * i + c);
+      double v0 = read(a, 3 * (n + i) + c), v1 = read(b, 3 * (n + i) + c);
+      positions[i][c] = h00 * x0 + h10 * h * v0 + h01 * x1 + h11 * h * v1;
+      velocities[i][c] = (d00 * x0 + d01 * x1) / h + d10 * v0 + d11 * v1;
+    }
+  }
+}
+
+void TrajectoryPlayback::apply(Galaxy &galaxy, double t) {
+  sample(t, x, v);
+  galaxy.setState(x, v);
+  galaxy.time = std::min(std::max(t, start()), end());
+}
@@ -0,0 +1,109 @@
+#ifndef CLOTHSIM_TRAJECTORY_H
+#define CLOTHSIM_TRAJECTORY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "CGL/vector3D.h"
+#include "galaxy.h"
+#include "misc/mapped_file.h"
+
+using namespace CGL;
+
+/*
+  Trajectory files hold a recorded run for playback without the physics.
+
+  A header (magic, version, body count, the masses) is followed by frames
+  of the simulated time in seconds and the positions then velocities of
+  every planet and asteroid, in internal units, all as native doubles. The
+  number of frames follows from the file size, so a recording cut short
+  still plays up to its last whole frame.
+*/
+namespace Trajectory {
+  static const char MAGIC[8] = {'C', 'S', '1', '8', '4', 'T', 'R', 'J'};
+  static const uint32_t VERSION = 1;
+}
+
+/*
+  Writes the state of a galaxy to a trajectory file once every `every`
+  steps. Stops, with a message, if bodies are added or removed or the
+  simulated time goes back, since playback needs frames in time order.
+*/
+class TrajectoryRecorder {
+public:
+  TrajectoryRecorder() {}
+  ~TrajectoryRecorder() { close(); }
+
+  TrajectoryRecorder(const TrajectoryRecorder &) = delete;
+  TrajectoryRecorder &operator=(const TrajectoryRecorder &) = delete;
+
+  // Writes the header and the galaxy as the first frame
+  bool open(const std::string &path, Galaxy &galaxy, int every = 16);
+  void close();
+  bool is_open() const { return file != nullptr; }
+
+  // Call after every simulate or advance
+  void record(Galaxy &galaxy);
+
+  size_t frames() const { return written; }
+
+private:
+  void write_frame(Galaxy &galaxy);
+
+  FILE *file = nullptr;
+  std::string path;
+  int every = 16;
+  int steps = 0;
+  size_t bodies = 0;
+  size_t written = 0;
+  // Time of the last frame written
+  double last_time = 0;
+
+  // Scratch
+  std::vector<Vector3D> x, v;
+  std::vector<double> m, frame;
+};
+
+/*
+  Reads a trajectory file through a memory mapping, so only the frames
+  around the time being shown are paged in, and gives the state at any
+  time between the first and last frame.
+
+  Between two frames every coordinate follows the cubic Hermite curve
+  through both positions with both velocities as its slopes, so sparse
+  frames still play back smoothly, and the velocity is its derivative.
+*/
+class TrajectoryPlayback {
+public:
+  bool open(const std::string &path);
+  void close();
+  bool is_open() const { return count > 0; }
+
+  size_t bodies() const { return masses.size(); }
+  size_t frames() const { return count; }
+  double start() const { return count > 0 ? time(0) : 0; }
+  double end() const { return count > 0 ? time(count - 1) : 0; }
+
+  // State at the given simulated time, clamped to the recording
+  void sample(double time, std::vector<Vector3D> &positions, std::vector<Vector3D> &velocities) const;
+  // Moves the galaxy, which must have the recorded bodies, to that state
+  void apply(Galaxy &galaxy, double time);
+
+private:
+  double time(size_t frame) const;
+  // The doubles of a frame after its time
+  const unsigned char *values(size_t frame) const;
+
+  MappedFile file;
+  std::vector<double> masses;
+  size_t header_bytes = 0;
+  size_t frame_bytes = 0;
+  size_t count = 0;
+
+  // Scratch
+  std::vector<Vector3D> x, v;
+};
+
+#endif // CLOTHSIM_TRAJECTORY_H
@@ -0,0 +1,64 @@
+#ifndef CLOTHSIM_UNITS_H
+#define CLOTHSIM_UNITS_H
+
+#include <cmath>
+
+#include "CGL/vector3D.h"
+
+/*
+  Internal unit system used by the physics.
+
+  Lengths are in astronomical units, masses in solar masses and time in
+  (Gaussian) years, which makes G = 4 pi^2 and keeps positions, velocities
+  and masses of the scenes within a few orders of magnitude of 1. Scene files
+  are still written in SI units; convert on load with the *_from_si helpers
+  and back with the *_to_si helpers whenever a value is shown to the user.
+*/
+namespace Units {
+
+// SI value of one internal unit
+const double METERS_PER_LENGTH = 1.495978707e11;  // 1 AU
+const double KILOGRAMS_PER_MASS = 1.9891e30;      // 1 solar mass
+// One orbit at 1 AU around 1 solar mass, i.e. 2 pi sqrt(AU^3 / (G M_sun))
+const double SECONDS_PER_TIME = 31553240.936990187;
+
+const double G_SI = 6.67408e-11;
+const double G = 4 * M_PI * M_PI;
+
+inline double length_from_si(double si) { return si / METERS_PER_LENGTH; }
+inline double mass_from_si(double si) { return si / KILOGRAMS_PER_MASS; }
+inline double time_from_si(double si) { return si / SECONDS_PER_TIME; }
+inline double velocity_from_si(double si) {
+  return si * SECONDS_PER_TIME / METERS_PER_LENGTH;
+}
+
+inline double length_to_si(double length) { return length * METERS_PER_LENGTH; }
+inline double mass_to_si(double mass) { return mass * KILOGRAMS_PER_MASS; }
+inline double time_to_si(double time) { return time * SECONDS_PER_TIME; }
+inline double velocity_to_si(double velocity) {
+  return velocity * METERS_PER_LENGTH / SECONDS_PER_TIME;
+}
+
+inline CGL::Vector3D length_from_si(const CGL::Vector3D &si) { return si / METERS_PER_LENGTH; }
+inline CGL::Vector3D velocity_from_si(const CGL::Vector3D &si) {
+  return si * (SECONDS_PER_TIME / METERS_PER_LENGTH);
+}
+inline CGL::Vector3D length_to_si(const CGL::Vector3D &length) { return length * METERS_PER_LENGTH; }
+inline CGL::Vector3D velocity_to_si(const CGL::Vector3D &velocity) {
+  return velocity * (METERS_PER_LENGTH / SECONDS_PER_TIME);
+}
+
+/*
+  Scale that maps internal lengths to render (world) units. The scenes were
+  tuned with one render unit per power of ten meters of the nearest body, so
+  the decade is still picked in meters to keep the look of every scene.
+*/
+inline double render_scale(double nearest_distance) {
+  double distance = length_to_si(std::abs(nearest_distance));
+  if (distance <= 0) return 1;
+  return length_from_si(std::pow(10.0, std::floor(std::log10(distance))));
+}
+
+} // namespace Units
+
+#endif // CLOTHSIM_UNITS_H